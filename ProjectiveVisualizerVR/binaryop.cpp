@@ -9,6 +9,9 @@
 #include "binaryop.h"
 
 #include <iostream>
+#include <cmath>
+#include <climits>
+#include <algorithm>
 #include "numericalterm.h"
 #include "variable.h"
 
@@ -280,3 +283,62 @@ Term* BinaryOp::homogenize(int* degree)
     }
     throw BadTermException();
 }
+
+Polynomial BinaryOp::expand()
+{
+    switch (op)
+    {
+    case OP_PLUS:
+        return lhs->expand() + rhs->expand();
+    case OP_MINUS:
+        return lhs->expand() - rhs->expand();
+    case OP_TIMES:
+        return lhs->expand() * rhs->expand();
+    case OP_EXP:
+    {
+        if (!rhs->isNumerical())
+            throw BadTermException("Exponent is not a number.");
+        double exponent = rhs->eval(0,0,0,0);
+        if (exponent < 0 || exponent != floor(exponent))
+            throw BadTermException("Exponent is not a non-negative integer.");
+        if (lhs->isNumerical())
+            return Polynomial::constant(pow(lhs->eval(0,0,0,0), exponent));
+        if (exponent > INT_MAX)
+            throw BadTermException("Exponent is too large to expand.");
+        return lhs->expand().power((int)exponent);
+    }
+    }
+    throw BadTermException();
+}
+
+int BinaryOp::degreeBound()
+{
+    // Worked in doubles so that sums and products of huge bounds saturate rather than overflow.
+    double lhs_degree = lhs->degreeBound();
+    double rhs_degree = rhs->degreeBound();
+    double degree = 0;
+
+    switch (op)
+    {
+    case OP_PLUS:
+    case OP_MINUS:
+        degree = std::max(lhs_degree, rhs_degree);
+        break;
+    case OP_TIMES:
+        degree = lhs_degree + rhs_degree;
+        break;
+    case OP_EXP:
+    {
+        if (!rhs->isNumerical())
+            throw BadTermException("Exponent is not a number.");
+        double exponent = rhs->eval(0,0,0,0);
+        if (exponent < 0 || exponent != floor(exponent))
+            throw BadTermException("Exponent is not a non-negative integer.");
+        degree = (lhs_degree == 0) ? 0 : lhs_degree * exponent;
+        break;
+    }
+    default:
+        throw BadTermException();
+    }
+    return (degree >= INT_MAX) ? INT_MAX : (int)degree;
+}
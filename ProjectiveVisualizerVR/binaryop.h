@@ -34,6 +34,8 @@ public:
     virtual Term* simplify();
     virtual bool isNumerical() { return lhs->isNumerical() && rhs->isNumerical(); }
     virtual Term* homogenize(int* degree);
+    virtual Polynomial expand();
+    virtual int degreeBound();
 private:
     op_type op;
     Term* lhs;
@@ -0,0 +1,504 @@
+#include "cellkernel.h"
+#include "shared/cpufeatures.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CELLKERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+// In cellkernelavx.cpp, the only file built for AVX: the same loops, four values at a time.
+unsigned int RowSignBitsAVX(const double* values, int count);
+void InterpolateCrossingsAVX(const double* start, const double* end, double* t, int n);
+
+static const bool use_avx = CpuHasAVX();
+
+// Indexed by edge number; see the EI constants below.
+const unsigned char cell_edge_start[cell_edge_count] = { 0, 0, 0, 2, 1, 3, 4, 5, 1, 6, 4, 2 };
+const unsigned char cell_edge_axis[cell_edge_count]  = { 2, 1, 0, 2, 1, 0, 2, 1, 0, 2, 1, 0 };
+
+// Fills in the triangles for one case. Only flags without M111 are handled;
+// the others are the complements of those, which have the same surface.
+// Cases that need M111 spell it as the complement, e.g. ~M111 is every corner but 111.
+static void BuildCellCase(unsigned char flags, CellCase* cell_case)
+{
+    // EI for edge index.
+    const int EI000_001 = 0;
+    const int EI000_010 = 1;
+    const int EI000_100 = 2;
+    const int EI011_010 = 3;
+    const int EI011_001 = 4;
+    const int EI011_111 = 5;
+    const int EI101_100 = 6;
+    const int EI101_111 = 7;
+    const int EI101_001 = 8;
+    const int EI110_111 = 9;
+    const int EI110_100 = 10;
+    const int EI110_010 = 11;
+
+    const int EI001_000 = EI000_001;
+    const int EI010_000 = EI000_010;
+    const int EI100_000 = EI000_100;
+    const int EI010_011 = EI011_010;
+    const int EI001_011 = EI011_001;
+    const int EI111_011 = EI011_111;
+    const int EI100_101 = EI101_100;
+    const int EI111_101 = EI101_111;
+    const int EI001_101 = EI101_001;
+    const int EI111_110 = EI110_111;
+    const int EI100_110 = EI110_100;
+    const int EI010_110 = EI110_010;
+
+    // M for bitMask.
+    const char M000 = 1;
+    const char M001 = 1 << 1;
+    const char M010 = 1 << 2;
+    const char M011 = 1 << 3;
+    const char M100 = 1 << 4;
+    const char M101 = 1 << 5;
+    const char M110 = 1 << 6;
+    const char M111 = 1 << 7;
+
+    cell_case->edge_count = 0;
+
+#define ADD_EDGE(e) \
+  { cell_case->edges[cell_case->edge_count++] = (unsigned char)(e); }
+
+// This got tedious to type out after a while below.
+#define ADD_TRIANGLE(a,b,c) \
+  { ADD_EDGE(EI##a); ADD_EDGE(EI##b); ADD_EDGE(EI##c) }
+
+    switch (flags)
+    {
+    // Case 0
+
+    case 0:
+        // Empty cube!
+        break;
+
+
+    // Case 1: Corner.
+    case M000:
+        ADD_EDGE(EI000_001);
+        ADD_EDGE(EI000_010);
+        ADD_EDGE(EI000_100);
+        break;
+    case M001:
+        ADD_EDGE(EI000_001);
+        ADD_EDGE(EI011_001);
+        ADD_EDGE(EI101_001);
+        break;
+    case M010:
+        ADD_EDGE(EI011_010);
+        ADD_EDGE(EI000_010);
+        ADD_EDGE(EI110_010);
+        break;
+    case M011:
+        ADD_EDGE(EI011_010);
+        ADD_EDGE(EI011_001);
+        ADD_EDGE(EI011_111);
+        break;
+    case M100:
+        ADD_EDGE(EI000_100);
+        ADD_EDGE(EI110_100);
+        ADD_EDGE(EI101_100);
+        break;
+    case M101:
+        ADD_EDGE(EI101_100);
+        ADD_EDGE(EI101_111);
+        ADD_EDGE(EI101_001);
+        break;
+    case M110:
+        ADD_EDGE(EI110_111);
+        ADD_EDGE(EI110_100);
+        ADD_EDGE(EI110_010);
+        break;
+    case ~M111:
+        ADD_EDGE(EI110_111);
+        ADD_EDGE(EI101_111);
+        ADD_EDGE(EI011_111);
+        break;
+
+    // Case 2: An edge.
+    case M000 | M001:
+        ADD_EDGE(EI000_010);
+        ADD_EDGE(EI000_100);
+        ADD_EDGE(EI011_001);
+
+        ADD_EDGE(EI011_001);
+        ADD_EDGE(EI101_001);
+        ADD_EDGE(EI000_100);
+        break;
+
+    case M000 | M010:
+        ADD_EDGE(EI000_001);
+        ADD_EDGE(EI000_100);
+        ADD_EDGE(EI011_010);
+
+        ADD_EDGE(EI011_010);
+        ADD_EDGE(EI110_010);
+        ADD_EDGE(EI000_100);
+        break;
+
+    case M000 | M100:
+        ADD_EDGE(EI000_001);
+        ADD_EDGE(EI000_010);
+        ADD_EDGE(EI101_100);
+
+        ADD_EDGE(EI101_100);
+        ADD_EDGE(EI110_100);
+        ADD_EDGE(EI000_010);
+        break;
+
+    case M011 | M010:
+        ADD_EDGE(EI011_001);
+        ADD_EDGE(EI011_111);
+        ADD_EDGE(EI000_010);
+
+        ADD_EDGE(EI000_010);
+        ADD_EDGE(EI110_010);
+        ADD_EDGE(EI011_111);
+        break;
+
+    case M011 | M001:
+        ADD_EDGE(EI011_111);
+        ADD_EDGE(EI011_010);
+        ADD_EDGE(EI101_001);
+
+        ADD_EDGE(EI101_001);
+        ADD_EDGE(EI000_001);
+        ADD_EDGE(EI011_010);
+        break;
+
+    case ~(M011 | M111):
+        ADD_EDGE(EI011_001);
+        ADD_EDGE(EI011_010);
+        ADD_EDGE(EI101_111);
+
+        ADD_EDGE(EI101_111);
+        ADD_EDGE(EI110_111);
+        ADD_EDGE(EI011_010);
+        break;
+
+    case M101 | M100:
+        ADD_EDGE(EI101_111);
+        ADD_EDGE(EI101_001);
+        ADD_EDGE(EI110_100);
+
+        ADD_EDGE(EI110_100);
+        ADD_EDGE(EI000_100);
+        ADD_EDGE(EI101_001);
+        break;
+
+    case ~(M101 | M111):
+        ADD_EDGE(EI101_001);
+        ADD_EDGE(EI101_100);
+        ADD_EDGE(EI011_111);
+
+        ADD_EDGE(EI011_111);
+        ADD_EDGE(EI110_111);
+        ADD_EDGE(EI101_100);
+        break;
+
+    case M101 | M001:
+        ADD_EDGE(EI101_111);
+        ADD_EDGE(EI101_100);
+        ADD_EDGE(EI011_001);
+
+        ADD_EDGE(EI011_001);
+        ADD_EDGE(EI000_001);
+        ADD_EDGE(EI101_100);
+        break;
+
+    case ~(M110 | M111):
+        ADD_EDGE(EI110_010);
+        ADD_EDGE(EI110_100);
+        ADD_EDGE(EI011_111);
+
+        ADD_EDGE(EI011_111);
+        ADD_EDGE(EI101_111);
+        ADD_EDGE(EI110_100);
+        break;
+
+    case M110 | M100:
+        ADD_EDGE(EI110_010);
+        ADD_EDGE(EI110_111);
+        ADD_EDGE(EI000_100);
+
+        ADD_EDGE(EI000_100);
+        ADD_EDGE(EI101_100);
+        ADD_EDGE(EI110_111);
+        break;
+
+    case M110 | M010:
+        ADD_EDGE(EI110_100);
+        ADD_EDGE(EI110_111);
+        ADD_EDGE(EI000_010);
+
+        ADD_EDGE(EI000_010);
+        ADD_EDGE(EI011_010);
+        ADD_EDGE(EI110_111);
+        break;
+
+    // Case 5: 3 vertices on a common face
+
+    // Left face
+    case M000 | M001 | M010:
+        ADD_TRIANGLE(000_100, 110_010, 101_001);
+        ADD_TRIANGLE(110_010, 101_001, 011_010);
+        ADD_TRIANGLE(101_001, 011_010, 011_001);
+        break;
+
+    case M001 | M000 | M011:
+        ADD_TRIANGLE(101_001, 000_100, 011_111);
+        ADD_TRIANGLE(100_000, 011_111, 000_010);
+        ADD_TRIANGLE(000_010, 011_010, 011_111);
+        break;
+
+    case M011 | M010 | M001:
+        ADD_TRIANGLE(011_111, 010_110, 001_101);
+        ADD_TRIANGLE(010_110, 001_101, 010_000);
+        ADD_TRIANGLE(010_000, 001_000, 001_101);
+        break;
+
+    case M010 | M011 | M000:
+        ADD_TRIANGLE(010_110, 011_111, 000_100);
+        ADD_TRIANGLE(011_111, 000_100, 011_001);
+        ADD_TRIANGLE(011_001, 000_001, 000_100);
+        break;
+
+    // Right face
+    case M100 | M110 | M101:
+        ADD_TRIANGLE(100_000, 110_010, 101_001);
+        ADD_TRIANGLE(110_010, 101_001, 101_111);
+        ADD_TRIANGLE(101_111, 110_111, 110_010);
+        break;
+
+    case ~(M100 | M101 | M111):
+        ADD_TRIANGLE(101_001, 111_011, 100_000);
+        ADD_TRIANGLE(111_011, 100_000, 100_110);
+        ADD_TRIANGLE(100_110, 111_110, 111_011);
+        break;
+
+    case ~(M111 | M110 | M101):
+        ADD_TRIANGLE(111_011, 110_010, 101_001);
+        ADD_TRIANGLE(110_010, 101_001, 101_100);
+        ADD_TRIANGLE(101_100, 110_100, 110_010);
+        break;
+
+    case ~(M110 | M111 | M100):
+        ADD_TRIANGLE(110_010, 111_011, 100_000);
+        ADD_TRIANGLE(111_011, 100_000, 111_101);
+        ADD_TRIANGLE(111_101, 100_101, 100_000);
+        break;
+
+    // Bottom face
+    case M000 | M001 | M100:
+        ADD_TRIANGLE(000_010, 100_110, 001_011);
+        ADD_TRIANGLE(100_110, 001_011, 100_101);
+        ADD_TRIANGLE(100_101, 001_101, 001_011);
+        break;
+
+    case M000 | M100 | M101:
+        ADD_TRIANGLE(000_010, 100_110, 101_111);
+        ADD_TRIANGLE(000_010, 101_111, 000_001);
+        ADD_TRIANGLE(000_001, 101_001, 101_111);
+        break;
+
+    case M100 | M101 | M001:
+        ADD_TRIANGLE(100_110, 101_111, 001_011);
+        ADD_TRIANGLE(100_110, 001_011, 001_000);
+        ADD_TRIANGLE(001_000, 100_000, 100_110);
+        break;
+
+    case M000 | M001 | M101:
+        ADD_TRIANGLE(000_010, 001_011, 101_111);
+        ADD_TRIANGLE(000_010, 101_111, 000_100);
+        ADD_TRIANGLE(000_100, 100_101, 101_111);
+        break;
+
+    // Top face
+    case M010 | M011 | M110:
+        ADD_TRIANGLE(010_000, 001_011, 110_100);
+        ADD_TRIANGLE(011_001, 110_100, 110_111);
+        ADD_TRIANGLE(110_111, 011_111, 011_001);
+        break;
+
+    case ~(M010 | M110 | M111):
+        ADD_TRIANGLE(010_000, 110_100, 111_101);
+        ADD_TRIANGLE(010_000, 111_101, 010_011);
+        ADD_TRIANGLE(010_011, 011_111, 111_101);
+        break;
+
+    case ~(M110 | M111 | M011):
+        ADD_TRIANGLE(110_100, 111_101, 011_001);
+        ADD_TRIANGLE(110_100, 011_001, 011_010);
+        ADD_TRIANGLE(011_010, 110_010, 110_100);
+        break;
+
+    case ~(M010 | M011 | M111):
+        ADD_TRIANGLE(010_000, 011_001, 111_101);
+        ADD_TRIANGLE(010_000, 111_101, 111_110);
+        ADD_TRIANGLE(111_110, 010_110, 010_000);
+        break;
+
+    // Front face
+    case M000 | M100 | M010:
+        ADD_TRIANGLE(000_001, 100_101, 010_011);
+        ADD_TRIANGLE(100_101, 010_011, 010_110);
+        ADD_TRIANGLE(010_110, 100_110, 100_101);
+        break;
+
+    case M000 | M100 | M110:
+        ADD_TRIANGLE(000_001, 100_101, 110_111);
+        ADD_TRIANGLE(000_001, 110_111, 110_010);
+        ADD_TRIANGLE(110_010, 000_010, 000_001);
+        break;
+
+    case M100 | M110 | M010:
+        ADD_TRIANGLE(100_101, 110_111, 010_011);
+        ADD_TRIANGLE(100_101, 010_011, 010_000);
+        ADD_TRIANGLE(010_000, 100_000, 100_101);
+        break;
+
+    case M110 | M010 | M000:
+        ADD_TRIANGLE(110_111, 010_011, 000_001);
+        ADD_TRIANGLE(110_111, 000_001, 000_100);
+        ADD_TRIANGLE(000_100, 110_100, 110_111);
+        break;
+
+    // Back face
+    case M001 | M011 | M101:
+        ADD_TRIANGLE(001_000, 011_010, 101_100);
+        ADD_TRIANGLE(011_010, 101_100, 101_111);
+        ADD_TRIANGLE(101_111, 011_111, 011_010);
+        break;
+
+    case ~(M001 | M101 | M111):
+        ADD_TRIANGLE(001_000, 101_100, 111_110);
+        ADD_TRIANGLE(001_000, 111_110, 111_011);
+        ADD_TRIANGLE(111_011, 001_011, 001_000);
+        break;
+
+    case ~(M101 | M111 | M011):
+        ADD_TRIANGLE(111_110, 011_010, 101_100);
+        ADD_TRIANGLE(011_010, 101_100, 101_001);
+        ADD_TRIANGLE(101_001, 011_001, 011_010);
+        break;
+
+    case ~(M111 | M011 | M001):
+        ADD_TRIANGLE(111_110, 011_010, 001_000);
+        ADD_TRIANGLE(111_110, 001_000, 001_101);
+        ADD_TRIANGLE(001_101, 111_101, 111_110);
+        break;
+
+    // Case 8: a whole face is positive.
+    case M000 | M001 | M011 | M010:
+        ADD_TRIANGLE(000_100, 010_110, 011_111);
+        ADD_TRIANGLE(000_100, 001_101, 011_111);
+        break;
+
+    case M000 | M100 | M110 | M010:
+        ADD_TRIANGLE(000_001, 100_101, 110_111);
+        ADD_TRIANGLE(000_001, 110_111, 010_011);
+        break;
+
+    case M000 | M100 | M101 | M001:
+        ADD_TRIANGLE(000_010, 100_110, 101_111);
+        ADD_TRIANGLE(000_010, 101_111, 001_011);
+        break;
+
+    // Case 9: A corner and 3 adjacent edges.
+    case M001 | M011 | M000 | M101:
+        ADD_TRIANGLE(011_111, 011_010, 010_000);
+        ADD_TRIANGLE(000_010, 011_111, 000_100);
+        ADD_TRIANGLE(011_111, 000_100, 101_111);
+        ADD_TRIANGLE(000_100, 111_101, 100_101);
+        break;
+
+    case M000 | M100 | M010 | M001:
+        ADD_TRIANGLE(011_010, 010_110, 011_001);
+        ADD_TRIANGLE(011_001, 010_110, 001_101);
+        ADD_TRIANGLE(001_101, 010_110, 110_100);
+        ADD_TRIANGLE(110_100, 100_101, 101_001);
+        break;
+
+    case M010 | M000 | M011 | M110:
+        ADD_TRIANGLE(100_110, 110_111, 100_000);
+        ADD_TRIANGLE(100_000, 110_111, 000_001);
+        ADD_TRIANGLE(000_001, 110_111, 111_011);
+        ADD_TRIANGLE(111_011, 011_001, 001_000);
+        break;
+
+    case M100 | M000 | M110 | M101:
+        ADD_TRIANGLE(110_111, 111_101, 110_010);
+        ADD_TRIANGLE(010_110, 111_101, 001_101);
+        ADD_TRIANGLE(010_110, 001_101, 000_010);
+        ADD_TRIANGLE(000_010, 101_001, 001_000);
+        break;
+    }
+
+#undef ADD_TRIANGLE
+#undef ADD_EDGE
+}
+
+struct CellCaseTable
+{
+    CellCaseTable()
+    {
+        for (int flags = 0; flags < 256; flags++)
+        {
+            // Flipping every sign leaves the surface alone and removes some redundant cases.
+            BuildCellCase((unsigned char)((flags & 0x80) ? ~flags : flags), &cases[flags]);
+        }
+    }
+
+    CellCase cases[256];
+};
+
+const CellCase& GetCellCase(unsigned char sign_flags)
+{
+    static const CellCaseTable table;
+    return table.cases[sign_flags];
+}
+
+unsigned int RowSignBits(const double* values, int count)
+{
+    if (use_avx)
+        return RowSignBitsAVX(values, count);
+
+    unsigned int bits = 0;
+    int n = 0;
+
+#if defined(CELLKERNEL_SSE2)
+    const __m128d zero = _mm_setzero_pd();
+    for (; n + 2 <= count; n += 2)
+        bits |= (unsigned int)_mm_movemask_pd(_mm_cmpge_pd(_mm_loadu_pd(values + n), zero)) << n;
+#endif
+
+    for (; n < count; n++)
+        bits |= (unsigned int)(values[n] >= 0) << n;
+
+    return bits;
+}
+
+void InterpolateCrossings(const double* start, const double* end, double* t, int n)
+{
+    if (use_avx)
+    {
+        InterpolateCrossingsAVX(start, end, t, n);
+        return;
+    }
+
+    int e = 0;
+
+#if defined(CELLKERNEL_SSE2)
+    for (; e + 2 <= n; e += 2)
+    {
+        __m128d s = _mm_loadu_pd(start + e);
+        _mm_storeu_pd(t + e, _mm_div_pd(s, _mm_sub_pd(s, _mm_loadu_pd(end + e))));
+    }
+#endif
+
+    for (; e < n; e++)
+        t[e] = start[e]/(start[e] - end[e]);
+}
@@ -0,0 +1,78 @@
+#ifndef CELLKERNEL_H
+#define CELLKERNEL_H
+
+// Building blocks for classifying the cells of a lattice and placing surface vertices on their edges.
+//
+// A row of lattice points is summarized by a bit mask with bit k set iff the value at point k is >= 0.
+// The cells between four neighboring rows can then be classified all at once with a few shifts and ands,
+// so cells the surface doesn't pass through (most of them) are skipped without ever being looked at.
+//
+// Corners of a cell are numbered by the bits (di, dj, dk) of their offset from the cell's lowest corner,
+// and the sign flags of a cell have bit (4*di + 2*dj + dk) set iff that corner is positive.
+
+// Rows are limited to 32 lattice points, i.e. 31 cells.
+const int max_row_cells = 31;
+
+// Edges of a cell. Edge e runs from corner cell_edge_start[e] along axis cell_edge_axis[e],
+// where axis 0 is i, 1 is j and 2 is k.
+const int cell_edge_count = 12;
+extern const unsigned char cell_edge_start[cell_edge_count];
+extern const unsigned char cell_edge_axis[cell_edge_count];
+
+// The triangles making up the surface in a cell, as a list of edges; every three edges form a triangle.
+struct CellCase
+{
+    int edge_count;
+    unsigned char edges[12];
+};
+
+// Looks up the triangles for a cell with the given sign flags.
+const CellCase& GetCellCase(unsigned char sign_flags);
+
+// Returns a mask with bit k set iff values[k] >= 0. count must be at most 32.
+unsigned int RowSignBits(const double* values, int count);
+
+// Given the sign bits of the four rows around a row of cells, (i,j), (i,j+1), (i+1,j) and (i+1,j+1),
+// returns a mask with bit k set iff the surface passes through cell k, i.e. its corners don't all agree.
+inline unsigned int ActiveCellBits(unsigned int r00, unsigned int r01, unsigned int r10, unsigned int r11, int cells)
+{
+    unsigned int all_positive = r00 & (r00 >> 1) & r01 & (r01 >> 1) & r10 & (r10 >> 1) & r11 & (r11 >> 1);
+    unsigned int any_positive = r00 | (r00 >> 1) | r01 | (r01 >> 1) | r10 | (r10 >> 1) | r11 | (r11 >> 1);
+    unsigned int cell_mask = (cells >= 32) ? 0xFFFFFFFFu : ((1u << cells) - 1);
+    return (any_positive & ~all_positive) & cell_mask;
+}
+
+// Sign flags of cell k from the sign bits of the four rows around it.
+inline unsigned char CellSignFlags(unsigned int r00, unsigned int r01, unsigned int r10, unsigned int r11, int k)
+{
+    return (unsigned char)(((r00 >> k) & 3) | (((r01 >> k) & 3) << 2) | (((r10 >> k) & 3) << 4) | (((r11 >> k) & 3) << 6));
+}
+
+// Index of the lowest set bit of a nonzero mask.
+inline int LowestSetBit(unsigned int mask)
+{
+    int index = 0;
+    while (!(mask & 1))
+    {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+}
+
+inline int LowestSetBit(unsigned long long mask)
+{
+    int index = 0;
+    if (!(mask & 0xFFFFFFFFull))
+    {
+        mask >>= 32;
+        index = 32;
+    }
+    return index + LowestSetBit((unsigned int)mask);
+}
+
+// For each of n edges with endpoint values start[e] and end[e] of opposite sign, computes the fraction
+// of the way along the edge where the linear interpolant crosses zero.
+void InterpolateCrossings(const double* start, const double* end, double* t, int n);
+
+#endif // CELLKERNEL_H
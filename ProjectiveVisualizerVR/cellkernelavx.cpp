@@ -0,0 +1,33 @@
+// The AVX versions of cellkernel.cpp's loops. Only this file is built for AVX, and cellkernel.cpp
+// calls it only once CpuHasAVX says the CPU has it; see shared/cpufeatures.h.
+
+#include <immintrin.h>
+
+unsigned int RowSignBitsAVX(const double* values, int count)
+{
+    unsigned int bits = 0;
+    int n = 0;
+
+    const __m256d zero = _mm256_setzero_pd();
+    for (; n + 4 <= count; n += 4)
+        bits |= (unsigned int)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(values + n), zero, _CMP_GE_OQ)) << n;
+
+    for (; n < count; n++)
+        bits |= (unsigned int)(values[n] >= 0) << n;
+
+    return bits;
+}
+
+void InterpolateCrossingsAVX(const double* start, const double* end, double* t, int n)
+{
+    int e = 0;
+
+    for (; e + 4 <= n; e += 4)
+    {
+        __m256d s = _mm256_loadu_pd(start + e);
+        _mm256_storeu_pd(t + e, _mm256_div_pd(s, _mm256_sub_pd(s, _mm256_loadu_pd(end + e))));
+    }
+
+    for (; e < n; e++)
+        t[e] = start[e]/(start[e] - end[e]);
+}
@@ -0,0 +1,355 @@
+#include "edgesolver.h"
+
+#include <cmath>
+
+// Coefficients this small relative to the largest are taken to be rounding error.
+static const double coefficient_tolerance = 1e-12;
+
+// Isolating intervals are bisected at most this many times, which is far below the spacing of doubles.
+static const int max_bisections = 52;
+static const int max_newton_steps = 60;
+
+typedef double SturmSequence[EdgeSolver::max_degree + 1][EdgeSolver::max_degree + 1];
+
+static double EvaluatePolynomial(const double* p, int degree, double t)
+{
+    double value = p[degree];
+    for (int n = degree - 1; n >= 0; n--)
+        value = value*t + p[n];
+    return value;
+}
+
+static double EvaluateDerivative(const double* p, int degree, double t)
+{
+    double value = 0;
+    for (int n = degree; n >= 1; n--)
+        value = value*t + n*p[n];
+    return value;
+}
+
+static double LargestCoefficient(const double* p, int degree)
+{
+    double largest = 0;
+    for (int n = 0; n <= degree; n++)
+    {
+        if (fabs(p[n]) > largest)
+            largest = fabs(p[n]);
+    }
+    return largest;
+}
+
+// Lowers degree past leading coefficients that are zero up to rounding. Returns -1 for the zero polynomial.
+static int TrimDegree(const double* p, int degree, double scale)
+{
+    while (degree >= 0 && fabs(p[degree]) <= coefficient_tolerance*scale)
+        degree--;
+    return degree;
+}
+
+// p, p', then the negated remainders of each polynomial by the next, until one is constant. Each is
+// scaled so its largest coefficient is 1, which doesn't change its signs. Returns the sequence's length.
+static int BuildSturmSequence(const double* p, int degree, SturmSequence seq, int* seq_degree)
+{
+    double scale = LargestCoefficient(p, degree);
+    for (int n = 0; n <= degree; n++)
+        seq[0][n] = p[n] / scale;
+    seq_degree[0] = degree;
+
+    for (int n = 1; n <= degree; n++)
+        seq[1][n - 1] = n*seq[0][n];
+    seq_degree[1] = TrimDegree(seq[1], degree - 1, LargestCoefficient(seq[1], degree - 1));
+    scale = LargestCoefficient(seq[1], seq_degree[1]);
+    for (int n = 0; n <= seq_degree[1]; n++)
+        seq[1][n] /= scale;
+
+    int length = 2;
+    while (seq_degree[length - 1] > 0)
+    {
+        const double* a = seq[length - 2];
+        const double* b = seq[length - 1];
+        int a_degree = seq_degree[length - 2];
+        int b_degree = seq_degree[length - 1];
+
+        double remainder[EdgeSolver::max_degree + 1];
+        for (int n = 0; n <= a_degree; n++)
+            remainder[n] = a[n];
+        for (int n = a_degree; n >= b_degree; n--)
+        {
+            double q = remainder[n] / b[b_degree];
+            for (int m = 0; m <= b_degree; m++)
+                remainder[n - b_degree + m] -= q*b[m];
+        }
+
+        // An exact divisor means the roots so far are repeated; the sequence already counts each once.
+        int r_degree = TrimDegree(remainder, b_degree - 1, 1);
+        if (r_degree < 0)
+            break;
+
+        scale = LargestCoefficient(remainder, r_degree);
+        for (int n = 0; n <= r_degree; n++)
+            seq[length][n] = -remainder[n] / scale;
+        seq_degree[length] = r_degree;
+        length++;
+    }
+    return length;
+}
+
+static int SignChanges(const SturmSequence seq, const int* seq_degree, int length, double t)
+{
+    int changes = 0;
+    int last_sign = 0;
+    for (int n = 0; n < length; n++)
+    {
+        double value = EvaluatePolynomial(seq[n], seq_degree[n], t);
+        int sign = (value > 0) - (value < 0);
+        if (sign == 0)
+            continue;
+        if (last_sign != 0 && sign != last_sign)
+            changes++;
+        last_sign = sign;
+    }
+    return changes;
+}
+
+// Sign changes in the Bernstein coefficients of p on [0,1],
+//   b_i = sum over j <= i of C(i,j)/C(n,j) a_j,
+// which by Descartes' rule bound the number of roots in (0,1) from above, and have the same parity.
+static int BernsteinSignChanges(const double* p, int n)
+{
+    double choose_n[EdgeSolver::max_degree + 1];
+    choose_n[0] = 1;
+    for (int j = 1; j <= n; j++)
+        choose_n[j] = choose_n[j - 1]*(n - j + 1)/j;
+
+    int changes = 0;
+    int last_sign = 0;
+    for (int i = 0; i <= n; i++)
+    {
+        double b = 0;
+        double choose_i = 1;
+        for (int j = 0; j <= i; j++)
+        {
+            b += choose_i/choose_n[j]*p[j];
+            choose_i = choose_i*(i - j)/(j + 1);
+        }
+
+        int sign = (b > 0) - (b < 0);
+        if (sign == 0)
+            continue;
+        if (last_sign != 0 && sign != last_sign)
+            changes++;
+        last_sign = sign;
+    }
+    return changes;
+}
+
+// Newton's method from t for a root of p in [lo, hi], falling back on bisection whenever a step would
+// leave the interval. p must change sign over the interval.
+static double RefineRoot(const double* p, int degree, double lo, double hi, double t)
+{
+    double f_lo = EvaluatePolynomial(p, degree, lo);
+    for (int step = 0; step < max_newton_steps && hi - lo > 1e-15; step++)
+    {
+        double f = EvaluatePolynomial(p, degree, t);
+        if (f == 0)
+            return t;
+
+        if ((f < 0) == (f_lo < 0))
+        {
+            lo = t;
+            f_lo = f;
+        }
+        else
+            hi = t;
+
+        double df = EvaluateDerivative(p, degree, t);
+        double next = (df != 0) ? t - f/df : lo;
+        t = (next > lo && next < hi) ? next : 0.5*(lo + hi);
+    }
+    return t;
+}
+
+// The single distinct root in (lo, hi]. A root where p doesn't change sign is a root of p' too.
+static double IsolatedRoot(const double* p, int degree, double lo, double hi)
+{
+    double f_lo = EvaluatePolynomial(p, degree, lo);
+    double f_hi = EvaluatePolynomial(p, degree, hi);
+    if (f_hi == 0)
+        return hi;
+    if ((f_lo < 0) != (f_hi < 0))
+        return RefineRoot(p, degree, lo, hi, 0.5*(lo + hi));
+
+    double derivative[EdgeSolver::max_degree + 1];
+    for (int n = 1; n <= degree; n++)
+        derivative[n - 1] = n*p[n];
+    if ((EvaluatePolynomial(derivative, degree - 1, lo) < 0) != (EvaluatePolynomial(derivative, degree - 1, hi) < 0))
+        return RefineRoot(derivative, degree - 1, lo, hi, 0.5*(lo + hi));
+    return 0.5*(lo + hi);
+}
+
+static void IsolateRoots(const double* p, int degree, const SturmSequence seq, const int* seq_degree, int length,
+                         double lo, double hi, int changes_lo, int changes_hi, int bisections, double* t_out, int* count)
+{
+    int roots = changes_lo - changes_hi;
+    if (roots <= 0)
+        return;
+
+    if (roots == 1 || bisections == max_bisections)
+    {
+        t_out[(*count)++] = IsolatedRoot(p, degree, lo, hi);
+        return;
+    }
+
+    double mid = 0.5*(lo + hi);
+    int changes_mid = SignChanges(seq, seq_degree, length, mid);
+    IsolateRoots(p, degree, seq, seq_degree, length, lo, mid, changes_lo, changes_mid, bisections + 1, t_out, count);
+    IsolateRoots(p, degree, seq, seq_degree, length, mid, hi, changes_mid, changes_hi, bisections + 1, t_out, count);
+}
+
+EdgeSolver::EdgeSolver(const Polynomial& f)
+{
+    terms = f.getTerms();
+    degree = f.degree();
+
+    for (int var = 0; var < 4; var++)
+    {
+        max_exponent[var] = 0;
+        for (int m = 0; m < terms.size(); m++)
+        {
+            if (terms[m].exponents[var] > max_exponent[var])
+                max_exponent[var] = terms[m].exponents[var];
+        }
+    }
+}
+
+void EdgeSolver::Restrict(const double start[4], const double end[4], double* coefficients_out) const
+{
+    // Powers of each coordinate along the segment, (start + t(end - start))^e, as polynomials in t.
+    double powers[4][max_degree + 1][max_degree + 1];
+    for (int var = 0; var < 4; var++)
+    {
+        double a = start[var];
+        double d = end[var] - start[var];
+
+        powers[var][0][0] = 1;
+        for (int e = 1; e <= max_exponent[var]; e++)
+        {
+            powers[var][e][e] = d*powers[var][e - 1][e - 1];
+            for (int n = e - 1; n >= 1; n--)
+                powers[var][e][n] = a*powers[var][e - 1][n] + d*powers[var][e - 1][n - 1];
+            powers[var][e][0] = a*powers[var][e - 1][0];
+        }
+    }
+
+    for (int n = 0; n <= degree; n++)
+        coefficients_out[n] = 0;
+
+    for (int m = 0; m < terms.size(); m++)
+    {
+        const int* exponents = terms[m].exponents;
+
+        double product[max_degree + 1];
+        int product_degree = 0;
+        product[0] = terms[m].coefficient;
+        for (int var = 0; var < 4; var++)
+        {
+            int e = exponents[var];
+            if (e == 0)
+                continue;
+
+            double next[max_degree + 1];
+            for (int n = 0; n <= product_degree + e; n++)
+                next[n] = 0;
+            for (int n = 0; n <= product_degree; n++)
+            {
+                for (int k = 0; k <= e; k++)
+                    next[n + k] += product[n]*powers[var][e][k];
+            }
+            product_degree += e;
+            for (int n = 0; n <= product_degree; n++)
+                product[n] = next[n];
+        }
+
+        for (int n = 0; n <= product_degree; n++)
+            coefficients_out[n] += product[n];
+    }
+}
+
+int EdgeSolver::FindRoots(const double start[4], const double end[4], double* t_out) const
+{
+    double p[max_degree + 1];
+    Restrict(start, end, p);
+
+    int p_degree = TrimDegree(p, degree, LargestCoefficient(p, degree));
+    if (p_degree <= 0)
+        return 0;
+
+    SturmSequence seq;
+    int seq_degree[max_degree + 1];
+    int length = BuildSturmSequence(p, p_degree, seq, seq_degree);
+
+    int count = 0;
+    if (EvaluatePolynomial(p, p_degree, 0) == 0)
+        t_out[count++] = 0;
+    IsolateRoots(p, p_degree, seq, seq_degree, length, 0, 1,
+                 SignChanges(seq, seq_degree, length, 0), SignChanges(seq, seq_degree, length, 1), 0, t_out, &count);
+    return count;
+}
+
+bool EdgeSolver::HasHiddenCrossing(const double start[4], const double end[4]) const
+{
+    double p[max_degree + 1];
+    Restrict(start, end, p);
+
+    int n = TrimDegree(p, degree, LargestCoefficient(p, degree));
+    if (n <= 0 || BernsteinSignChanges(p, n) == 0)
+        return false;
+
+    SturmSequence seq;
+    int seq_degree[max_degree + 1];
+    int length = BuildSturmSequence(p, n, seq, seq_degree);
+
+    // Counts roots in (0,1]; a root at the end itself is the next edge's business.
+    int roots = SignChanges(seq, seq_degree, length, 0) - SignChanges(seq, seq_degree, length, 1);
+    if (EvaluatePolynomial(p, n, 1) == 0)
+        roots--;
+    return roots > 0;
+}
+
+double EdgeSolver::Crossing(const double start[4], const double end[4], double t_guess) const
+{
+    double p[max_degree + 1];
+    Restrict(start, end, p);
+
+    int n = TrimDegree(p, degree, LargestCoefficient(p, degree));
+    if (n <= 0)
+        return t_guess;
+
+    // Nearly always the edge is crossed once, which its Bernstein coefficients show without a Sturm sequence.
+    if (BernsteinSignChanges(p, n) == 1)
+        return RefineRoot(p, n, 0, 1, t_guess);
+
+    double roots[max_degree + 2];
+    int count = FindRoots(start, end, roots);
+
+    // A root changes the sign of f if f has different signs on either side of it, up to the next roots.
+    double best = t_guess;
+    double best_distance = 2;
+    for (int r = 0; r < count; r++)
+    {
+        double before = (r == 0) ? 0 : 0.5*(roots[r - 1] + roots[r]);
+        double after = (r == count - 1) ? 1 : 0.5*(roots[r] + roots[r + 1]);
+        double f_before = EvaluatePolynomial(p, n, before);
+        double f_after = EvaluatePolynomial(p, n, after);
+        if ((f_before >= 0) == (f_after >= 0))
+            continue;
+
+        double distance = fabs(roots[r] - t_guess);
+        if (distance < best_distance)
+        {
+            best = roots[r];
+            best_distance = distance;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,47 @@
+#ifndef EDGESOLVER_H
+#define EDGESOLVER_H
+
+#include <vector>
+
+#include "polynomial.h"
+
+// Finds where the surface crosses a lattice edge from the polynomial f restricts to along the edge,
+// rather than from the values at its ends alone. Marching cubes only sees the ends, so it misses an
+// edge crossed twice, and places the crossing it does see by linear interpolation.
+//
+// Along the segment from a to b, f(a + t(b - a)) is a polynomial in t of at most f's degree. Its
+// real roots in [0,1] are counted and isolated with a Sturm sequence, then refined by Newton's method
+// kept inside the isolating interval.
+class EdgeSolver
+{
+public:
+    // Restrictions are kept on the stack, so f may be at most this degree.
+    static const int max_degree = 24;
+
+    // f must be a polynomial of at most max_degree.
+    explicit EdgeSolver(const Polynomial& f);
+
+    int GetDegree() const { return degree; }
+
+    // Coefficients of t^0 to t^GetDegree() of f along the segment from start to end.
+    void Restrict(const double start[4], const double end[4], double* coefficients_out) const;
+
+    // Distinct roots of f in [0,1] along the segment, in increasing order. Returns how many there are.
+    int FindRoots(const double start[4], const double end[4], double* t_out) const;
+
+    // For a segment whose ends have the same sign: whether f has a root on it anyway, e.g. where the
+    // surface crosses it twice or touches it. Most segments are ruled out by their Bernstein
+    // coefficients before a Sturm sequence is needed.
+    bool HasHiddenCrossing(const double start[4], const double end[4]) const;
+
+    // For a segment whose ends have opposite signs: the root of f where it changes sign closest to t_guess.
+    // Returns t_guess if no such root can be found.
+    double Crossing(const double start[4], const double end[4], double t_guess) const;
+
+private:
+    std::vector<Polynomial::Monomial> terms;
+    int degree;
+    int max_exponent[4];        // Of each variable over all the terms.
+};
+
+#endif // EDGESOLVER_H
@@ -0,0 +1,156 @@
+#include "framearena.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef PV_COUNT_HEAP_ALLOCATIONS
+static thread_local unsigned long long heap_allocations = 0;
+
+// Counted versions of the global allocation functions, for ThreadHeapAllocations. Each new retries
+// through the new handler, as the standard ones do.
+void* operator new(size_t bytes)
+{
+    heap_allocations++;
+    if (bytes == 0)
+        bytes = 1;
+    while (true)
+    {
+        void* p = malloc(bytes);
+        if (p != NULL)
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new[](size_t bytes)
+{
+    return operator new(bytes);
+}
+
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return operator new(bytes);
+    }
+    catch (std::bad_alloc)
+    {
+        return NULL;
+    }
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept
+{
+    return operator new(bytes, std::nothrow);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+unsigned long long ThreadHeapAllocations()
+{
+    return heap_allocations;
+}
+#else
+unsigned long long ThreadHeapAllocations()
+{
+    return 0;
+}
+#endif
+
+FrameArena::FrameArena(size_t initial_bytes)
+{
+    block_bytes = 0;
+    block_used = 0;
+    used_bytes = 0;
+    AddBlock(initial_bytes);
+}
+
+FrameArena::~FrameArena()
+{
+    for (int i = 0; i < blocks.size(); i++)
+        delete[] blocks[i];
+}
+
+unsigned char* FrameArena::AddBlock(size_t bytes)
+{
+    unsigned char* block = new unsigned char[bytes];
+    blocks.push_back(block);
+    block_bytes = bytes;
+    block_used = 0;
+    return block;
+}
+
+// The first offset from used on that's aligned in memory; blocks themselves are only aligned for
+// the fundamental types.
+static size_t AlignedOffset(const unsigned char* block, size_t used, size_t alignment)
+{
+    uintptr_t start = (uintptr_t)block;
+    return (start + used + alignment - 1) / alignment * alignment - start;
+}
+
+void* FrameArena::AllocateBytes(size_t bytes, size_t alignment)
+{
+    unsigned char* block = blocks.back();
+    size_t offset = AlignedOffset(block, block_used, alignment);
+    if (offset + bytes > block_bytes)
+    {
+        size_t new_bytes = 2 * block_bytes;
+        while (new_bytes < bytes + alignment)
+            new_bytes *= 2;
+        block = AddBlock(new_bytes);
+        offset = AlignedOffset(block, 0, alignment);
+    }
+
+    block_used = offset + bytes;
+    used_bytes += bytes;
+    return block + offset;
+}
+
+void FrameArena::Reset()
+{
+    if (blocks.size() > 1)
+    {
+        // Each block is at least twice the one before, so the last frame used less than twice the
+        // current one.
+        size_t total_bytes = 2 * block_bytes;
+        for (int i = 0; i < blocks.size(); i++)
+            delete[] blocks[i];
+        blocks.clear();
+        AddBlock(total_bytes);
+    }
+
+    block_used = 0;
+    used_bytes = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#include <cstddef>
+#include <vector>
+
+// Memory for data that lives only while one frame is built and drawn: vertices bound for the
+// stream buffer, lists of draws, and the like. Allocating is bumping an offset, and everything is
+// freed at once by Reset at the start of the next frame. Once the arena has grown to what a frame
+// needs it stays in one block, so frames after the first few make no heap allocations for it.
+//
+// Only for types that need no destructor; nothing allocated here is ever destroyed.
+class FrameArena
+{
+public:
+    explicit FrameArena(size_t initial_bytes = 1 << 20);
+    virtual ~FrameArena();
+
+    // Room for count uninitialized Ts, until the next Reset.
+    template <class T>
+    T* Allocate(size_t count)
+    {
+        return static_cast<T*>(AllocateBytes(count * sizeof(T), (alignof(T) > min_alignment) ? alignof(T) : min_alignment));
+    }
+    void* AllocateBytes(size_t bytes, size_t alignment = min_alignment);
+
+    // Frees everything. If the last frame overflowed its block, the next gets one big enough for
+    // all it used.
+    void Reset();
+
+    // Since the last Reset.
+    size_t GetUsedBytes() const { return used_bytes; }
+
+private:
+    static const size_t min_alignment = 16;
+
+    unsigned char* AddBlock(size_t bytes);
+
+    std::vector<unsigned char*> blocks;     // The current one last.
+    size_t block_bytes;                     // Size of the current block...
+    size_t block_used;                      // ...and how much of it is taken.
+    size_t used_bytes;
+};
+
+// Heap allocations made by operator new on the calling thread since it started, if the program is
+// built with PV_COUNT_HEAP_ALLOCATIONS defined, and otherwise always 0. With -perf the main loop
+// compares them from frame to frame, to show what still allocates.
+//
+// Counting replaces the program's global allocation functions: the plain, array and nothrow forms
+// of operator new, and the plain, array, sized and nothrow forms of operator delete, all of which
+// go to malloc and free. The C++17 aligned forms are left alone. That changes every allocation in
+// the process, libraries' included, so it's off unless asked for.
+unsigned long long ThreadHeapAllocations();
+
+#endif // FRAMEARENA_H
@@ -0,0 +1,391 @@
+#include "functionlens.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+FunctionLens::FunctionLens(int worker_count, double frame_budget_ms)
+{
+    mesh = NULL;
+    generation = 0;
+    completed = 0;
+    wanted_changed = false;
+    revision = 0;
+    this->frame_budget_ms = frame_budget_ms;
+    frame_budget_used = 0;
+    frame = 0;
+    block_ms_estimate = 1;
+    busy_workers = 0;
+    quitting = false;
+
+    InitializeCriticalSection(&lock);
+    InitializeConditionVariable(&work_available);
+    InitializeConditionVariable(&work_done);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        DWORD threadID;
+        workers.push_back(CreateThread(NULL, 0, WorkerStarter, this, 0, &threadID));
+    }
+}
+
+FunctionLens::~FunctionLens()
+{
+    EnterCriticalSection(&lock);
+    quitting = true;
+    WakeAllConditionVariable(&work_available);
+    LeaveCriticalSection(&lock);
+
+    if (!workers.empty())
+        WaitForMultipleObjects(workers.size(), &workers[0], TRUE, INFINITE);
+    for (int i = 0; i < workers.size(); i++)
+        CloseHandle(workers[i]);
+
+    for (std::map<unsigned long long, Block*>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+        delete it->second;
+
+    DeleteCriticalSection(&lock);
+}
+
+unsigned long long FunctionLens::BlockKey(Variable::var_type chart, int depth, int bi, int bj, int bk)
+{
+    // 2 bits of chart, 6 of depth and 18 for each block coordinate, offset to be non-negative.
+    const int offset = 1 << 17;
+    return ((unsigned long long)chart << 62)
+         | ((unsigned long long)depth << 56)
+         | ((unsigned long long)(bi + offset) << 36)
+         | ((unsigned long long)(bj + offset) << 18)
+         | (unsigned long long)(bk + offset);
+}
+
+void FunctionLens::SetMesh(FunctionMesh* mesh)
+{
+    EnterCriticalSection(&lock);
+
+    this->mesh = mesh;
+    generation++;
+
+    for (std::map<unsigned long long, Block*>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+        delete it->second;
+    blocks.clear();
+    jobs.clear();
+    wanted.clear();
+    vertices.clear();
+    gradients.clear();
+    revision++;
+
+    // Workers only touch the mesh outside the lock, while counted as busy.
+    while (busy_workers > 0)
+        SleepConditionVariableCS(&work_done, &lock, INFINITE);
+
+    LeaveCriticalSection(&lock);
+}
+
+void FunctionLens::Disable()
+{
+    EnterCriticalSection(&lock);
+
+    jobs.clear();
+    wanted.clear();
+    vertices.clear();
+    gradients.clear();
+    revision++;
+
+    LeaveCriticalSection(&lock);
+}
+
+// The variable largest in magnitude at p, whose chart holds it furthest from infinity, or -1 at
+// the origin.
+static int LargestCoordinate(const Vector4& p)
+{
+    int chart = -1;
+    float largest = 0;
+    for (int c = 0; c < 4; c++)
+    {
+        if (fabs(p[c]) > largest)
+        {
+            largest = fabs(p[c]);
+            chart = c;
+        }
+    }
+    return chart;
+}
+
+void FunctionLens::Update(const Matrix4& function_pose, const Vector3& world_center, float world_radius)
+{
+    // Only SetMesh, on this same thread, changes the mesh.
+    if (mesh == NULL)
+        return;
+
+    Matrix4 world_to_function = function_pose;
+    world_to_function.invert();
+
+    // The center of the lens and the ends of its axes, in function coordinates. The lens is
+    // meshed in the chart of each of them, so it isn't cut off where it crosses a chart's edge.
+    Vector4 points[7];
+    points[0] = world_to_function*Vector4(world_center.x, world_center.y, world_center.z, 1);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int sign = 0; sign < 2; sign++)
+        {
+            Vector4 world_point(world_center.x, world_center.y, world_center.z, 1);
+            world_point[axis] += sign ? world_radius : -world_radius;
+            points[1 + 2*axis + sign] = world_to_function*world_point;
+        }
+    }
+
+    bool in_lens[4] = { false, false, false, false };
+    for (int p = 0; p < 7; p++)
+    {
+        int chart = LargestCoordinate(points[p]);
+        if (chart >= 0)
+            in_lens[chart] = true;
+    }
+
+    EnterCriticalSection(&lock);
+
+    frame_budget_used = 0;
+    frame++;
+
+    new_wanted.clear();
+    for (int c = 0; c < 4; c++)
+    {
+        if (in_lens[c])
+            AddChartBlocks((Variable::var_type)c, points);
+    }
+
+    if (new_wanted != wanted)
+    {
+        wanted.swap(new_wanted);
+        wanted_changed = true;
+
+        // Queue what's missing, dropping jobs the lens has moved away from.
+        jobs.clear();
+        for (int w = 0; w < wanted.size(); w++)
+        {
+            Block* block = blocks[wanted[w]];
+            if (!block->ready && !block->meshing)
+                jobs.push_back(wanted[w]);
+        }
+        std::sort(jobs.begin(), jobs.end(), [this](unsigned long long a, unsigned long long b)
+        {
+            return blocks[a]->priority > blocks[b]->priority;
+        });
+
+        // Evict blocks the lens no longer covers once the cache grows too big, except
+        // those a worker is still meshing.
+        if (blocks.size() > max_cached_blocks)
+        {
+            std::vector<unsigned long long> sorted_wanted = wanted;
+            std::sort(sorted_wanted.begin(), sorted_wanted.end());
+            for (std::map<unsigned long long, Block*>::iterator it = blocks.begin(); it != blocks.end(); )
+            {
+                if (!it->second->meshing && !std::binary_search(sorted_wanted.begin(), sorted_wanted.end(), it->first))
+                {
+                    delete it->second;
+                    it = blocks.erase(it);
+                }
+                else
+                    ++it;
+            }
+        }
+    }
+
+    if (!jobs.empty())
+        WakeAllConditionVariable(&work_available);
+
+    if (wanted_changed || completed > 0)
+    {
+        vertices.clear();
+        gradients.clear();
+        for (int w = 0; w < wanted.size(); w++)
+        {
+            Block* block = blocks[wanted[w]];
+            if (block->ready)
+            {
+                vertices.insert(vertices.end(), block->vertices.cbegin(), block->vertices.cend());
+                gradients.insert(gradients.end(), block->gradients.cbegin(), block->gradients.cend());
+            }
+        }
+        wanted_changed = false;
+        completed = 0;
+        revision++;
+    }
+
+    LeaveCriticalSection(&lock);
+}
+
+void FunctionLens::AddChartBlocks(Variable::var_type chart, const Vector4* points)
+{
+    Vector4 e1, e2, e3, e4;
+    FunctionMesh::GetChartBasis(chart, &e1, &e2, &e3, &e4);
+
+    const Vector4& center = points[0];
+    if (center.dot(e4) == 0)
+        return;
+
+    // Blocks are laid out in the mesh's generating coordinates, like the leaves of its tree.
+    Vector3 generating_center = ToGenerating(Vector3(center.dot(e1), center.dot(e2), center.dot(e3)) / center.dot(e4));
+
+    // The sphere is not a sphere in generating coordinates; bound it by the furthest of its axis points.
+    float radius = 0;
+    for (int p = 1; p < 7; p++)
+    {
+        if (points[p].dot(e4) == 0)
+            continue;
+        Vector3 generating_point = ToGenerating(Vector3(points[p].dot(e1), points[p].dot(e2), points[p].dot(e3)) / points[p].dot(e4));
+        radius = fmaxf(radius, generating_point.distance(generating_center));
+    }
+    radius = fminf(radius, 1.0f);
+    if (radius <= 0)
+        return;
+
+    // Pick the depth that puts about lens_cells cells across the lens.
+    int depth = (int)floor(log2(lens_cells / radius));
+    if (depth > max_lens_depth)
+        depth = max_lens_depth;
+    if (depth < block_bits)
+        depth = block_bits;
+
+    double block_size = (2.0 / (1 << depth)) * (1 << block_bits);
+    int blocks_across = 1 << (depth - block_bits);
+
+    int lo[3];
+    int hi[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // Only blocks inside the chart; past its edge the equi-angular coordinate wraps.
+        lo[axis] = (int)floor((generating_center[axis] - radius + 1) / block_size);
+        hi[axis] = (int)floor((generating_center[axis] + radius + 1) / block_size);
+        lo[axis] = std::max(lo[axis], 0);
+        hi[axis] = std::min(hi[axis], blocks_across - 1);
+    }
+
+    for (int bi = lo[0]; bi <= hi[0]; bi++)
+    {   for (int bj = lo[1]; bj <= hi[1]; bj++)
+        {   for (int bk = lo[2]; bk <= hi[2]; bk++)
+            {
+                // Skip blocks the sphere doesn't reach.
+                int b[3] = { bi, bj, bk };
+                float outside = 0;
+                float priority = 0;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    float block_min = (float)(-1 + b[axis]*block_size);
+                    float block_max = (float)(block_min + block_size);
+                    float nearest = fmaxf(block_min, fminf(generating_center[axis], block_max));
+                    outside += (generating_center[axis] - nearest)*(generating_center[axis] - nearest);
+                    float mid = (block_min + block_max) / 2 - generating_center[axis];
+                    priority += mid*mid;
+                }
+                if (outside > radius*radius)
+                    continue;
+
+                unsigned long long key = BlockKey(chart, depth, bi, bj, bk);
+                new_wanted.push_back(key);
+
+                Block*& block = blocks[key];
+                if (block == NULL)
+                {
+                    block = new Block;
+                    block->chart = chart;
+                    block->depth = depth;
+                    block->bi = bi;
+                    block->bj = bj;
+                    block->bk = bk;
+                    block->meshing = false;
+                    block->ready = false;
+                }
+                block->priority = priority;
+            }
+        }
+    }
+}
+
+Vector3 FunctionLens::ToGenerating(const Vector3& chart_point)
+{
+    return Vector3(mesh->GeneratingCoordinate(chart_point.x),
+                   mesh->GeneratingCoordinate(chart_point.y),
+                   mesh->GeneratingCoordinate(chart_point.z));
+}
+
+DWORD WINAPI FunctionLens::WorkerStarter(LPVOID vlens)
+{
+    ((FunctionLens*)vlens)->WorkerLoop();
+    return 0;
+}
+
+void FunctionLens::WorkerLoop()
+{
+    std::vector<Vector4> block_vertices;
+    std::vector<Vector4> block_gradients;
+    std::vector<Vector4> unused_debug_vertices;
+    std::vector<Vector3> unused_debug_colors;
+
+    EnterCriticalSection(&lock);
+
+    while (true)
+    {
+        while (!quitting && (jobs.empty() || frame_budget_used >= frame_budget_ms))
+            SleepConditionVariableCS(&work_available, &lock, INFINITE);
+
+        if (quitting)
+            break;
+
+        unsigned long long key = jobs.back();
+        jobs.pop_back();
+
+        Block* block = blocks[key];
+        block->meshing = true;
+
+        // Charge the frame for the block now, at what blocks have been taking, so workers
+        // starting blocks together can't each take what's left of the budget.
+        double reserved_ms = block_ms_estimate;
+        int job_frame = frame;
+        frame_budget_used += reserved_ms;
+
+        FunctionMesh* job_mesh = mesh;
+        int job_generation = generation;
+        Variable::var_type chart = block->chart;
+        int cells = 1 << block_bits;
+        float step = 2.0f / (1 << block->depth);
+        Vector3 min(-1 + step*cells*block->bi, -1 + step*cells*block->bj, -1 + step*cells*block->bk);
+        Vector3 max = min + Vector3(step*cells, step*cells, step*cells);
+        int depth = block->depth;
+
+        busy_workers++;
+        LeaveCriticalSection(&lock);
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        FunctionMesh::FunctionMeshTreeLeaf leaf(job_mesh, depth, cells, chart, min, max);
+        block_vertices.clear();
+        block_gradients.clear();
+        leaf.GetMeshData(&block_vertices, &block_gradients, &unused_debug_vertices, &unused_debug_colors);
+        unused_debug_vertices.clear();
+        unused_debug_colors.clear();
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        EnterCriticalSection(&lock);
+        busy_workers--;
+        if (job_frame == frame)
+            frame_budget_used += elapsed.count() - reserved_ms;
+        block_ms_estimate = 0.75*block_ms_estimate + 0.25*elapsed.count();
+
+        // The block may have been evicted, or the surface replaced, while we were busy.
+        std::map<unsigned long long, Block*>::iterator it = blocks.find(key);
+        if (job_generation == generation && it != blocks.end())
+        {
+            it->second->meshing = false;
+            it->second->vertices.swap(block_vertices);
+            it->second->gradients.swap(block_gradients);
+            it->second->ready = true;
+            completed++;
+        }
+
+        WakeAllConditionVariable(&work_done);
+    }
+
+    LeaveCriticalSection(&lock);
+}
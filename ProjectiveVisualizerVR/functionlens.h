@@ -0,0 +1,103 @@
+#ifndef FUNCTIONLENS_H
+#define FUNCTIONLENS_H
+
+#include <vector>
+#include <map>
+
+#include <Windows.h>
+
+#include "functionmesh.h"
+#include "shared/Vectors.h"
+#include "shared/Matrices.h"
+
+// A "magnifying lens": a small sphere in which the surface is meshed at a much higher
+// depth than the global mesh, to look closely at singularities and other fine detail.
+//
+// The lens is placed in world coordinates; the pose of the function is undone to find the
+// charts of projective space it lies in, and each of them is cut into blocks of leaf-sized
+// lattices at the lens depth, laid out in generating coordinates like the mesh's own tree.
+// Blocks are meshed on worker threads, nearest to the center of the lens first, and kept
+// as the lens slides so only newly covered blocks are meshed. The workers only start new
+// blocks while the frame's time budget lasts, and charge it for each one as they start it.
+class FunctionLens
+{
+public:
+    FunctionLens(int worker_count = 3, double frame_budget_ms = 4);
+    virtual ~FunctionLens();
+
+    // Switches to another surface. Blocks of the old one are dropped, and this waits for
+    // workers still meshing them, so the old mesh may be deleted as soon as it returns.
+    void SetMesh(FunctionMesh* mesh);
+
+    // Called once per frame with the lens sphere in world coordinates and the current pose
+    // of the function. Starts the frame's time budget for the workers and refreshes
+    // vertices/gradients with every block finished so far.
+    void Update(const Matrix4& function_pose, const Vector3& world_center, float world_radius);
+
+    // Stops meshing and empties vertices/gradients until the next Update.
+    void Disable();
+
+    // Triangles of the finished blocks, in function coordinates.
+    std::vector<Vector4> vertices;
+    std::vector<Vector4> gradients;
+
+    // Bumped whenever vertices/gradients change, so copies of them can tell when they're stale.
+    int revision;
+
+private:
+    // Cells across the diameter of the lens, which decides the depth it is meshed at.
+    const int lens_cells = 64;
+    const int max_lens_depth = 16;
+    const int block_bits = 3;
+
+    // Blocks beyond this many are dropped once the lens no longer covers them.
+    const int max_cached_blocks = 4096;
+
+    struct Block
+    {
+        Variable::var_type chart;
+        int depth;
+        int bi, bj, bk;
+        float priority;         // Squared distance from the lens center; smaller is meshed first.
+        bool meshing;           // Taken by a worker.
+        bool ready;
+        std::vector<Vector4> vertices;
+        std::vector<Vector4> gradients;
+    };
+
+    Vector3 ToGenerating(const Vector3& chart_point);
+
+    // Adds the blocks of chart the lens covers to new_wanted, given its center and the ends of
+    // its axes in function coordinates.
+    void AddChartBlocks(Variable::var_type chart, const Vector4* points);
+
+    static unsigned long long BlockKey(Variable::var_type chart, int depth, int bi, int bj, int bk);
+
+    static DWORD WINAPI WorkerStarter(LPVOID vlens);
+    void WorkerLoop();
+
+    FunctionMesh* mesh;
+    int generation;             // Bumped by SetMesh, so stale results can be recognised.
+
+    std::map<unsigned long long, Block*> blocks;
+    std::vector<unsigned long long> wanted;     // Blocks covered by the lens this frame.
+    std::vector<unsigned long long> new_wanted; // Update's scratch list, kept to reuse its memory.
+    std::vector<unsigned long long> jobs;       // Blocks waiting for a worker; the next one is at the back.
+
+    int completed;              // Blocks finished since vertices were last rebuilt.
+    bool wanted_changed;
+
+    double frame_budget_ms;
+    double frame_budget_used;   // Including what's reserved for blocks still being meshed.
+    int frame;                  // Bumped by Update, when the budget starts again.
+    double block_ms_estimate;   // What a block has been taking lately, reserved as it's started.
+    int busy_workers;
+    bool quitting;
+
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE work_available;
+    CONDITION_VARIABLE work_done;
+    std::vector<HANDLE> workers;
+};
+
+#endif // FUNCTIONLENS_H
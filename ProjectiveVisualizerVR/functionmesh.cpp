@@ -1,7 +1,15 @@
 #include "functionmesh.h"
+#include "cellkernel.h"
+#include "signfield.h"
+#include "meshstream.h"
+#include "meshcoordinator.h"
 
 #include <iostream>
 #include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
 
 #include <Windows.h>
 
@@ -14,6 +22,11 @@ struct asynch_gen_params
 	Vector3 min;
 	Vector3 max;
 	FunctionMesh::FunctionMeshTreeNode** gen_tree;
+
+	// Regions of the chart with their coarse levels, filled in once the tree is done.
+	std::vector<FunctionMesh::Region> regions;
+	std::vector<Vector4> lod_vertices;
+	std::vector<Vector4> lod_gradients;
 };
 
 // Asynchronous generation of mesh trees.
@@ -24,33 +37,116 @@ DWORD WINAPI AsynchronousGenerateMeshTree(LPVOID vparams)
 
 	*(params->gen_tree) = new FunctionMesh::FunctionMeshTreeNode(params->fm, params->depth, params->max_depth, params->var, params->min, params->max);
 
+	params->fm->MeshChartRegions(*(params->gen_tree), params->var, params->max_depth, &params->regions, &params->lod_vertices, &params->lod_gradients);
+
 	return 0;
 }
 
-FunctionMesh::FunctionMesh(Term *f_of_xyz)
+FunctionMesh::FunctionMesh(Term *f_of_xyz, const MeshBudget& budget, ChartSampling sampling, bool use_symmetry,
+                           MeshCoordinator* coordinator, bool find_hidden_crossings)
 {
-	this->f_of_xyz = f_of_xyz->simplify();
+    load_failed = false;
+    this->sampling = sampling;
+    this->find_hidden_crossings = find_hidden_crossings;
+    SetFunction(f_of_xyz);
+
+    if (use_symmetry && f_is_polynomial)
+        FindSymmetries(f_expanded, &symmetries);
+    if (symmetries.empty())
+    {
+        Symmetry identity = { { { 0, 1, 2, 3 }, { 1, 1, 1, 1 } }, 1 };
+        symmetries.push_back(identity);
+    }
 
-    Term* dfdx_temp = f_of_xyz->derivative('x');
-    Term* dfdy_temp = f_of_xyz->derivative('y');
-    Term* dfdz_temp = f_of_xyz->derivative('z');
-    Term* dfdw_temp = f_of_xyz->derivative('w');
+    FindFundamentalRegions();
+    ChooseChartDepths(budget);
 
-    dfdx = dfdx_temp->simplify();
-    dfdy = dfdy_temp->simplify();
-    dfdz = dfdz_temp->simplify();
-    dfdw = dfdw_temp->simplify();
+    for (int c = 0; c < 4; c++)
+    {
+        if (chart_depth[c] < min_fundamental_depth)
+            use_fundamental_domain = false;
+    }
+    if (!use_fundamental_domain)
+        region_meshed.assign(4*regions_per_chart, true);
 
-    dfdx->print(); std::cout << std::endl;
-    dfdy->print(); std::cout << std::endl;
-    dfdz->print(); std::cout << std::endl;
-    dfdw->print(); std::cout << std::endl;
+    std::cout << "Found " << symmetries.size() << " symmetries";
+    if (use_fundamental_domain)
+        std::cout << "; meshing " << std::count(region_meshed.begin(), region_meshed.end(), true)
+                  << " of " << 4*regions_per_chart << " regions";
+    std::cout << "." << std::endl;
 
-    delete dfdx_temp;
-    delete dfdy_temp;
-    delete dfdz_temp;
-    delete dfdw_temp;
+    std::vector<int> region_ids;
+    std::vector<int> first_debug_vertex;
+    if (coordinator == 0 || !MeshRegionsOnWorkers(coordinator, &region_ids, &first_debug_vertex))
+        MeshChartsOnThreads(&region_ids, &first_debug_vertex);
+
+	first_debug_vertex.push_back(debug_vertices.size());
+
+	if (use_fundamental_domain)
+		ReplicateRegions(region_ids, first_debug_vertex);
+
+    std::cout << "Function mesh constructed." << std::endl;
+}
+
+FunctionMesh::FunctionMesh(Term* f_of_xyz, ChartSampling sampling, bool find_hidden_crossings)
+{
+    load_failed = false;
+    this->sampling = sampling;
+    this->find_hidden_crossings = find_hidden_crossings;
+    SetFunction(f_of_xyz);
+
+    Symmetry identity = { { { 0, 1, 2, 3 }, { 1, 1, 1, 1 } }, 1 };
+    symmetries.push_back(identity);
+    use_fundamental_domain = false;
+
+    for (int c = 0; c < 4; c++)
+        chart_depth[c] = default_depth;
+}
+
+FunctionMesh::FunctionMesh(Term* f_of_xyz, const char* streamed_mesh_path)
+{
+    load_failed = true;
+    find_hidden_crossings = false;
+    SetFunction(f_of_xyz);
+
+    Symmetry identity = { { { 0, 1, 2, 3 }, { 1, 1, 1, 1 } }, 1 };
+    symmetries.push_back(identity);
+    use_fundamental_domain = false;
+
+    StreamedMeshHeader header;
+    if (!ReadStreamedMeshHeader(streamed_mesh_path, &header))
+    {
+        std::cout << "Couldn't read mesh file " << streamed_mesh_path << std::endl;
+        sampling = SAMPLING_CUBE;
+        return;
+    }
+
+    sampling = (ChartSampling)header.sampling;
+    for (int c = 0; c < 4; c++)
+        chart_depth[c] = header.depth;
+
+    if (!StreamedMeshFitsInMemory(header))
+    {
+        std::cout << "Mesh file " << streamed_mesh_path << " has " << header.index_count / 3
+                  << " triangles, too many to load." << std::endl;
+        return;
+    }
+
+    if (!ReadStreamedMesh(streamed_mesh_path, &vertices, &gradients, &regions))
+    {
+        std::cout << "Mesh file " << streamed_mesh_path << " is damaged." << std::endl;
+        vertices.clear();
+        gradients.clear();
+        regions.clear();
+        return;
+    }
+
+    load_failed = false;
+    std::cout << "Function mesh loaded from " << streamed_mesh_path << "." << std::endl;
+}
 
+void FunctionMesh::MeshChartsOnThreads(std::vector<int>* region_ids_out, std::vector<int>* first_debug_vertex_out)
+{
     Vector3 min = Vector3(-1,-1,-1);
     Vector3 max = Vector3(1,1,1);
 
@@ -63,7 +159,7 @@ FunctionMesh::FunctionMesh(Term *f_of_xyz)
 	{
 		this,
 		1,
-		default_depth,
+		chart_depth[Variable::VAR_X],
 		Variable::VAR_X,
 		min,
 		max,
@@ -74,7 +170,7 @@ FunctionMesh::FunctionMesh(Term *f_of_xyz)
 	{
 		this,
 		1,
-		default_depth,
+		chart_depth[Variable::VAR_Y],
 		Variable::VAR_Y,
 		min,
 		max,
@@ -85,7 +181,7 @@ FunctionMesh::FunctionMesh(Term *f_of_xyz)
 	{
 		this,
 		1,
-		default_depth,
+		chart_depth[Variable::VAR_Z],
 		Variable::VAR_Z,
 		min,
 		max,
@@ -96,7 +192,7 @@ FunctionMesh::FunctionMesh(Term *f_of_xyz)
 	{
 		this,
 		1,
-		default_depth,
+		chart_depth[Variable::VAR_W],
 		Variable::VAR_W,
 		min,
 		max,
@@ -113,17 +209,156 @@ FunctionMesh::FunctionMesh(Term *f_of_xyz)
 
 	WaitForMultipleObjects(4, asynch_threads, TRUE, INFINITE);
 
-	mesh_tree_x->GetMeshData(&vertices, &gradients, &debug_vertices, &debug_colors);
-	mesh_tree_y->GetMeshData(&vertices, &gradients, &debug_vertices, &debug_colors);
-	mesh_tree_z->GetMeshData(&vertices, &gradients, &debug_vertices, &debug_colors);
-	mesh_tree_w->GetMeshData(&vertices, &gradients, &debug_vertices, &debug_colors);
+	// Gather the charts region by region, so each region's full-depth mesh is one range of vertices.
+	struct asynch_gen_params* chart_params[4] = { &params_x, &params_y, &params_z, &params_w };
+	for (int c = 0; c < 4; c++)
+	{
+		std::vector<FunctionMeshTree*> region_trees;
+		(*chart_params[c]->gen_tree)->GetRegions(region_depth, &region_trees);
+
+		int lod_offset = lod_vertices.size();
+		for (int r = 0; r < region_trees.size(); r++)
+		{
+			Region region = chart_params[c]->regions[r];
+
+			region_ids_out->push_back(RegionId((Variable::var_type)c, region_trees[r]->GetMin()));
+			first_debug_vertex_out->push_back(debug_vertices.size());
+
+			region.levels[0].first_vertex = vertices.size();
+			region_trees[r]->GetMeshData(&vertices, &gradients, &debug_vertices, &debug_colors);
+			region.levels[0].vertex_count = vertices.size() - region.levels[0].first_vertex;
+
+			for (int level = 1; level < region.level_count; level++)
+				region.levels[level].first_vertex += lod_offset;
+
+			regions.push_back(region);
+		}
+
+		lod_vertices.insert(lod_vertices.end(), chart_params[c]->lod_vertices.cbegin(), chart_params[c]->lod_vertices.cend());
+		lod_gradients.insert(lod_gradients.end(), chart_params[c]->lod_gradients.cbegin(), chart_params[c]->lod_gradients.cend());
+	}
 
 	delete mesh_tree_x;
 	delete mesh_tree_y;
 	delete mesh_tree_z;
     delete mesh_tree_w;
+}
 
-    std::cout << "Function mesh constructed." << std::endl;
+bool FunctionMesh::MeshRegionsOnWorkers(MeshCoordinator* coordinator, std::vector<int>* region_ids_out,
+                                        std::vector<int>* first_debug_vertex_out)
+{
+    // Jobs are whole regions, so every chart's tree has to reach region_depth with leaves no bigger than a region.
+    for (int c = 0; c < 4; c++)
+    {
+        if (chart_depth[c] < min_fundamental_depth)
+            return false;
+    }
+
+    // Workers rebuild f from its expanded form, which they can only do for integer coefficients.
+    if (!f_is_polynomial)
+        return false;
+    try
+    {
+        delete f_expanded.toTerm();
+    }
+    catch (BadTermException e)
+    {
+        return false;
+    }
+
+    double region_size = 2.0 / regions_per_axis;
+    std::vector<MeshJob> jobs;
+    std::vector<int> job_region_ids;
+    for (int id = 0; id < 4*regions_per_chart; id++)
+    {
+        if (!region_meshed[id])
+            continue;
+
+        int ri = id / (regions_per_axis*regions_per_axis) % regions_per_axis;
+        int rj = id / regions_per_axis % regions_per_axis;
+        int rk = id % regions_per_axis;
+
+        MeshJob job;
+        job.f = f_expanded;
+        job.chart = (Variable::var_type)(id / regions_per_chart);
+        job.min = Vector3(-1 + region_size*ri, -1 + region_size*rj, -1 + region_size*rk);
+        job.max = job.min + Vector3(region_size, region_size, region_size);
+        job.depth = chart_depth[job.chart];
+        job.sampling = sampling;
+        job.find_hidden_crossings = find_hidden_crossings;
+        jobs.push_back(job);
+        job_region_ids.push_back(id);
+    }
+
+    std::vector<MeshFragment> fragments;
+    if (coordinator->GetWorkerCount() == 0 || !coordinator->Run(jobs, &fragments))
+    {
+        std::cout << "Meshing on this process instead." << std::endl;
+        return false;
+    }
+
+    for (int n = 0; n < fragments.size(); n++)
+    {
+        // Regions with no surface are left out, as empty subtrees are.
+        MeshFragment& fragment = fragments[n];
+        if (fragment.vertices.empty())
+            continue;
+
+        Region region = fragment.region;
+        region.levels[0].first_vertex += vertices.size();
+        for (int level = 1; level < region.level_count; level++)
+            region.levels[level].first_vertex += lod_vertices.size();
+
+        vertices.insert(vertices.end(), fragment.vertices.cbegin(), fragment.vertices.cend());
+        gradients.insert(gradients.end(), fragment.gradients.cbegin(), fragment.gradients.cend());
+        lod_vertices.insert(lod_vertices.end(), fragment.lod_vertices.cbegin(), fragment.lod_vertices.cend());
+        lod_gradients.insert(lod_gradients.end(), fragment.lod_gradients.cbegin(), fragment.lod_gradients.cend());
+
+        region_ids_out->push_back(job_region_ids[n]);
+        first_debug_vertex_out->push_back(debug_vertices.size());
+        regions.push_back(region);
+    }
+
+    std::cout << "Meshed " << jobs.size() << " regions on " << coordinator->GetWorkerCount() << " workers." << std::endl;
+    return true;
+}
+
+void FunctionMesh::SetFunction(Term* f_of_xyz)
+{
+	this->f_of_xyz = f_of_xyz->simplify();
+
+    Term* dfdx_temp = f_of_xyz->derivative('x');
+    Term* dfdy_temp = f_of_xyz->derivative('y');
+    Term* dfdz_temp = f_of_xyz->derivative('z');
+    Term* dfdw_temp = f_of_xyz->derivative('w');
+
+    dfdx = dfdx_temp->simplify();
+    dfdy = dfdy_temp->simplify();
+    dfdz = dfdz_temp->simplify();
+    dfdw = dfdw_temp->simplify();
+
+    dfdx->print(); std::cout << std::endl;
+    dfdy->print(); std::cout << std::endl;
+    dfdz->print(); std::cout << std::endl;
+    dfdw->print(); std::cout << std::endl;
+
+    delete dfdx_temp;
+    delete dfdy_temp;
+    delete dfdz_temp;
+    delete dfdw_temp;
+
+    f_is_polynomial = false;
+    try
+    {
+        f_expanded = this->f_of_xyz->expandUpTo(EdgeSolver::max_degree);
+        f_is_polynomial = true;
+    }
+    catch (BadTermException e)
+    {
+    }
+
+    edge_solver = f_is_polynomial ? new EdgeSolver(f_expanded) : 0;
+    lattice_evaluator = CreateLatticeEvaluator(this->f_of_xyz, f_is_polynomial ? &f_expanded : 0);
 }
 
 FunctionMesh::~FunctionMesh()
@@ -132,10 +367,498 @@ FunctionMesh::~FunctionMesh()
     delete dfdx;
     delete dfdy;
     delete dfdz;
+    delete edge_solver;
+    delete lattice_evaluator;
 
     std::cout << "Function mesh deconstructed." << std::endl;
 }
 
+double FunctionMesh::ChartCoordinate(double u) const
+{
+    return ChartCoordinate(sampling, u);
+}
+
+double FunctionMesh::ChartCoordinate(ChartSampling sampling, double u)
+{
+    const double quarter_pi = 0.78539816339744830962;
+
+    if (sampling == SAMPLING_EQUIANGULAR)
+        return tan(u*quarter_pi);
+    return u;
+}
+
+double FunctionMesh::GeneratingCoordinate(double chart_coordinate) const
+{
+    const double quarter_pi = 0.78539816339744830962;
+
+    if (sampling == SAMPLING_EQUIANGULAR)
+        return atan(chart_coordinate)/quarter_pi;
+    return chart_coordinate;
+}
+
+void FunctionMesh::GetChartBasis(Variable::var_type largest_var, Vector4* e1, Vector4* e2, Vector4* e3, Vector4* e4)
+{
+    switch (largest_var)
+    {
+    case Variable::VAR_X:
+        *e1 = Vector4(0,1,0,0);
+        *e2 = Vector4(0,0,1,0);
+        *e3 = Vector4(0,0,0,1);
+        *e4 = Vector4(1,0,0,0);
+        break;
+    case Variable::VAR_Y:
+        *e1 = Vector4(1,0,0,0);
+        *e2 = Vector4(0,0,1,0);
+        *e3 = Vector4(0,0,0,1);
+        *e4 = Vector4(0,1,0,0);
+        break;
+    case Variable::VAR_Z:
+        *e1 = Vector4(1,0,0,0);
+        *e2 = Vector4(0,1,0,0);
+        *e3 = Vector4(0,0,0,1);
+        *e4 = Vector4(0,0,1,0);
+        break;
+    case Variable::VAR_W:
+        *e1 = Vector4(1,0,0,0);
+        *e2 = Vector4(0,1,0,0);
+        *e3 = Vector4(0,0,1,0);
+        *e4 = Vector4(0,0,0,1);
+        break;
+    }
+}
+
+// Coarse pre-pass: samples f on a small lattice over the chart, counting the cells the surface
+// passes through and timing the evaluations so the cost at higher depths can be extrapolated.
+void FunctionMesh::EstimateChart(Variable::var_type largest_var, ChartEstimate* estimate)
+{
+    Vector4 e1, e2, e3, e4;
+    GetChartBasis(largest_var, &e1, &e2, &e3, &e4);
+
+    int res = 1 << estimate_depth;
+    double step_length = 2.0/res;
+
+    std::vector<double> x(res + 1);
+    for (int n = 0; n < res + 1; n++)
+        x[n] = ChartCoordinate(-1 + step_length*n);
+
+    std::vector<double> values((res+1)*(res+1)*(res+1));
+
+    std::chrono::high_resolution_clock::time_point eval_start = std::chrono::high_resolution_clock::now();
+    lattice_evaluator->Evaluate(e1, e2, e3, e4, x, x, x, values.data());
+    std::chrono::duration<double, std::milli> eval_time = std::chrono::high_resolution_clock::now() - eval_start;
+    estimate->eval_ms = eval_time.count() / values.size();
+
+    estimate->surface_cells = 0;
+    for (int i = 0; i < res; i++)
+    {   for (int j = 0; j < res; j++)
+        {   for (int k = 0; k < res; k++)
+            {
+                int positive = 0;
+                for (int corner = 0; corner < 8; corner++)
+                {
+                    int ci = i + ((corner >> 2) & 1);
+                    int cj = j + ((corner >> 1) & 1);
+                    int ck = k + (corner & 1);
+                    positive += values[ci*(res+1)*(res+1) + cj*(res+1) + ck] >= 0;
+                }
+                if (positive != 0 && positive != 8)
+                    estimate->surface_cells++;
+            }
+        }
+    }
+
+    // Gradients are only evaluated at surface vertices, so time a handful along the chart diagonal.
+    const int gradient_samples = 64;
+    volatile double sink = 0;
+    std::chrono::high_resolution_clock::time_point gradient_start = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < gradient_samples; n++)
+    {
+        Vector4 v = e4 + ChartCoordinate(-1 + 2.0*n/gradient_samples)*(e1 + e2 + e3);
+        sink = sink + dfdx->eval(v) + dfdy->eval(v) + dfdz->eval(v) + dfdw->eval(v);
+    }
+    std::chrono::duration<double, std::milli> gradient_time = std::chrono::high_resolution_clock::now() - gradient_start;
+    estimate->gradient_ms = gradient_time.count() / gradient_samples;
+}
+
+double FunctionMesh::EstimateTriangles(const ChartEstimate& estimate, int depth)
+{
+    // The surface is two-dimensional, so each doubling of resolution quadruples the cells it
+    // passes through. A cell on the surface produces about two triangles.
+    const double triangles_per_surface_cell = 2.0;
+    return estimate.surface_cells * pow(4.0, depth - estimate_depth) * triangles_per_surface_cell;
+}
+
+double FunctionMesh::EstimateMilliseconds(const ChartEstimate& estimate, int depth)
+{
+    // Every leaf evaluates f on its own (res+1)^3 lattice, so a leaf of 8^3 cells costs 9^3 evaluations.
+    double evals_per_cell = 729.0 / 512.0;
+    double cells = pow(8.0, depth);
+
+    // Gradients are evaluated once per edge crossing, and a crossing is shared by about
+    // six triangle corners, so there is about one gradient per two triangles.
+    const double gradients_per_triangle = 0.5;
+
+    // Sign field leaves are 32^3 cells, but evaluate f again at the ends of crossed edges,
+    // which comes to about one new lattice point per crossing.
+    double reevals_per_triangle = 0;
+    if (depth >= min_sign_field_depth)
+    {
+        evals_per_cell = 35937.0 / 32768.0;
+        reevals_per_triangle = 0.5;
+    }
+
+    return cells * evals_per_cell * estimate.eval_ms
+         + EstimateTriangles(estimate, depth) * (gradients_per_triangle * estimate.gradient_ms + reevals_per_triangle * estimate.eval_ms);
+}
+
+void FunctionMesh::ChooseChartDepths(const MeshBudget& budget)
+{
+    for (int c = 0; c < 4; c++)
+        chart_depth[c] = default_depth;
+
+    if (!budget.IsLimited())
+        return;
+
+    ChartEstimate estimates[4];
+    for (int c = 0; c < 4; c++)
+    {
+        EstimateChart((Variable::var_type)c, &estimates[c]);
+        chart_depth[c] = min_budget_depth;
+    }
+
+    // The four charts are built on their own threads, so the time limit applies to each chart
+    // separately, while the triangle limit applies to their sum. Raise the depth of one chart at
+    // a time, round-robin, for as long as the result stays within the budget. Charts that are
+    // copies of each other under a symmetry are raised together.
+    bool raised = true;
+    while (raised)
+    {
+        raised = false;
+        for (int c = 0; c < 4; c++)
+        {
+            if (chart_orbit[c] != c)
+                continue;
+
+            int new_depth = chart_depth[c] + 1;
+            if (new_depth > max_budget_depth)
+                continue;
+
+            bool over_budget = false;
+            for (int member = 0; member < 4; member++)
+            {
+                if (chart_orbit[member] != c)
+                    continue;
+
+                // Only the chart's share of the fundamental domain is meshed, once it is deep enough.
+                double milliseconds = EstimateMilliseconds(estimates[member], new_depth);
+                if (use_fundamental_domain && new_depth >= min_fundamental_depth)
+                    milliseconds *= (double)chart_meshed_regions[member] / regions_per_chart;
+
+                if (budget.max_milliseconds > 0 && milliseconds > budget.max_milliseconds)
+                    over_budget = true;
+            }
+            if (over_budget)
+                continue;
+
+            if (budget.max_triangles > 0)
+            {
+                double triangles = 0;
+                for (int other = 0; other < 4; other++)
+                    triangles += EstimateTriangles(estimates[other], chart_orbit[other] == c ? new_depth : chart_depth[other]);
+                if (triangles > budget.max_triangles)
+                    continue;
+            }
+
+            for (int member = 0; member < 4; member++)
+            {
+                if (chart_orbit[member] == c)
+                    chart_depth[member] = new_depth;
+            }
+            raised = true;
+        }
+    }
+
+    std::cout << "Chart depths chosen for budget: "
+              << chart_depth[0] << " " << chart_depth[1] << " " << chart_depth[2] << " " << chart_depth[3] << std::endl;
+}
+
+void FunctionMesh::DescribeRegion(Variable::var_type largest_var, Vector3 min, Vector3 max, Region* region_out)
+{
+    Vector4 e1, e2, e3, e4;
+    GetChartBasis(largest_var, &e1, &e2, &e3, &e4);
+
+    region_out->chart = largest_var;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        region_out->corners[corner] = e4 + ChartCoordinate((corner & 4) ? max.x : min.x)*e1
+                                         + ChartCoordinate((corner & 2) ? max.y : min.y)*e2
+                                         + ChartCoordinate((corner & 1) ? max.z : min.z)*e3;
+    }
+}
+
+void FunctionMesh::MeshChartRegions(FunctionMeshTree* tree, Variable::var_type largest_var, int depth, std::vector<Region>* regions_out,
+                                    std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradients_out)
+{
+    std::vector<FunctionMeshTree*> region_trees;
+    tree->GetRegions(region_depth, &region_trees);
+
+    for (int r = 0; r < region_trees.size(); r++)
+    {
+        Vector3 min = region_trees[r]->GetMin();
+        Vector3 max = region_trees[r]->GetMax();
+
+        Region region;
+        DescribeRegion(largest_var, min, max, &region);
+
+        MeshRegionLevels(largest_var, min, max, depth, &region, vertices_out, gradients_out);
+
+        regions_out->push_back(region);
+    }
+}
+
+void FunctionMesh::MeshRegion(Variable::var_type largest_var, Vector3 min, Vector3 max, int depth, Region* region_out,
+                              std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradients_out,
+                              std::vector<Vector4>* lod_vertices_out, std::vector<Vector4>* lod_gradients_out)
+{
+    DescribeRegion(largest_var, min, max, region_out);
+    MeshRegionLevels(largest_var, min, max, depth, region_out, lod_vertices_out, lod_gradients_out);
+
+    std::vector<Vector4> unused_debug_vertices;
+    std::vector<Vector3> unused_debug_colors;
+
+    FunctionMeshTreeNode tree(this, region_depth, depth, largest_var, min, max);
+    region_out->levels[0].first_vertex = vertices_out->size();
+    tree.GetMeshData(vertices_out, gradients_out, &unused_debug_vertices, &unused_debug_colors);
+    region_out->levels[0].vertex_count = vertices_out->size() - region_out->levels[0].first_vertex;
+}
+
+void FunctionMesh::MeshRegionLevels(Variable::var_type largest_var, Vector3 min, Vector3 max, int depth, Region* region,
+                                    std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradients_out)
+{
+    double chart_step = 2.0 / (1 << depth);
+    int cells = (int)((max.x - min.x) / chart_step + 0.5);
+
+    region->levels[0].first_vertex = 0;
+    region->levels[0].vertex_count = 0;
+    region->levels[0].cells = cells;
+    region->level_count = 1;
+
+    std::vector<Vector4> unused_debug_vertices;
+    std::vector<Vector3> unused_debug_colors;
+
+    for (int level = 1; level < max_lod_levels && (cells >> level) >= 2; level++)
+    {
+        int level_cells = cells >> level;
+        float step = (float)(chart_step * (1 << level));
+
+        // The level covers the region plus one of its cells on every side. That box is cut
+        // into as few equal cubic leaves as the leaves' row length allows.
+        int box_cells = level_cells + 2;
+        int tiles = 1;
+        while (box_cells % tiles != 0 || box_cells / tiles > max_row_cells)
+            tiles++;
+        int tile_cells = box_cells / tiles;
+
+        RegionLevel& lod = region->levels[level];
+        lod.first_vertex = vertices_out->size();
+        lod.cells = level_cells;
+
+        for (int i = 0; i < tiles; i++)
+        {   for (int j = 0; j < tiles; j++)
+            {   for (int k = 0; k < tiles; k++)
+                {
+                    Vector3 tile_min = min + Vector3(step*(tile_cells*i - 1), step*(tile_cells*j - 1), step*(tile_cells*k - 1));
+                    Vector3 tile_max = tile_min + Vector3(step*tile_cells, step*tile_cells, step*tile_cells);
+
+                    FunctionMeshTreeLeaf leaf(this, depth - level, tile_cells, largest_var, tile_min, tile_max);
+                    leaf.GetMeshData(vertices_out, gradients_out, &unused_debug_vertices, &unused_debug_colors);
+                    unused_debug_vertices.clear();
+                    unused_debug_colors.clear();
+                }
+            }
+        }
+
+        lod.vertex_count = vertices_out->size() - lod.first_vertex;
+        region->level_count = level + 1;
+    }
+}
+
+int FunctionMesh::RegionId(Variable::var_type largest_var, const Vector3& min)
+{
+    double region_size = 2.0 / regions_per_axis;
+    int ri = (int)floor((min.x + 1) / region_size + 0.5);
+    int rj = (int)floor((min.y + 1) / region_size + 0.5);
+    int rk = (int)floor((min.z + 1) / region_size + 0.5);
+    return largest_var*regions_per_chart + (ri*regions_per_axis + rj)*regions_per_axis + rk;
+}
+
+int FunctionMesh::MapRegion(int region_id, const SignedPermutation& g)
+{
+    double region_size = 2.0 / regions_per_axis;
+
+    int r = region_id % regions_per_chart;
+    int index[3] = { r / (regions_per_axis*regions_per_axis), (r / regions_per_axis) % regions_per_axis, r % regions_per_axis };
+
+    Vector4 e[4];
+    GetChartBasis((Variable::var_type)(region_id / regions_per_chart), &e[0], &e[1], &e[2], &e[3]);
+
+    // Follow the center of the region. No other coordinate comes close to the fixed one there,
+    // so it lands well inside one region of one chart.
+    Vector4 center = e[3];
+    for (int axis = 0; axis < 3; axis++)
+        center += ChartCoordinate(-1 + region_size*(index[axis] + 0.5))*e[axis];
+
+    Vector4 image = g.apply(center);
+
+    int image_chart = 0;
+    for (int n = 1; n < 4; n++)
+    {
+        if (fabs(image[n]) > fabs(image[image_chart]))
+            image_chart = n;
+    }
+
+    GetChartBasis((Variable::var_type)image_chart, &e[0], &e[1], &e[2], &e[3]);
+
+    int image_id = image_chart;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double u = GeneratingCoordinate(image.dot(e[axis]) / image.dot(e[3]));
+        int i = (int)floor((u + 1) / region_size);
+        if (i < 0)
+            i = 0;
+        if (i > regions_per_axis - 1)
+            i = regions_per_axis - 1;
+        image_id = image_id*regions_per_axis + i;
+    }
+    return image_id;
+}
+
+void FunctionMesh::FindFundamentalRegions()
+{
+    region_meshed.assign(4*regions_per_chart, false);
+    for (int c = 0; c < 4; c++)
+        chart_meshed_regions[c] = 0;
+
+    std::vector<bool> seen(4*regions_per_chart, false);
+    std::vector<int> orbit;
+    for (int id = 0; id < 4*regions_per_chart; id++)
+    {
+        if (seen[id])
+            continue;
+
+        orbit.clear();
+        for (int s = 0; s < symmetries.size(); s++)
+        {
+            int image = MapRegion(id, symmetries[s].g);
+            if (!seen[image])
+            {
+                seen[image] = true;
+                orbit.push_back(image);
+            }
+        }
+
+        int representative = orbit[0];
+        for (int n = 1; n < orbit.size(); n++)
+        {
+            if (chart_meshed_regions[orbit[n] / regions_per_chart] < chart_meshed_regions[representative / regions_per_chart])
+                representative = orbit[n];
+        }
+        region_meshed[representative] = true;
+        chart_meshed_regions[representative / regions_per_chart]++;
+    }
+
+    // Coordinate n of g v is +-v[perm[n]], so g takes the chart where perm[n] is largest to chart n.
+    for (int c = 0; c < 4; c++)
+        chart_orbit[c] = c;
+    for (int s = 0; s < symmetries.size(); s++)
+    {
+        for (int n = 0; n < 4; n++)
+        {
+            int a = chart_orbit[n];
+            int b = chart_orbit[symmetries[s].g.perm[n]];
+            for (int c = 0; c < 4; c++)
+            {
+                if (chart_orbit[c] == a || chart_orbit[c] == b)
+                    chart_orbit[c] = (a < b) ? a : b;
+            }
+        }
+    }
+
+    use_fundamental_domain = std::count(region_meshed.begin(), region_meshed.end(), true) < 4*regions_per_chart;
+}
+
+void FunctionMesh::ReplicateRegions(const std::vector<int>& region_ids, const std::vector<int>& first_debug_vertex)
+{
+    // Regions left out of the tree because they're empty have empty images, so count them as done too.
+    std::vector<bool> produced = region_meshed;
+
+    int meshed_count = regions.size();
+    for (int r = 0; r < meshed_count; r++)
+    {
+        for (int s = 1; s < symmetries.size(); s++)
+        {
+            const Symmetry& symmetry = symmetries[s];
+
+            int image_id = MapRegion(region_ids[r], symmetry.g);
+            if (produced[image_id])
+                continue;
+            produced[image_id] = true;
+
+            Region image = regions[r];
+            image.chart = (Variable::var_type)(image_id / regions_per_chart);
+            for (int corner = 0; corner < 8; corner++)
+                image.corners[corner] = symmetry.g.apply(regions[r].corners[corner]);
+
+            for (int level = 0; level < image.level_count; level++)
+            {
+                std::vector<Vector4>& level_vertices = (level == 0) ? vertices : lod_vertices;
+                std::vector<Vector4>& level_gradients = (level == 0) ? gradients : lod_gradients;
+
+                int first = regions[r].levels[level].first_vertex;
+                int count = regions[r].levels[level].vertex_count;
+                image.levels[level].first_vertex = level_vertices.size();
+                for (int n = first; n < first + count; n++)
+                {
+                    level_vertices.push_back(symmetry.g.apply(level_vertices[n]));
+                    level_gradients.push_back((float)symmetry.parity*symmetry.g.apply(level_gradients[n]));
+                }
+            }
+
+            // A symmetry that negates f swaps which corners of the debug cubes count as positive.
+            for (int n = first_debug_vertex[r]; n < first_debug_vertex[r + 1]; n++)
+            {
+                debug_vertices.push_back(symmetry.g.apply(debug_vertices[n]));
+                Vector3 color = debug_colors[n];
+                debug_colors.push_back(symmetry.parity > 0 ? color : Vector3(color.y, color.x, color.z));
+            }
+
+            regions.push_back(image);
+        }
+    }
+}
+
+void FunctionMesh::FunctionMeshTreeLeaf::GetRegions(int region_depth, std::vector<FunctionMeshTree*>* regions_out)
+{
+    regions_out->push_back(this);
+}
+
+void FunctionMesh::FunctionMeshTreeNode::GetRegions(int region_depth, std::vector<FunctionMeshTree*>* regions_out)
+{
+    if (depth >= region_depth)
+    {
+        regions_out->push_back(this);
+        return;
+    }
+
+    for (int i = 0; i < descendents.size(); i++)
+    {
+        if (descendents[i] != 0)
+        {
+            descendents[i]->GetRegions(region_depth, regions_out);
+        }
+    }
+}
+
 void FunctionMesh::FunctionMeshTreeLeaf::GetMeshData(std::vector<Vector4> *vertices_out, std::vector<Vector4>* gradient_out, std::vector<Vector4>* debug_vertices_out, std::vector<Vector3>* debug_colors_out)
 {
     vertices_out->insert(vertices_out->end(), vertex_data.cbegin(), vertex_data.cend());
@@ -163,19 +886,29 @@ FunctionMesh::FunctionMeshTreeNode::FunctionMeshTreeNode(FunctionMesh* mesh, int
   : FunctionMeshTree(mesh, largest_var)
 {
     is_leaf = false;
+    this->depth = depth;
+    this->min = min;
+    this->max = max;
 
     int res = ((depth == 1) ? initial_branch_factor : branch_factor);
 
     float step_length = (max.x - min.x)/res;
 
+    int bits = (depth_to_compute >= mesh->min_sign_field_depth) ? sign_field_leaf_bits : leaf_bits;
+
     // Decide whether to recurse in each cell.
     for (int i = 0; i < res; i++)
     {   for (int j = 0; j < res; j++)
         {   for (int k = 0; k < res; k++)
             {
+                // Regions outside the fundamental domain are copied from their representatives afterwards.
+                if (depth + 1 == mesh->region_depth
+                    && !mesh->region_meshed[mesh->RegionId(largest_var, min + Vector3(step_length*i, step_length*j, step_length*k))])
+                    continue;
+
                 FunctionMeshTree* new_tree;
-                if (depth + 1 == depth_to_compute)
-                    new_tree = new FunctionMeshTreeLeaf(mesh, depth+1, largest_var,
+                if (depth_to_compute - depth <= bits)
+                    new_tree = new FunctionMeshTreeLeaf(mesh, depth+1, 1 << (depth_to_compute - depth), largest_var,
                                                                    min + Vector3(step_length*i, step_length*j, step_length*k),
                                                                    min + Vector3(step_length*(i+1), step_length*(j+1), step_length*(k+1)));
                 else
@@ -204,10 +937,22 @@ FunctionMesh::FunctionMeshTreeNode::~FunctionMeshTreeNode()
     }
 }
 
-FunctionMesh::FunctionMeshTreeLeaf::FunctionMeshTreeLeaf(FunctionMesh* mesh, int depth, Variable::var_type largest_var, Vector3 min, Vector3 max)
+// Function coordinates of the chart point e4 + c1*e1 + c2*e2 + c3*e3, in double precision for EdgeSolver.
+static void ChartPoint(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                       double c1, double c2, double c3, double point_out[4])
+{
+    for (int n = 0; n < 4; n++)
+        point_out[n] = e4[n] + c1*e1[n] + c2*e2[n] + c3*e3[n];
+}
+
+FunctionMesh::FunctionMeshTreeLeaf::FunctionMeshTreeLeaf(FunctionMesh* mesh, int depth, int res, Variable::var_type largest_var, Vector3 min, Vector3 max,
+                                                         bool refine_hidden_crossings)
     : FunctionMeshTree(mesh, largest_var)
 {
     is_leaf = true;
+    this->depth = depth;
+    this->min = min;
+    this->max = max;
 
     // min, max are in generating coordinates
     // e1, e2, e3, x1, x2, x3 are in function coordinates.
@@ -221,602 +966,398 @@ FunctionMesh::FunctionMeshTreeLeaf::FunctionMeshTreeLeaf(FunctionMesh* mesh, int
     Vector4 e3;
     Vector4 e4;
 
-    switch (largest_var)
+    GetChartBasis(largest_var, &e1, &e2, &e3, &e4);
+
+    double step_length = (max.x - min.x)/res;
+
+    // Chart coordinates of the lattice planes along each axis.
+    std::vector<double> x1(res + 1);
+    std::vector<double> x2(res + 1);
+    std::vector<double> x3(res + 1);
+    for (int n = 0; n < res + 1; n++)
     {
-    case Variable::VAR_X:
-        e1 = Vector4(0,1,0,0);
-        e2 = Vector4(0,0,1,0);
-        e3 = Vector4(0,0,0,1);
-        e4 = Vector4(1,0,0,0);
-        break;
-    case Variable::VAR_Y:
-        e1 = Vector4(1,0,0,0);
-        e2 = Vector4(0,0,1,0);
-        e3 = Vector4(0,0,0,1);
-        e4 = Vector4(0,1,0,0);
-        break;
-    case Variable::VAR_Z:
-        e1 = Vector4(1,0,0,0);
-        e2 = Vector4(0,1,0,0);
-        e3 = Vector4(0,0,0,1);
-        e4 = Vector4(0,0,1,0);
-        break;
-    case Variable::VAR_W:
-        e1 = Vector4(1,0,0,0);
-        e2 = Vector4(0,1,0,0);
-        e3 = Vector4(0,0,1,0);
-        e4 = Vector4(0,0,0,1);
-        break;
+        x1[n] = mesh->ChartCoordinate(min.x + step_length*n);
+        x2[n] = mesh->ChartCoordinate(min.y + step_length*n);
+        x3[n] = mesh->ChartCoordinate(min.z + step_length*n);
     }
 
-    int res = (depth == 0 ? initial_branch_factor : branch_factor);
+    if (res > max_row_cells)
+    {
+        MeshSignField(res, x1, x2, x3, e1, e2, e3, e4);
+        is_empty = vertex_data.empty();
+        return;
+    }
 
-    double step_length = (max.x - min.x)/res;
-    Vector4 x1_step = step_length*e1;
-    Vector4 x2_step = step_length*e2;
-    Vector4 x3_step = step_length*e3;
-    Vector4 function_coords_min = min.x*e1 + min.y*e2 + min.z*e3 + e4;
+    const int row = res + 1;
 
     // Pre-compute values on the grid we're responsible for...
-    double* value_array = new double[(res+1)*(res+1)*(res+1)];
+    std::vector<double> value_array(row*row*row);
+    mesh->lattice_evaluator->Evaluate(e1, e2, e3, e4, x1, x2, x3, value_array.data());
 
+    // ...and the signs of each row of it along k, one bit per value.
+    std::vector<unsigned int> sign_rows(row*row);
     for (int i = 0; i < res + 1; i++)
     {   for (int j = 0; j < res + 1; j++)
-        {   for (int k = 0; k < res + 1; k++)
+        {
+            sign_rows[i*row + j] = RowSignBits(&value_array[(i*row + j)*row], row);
+        }
+    }
+
+    // Cells with hidden crossings are left out below, and meshed finer at the end.
+    std::vector<unsigned int> refined_rows(res*res, 0);
+    if (refine_hidden_crossings && mesh->find_hidden_crossings && mesh->edge_solver != 0)
+        FindHiddenCrossings(res, x1, x2, x3, e1, e2, e3, e4, sign_rows, &refined_rows);
+
+    // Crossings found so far in this leaf. Each lattice edge is shared by up to four cells,
+    // so its crossing and gradient are computed by the first cell that needs them and
+    // looked up by the rest.
+    std::vector<Vector4> crossing_vertices;
+    std::vector<Vector4> crossing_gradients;
+
+    // Index into the crossings above of each edge of the current slab of cells (i to i+1), or -1
+    // if not computed yet, keyed by the edge's axis and lowest lattice point. Edges along j and k
+    // lie in one of the two planes bounding the slab; when moving to the next slab the upper plane
+    // becomes the lower one. Edges along i run between the planes and belong to one slab only.
+    std::vector<int> plane_edges[2] = { std::vector<int>(2*row*row, -1), std::vector<int>(2*row*row, -1) };
+    std::vector<int> slab_edges(row*row);
+
+    // Crossings first needed by one row of cells, kept as parallel arrays
+    // so the interpolation can run over all of them at once.
+    const int max_row_edges = max_row_cells*cell_edge_count;
+    double edge_start_values[max_row_edges];
+    double edge_end_values[max_row_edges];
+    double edge_t[max_row_edges];
+    int edge_k[max_row_edges];
+    int edge_number[max_row_edges];
+
+    // For each active cell in the row, the index of the crossing on each of its active edges.
+    int active_k[max_row_cells];
+    unsigned char active_flags[max_row_cells];
+    int edge_crossing[max_row_cells][cell_edge_count];
+
+    for (int i = 0; i < res; i++)
+    {
+        if (i > 0)
+        {
+            plane_edges[0].swap(plane_edges[1]);
+            std::fill(plane_edges[1].begin(), plane_edges[1].end(), -1);
+        }
+        std::fill(slab_edges.begin(), slab_edges.end(), -1);
+
+        for (int j = 0; j < res; j++)
+        {
+            unsigned int r00 = sign_rows[i*row + j];
+            unsigned int r01 = sign_rows[i*row + j + 1];
+            unsigned int r10 = sign_rows[(i+1)*row + j];
+            unsigned int r11 = sign_rows[(i+1)*row + j + 1];
+
+            // Cells whose corners all agree don't contain any surface; skip them all at once.
+            unsigned int active = ActiveCellBits(r00, r01, r10, r11, res) & ~refined_rows[i*res + j];
+            if (!active)
+                continue;
+
+            int first_new_crossing = (int)crossing_vertices.size();
+            int active_count = 0;
+            int edge_count = 0;
+            for (unsigned int remaining = active; remaining; remaining &= remaining - 1)
+            {
+                int k = LowestSetBit(remaining);
+                unsigned char flags = CellSignFlags(r00, r01, r10, r11, k);
+
+                active_k[active_count] = k;
+                active_flags[active_count] = flags;
+
+                for (int e = 0; e < cell_edge_count; e++)
+                {
+                    int start = cell_edge_start[e];
+                    int axis = cell_edge_axis[e];
+                    int end = start | (4 >> axis);
+                    if (!(((flags >> start) ^ (flags >> end)) & 1))
+                        continue;
+
+                    int plane_point = (j + ((start >> 1) & 1))*row + k + (start & 1);
+                    int& cached = (axis == 0) ? slab_edges[plane_point]
+                                              : plane_edges[start >> 2][(axis - 1)*row*row + plane_point];
+                    if (cached < 0)
+                    {
+                        cached = first_new_crossing + edge_count;
+                        edge_start_values[edge_count] = value_array[((i + (start >> 2))*row + j + ((start >> 1) & 1))*row + k + (start & 1)];
+                        edge_end_values[edge_count] = value_array[((i + (end >> 2))*row + j + ((end >> 1) & 1))*row + k + (end & 1)];
+                        edge_k[edge_count] = k;
+                        edge_number[edge_count] = e;
+                        edge_count++;
+                    }
+                    edge_crossing[active_count][e] = cached;
+                }
+                active_count++;
+            }
+
+            InterpolateCrossings(edge_start_values, edge_end_values, edge_t, edge_count);
+
+            for (int s = 0; s < edge_count; s++)
+            {
+                int e = edge_number[s];
+                int start = cell_edge_start[e];
+                int axis = cell_edge_axis[e];
+
+                // Edges start at the low end of their axis, so the edge runs from x[n] to x[n+1] there.
+                int ci = i + (start >> 2);
+                int cj = j + ((start >> 1) & 1);
+                int ck = edge_k[s] + (start & 1);
+                if (mesh->edge_solver != 0)
+                {
+                    double edge_start[4], edge_end[4];
+                    ChartPoint(e1, e2, e3, e4, x1[ci], x2[cj], x3[ck], edge_start);
+                    ChartPoint(e1, e2, e3, e4, x1[ci + (axis == 0)], x2[cj + (axis == 1)], x3[ck + (axis == 2)], edge_end);
+                    edge_t[s] = mesh->edge_solver->Crossing(edge_start, edge_end, edge_t[s]);
+                }
+                double c1 = x1[ci] + (axis == 0 ? edge_t[s]*(x1[ci + 1] - x1[ci]) : 0);
+                double c2 = x2[cj] + (axis == 1 ? edge_t[s]*(x2[cj + 1] - x2[cj]) : 0);
+                double c3 = x3[ck] + (axis == 2 ? edge_t[s]*(x3[ck + 1] - x3[ck]) : 0);
+
+                Vector4 v = e4 + c1*e1 + c2*e2 + c3*e3;
+                crossing_vertices.push_back(v);
+                crossing_gradients.push_back(Vector4(mesh->dfdx->eval(v), mesh->dfdy->eval(v), mesh->dfdz->eval(v), mesh->dfdw->eval(v)));
+            }
+
+            for (int c = 0; c < active_count; c++)
             {
-                value_array[i*(res+1)*(res+1) + j*(res+1) + k] = mesh->f_of_xyz->eval(function_coords_min + x1_step*i + x2_step*j + x3_step*k);
+                const CellCase& cell_case = GetCellCase(active_flags[c]);
+                for (int n = 0; n < cell_case.edge_count; n++)
+                {
+                    int s = edge_crossing[c][cell_case.edges[n]];
+                    vertex_data.push_back(crossing_vertices[s]);
+                    gradient_data.push_back(crossing_gradients[s]);
+                }
+
+                // Debug cube stuff: the edges of the cell, colored by the sign at each corner.
+                int k = active_k[c];
+                for (int e = 0; e < cell_edge_count; e++)
+                {
+                    int corners[2] = { cell_edge_start[e], cell_edge_start[e] | (4 >> cell_edge_axis[e]) };
+                    for (int n = 0; n < 2; n++)
+                    {
+                        int corner = corners[n];
+                        debug_vertices.push_back(e4 + x1[i + (corner >> 2)]*e1 + x2[j + ((corner >> 1) & 1)]*e2 + x3[k + (corner & 1)]*e3);
+                        debug_colors.push_back(((active_flags[c] >> corner) & 1) ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
+                    }
+                }
             }
         }
     }
 
-    // Decide whether to recurse in each cell.
+    // Each cell with a hidden crossing is meshed as a leaf of its own, fine enough to see the crossings
+    // as sign changes. Its neighbours stay coarse, so where the surface leaves it through a face there
+    // can be a crack, but hidden crossings are mostly small features wholly inside the refined cells.
+    int refined_res = 1 << mesh->hidden_crossing_refinement_bits;
     for (int i = 0; i < res; i++)
     {   for (int j = 0; j < res; j++)
-        {   for (int k = 0; k < res; k++)
+        {
+            for (unsigned int remaining = refined_rows[i*res + j]; remaining; remaining &= remaining - 1)
+            {
+                int k = LowestSetBit(remaining);
+                Vector3 cell_min = min + Vector3(step_length*i, step_length*j, step_length*k);
+                Vector3 cell_max = cell_min + Vector3(step_length, step_length, step_length);
+
+                FunctionMeshTreeLeaf cell(mesh, depth + mesh->hidden_crossing_refinement_bits, refined_res, largest_var,
+                                          cell_min, cell_max, false);
+                cell.GetMeshData(&vertex_data, &gradient_data, &debug_vertices, &debug_colors);
+            }
+        }
+    }
+
+    is_empty = vertex_data.empty();
+}
+
+void FunctionMesh::FunctionMeshTreeLeaf::FindHiddenCrossings(int res, const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                                                             const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                                             const std::vector<unsigned int>& sign_rows, std::vector<unsigned int>* refined_rows_out)
+{
+    const int row = res + 1;
+
+    for (int i = 0; i < row; i++)
+    {   for (int j = 0; j < row; j++)
+        {   for (int k = 0; k < row; k++)
             {
-                // v for value
-                double v000 = value_array[(res+1)*(res+1)*i    + (res+1)*j    + k];
-                double v100 = value_array[(res+1)*(res+1)*(i+1)+ (res+1)*j    + k];
-                double v010 = value_array[(res+1)*(res+1)*i    + (res+1)*(j+1)+ k];
-                double v110 = value_array[(res+1)*(res+1)*(i+1)+ (res+1)*(j+1)+ k];
-                double v001 = value_array[(res+1)*(res+1)*i    + (res+1)*j    + k + 1];
-                double v101 = value_array[(res+1)*(res+1)*(i+1)+ (res+1)*j    + k + 1];
-                double v011 = value_array[(res+1)*(res+1)*i    + (res+1)*(j+1)+ k + 1];
-                double v111 = value_array[(res+1)*(res+1)*(i+1)+ (res+1)*(j+1)+ k + 1];
-
-                Vector4 pos = function_coords_min + i*x1_step + j*x2_step + k*x3_step;
-
-                // p for positive
-                char p000 = v000 >= 0;
-                char p001 = v001 >= 0;
-                char p010 = v010 >= 0;
-                char p011 = v011 >= 0;
-                char p100 = v100 >= 0;
-                char p101 = v101 >= 0;
-                char p110 = v110 >= 0;
-                char p111 = v111 >= 0;
-
-                // e for edge.
-                char e000_001 = p000 ^ p001; char e000_010 = p000 ^ p010; char e000_100 = p000 ^ p100;
-                char e011_010 = p011 ^ p010; char e011_001 = p011 ^ p001; char e011_111 = p011 ^ p111;
-                char e101_100 = p101 ^ p100; char e101_111 = p101 ^ p111; char e101_001 = p101 ^ p001;
-                char e110_111 = p110 ^ p111; char e110_100 = p110 ^ p100; char e110_010 = p110 ^ p010;
-
-                // EI for edge index.
-                const int EI000_001 = 0;
-                const int EI000_010 = 1;
-                const int EI000_100 = 2;
-                const int EI011_010 = 3;
-                const int EI011_001 = 4;
-                const int EI011_111 = 5;
-                const int EI101_100 = 6;
-                const int EI101_111 = 7;
-                const int EI101_001 = 8;
-                const int EI110_111 = 9;
-                const int EI110_100 = 10;
-                const int EI110_010 = 11;
-
-                const int EI001_000 = EI000_001;
-                const int EI010_000 = EI000_010;
-                const int EI100_000 = EI000_100;
-                const int EI010_011 = EI011_010;
-                const int EI001_011 = EI011_001;
-                const int EI111_011 = EI011_111;
-                const int EI100_101 = EI101_100;
-                const int EI111_101 = EI101_111;
-                const int EI001_101 = EI101_001;
-                const int EI111_110 = EI110_111;
-                const int EI100_110 = EI110_100;
-                const int EI010_110 = EI110_010;
-
-                // M for bitMask.
-                const char M000 = 1;
-                const char M001 = 1 << 1;
-                const char M010 = 1 << 2;
-                const char M011 = 1 << 3;
-                const char M100 = 1 << 4;
-                const char M101 = 1 << 5;
-                const char M110 = 1 << 6;
-                const char M111 = 1 << 7;
-
-                // ev for edge vertices. Only active edges are filled; the rest is uninitialized.
-                Vector4 ev[12];
-
-                if (e000_001) ev[EI000_001] = pos + (-v000)/(v001 - v000)*x3_step;
-                if (e000_010) ev[EI000_010] = pos + (-v000)/(v010 - v000)*x2_step;
-                if (e000_100) ev[EI000_100] = pos + (-v000)/(v100 - v000)*x1_step;
-                if (e011_010) ev[EI011_010] = pos + x2_step + (-v010)/(v011 - v010)*x3_step;
-                if (e011_001) ev[EI011_001] = pos + (-v001)/(v011 - v001)*x2_step + x3_step;
-                if (e011_111) ev[EI011_111] = pos + (-v011)/(v111 - v011)*x1_step + x2_step + x3_step;
-                if (e101_100) ev[EI101_100] = pos + x1_step + (-v100)/(v101 - v100)*x3_step;
-                if (e101_111) ev[EI101_111] = pos + x1_step + (-v101)/(v111 - v101)*x2_step + x3_step;
-                if (e101_001) ev[EI101_001] = pos + (-v001)/(v101 - v001)*x1_step + x3_step;
-                if (e110_111) ev[EI110_111] = pos + x1_step + x2_step + (-v110)/(v111 - v110)*x3_step;
-                if (e110_100) ev[EI110_100] = pos + x1_step + (-v100)/(v110 - v100)*x2_step;
-                if (e110_010) ev[EI110_010] = pos + (-v010)/(v110 - v010)*x1_step + x2_step;
-
-                char flags = p000*M000 | p001*M001 | p010*M010 | p011*M011
-                           | p100*M100 | p101*M101 | p110*M110 | p111*M111;
-				if (p111)
-					flags = ~flags; // Removes some redundant cases;
-
-				// Debug cube stuff
-
-				// l for location
-				Vector4 l000 = function_coords_min + x1_step*i + x2_step*j + x3_step*k;
-				Vector4 l001 = function_coords_min + x1_step*i + x2_step*j + x3_step*(k+1);
-				Vector4 l010 = function_coords_min + x1_step*i + x2_step*(j+1) + x3_step*k;
-				Vector4 l011 = function_coords_min + x1_step*i + x2_step*(j+1) + x3_step*(k+1);
-				Vector4 l100 = function_coords_min + x1_step*(i+1) + x2_step*j + x3_step*k;
-				Vector4 l101 = function_coords_min + x1_step*(i+1) + x2_step*j + x3_step*(k+1);
-				Vector4 l110 = function_coords_min + x1_step*(i+1) + x2_step*(j+1) + x3_step*k;
-				Vector4 l111 = function_coords_min + x1_step*(i+1) + x2_step*(j+1) + x3_step*(k+1);
-
-				debug_vertices.push_back(l000);
-				debug_colors.push_back(p000 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l100);
-				debug_colors.push_back(p100 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l001);
-				debug_colors.push_back(p001 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l101);
-				debug_colors.push_back(p101 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l010);
-				debug_colors.push_back(p010 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l110);
-				debug_colors.push_back(p110 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l011);
-				debug_colors.push_back(p011 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l111);
-				debug_colors.push_back(p111 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l000);
-				debug_colors.push_back(p000 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l010);
-				debug_colors.push_back(p010 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l001);
-				debug_colors.push_back(p001 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l011);
-				debug_colors.push_back(p011 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l100);
-				debug_colors.push_back(p100 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l110);
-				debug_colors.push_back(p110 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l101);
-				debug_colors.push_back(p101 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l111);
-				debug_colors.push_back(p111 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l000);
-				debug_colors.push_back(p000 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l001);
-				debug_colors.push_back(p001 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l010);
-				debug_colors.push_back(p010 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l011);
-				debug_colors.push_back(p011 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l100);
-				debug_colors.push_back(p100 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l101);
-				debug_colors.push_back(p101 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-				debug_vertices.push_back(l110);
-				debug_colors.push_back(p110 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-				debug_vertices.push_back(l111);
-				debug_colors.push_back(p111 ? Vector3(0, 1, 0) : Vector3(1, 0, 0));
-
-
-#define ADD_VERTEX(v) \
-  { vertex_data.push_back(v); gradient_data.push_back(Vector4(mesh->dfdx->eval(v),mesh->dfdy->eval(v), mesh->dfdz->eval(v), mesh->dfdw->eval(v))); }
-
-// This got tedious to type out after a while below.
-#define ADD_TRIANGLE(a,b,c) \
-  { ADD_VERTEX(ev[EI##a]); ADD_VERTEX(ev[EI##b]); ADD_VERTEX(ev[EI##c]) }
-
-
-                switch (flags)
+                bool positive = (sign_rows[i*row + j] >> k) & 1;
+
+                double point[4];
+                ChartPoint(e1, e2, e3, e4, x1[i], x2[j], x3[k], point);
+
+                // The edges from this point up each axis.
+                for (int axis = 0; axis < 3; axis++)
                 {
-                // Case 0
-
-                case 0:
-                    // Empty cube!
-                    break;
-
-
-                // Case 1: Corner.
-                case M000:
-                    ADD_VERTEX(ev[EI000_001]);
-                    ADD_VERTEX(ev[EI000_010]);
-                    ADD_VERTEX(ev[EI000_100]);
-                    break;
-                case M001:
-                    ADD_VERTEX(ev[EI000_001]);
-                    ADD_VERTEX(ev[EI011_001]);
-                    ADD_VERTEX(ev[EI101_001]);
-                    break;
-                case M010:
-                    ADD_VERTEX(ev[EI011_010]);
-                    ADD_VERTEX(ev[EI000_010]);
-                    ADD_VERTEX(ev[EI110_010]);
-                    break;
-                case M011:
-                    ADD_VERTEX(ev[EI011_010]);
-                    ADD_VERTEX(ev[EI011_001]);
-                    ADD_VERTEX(ev[EI011_111]);
-                    break;
-                case M100:
-                    ADD_VERTEX(ev[EI000_100]);
-                    ADD_VERTEX(ev[EI110_100]);
-                    ADD_VERTEX(ev[EI101_100]);
-                    break;
-                case M101:
-                    ADD_VERTEX(ev[EI101_100]);
-                    ADD_VERTEX(ev[EI101_111]);
-                    ADD_VERTEX(ev[EI101_001]);
-                    break;
-                case M110:
-                    ADD_VERTEX(ev[EI110_111]);
-                    ADD_VERTEX(ev[EI110_100]);
-                    ADD_VERTEX(ev[EI110_010]);
-                    break;
-                case ~M111:
-                    ADD_VERTEX(ev[EI110_111]);
-                    ADD_VERTEX(ev[EI101_111]);
-                    ADD_VERTEX(ev[EI011_111]);
-                    break;
-
-                // Case 2: An edge.
-                case M000 | M001:
-                    ADD_VERTEX(ev[EI000_010]);
-                    ADD_VERTEX(ev[EI000_100]);
-                    ADD_VERTEX(ev[EI011_001]);
-
-                    ADD_VERTEX(ev[EI011_001]);
-                    ADD_VERTEX(ev[EI101_001]);
-                    ADD_VERTEX(ev[EI000_100]);
-                    break;
-
-                case M000 | M010:
-                    ADD_VERTEX(ev[EI000_001]);
-                    ADD_VERTEX(ev[EI000_100]);
-                    ADD_VERTEX(ev[EI011_010]);
-
-                    ADD_VERTEX(ev[EI011_010]);
-                    ADD_VERTEX(ev[EI110_010]);
-                    ADD_VERTEX(ev[EI000_100]);
-                    break;
-
-                case M000 | M100:
-                    ADD_VERTEX(ev[EI000_001]);
-                    ADD_VERTEX(ev[EI000_010]);
-                    ADD_VERTEX(ev[EI101_100]);
-
-                    ADD_VERTEX(ev[EI101_100]);
-                    ADD_VERTEX(ev[EI110_100]);
-                    ADD_VERTEX(ev[EI000_010]);
-                    break;
-
-                case M011 | M010:
-                    ADD_VERTEX(ev[EI011_001]);
-                    ADD_VERTEX(ev[EI011_111]);
-                    ADD_VERTEX(ev[EI000_010]);
-
-                    ADD_VERTEX(ev[EI000_010]);
-                    ADD_VERTEX(ev[EI110_010]);
-                    ADD_VERTEX(ev[EI011_111]);
-                    break;
-
-                case M011 | M001:
-                    ADD_VERTEX(ev[EI011_111]);
-                    ADD_VERTEX(ev[EI011_010]);
-                    ADD_VERTEX(ev[EI101_001]);
-
-                    ADD_VERTEX(ev[EI101_001]);
-                    ADD_VERTEX(ev[EI000_001]);
-                    ADD_VERTEX(ev[EI011_010]);
-                    break;
-
-                case ~(M011 | M111):
-                    ADD_VERTEX(ev[EI011_001]);
-                    ADD_VERTEX(ev[EI011_010]);
-                    ADD_VERTEX(ev[EI101_111]);
-
-                    ADD_VERTEX(ev[EI101_111]);
-                    ADD_VERTEX(ev[EI110_111]);
-                    ADD_VERTEX(ev[EI011_010]);
-                    break;
-
-                case M101 | M100:
-                    ADD_VERTEX(ev[EI101_111]);
-                    ADD_VERTEX(ev[EI101_001]);
-                    ADD_VERTEX(ev[EI110_100]);
-
-                    ADD_VERTEX(ev[EI110_100]);
-                    ADD_VERTEX(ev[EI000_100]);
-                    ADD_VERTEX(ev[EI101_001]);
-                    break;
-
-                case ~(M101 | M111):
-                    ADD_VERTEX(ev[EI101_001]);
-                    ADD_VERTEX(ev[EI101_100]);
-                    ADD_VERTEX(ev[EI011_111]);
-
-                    ADD_VERTEX(ev[EI011_111]);
-                    ADD_VERTEX(ev[EI110_111]);
-                    ADD_VERTEX(ev[EI101_100]);
-                    break;
-
-                case M101 | M001:
-                    ADD_VERTEX(ev[EI101_111]);
-                    ADD_VERTEX(ev[EI101_100]);
-                    ADD_VERTEX(ev[EI011_001]);
-
-                    ADD_VERTEX(ev[EI011_001]);
-                    ADD_VERTEX(ev[EI000_001]);
-                    ADD_VERTEX(ev[EI101_100]);
-                    break;
-
-                case ~(M110 | M111):
-                    ADD_VERTEX(ev[EI110_010]);
-                    ADD_VERTEX(ev[EI110_100]);
-                    ADD_VERTEX(ev[EI011_111]);
-
-                    ADD_VERTEX(ev[EI011_111]);
-                    ADD_VERTEX(ev[EI101_111]);
-                    ADD_VERTEX(ev[EI110_100]);
-                    break;
-
-                case M110 | M100:
-                    ADD_VERTEX(ev[EI110_010]);
-                    ADD_VERTEX(ev[EI110_111]);
-                    ADD_VERTEX(ev[EI000_100]);
-
-                    ADD_VERTEX(ev[EI000_100]);
-                    ADD_VERTEX(ev[EI101_100]);
-                    ADD_VERTEX(ev[EI110_111]);
-                    break;
-
-                case M110 | M010:
-                    ADD_VERTEX(ev[EI110_100]);
-                    ADD_VERTEX(ev[EI110_111]);
-                    ADD_VERTEX(ev[EI000_010]);
-
-                    ADD_VERTEX(ev[EI000_010]);
-                    ADD_VERTEX(ev[EI011_010]);
-                    ADD_VERTEX(ev[EI110_111]);
-                    break;
-
-                // Case 5: 3 vertices on a common face
-
-                // Left face
-                case M000 | M001 | M010:
-                    ADD_TRIANGLE(000_100, 110_010, 101_001);
-                    ADD_TRIANGLE(110_010, 101_001, 011_010);
-                    ADD_TRIANGLE(101_001, 011_010, 011_001);
-                    break;
-
-                case M001 | M000 | M011:
-                    ADD_TRIANGLE(101_001, 000_100, 011_111);
-                    ADD_TRIANGLE(100_000, 011_111, 000_010);
-                    ADD_TRIANGLE(000_010, 011_010, 011_111);
-                    break;
-
-                case M011 | M010 | M001:
-                    ADD_TRIANGLE(011_111, 010_110, 001_101);
-                    ADD_TRIANGLE(010_110, 001_101, 010_000);
-                    ADD_TRIANGLE(010_000, 001_000, 001_101);
-                    break;
-
-                case M010 | M011 | M000:
-                    ADD_TRIANGLE(010_110, 011_111, 000_100);
-                    ADD_TRIANGLE(011_111, 000_100, 011_001);
-                    ADD_TRIANGLE(011_001, 000_001, 000_100);
-                    break;
-
-                // Right face
-                case M100 | M110 | M101:
-                    ADD_TRIANGLE(100_000, 110_010, 101_001);
-                    ADD_TRIANGLE(110_010, 101_001, 101_111);
-                    ADD_TRIANGLE(101_111, 110_111, 110_010);
-                    break;
-
-                case ~(M100 | M101 | M111):
-                    ADD_TRIANGLE(101_001, 111_011, 100_000);
-                    ADD_TRIANGLE(111_011, 100_000, 100_110);
-                    ADD_TRIANGLE(100_110, 111_110, 111_011);
-                    break;
-
-                case ~(M111 | M110 | M101):
-                    ADD_TRIANGLE(111_011, 110_010, 101_001);
-                    ADD_TRIANGLE(110_010, 101_001, 101_100);
-                    ADD_TRIANGLE(101_100, 110_100, 110_010);
-                    break;
-
-                case ~(M110 | M111 | M100):
-                    ADD_TRIANGLE(110_010, 111_011, 100_000);
-                    ADD_TRIANGLE(111_011, 100_000, 111_101);
-                    ADD_TRIANGLE(111_101, 100_101, 100_000);
-                    break;
-
-                // Bottom face
-                case M000 | M001 | M100:
-                    ADD_TRIANGLE(000_010, 100_110, 001_011);
-                    ADD_TRIANGLE(100_110, 001_011, 100_101);
-                    ADD_TRIANGLE(100_101, 001_101, 001_011);
-                    break;
-
-                case M000 | M100 | M101:
-                    ADD_TRIANGLE(000_010, 100_110, 101_111);
-                    ADD_TRIANGLE(000_010, 101_111, 000_001);
-                    ADD_TRIANGLE(000_001, 101_001, 101_111);
-                    break;
-
-                case M100 | M101 | M001:
-                    ADD_TRIANGLE(100_110, 101_111, 001_011);
-                    ADD_TRIANGLE(100_110, 001_011, 001_000);
-                    ADD_TRIANGLE(001_000, 100_000, 100_110);
-                    break;
-
-                case M000 | M001 | M101:
-                    ADD_TRIANGLE(000_010, 001_011, 101_111);
-                    ADD_TRIANGLE(000_010, 101_111, 000_100);
-                    ADD_TRIANGLE(000_100, 100_101, 101_111);
-                    break;
-
-                // Top face
-                case M010 | M011 | M110:
-                    ADD_TRIANGLE(010_000, 001_011, 110_100);
-                    ADD_TRIANGLE(011_001, 110_100, 110_111);
-                    ADD_TRIANGLE(110_111, 011_111, 011_001);
-                    break;
-
-                case ~(M010 | M110 | M111):
-                    ADD_TRIANGLE(010_000, 110_100, 111_101);
-                    ADD_TRIANGLE(010_000, 111_101, 010_011);
-                    ADD_TRIANGLE(010_011, 011_111, 111_101);
-                    break;
-
-                case ~(M110 | M111 | M011):
-                    ADD_TRIANGLE(110_100, 111_101, 011_001);
-                    ADD_TRIANGLE(110_100, 011_001, 011_010);
-                    ADD_TRIANGLE(011_010, 110_010, 110_100);
-                    break;
-
-                case ~(M010 | M011 | M111):
-                    ADD_TRIANGLE(010_000, 011_001, 111_101);
-                    ADD_TRIANGLE(010_000, 111_101, 111_110);
-                    ADD_TRIANGLE(111_110, 010_110, 010_000);
-                    break;
-
-                // Front face
-                case M000 | M100 | M010:
-                    ADD_TRIANGLE(000_001, 100_101, 010_011);
-                    ADD_TRIANGLE(100_101, 010_011, 010_110);
-                    ADD_TRIANGLE(010_110, 100_110, 100_101);
-                    break;
-
-                case M000 | M100 | M110:
-                    ADD_TRIANGLE(000_001, 100_101, 110_111);
-                    ADD_TRIANGLE(000_001, 110_111, 110_010);
-                    ADD_TRIANGLE(110_010, 000_010, 000_001);
-                    break;
-
-                case M100 | M110 | M010:
-                    ADD_TRIANGLE(100_101, 110_111, 010_011);
-                    ADD_TRIANGLE(100_101, 010_011, 010_000);
-                    ADD_TRIANGLE(010_000, 100_000, 100_101);
-                    break;
-
-                case M110 | M010 | M000:
-                    ADD_TRIANGLE(110_111, 010_011, 000_001);
-                    ADD_TRIANGLE(110_111, 000_001, 000_100);
-                    ADD_TRIANGLE(000_100, 110_100, 110_111);
-                    break;
-
-                // Back face
-                case M001 | M011 | M101:
-                    ADD_TRIANGLE(001_000, 011_010, 101_100);
-                    ADD_TRIANGLE(011_010, 101_100, 101_111);
-                    ADD_TRIANGLE(101_111, 011_111, 011_010);
-                    break;
-
-                case ~(M001 | M101 | M111):
-                    ADD_TRIANGLE(001_000, 101_100, 111_110);
-                    ADD_TRIANGLE(001_000, 111_110, 111_011);
-                    ADD_TRIANGLE(111_011, 001_011, 001_000);
-                    break;
-
-                case ~(M101 | M111 | M011):
-                    ADD_TRIANGLE(111_110, 011_010, 101_100);
-                    ADD_TRIANGLE(011_010, 101_100, 101_001);
-                    ADD_TRIANGLE(101_001, 011_001, 011_010);
-                    break;
-
-                case ~(M111 | M011 | M001):
-                    ADD_TRIANGLE(111_110, 011_010, 001_000);
-                    ADD_TRIANGLE(111_110, 001_000, 001_101);
-                    ADD_TRIANGLE(001_101, 111_101, 111_110);
-                    break;
-
-                // Case 8: a whole face is positive.
-                case M000 | M001 | M011 | M010:
-                    ADD_TRIANGLE(000_100, 010_110, 011_111);
-                    ADD_TRIANGLE(000_100, 001_101, 011_111);
-                    break;
-
-                case M000 | M100 | M110 | M010:
-                    ADD_TRIANGLE(000_001, 100_101, 110_111);
-                    ADD_TRIANGLE(000_001, 110_111, 010_011);
-                    break;
-
-                case M000 | M100 | M101 | M001:
-                    ADD_TRIANGLE(000_010, 100_110, 101_111);
-                    ADD_TRIANGLE(000_010, 101_111, 001_011);
-                    break;
-
-                // Case 9: A corner and 3 adjacent edges.
-                case M001 | M011 | M000 | M101:
-                    ADD_TRIANGLE(011_111, 011_010, 010_000);
-                    ADD_TRIANGLE(000_010, 011_111, 000_100);
-                    ADD_TRIANGLE(011_111, 000_100, 101_111);
-                    ADD_TRIANGLE(000_100, 111_101, 100_101);
-                    break;
-
-                case M000 | M100 | M010 | M001:
-					ADD_TRIANGLE(011_010, 010_110, 011_001);
-					ADD_TRIANGLE(011_001, 010_110, 001_101);
-					ADD_TRIANGLE(001_101, 010_110, 110_100);
-					ADD_TRIANGLE(110_100, 100_101, 101_001);
-                    break;
-
-                case M010 | M000 | M011 | M110:
-					ADD_TRIANGLE(100_110, 110_111, 100_000);
-					ADD_TRIANGLE(100_000, 110_111, 000_001);
-					ADD_TRIANGLE(000_001, 110_111, 111_011);
-					ADD_TRIANGLE(111_011, 011_001, 001_000);
-                    break;
-
-                case M100 | M000 | M110 | M101:
-                    ADD_TRIANGLE(110_111, 111_101, 110_010);
-					ADD_TRIANGLE(010_110, 111_101, 001_101);
-					ADD_TRIANGLE(010_110, 001_101, 000_010);
-					ADD_TRIANGLE(000_010, 101_001, 001_000);
-                    break;
+                    int ni = i + (axis == 0);
+                    int nj = j + (axis == 1);
+                    int nk = k + (axis == 2);
+                    if (ni == row || nj == row || nk == row)
+                        continue;
+
+                    // Edges whose ends differ already have a crossing the cells around them will find.
+                    if ((((sign_rows[ni*row + nj] >> nk) & 1) != 0) != positive)
+                        continue;
+
+                    double next[4];
+                    ChartPoint(e1, e2, e3, e4, x1[ni], x2[nj], x3[nk], next);
+                    if (!mesh->edge_solver->HasHiddenCrossing(point, next))
+                        continue;
+
+                    // Mark the up to four cells around the edge, which are offset by 0 or -1 along the other two axes.
+                    for (int around = 0; around < 4; around++)
+                    {
+                        int ci = i - ((axis != 0) ? (around & 1) : 0);
+                        int cj = j - ((axis == 0) ? (around & 1) : (axis == 2) ? (around >> 1) : 0);
+                        int ck = k - ((axis != 2) ? (around >> 1) : 0);
+                        if (ci < 0 || cj < 0 || ck < 0 || ci == res || cj == res || ck == res)
+                            continue;
+                        (*refined_rows_out)[ci*res + cj] |= 1u << ck;
+                    }
                 }
             }
         }
     }
+}
+
+void FunctionMesh::FunctionMeshTreeLeaf::MeshSignField(int res, const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                                                       const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4)
+{
+    const int row = res + 1;
+
+    SignField signs(row);
+    std::vector<double> row_values(row);
+    for (int i = 0; i < row; i++)
+    {   for (int j = 0; j < row; j++)
+        {
+            mesh->lattice_evaluator->EvaluateRow(e1, e2, e3, e4, x1[i], x2[j], x3.data(), row, row_values.data());
+            for (int k = 0; k < row; k++)
+            {
+                if (row_values[k] >= 0)
+                    signs.SetPositive(i, j, k);
+            }
+        }
+    }
 
-    is_empty = vertex_data.empty();
+    // Values of f along rows with crossed edges, and the crossings themselves, keyed by lattice point
+    // (and the axis of the edge starting there). Rows are evaluated again whole, just as they were for
+    // the signs, so a value near 0 can't come out with a different sign than its bit.
+    std::unordered_map<int, std::vector<double> > crossed_rows;
+    std::unordered_map<int, int> edge_crossings;
+    auto point_value = [&](int i, int j, int k) -> double
+    {
+        std::unordered_map<int, std::vector<double> >::iterator it = crossed_rows.find(i*row + j);
+        if (it == crossed_rows.end())
+        {
+            it = crossed_rows.insert(std::make_pair(i*row + j, std::vector<double>(row))).first;
+            mesh->lattice_evaluator->EvaluateRow(e1, e2, e3, e4, x1[i], x2[j], x3.data(), row, it->second.data());
+        }
+        return it->second[k];
+    };
+
+    std::vector<Vector4> crossing_vertices;
+    std::vector<Vector4> crossing_gradients;
+
+    // As in the row-at-a-time path, but a brick of 4^3 cells at a time.
+    const int brick_cells = 64;
+    const int max_brick_edges = brick_cells*cell_edge_count;
+    double edge_start_values[max_brick_edges];
+    double edge_end_values[max_brick_edges];
+    double edge_t[max_brick_edges];
+    int edge_point[max_brick_edges][3];
+    int edge_axis[max_brick_edges];
+
+    unsigned char active_flags[brick_cells];
+    int edge_crossing[brick_cells][cell_edge_count];
+
+    int bricks = signs.GetBricksPerAxis();
+    for (int bi = 0; bi < bricks; bi++)
+    {   for (int bj = 0; bj < bricks; bj++)
+        {   for (int bk = 0; bk < bricks; bk++)
+            {
+                unsigned long long corners[8];
+                unsigned long long active = signs.ClassifyBrick(bi, bj, bk, corners);
+                if (!active)
+                    continue;
+
+                int first_new_crossing = (int)crossing_vertices.size();
+                int active_count = 0;
+                int edge_count = 0;
+                for (unsigned long long remaining = active; remaining; remaining &= remaining - 1)
+                {
+                    int b = LowestSetBit(remaining);
+                    int i = 4*bi + (b >> 4);
+                    int j = 4*bj + ((b >> 2) & 3);
+                    int k = 4*bk + (b & 3);
+
+                    unsigned char flags = 0;
+                    for (int c = 0; c < 8; c++)
+                        flags |= ((corners[c] >> b) & 1) << c;
+                    active_flags[active_count] = flags;
+
+                    for (int e = 0; e < cell_edge_count; e++)
+                    {
+                        int start = cell_edge_start[e];
+                        int axis = cell_edge_axis[e];
+                        int end = start | (4 >> axis);
+                        if (!(((flags >> start) ^ (flags >> end)) & 1))
+                            continue;
+
+                        int si = i + (start >> 2);
+                        int sj = j + ((start >> 1) & 1);
+                        int sk = k + (start & 1);
+                        std::pair<std::unordered_map<int, int>::iterator, bool> inserted =
+                            edge_crossings.insert(std::make_pair(((si*row + sj)*row + sk)*3 + axis, first_new_crossing + edge_count));
+                        if (inserted.second)
+                        {
+                            edge_start_values[edge_count] = point_value(si, sj, sk);
+                            edge_end_values[edge_count] = point_value(i + (end >> 2), j + ((end >> 1) & 1), k + (end & 1));
+                            edge_point[edge_count][0] = si;
+                            edge_point[edge_count][1] = sj;
+                            edge_point[edge_count][2] = sk;
+                            edge_axis[edge_count] = axis;
+                            edge_count++;
+                        }
+                        edge_crossing[active_count][e] = inserted.first->second;
+                    }
+                    active_count++;
+                }
+
+                InterpolateCrossings(edge_start_values, edge_end_values, edge_t, edge_count);
+
+                for (int s = 0; s < edge_count; s++)
+                {
+                    int ci = edge_point[s][0];
+                    int cj = edge_point[s][1];
+                    int ck = edge_point[s][2];
+                    int axis = edge_axis[s];
+                    if (mesh->edge_solver != 0)
+                    {
+                        double edge_start[4], edge_end[4];
+                        ChartPoint(e1, e2, e3, e4, x1[ci], x2[cj], x3[ck], edge_start);
+                        ChartPoint(e1, e2, e3, e4, x1[ci + (axis == 0)], x2[cj + (axis == 1)], x3[ck + (axis == 2)], edge_end);
+                        edge_t[s] = mesh->edge_solver->Crossing(edge_start, edge_end, edge_t[s]);
+                    }
+                    double c1 = x1[ci] + (axis == 0 ? edge_t[s]*(x1[ci + 1] - x1[ci]) : 0);
+                    double c2 = x2[cj] + (axis == 1 ? edge_t[s]*(x2[cj + 1] - x2[cj]) : 0);
+                    double c3 = x3[ck] + (axis == 2 ? edge_t[s]*(x3[ck + 1] - x3[ck]) : 0);
+
+                    Vector4 v = e4 + c1*e1 + c2*e2 + c3*e3;
+                    crossing_vertices.push_back(v);
+                    crossing_gradients.push_back(Vector4(mesh->dfdx->eval(v), mesh->dfdy->eval(v), mesh->dfdz->eval(v), mesh->dfdw->eval(v)));
+                }
 
-    delete value_array;
+                for (int c = 0; c < active_count; c++)
+                {
+                    const CellCase& cell_case = GetCellCase(active_flags[c]);
+                    for (int n = 0; n < cell_case.edge_count; n++)
+                    {
+                        int s = edge_crossing[c][cell_case.edges[n]];
+                        vertex_data.push_back(crossing_vertices[s]);
+                        gradient_data.push_back(crossing_gradients[s]);
+                    }
+                }
+            }
+        }
+    }
 }
 
 FunctionMesh::FunctionMeshTree::FunctionMeshTree(FunctionMesh *mesh, Variable::var_type largest_var)
@@ -5,26 +5,207 @@
 
 #include "term.h"
 #include "variable.h"
+#include "symmetry.h"
+#include "edgesolver.h"
+#include "latticeevaluator.h"
 #include "shared/Vectors.h"
 
+// Limits on the size and build time of a mesh. A limit of 0 means no limit.
+// If no limit is set, every chart is built at FunctionMesh's default depth.
+struct MeshBudget
+{
+    MeshBudget(int max_triangles = 0, double max_milliseconds = 0)
+        : max_triangles(max_triangles), max_milliseconds(max_milliseconds) {}
+
+    bool IsLimited() const { return max_triangles > 0 || max_milliseconds > 0; }
+
+    int max_triangles;
+    double max_milliseconds;
+};
+
+// How the lattice of each chart is laid out. With SAMPLING_CUBE, lattice points are evenly spaced
+// in the chart's affine coordinates, so cells near the corners of a chart cover a much smaller
+// angle of projective space than cells at its center. SAMPLING_EQUIANGULAR spaces them evenly in
+// angle along each axis instead (the chart coordinate is tan(u*pi/4) for u evenly spaced in [-1,1]),
+// which makes cells far more uniform in size and shrinks the largest cells, the ones that
+// limit quality, at the same depth.
+enum ChartSampling
+{
+    SAMPLING_CUBE,
+    SAMPLING_EQUIANGULAR
+};
+
+class MeshCoordinator;
+
 class FunctionMesh
 {
 public:
-    FunctionMesh(Term* f_of_xyz);
+    // With use_symmetry, signed permutations of (x,y,z,w) that map the surface to itself are
+    // found first, and only one region of each orbit of the group is meshed; see FindFundamentalRegions.
+    // With a coordinator, the regions are meshed by its worker processes instead of a thread per
+    // chart, as long as f is a polynomial with integer coefficients and every chart is deep enough.
+    // With find_hidden_crossings, cells with an edge the surface crosses without changing the sign
+    // at its ends are meshed finer; see EdgeSolver. Depths are chosen without counting the search.
+    FunctionMesh(Term* f_of_xyz, const MeshBudget& budget = MeshBudget(), ChartSampling sampling = SAMPLING_CUBE,
+                 bool use_symmetry = true, MeshCoordinator* coordinator = 0, bool find_hidden_crossings = false);
+
+    // Loads a mesh written by StreamMeshToFile; see meshstream.h. f_of_xyz is the function it was made
+    // from, which the lens needs. If the file can't be read, or its mesh is too big to hold in memory
+    // (see StreamedMeshFitsInMemory), the mesh is left empty, and load_failed set.
+    FunctionMesh(Term* f_of_xyz, const char* streamed_mesh_path);
+
+    // Sets up f without meshing anything, for building regions one at a time with MeshRegion.
+    FunctionMesh(Term* f_of_xyz, ChartSampling sampling, bool find_hidden_crossings = false);
 
     virtual ~FunctionMesh();
 
     class FunctionMeshTree;
 
+    // Each chart is cut into regions, and each region is meshed at up to max_lod_levels levels of
+    // detail so the renderer can choose one per region. Level 0 is the full-depth mesh, which is the
+    // region's part of vertices/gradients. Every following level halves the resolution and lives in
+    // lod_vertices/lod_gradients. Coarse levels reach one of their cells past the region on every
+    // side, so they overlap whatever level a neighbouring region is drawn at and leave no cracks.
+    static const int max_lod_levels = 3;
+
+    struct RegionLevel
+    {
+        int first_vertex;
+        int vertex_count;
+        int cells;              // Cells along each axis of the region at this level.
+    };
+
+    struct Region
+    {
+        Variable::var_type chart;
+        Vector4 corners[8];     // In function coordinates.
+        int level_count;
+        RegionLevel levels[max_lod_levels];
+    };
+
+    // Meshes the region [min, max] of a chart of the given depth at every level of detail, as the
+    // constructor would, appending level 0 to *vertices_out and the coarser levels to *lod_vertices_out.
+    // The region must be one of the chart's regions at region_depth. Makes no debug cubes.
+    void MeshRegion(Variable::var_type largest_var, Vector3 min, Vector3 max, int depth, Region* region_out,
+                    std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradients_out,
+                    std::vector<Vector4>* lod_vertices_out, std::vector<Vector4>* lod_gradients_out);
+
 private:
+    // Takes a simplified copy of f_of_xyz and its partial derivatives.
+    void SetFunction(Term* f_of_xyz);
+
     Term* f_of_xyz;
     Term* dfdx;
     Term* dfdy;
     Term* dfdz;
     Term* dfdw;
 
+    // f_of_xyz multiplied out, when it's a polynomial of at most EdgeSolver::max_degree. Set by
+    // SetFunction, so that everything wanting the monomials shares one expansion.
+    Polynomial f_expanded;
+    bool f_is_polynomial;
+
+    // Places crossings on lattice edges exactly, if f is a polynomial of low enough degree; otherwise
+    // they're interpolated linearly from the values at the ends of the edge. Set by SetFunction.
+    EdgeSolver* edge_solver;
+
+    // Evaluates f over the lattice of each leaf, and of the estimates. Set by SetFunction.
+    LatticeEvaluator* lattice_evaluator;
+
+    // Cells with a hidden crossing are cut into 2^hidden_crossing_refinement_bits cells along each axis.
+    bool find_hidden_crossings;
+    const int hidden_crossing_refinement_bits = 2;
+
     const int default_depth = 6;
+
+    ChartSampling sampling;
+
+    // Depth range considered when picking depths to meet a budget, and the depth
+    // of the lattice used by the pre-pass to estimate the cost of each chart.
+    const int min_budget_depth = 2;
+    const int max_budget_depth = 10;
+    const int estimate_depth = 4;
+
+    // Charts at least this deep are built from leaves that keep only the signs of f; see SignField.
+    const int min_sign_field_depth = 9;
+
+    // Depth actually used for each chart, indexed by Variable::var_type.
+    int chart_depth[4];
+
+    // What the pre-pass learned about one chart.
+    struct ChartEstimate
+    {
+        int surface_cells;       // Cells at estimate_depth with a sign change.
+        double eval_ms;          // Cost of one evaluation of f.
+        double gradient_ms;      // Cost of evaluating all four partial derivatives once.
+    };
+
+    void EstimateChart(Variable::var_type largest_var, ChartEstimate* estimate);
+    double EstimateTriangles(const ChartEstimate& estimate, int depth);
+    double EstimateMilliseconds(const ChartEstimate& estimate, int depth);
+    void ChooseChartDepths(const MeshBudget& budget);
+
+    // Tree depth at which the charts are cut into regions; a depth of 3 makes 4^3 regions per chart.
+    const int region_depth = 3;
+
+    // Fills in the chart and corners of the region [min, max].
+    void DescribeRegion(Variable::var_type largest_var, Vector3 min, Vector3 max, Region* region_out);
+
+    // Mesh the regions picked by region_meshed into vertices, gradients, regions and the lod vectors,
+    // recording each region's id and where its debug cubes start for ReplicateRegions.
+    void MeshChartsOnThreads(std::vector<int>* region_ids_out, std::vector<int>* first_debug_vertex_out);
+    // Returns false, having added nothing, if the regions can't be meshed by the coordinator's workers.
+    // Debug cubes aren't sent back by workers.
+    bool MeshRegionsOnWorkers(MeshCoordinator* coordinator, std::vector<int>* region_ids_out,
+                              std::vector<int>* first_debug_vertex_out);
+
+    // Meshes the coarser levels of detail of one region of a chart, appending them to *vertices_out
+    // and *gradients_out. Level 0 is left for the caller.
+    void MeshRegionLevels(Variable::var_type largest_var, Vector3 min, Vector3 max, int depth, Region* region,
+                          std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradients_out);
+
+    // Symmetries of the surface, starting with the identity. Only the identity if f couldn't be
+    // expanded into a polynomial or symmetry isn't in use.
+    std::vector<Symmetry> symmetries;
+
+    // Regions are numbered chart*64 + ri*16 + rj*4 + rk, (ri, rj, rk) being the region's position
+    // along each axis of the chart.
+    static const int regions_per_axis = 4;
+    static const int regions_per_chart = regions_per_axis*regions_per_axis*regions_per_axis;
+    int RegionId(Variable::var_type largest_var, const Vector3& min);
+    int MapRegion(int region_id, const SignedPermutation& g);
+
+    // Shallower trees have leaves bigger than a region, which can't be skipped one by one.
+    const int min_fundamental_depth = 5;
+
+    // Chooses one region of each orbit of the symmetry group to mesh. Representatives are spread
+    // over the charts as evenly as possible, as each chart is built on its own thread.
+    void FindFundamentalRegions();
+    // Appends the image of every meshed region under every symmetry, each image region once.
+    void ReplicateRegions(const std::vector<int>& region_ids, const std::vector<int>& first_debug_vertex);
+
+    bool use_fundamental_domain;
+    std::vector<bool> region_meshed;    // By region id.
+    int chart_meshed_regions[4];
+
+    // Charts that symmetries map onto each other must be built at the same depth, or the copies
+    // wouldn't line up with their neighbours; each chart's entry is the lowest chart it maps to.
+    int chart_orbit[4];
+
 public:
+    // Describes the regions of a chart's finished tree and meshes their coarser levels; see Region.
+    // Vertex ranges of the coarse levels are relative to the start of *vertices_out.
+    void MeshChartRegions(FunctionMeshTree* tree, Variable::var_type largest_var, int depth, std::vector<Region>* regions_out,
+                          std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradients_out);
+
+    // The tree, regions and lens lay out lattices evenly in generating coordinates, u in [-1,1] along
+    // each axis of a chart. These convert between those and the chart coordinates multiplying e1, e2, e3.
+    double ChartCoordinate(double u) const;
+    double GeneratingCoordinate(double chart_coordinate) const;
+    static double ChartCoordinate(ChartSampling sampling, double u);
+
+    // Chart coordinates: e4 is the variable fixed to 1, e1, e2, e3 the remaining ones.
+    static void GetChartBasis(Variable::var_type largest_var, Vector4* e1, Vector4* e2, Vector4* e3, Vector4* e4);
 
 	std::vector<Vector4> vertices;
 	std::vector<Vector4> gradients;
@@ -32,6 +213,12 @@ public:
 	std::vector<Vector4> debug_vertices;
 	std::vector<Vector3> debug_colors;
 
+    std::vector<Region> regions;
+    std::vector<Vector4> lod_vertices;
+    std::vector<Vector4> lod_gradients;
+
+    bool load_failed;
+
     class FunctionMeshTree
     {
     public:
@@ -42,10 +229,19 @@ public:
         // Those vertices are appended to *out.
         virtual void GetMeshData(std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradient_out, std::vector<Vector4>* debug_vertices_out, std::vector<Vector3>* debug_colors_out) = 0;
 
+        // Collects the subtrees making up the regions of the chart, in the order GetMeshData visits them:
+        // the nodes at region_depth, or leaves where the tree doesn't reach that deep.
+        virtual void GetRegions(int region_depth, std::vector<FunctionMeshTree*>* regions_out) = 0;
+
         bool IsEmpty() { return is_empty; }
+        int GetDepth() { return depth; }
+        Vector3 GetMin() { return min; }
+        Vector3 GetMax() { return max; }
     protected:
 
         int depth;
+        Vector3 min;
+        Vector3 max;
         bool is_leaf;
         bool is_empty;
 
@@ -56,6 +252,12 @@ public:
         // then subsequent layers of the tree branch by branch_factor in each dimension.
         const int initial_branch_factor = 2;
         const int branch_factor = 2;
+
+        // Leaves hold a block of 2^leaf_bits cells along each axis (fewer if the whole tree is
+        // shallower), which is classified a row at a time; see cellkernel.h. In charts of at least
+        // min_sign_field_depth, leaves are 2^sign_field_leaf_bits cells along each axis instead.
+        const int leaf_bits = 3;
+        const int sign_field_leaf_bits = 5;
     private:
 
 
@@ -65,11 +267,29 @@ public:
     class FunctionMeshTreeLeaf : public FunctionMeshTree
     {
     public:
-        FunctionMeshTreeLeaf(FunctionMesh* mesh, int depth, Variable::var_type largest_var, Vector3 min, Vector3 max);
+        // res is the number of cells along each axis of the block [min, max]. Leaves of more than
+        // max_row_cells cells along each axis are meshed from a SignField. Leaves made for the cells of
+        // another leaf that have hidden crossings are made with refine_hidden_crossings false, as the
+        // crossings of a surface tangent to an edge stay hidden however fine the cells.
+        FunctionMeshTreeLeaf(FunctionMesh* mesh, int depth, int res, Variable::var_type largest_var, Vector3 min, Vector3 max,
+                             bool refine_hidden_crossings = true);
         virtual ~FunctionMeshTreeLeaf() {}
 
         virtual void GetMeshData(std::vector<Vector4>* vertices_out, std::vector<Vector4> *gradient_out, std::vector<Vector4>* debug_vertices_out, std::vector<Vector3>* debug_colors_out);
+        virtual void GetRegions(int region_depth, std::vector<FunctionMeshTree*>* regions_out);
     private:
+        // Marks the cells of the lattice with planes x1, x2, x3 that have an edge with a hidden crossing,
+        // setting bit k of (*refined_rows_out)[i*res + j] for cell (i,j,k). sign_rows are as in the constructor.
+        void FindHiddenCrossings(int res, const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                                 const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                 const std::vector<unsigned int>& sign_rows, std::vector<unsigned int>* refined_rows_out);
+
+        // Meshes the lattice with planes x1, x2, x3 keeping only the signs of f at its points, and
+        // evaluates f again only at the ends of the edges the surface crosses. Makes no debug cubes,
+        // which at the depths this is for would take several times the memory of the mesh itself.
+        void MeshSignField(int res, const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                           const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4);
+
         // Flattened two-dimensional array of positions of vertices
         std::vector<Vector4> vertex_data;
         std::vector<Vector4> gradient_data;
@@ -86,6 +306,7 @@ public:
         virtual ~FunctionMeshTreeNode();
 
         virtual void GetMeshData(std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradient_out, std::vector<Vector4>* debug_vertices_out, std::vector<Vector3>* debug_colors_out);
+        virtual void GetRegions(int region_depth, std::vector<FunctionMeshTree*>* regions_out);
 
     private:
         // Flattened two-dimensional array of descendents. Null ptrs indicate no data at a position.
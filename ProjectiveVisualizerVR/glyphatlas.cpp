@@ -0,0 +1,340 @@
+#include "glyphatlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+static const char glyph_atlas_magic[8] = { 'P', 'V', 'G', 'L', 'Y', 'P', 'H', 0 };
+static const unsigned int glyph_atlas_version = 1;
+
+// The cache file is this, then the glyphs, the kerning table and the texels.
+struct GlyphAtlasFileHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int pixel_size;
+    unsigned int oversample;
+    unsigned int spread;
+    unsigned long long font_bytes;      // Size of the font file, to notice it being replaced.
+    unsigned int width;
+    unsigned int height;
+    float a_height;
+    float line_spacing;
+};
+
+// Stands for no feature pixel; squared distances stay far below it.
+static const float far_away = 1e20f;
+
+// Squared distances along a line to the nearest of the points where f is 0, or more generally the
+// lower envelope of the parabolas (q - p)^2 + f[p], by Felzenszwalb and Huttenlocher's method. v and z
+// are scratch space for n and n + 1 elements.
+static void DistanceTransform1D(const float* f, int n, float* d, int* v, float* z)
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    // v[0..k] are the parabolas of the envelope so far, and parabola v[j] is lowest between z[j] and z[j + 1].
+    int k = 0;
+    v[0] = 0;
+    z[0] = -infinity;
+    z[1] = infinity;
+    for (int q = 1; q < n; q++)
+    {
+        float s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        while (s <= z[k])
+        {
+            k--;
+            s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = infinity;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; q++)
+    {
+        while (z[k + 1] < q)
+            k++;
+        float offset = (float)(q - v[k]);
+        d[q] = offset * offset + f[v[k]];
+    }
+}
+
+// Squared distances from each pixel of a w by h grid to the nearest pixel where feature is true.
+static void DistanceTransform2D(const std::vector<bool>& feature, int w, int h, std::vector<float>* d_out)
+{
+    int n = (w > h) ? w : h;
+    std::vector<float> f(n), d(n), z(n + 1);
+    std::vector<int> v(n);
+    std::vector<float>& grid = *d_out;
+    grid.resize(w * h);
+
+    for (int i = 0; i < w * h; i++)
+        grid[i] = feature[i] ? 0 : far_away;
+
+    for (int x = 0; x < w; x++)
+    {
+        for (int y = 0; y < h; y++)
+            f[y] = grid[y * w + x];
+        DistanceTransform1D(&f[0], h, &d[0], &v[0], &z[0]);
+        for (int y = 0; y < h; y++)
+            grid[y * w + x] = d[y];
+    }
+
+    for (int y = 0; y < h; y++)
+    {
+        DistanceTransform1D(&grid[y * w], w, &d[0], &v[0], &z[0]);
+        memcpy(&grid[y * w], &d[0], w * sizeof(float));
+    }
+}
+
+static unsigned long long FileBytes(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    long bytes = ftell(file);
+    fclose(file);
+    return (bytes < 0) ? 0 : bytes;
+}
+
+GlyphAtlas::GlyphAtlas()
+{
+    for (int i = 0; i < glyph_count; i++)
+        glyphs[i] = Glyph();
+    memset(kerning, 0, sizeof(kerning));
+    a_height = 1;
+    line_spacing = 1;
+    width = 0;
+    height = 0;
+}
+
+bool GlyphAtlas::LoadOrBuild(FT_Face face, const char* font_path, const char* cache_path)
+{
+    unsigned long long font_bytes = FileBytes(font_path);
+    if (Load(cache_path, font_bytes))
+        return true;
+
+    if (face == NULL || !Build(face))
+        return false;
+
+    if (!Save(cache_path, font_bytes))
+        std::cout << "Couldn't save the glyph atlas to " << cache_path << std::endl;
+    return true;
+}
+
+bool GlyphAtlas::Build(FT_Face face)
+{
+    if (FT_Set_Pixel_Sizes(face, 0, pixel_size))
+    {
+        std::cout << "Trouble setting size of font." << std::endl;
+        return false;
+    }
+
+    // Each glyph's field, on its cell of whole texels.
+    const int margin = spread * oversample;
+    std::vector<unsigned char> fields[glyph_count];
+    int cell_widths[glyph_count] = {};
+    int cell_heights[glyph_count] = {};
+    FT_UInt glyph_indices[glyph_count] = {};
+
+    std::vector<bool> inside, outside;
+    std::vector<float> to_inside, to_outside;
+
+    for (int i = 0; i < glyph_count; i++)
+    {
+        Glyph& glyph = glyphs[i];
+        glyph = Glyph();
+
+        FT_UInt glyph_index = FT_Get_Char_Index(face, i);
+        if (glyph_index == 0)
+            continue;
+        if (FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT) != 0 ||
+            FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL) != 0)
+        {
+            std::cout << "Trouble rendering glyph " << i << std::endl;
+            continue;
+        }
+
+        glyph.present = true;
+        glyph.advance = face->glyph->metrics.horiAdvance;
+        glyph_indices[i] = glyph_index;
+        if (i == 'A')
+            a_height = face->glyph->metrics.height;
+
+        const FT_Bitmap& bitmap = face->glyph->bitmap;
+        if (bitmap.buffer == 0 || bitmap.width == 0 || bitmap.rows == 0)
+            continue;
+
+        // The bitmap with a margin of the spread around it, rounded up to whole texels.
+        int cell_width = (bitmap.width + 2 * margin + oversample - 1) / oversample;
+        int cell_height = (bitmap.rows + 2 * margin + oversample - 1) / oversample;
+        int w = cell_width * oversample;
+        int h = cell_height * oversample;
+
+        inside.assign(w * h, false);
+        for (int y = 0; y < bitmap.rows; y++)
+            for (int x = 0; x < bitmap.width; x++)
+                inside[(y + margin) * w + x + margin] = bitmap.buffer[y * bitmap.pitch + x] >= 128;
+        outside.resize(w * h);
+        for (int p = 0; p < w * h; p++)
+            outside[p] = !inside[p];
+
+        DistanceTransform2D(inside, w, h, &to_inside);
+        DistanceTransform2D(outside, w, h, &to_outside);
+
+        // The outline runs halfway between pixel centers on either side of it. Each texel takes the
+        // mean of its pixels' distances, which is the distance at its center up to where the outline
+        // bends within it.
+        fields[i].resize(cell_width * cell_height);
+        for (int ty = 0; ty < cell_height; ty++)
+            for (int tx = 0; tx < cell_width; tx++)
+            {
+                float sum = 0;
+                for (int y = ty * oversample; y < (ty + 1) * oversample; y++)
+                    for (int x = tx * oversample; x < (tx + 1) * oversample; x++)
+                    {
+                        int p = y * w + x;
+                        sum += inside[p] ? sqrtf(to_outside[p]) - 0.5f : 0.5f - sqrtf(to_inside[p]);
+                    }
+                float distance = sum / (oversample * oversample * oversample);
+                float value = 128 + 127 * distance / spread;
+                fields[i][ty * cell_width + tx] = (unsigned char)((value < 0) ? 0 : (value > 255) ? 255 : value + 0.5f);
+            }
+
+        cell_widths[i] = cell_width;
+        cell_heights[i] = cell_height;
+        glyph.bearing_x = (float)(face->glyph->bitmap_left - margin) * 64;
+        glyph.bearing_y = (float)(face->glyph->bitmap_top + margin) * 64;
+        glyph.width = (float)w * 64;
+        glyph.height = (float)h * 64;
+    }
+
+    line_spacing = face->size->metrics.height;
+
+    if (FT_HAS_KERNING(face))
+        for (int i = 0; i < glyph_count; i++)
+            for (int j = 0; j < glyph_count; j++)
+                if (glyph_indices[i] != 0 && glyph_indices[j] != 0)
+                {
+                    FT_Vector delta;
+                    FT_Get_Kerning(face, glyph_indices[i], glyph_indices[j], FT_KERNING_DEFAULT, &delta);
+                    kerning[i][j] = delta.x;
+                }
+
+    // Shelf-pack the cells, tallest first, left to right along rows as tall as their first cell. A
+    // texel of gap keeps linear filtering from reaching into the next cell.
+    std::vector<int> order;
+    for (int i = 0; i < glyph_count; i++)
+        if (!fields[i].empty())
+            order.push_back(i);
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return cell_heights[a] > cell_heights[b]; });
+
+    const int gap = 1;
+    int cell_x[glyph_count] = {};
+    int cell_y[glyph_count] = {};
+    int shelf_x = gap, shelf_y = gap, shelf_height = 0;
+    for (int n = 0; n < order.size(); n++)
+    {
+        int i = order[n];
+        if (shelf_x + cell_widths[i] + gap > atlas_width)
+        {
+            shelf_x = gap;
+            shelf_y += shelf_height + gap;
+            shelf_height = 0;
+        }
+        cell_x[i] = shelf_x;
+        cell_y[i] = shelf_y;
+        shelf_x += cell_widths[i] + gap;
+        if (cell_heights[i] > shelf_height)
+            shelf_height = cell_heights[i];
+    }
+
+    width = atlas_width;
+    height = shelf_y + shelf_height + gap;
+    texels.assign(width * height, 0);
+    for (int n = 0; n < order.size(); n++)
+    {
+        int i = order[n];
+        for (int y = 0; y < cell_heights[i]; y++)
+            memcpy(&texels[(cell_y[i] + y) * width + cell_x[i]], &fields[i][y * cell_widths[i]], cell_widths[i]);
+
+        glyphs[i].uv_min = Vector2((float)cell_x[i] / width, (float)cell_y[i] / height);
+        glyphs[i].uv_max = Vector2((float)(cell_x[i] + cell_widths[i]) / width, (float)(cell_y[i] + cell_heights[i]) / height);
+    }
+
+    return true;
+}
+
+bool GlyphAtlas::Load(const char* cache_path, unsigned long long font_bytes)
+{
+    FILE* file = fopen(cache_path, "rb");
+    if (file == NULL)
+        return false;
+
+    GlyphAtlasFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, glyph_atlas_magic, sizeof(header.magic)) == 0
+        && header.version == glyph_atlas_version
+        && header.pixel_size == pixel_size
+        && header.oversample == oversample
+        && header.spread == spread
+        && header.font_bytes == font_bytes
+        && header.width > 0 && header.width <= 16384
+        && header.height > 0 && header.height <= 16384;
+
+    if (ok)
+    {
+        width = header.width;
+        height = header.height;
+        a_height = header.a_height;
+        line_spacing = header.line_spacing;
+        texels.resize(width * height);
+        ok = fread(glyphs, sizeof(glyphs), 1, file) == 1
+            && fread(kerning, sizeof(kerning), 1, file) == 1
+            && fread(&texels[0], texels.size(), 1, file) == 1;
+    }
+    fclose(file);
+
+    if (!ok)
+    {
+        // Whatever was read is built again.
+        for (int i = 0; i < glyph_count; i++)
+            glyphs[i] = Glyph();
+        memset(kerning, 0, sizeof(kerning));
+        texels.clear();
+        width = height = 0;
+    }
+    return ok;
+}
+
+bool GlyphAtlas::Save(const char* cache_path, unsigned long long font_bytes) const
+{
+    FILE* file = fopen(cache_path, "wb");
+    if (file == NULL)
+        return false;
+
+    GlyphAtlasFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, glyph_atlas_magic, sizeof(header.magic));
+    header.version = glyph_atlas_version;
+    header.pixel_size = pixel_size;
+    header.oversample = oversample;
+    header.spread = spread;
+    header.font_bytes = font_bytes;
+    header.width = width;
+    header.height = height;
+    header.a_height = a_height;
+    header.line_spacing = line_spacing;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(glyphs, sizeof(glyphs), 1, file) == 1
+        && fwrite(kerning, sizeof(kerning), 1, file) == 1
+        && fwrite(&texels[0], texels.size(), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
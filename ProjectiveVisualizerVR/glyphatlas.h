@@ -0,0 +1,61 @@
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include <vector>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "shared/Vectors.h"
+
+// Signed distance fields of the ASCII glyphs of a font, packed into one 8-bit atlas. Each texel holds
+// the distance from its center to the glyph's outline, as 128 on the outline, more inside and less
+// outside, reaching 255 or 0 spread texels away. Thresholded at one half by the shader that draws them,
+// the glyphs stay sharp drawn far larger than their few dozen texels.
+//
+// The fields are computed from glyphs rasterized oversample times larger than the atlas, by an exact
+// Euclidean distance transform, then averaged down. That takes a moment, so an atlas is saved to a file
+// and loaded from it instead, as long as the font and the settings below are unchanged.
+class GlyphAtlas
+{
+public:
+    // Metrics are in FreeType's 26.6 units at the size the glyphs were rasterized; only their ratios
+    // matter to layout. A glyph's cell in the atlas is its box grown by the spread, and its bearing,
+    // width and height are those of its cell, so the drawn quad covers the whole field.
+    struct Glyph
+    {
+        bool present;
+        float bearing_x, bearing_y, width, height, advance;
+        Vector2 uv_min, uv_max;    // uv_min is the top left corner.
+    };
+
+    static const int glyph_count = 128;
+
+    GlyphAtlas();
+
+    // Loads the atlas from cache_path if it was saved there for the same font file and settings.
+    // Otherwise builds it from face, which this sets to the rasterizing size, and saves it there.
+    // Returns false if it could be neither loaded nor built.
+    bool LoadOrBuild(FT_Face face, const char* font_path, const char* cache_path);
+
+    Glyph glyphs[glyph_count];
+    float kerning[glyph_count][glyph_count];    // Added to the advance of the first character.
+    float a_height;                             // Of the outline of 'A'.
+    float line_spacing;
+
+    int width;
+    int height;
+    std::vector<unsigned char> texels;          // Rows of width bytes, top first.
+
+private:
+    static const int pixel_size = 128;          // Rasterized glyphs are this many pixels per em...
+    static const int oversample = 4;            // ...and this many pixels across for a texel.
+    static const int spread = 4;                // In texels.
+    static const int atlas_width = 512;
+
+    bool Build(FT_Face face);
+    bool Load(const char* cache_path, unsigned long long font_bytes);
+    bool Save(const char* cache_path, unsigned long long font_bytes) const;
+};
+
+#endif // GLYPHATLAS_H
@@ -32,6 +32,12 @@
 
 #include "term.h"
 #include "functionmesh.h"
+#include "functionlens.h"
+#include "posedsegments.h"
+#include "glyphatlas.h"
+#include "framearena.h"
+#include "meshstream.h"
+#include "meshcoordinator.h"
 
 #if defined(POSIX)
 #include "unistd.h"
@@ -62,7 +68,7 @@ public:
 
 	bool BInit( const vr::RenderModel_t & vrModel, const vr::RenderModel_TextureMap_t & vrDiffuseTexture );
 	void Cleanup();
-	void Draw();
+	void Draw( GLsizei nInstances = 1 );
 	const std::string & GetName() const { return m_sModelName; }
 
 private:
@@ -74,6 +80,65 @@ private:
 	std::string m_sModelName;
 };
 
+//-----------------------------------------------------------------------------
+// Purpose: A ring of buffer memory for vertex data, indices and draw commands
+//          that are drawn in the frame they're written, handed out front to
+//          back. With GL_ARB_buffer_storage the ring stays mapped, and a fence
+//          at the end of each frame tells when the GPU is done with that
+//          frame's part of it. Without, each write maps just its range,
+//          unsynchronized, and the whole buffer is orphaned when the ring wraps.
+//          Writes that don't fit make it grow into a new buffer; the old one is
+//          kept to the end of the frame, for what was already written to it.
+//-----------------------------------------------------------------------------
+class CGLStreamBuffer
+{
+public:
+	CGLStreamBuffer();
+	~CGLStreamBuffer();
+
+	bool BInit( GLsizeiptr nCapacity );
+	void Cleanup();
+
+	// Copies nBytes of pData in, returning their offset, a multiple of nAlignment, in the
+	// buffer GetBuffer() returns right after. That may change with any write. Returns -1 if
+	// the data couldn't be written, and then it mustn't be drawn.
+	GLintptr Write( const void *pData, GLsizeiptr nBytes, GLsizeiptr nAlignment = 16 );
+	void EndFrame();
+	GLuint GetBuffer() const { return m_glBuffer; }
+
+private:
+	// Written in a frame that the GPU may still be drawing, from nBegin up to nEnd, wrapping
+	// around the end of the ring if nEnd is smaller.
+	struct PendingFrame
+	{
+		GLsync sync;
+		GLintptr nBegin;
+		GLintptr nEnd;
+	};
+
+	// The GPU is never more than a few frames behind, so a frame that would overflow the queue
+	// waits for the oldest instead, and ending a frame never allocates.
+	enum { k_nMaxPendingFrames = 8 };
+
+	bool CreateBuffer( GLsizeiptr nCapacity );
+	void DeleteBuffer();
+	bool BOverlaps( GLintptr nBegin, GLintptr nEnd, GLintptr nOffset, GLsizeiptr nBytes ) const;
+	PendingFrame &PendingAt( int i ) { return m_pendingFrames[ ( m_nFirstPending + i ) % k_nMaxPendingFrames ]; }
+	void RetirePendingFrames( int nCount );
+
+	GLuint m_glBuffer;
+	GLsizeiptr m_nCapacity;
+	bool m_bPersistent;
+	unsigned char *m_pMapped;
+
+	GLintptr m_nHead;
+	GLintptr m_nFrameBegin;
+	PendingFrame m_pendingFrames[ k_nMaxPendingFrames ];    // A circular queue; see PendingAt.
+	int m_nFirstPending;
+	int m_nPendingFrames;
+	std::vector<GLuint> m_retiredBuffers;        // Grown out of this frame.
+};
+
 
 
 class FunctionTextInput
@@ -144,20 +209,29 @@ public:
 	GLuint glFramebufferId;
 	GLuint glTextureId;
 
-	GLuint glCharVertBuffer;
-	GLuint glCharIndexBuffer;
 	GLuint glCharVAO;
-	GLuint glCharTextures[256]; // The size of ASCII alphabet
 
 	const int texture_width = 2048;
 	const int texture_height = 2048;
-	
-	const int char_texture_height = 256;
+
+	// Signed distance fields of the glyphs, drawn by m_unGlyphProgramID.
+	GlyphAtlas atlas;
+	GLuint glAtlasTextureId;
 
 	Matrix4 pose;
 
 	bool is_correct = true;
 	Uint32 ticks_when_last_valid = 0;
+
+	// The string last checked for being a valid term.
+	std::string validated_str;
+	bool validated = false;
+
+	// What the text texture shows, so it's only drawn again when that changes.
+	std::string rendered_str;
+	int rendered_cursor_pos = -1;
+	Vector3 rendered_background;
+	bool rendered = false;
 };
 
 static bool g_bPrintf = true;
@@ -174,6 +248,10 @@ public:
 
 	bool BInit();
 	bool BInitGL();
+
+	// -streammesh only writes a mesh file, without starting VR.
+	bool BStreamMeshOnly() { return !m_strStreamMeshPath.empty(); }
+	int RunStreamMesher();
 	bool BInitCompositor();
 
 	void SetupRenderModels();
@@ -194,6 +272,11 @@ public:
 	void SetupCameras();
 
 	void SetupFunction();
+	void UploadFunctionMesh();
+	void BeginFunctionMeshUpload();
+	bool ContinueFunctionMeshUpload();
+	void SwapInFunctionMesh();
+	void SetupRandomFunction();
 	void AsynchReplaceFunction();
 	void CreateAsynchReplaceFunctionThread();
 
@@ -203,16 +286,23 @@ public:
 	void RenderCompanionWindow();
 	void RenderScene( vr::Hmd_Eye nEye );
 	void RenderFunction(vr::Hmd_Eye nEye);
+	void UpdateRegionLevels();
+	void UpdateFunctionDraws();
+	void UpdateLens();
+	void UpdateDebugCubes();
+	void UpdateFunctionTextInput();
 	void RenderFunctionTextInput(vr::Hmd_Eye nEye);
 
 	Matrix4 GetHMDMatrixProjectionEye( vr::Hmd_Eye nEye );
 	Matrix4 GetHMDMatrixPoseEye( vr::Hmd_Eye nEye );
 	Matrix4 GetCurrentViewProjectionMatrix( vr::Hmd_Eye nEye );
+	void SetEyeMatrices( GLint nMatrixLocation, GLint nEyeCountLocation, vr::Hmd_Eye nEye, const Matrix4 &matModel );
+	Matrix4 GetCurrentFunctionPose();
 	void UpdateHMDMatrixPose();
 
 	Matrix4 ConvertSteamVRMatrixToMatrix4( const vr::HmdMatrix34_t &matPose );
 
-	GLuint CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchFragmentShader );
+	GLuint CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchFragmentShader, const char *pchGeometryShader = NULL );
 	bool CreateAllShaders();
 
 	void SetupRenderModelForTrackedDevice( vr::TrackedDeviceIndex_t unTrackedDeviceIndex );
@@ -239,6 +329,33 @@ private:
 	FunctionMesh* m_FunctionMeshUnderConstruction;
 	bool m_bFunctionMeshIsUnderConstruction;
 	FunctionTextInput m_functionTextInput;
+	MeshBudget m_meshBudget;
+	ChartSampling m_chartSampling;
+	bool m_bUseSymmetry;
+	bool m_bFindHiddenCrossings;
+
+	// pvmesh-worker processes meshing regions for every FunctionMesh built, if any were asked for.
+	int m_nMeshWorkers;
+	MeshCoordinator* m_meshCoordinator;
+
+	// Offline meshing to a file, and loading one instead of a random function; see meshstream.h.
+	std::string m_strStreamMeshPath;
+	int m_nStreamMeshDepth;
+	std::string m_strStreamMeshEquation;
+	std::string m_strLoadMeshPath;
+
+	// Level of detail drawn for each region of m_functionMesh this frame, or -1 for
+	// regions outside the view of both eyes.
+	bool m_bLevelOfDetail;
+	float m_fLodCellPixels;
+	std::vector<int> m_regionLevels;
+
+	// High-depth meshing in a sphere in front of the controller; toggled with L.
+	FunctionLens* m_functionLens;
+	bool m_bLensActive;
+	float m_fLensRadius;
+	double m_fLensBudgetMs;
+	Vector3 m_lensCenter;
 
 	FT_Library m_ftLibrary;
 	FT_Face m_robotoFace;
@@ -285,7 +402,6 @@ private: // OpenGL bookkeeping
 	GLuint m_glCompanionWindowIDIndexBuffer;
 	unsigned int m_uiCompanionWindowIndexSize;
 
-	GLuint m_glControllerVertBuffer;
 	GLuint m_unControllerVAO;
 	unsigned int m_uiControllerVertcount;
 
@@ -313,8 +429,12 @@ private: // OpenGL bookkeeping
 		VertexDataWindow( const Vector2 & pos, const Vector2 tex ) :  position(pos), texCoord(tex) {	}
 	};
 
+	static void AddGlyphQuad( VertexDataWindow *vVerts, int &nVerts, GLushort *vIndices, int &nIndices,
+		const GlyphAtlas::Glyph &glyph, float penx, float baseline, float scale );
+
 	GLuint m_unSceneProgramID;
 	GLuint m_unCompanionWindowProgramID;
+	GLuint m_unGlyphProgramID;
 	GLuint m_unControllerTransformProgramID;
 	GLuint m_unRenderModelProgramID;
 
@@ -323,18 +443,69 @@ private: // OpenGL bookkeeping
 	GLint m_nSceneMatrixLocation;
 	GLint m_nControllerMatrixLocation;
 	GLint m_nRenderModelMatrixLocation;
+	GLint m_nControllerEyeCountLocation;
+	GLint m_nRenderModelEyeCountLocation;
 
+	// The function mesh, copied to the GPU once when it's swapped in: vertices and gradients
+	// of level 0, followed by those of the coarser levels. The pose is applied by the shaders.
 	GLuint m_functionVertBuffer;
-	GLuint m_functionNormalBuffer;
+	GLuint m_functionGradientBuffer;
 	GLuint m_functionVAO;
 
+	// A newly finished mesh is copied into buffers of its own, at most m_fMeshUploadMBPerFrame
+	// a frame, while the old one is still drawn. It's swapped in once it's all there.
+	FunctionMesh* m_stagedFunctionMesh;
+	Term* m_stagedFunction;
+	GLuint m_stagedVertBuffer;
+	GLuint m_stagedGradientBuffer;
+	GLsizeiptr m_nStagedBytes;           // Copied so far, of both buffers together.
+	float m_fMeshUploadMBPerFrame;
+
+	GLint *m_functionDrawFirsts;         // This frame's draws, in m_frameArena.
+	GLsizei *m_functionDrawCounts;
+	int m_nFunctionDraws;
+
+	// The same draws as commands for glMultiDrawArraysIndirect, where it's supported.
+	struct DrawArraysIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+	bool m_bDrawIndirect;
+	DrawArraysIndirectCommand *m_functionDrawCommands;
+	GLuint m_functionIndirectBuffer;     // Where this frame's commands went in m_streamBuffer.
+	GLintptr m_nFunctionIndirectOffset;
+
+	// Vertices, indices and draw commands written each frame, or whenever they're drawn.
+	CGLStreamBuffer m_streamBuffer;
+
+	// Where they're built, along with anything else that lasts only the frame. It's reset at
+	// the top of RenderFrame, so a frame like the last makes no heap allocations for them.
+	FrameArena m_frameArena;
+	unsigned long long m_nLastHeapAllocations;    // On the render thread, at the top of the last frame.
+
+	// The lens's triangles, copied again whenever its revision changes.
+	GLuint m_lensVertBuffer;
+	GLuint m_lensGradientBuffer;
+	GLuint m_lensVAO;
+	int m_nUploadedLensRevision;
+
+	// The debug cubes are posed on the CPU, again only when the pose has changed, and
+	// streamed each frame.
 	bool m_bDebugCubes;
-	GLuint m_debugCubesVertBuffer;
-	GLuint m_debugCubesColorBuffer;
+	PosedSegments* m_posedDebugCubes;
 	GLuint m_debugCubesVAO;
+	GLsizei m_nDebugCubesVertexCount;
 
 	GLint m_nFunctionMatrixLocation;
+	GLint m_nFunctionPoseLocation;
 	GLint m_nFunctionSurfaceColorLocation;
+	GLint m_nFunctionLensCenterLocation;
+	GLint m_nFunctionLensRadiusLocation;
+	GLint m_nFunctionLensModeLocation;
+	GLint m_nFunctionEyeCountLocation;
 
 	struct FramebufferDesc
 	{
@@ -347,7 +518,15 @@ private: // OpenGL bookkeeping
 	FramebufferDesc leftEyeDesc;
 	FramebufferDesc rightEyeDesc;
 
-	bool CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc );
+	// -singlepassstereo draws both eyes side by side into stereoDesc, which is twice as wide, with
+	// one instanced draw per object; it's resolved whole, and its halves copied into the eyes' own
+	// textures. The menu is still drawn an eye at a time. m_nPassEyeCount is 2 while both eyes are
+	// being drawn.
+	bool m_bSinglePassStereo;
+	FramebufferDesc stereoDesc;
+	int m_nPassEyeCount;
+
+	bool CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc, bool bResolve = true );
 	
 	uint32_t m_nRenderWidth;
 	uint32_t m_nRenderHeight;
@@ -385,6 +564,7 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	, m_nCompanionWindowHeight( 1200 )
 	, m_unSceneProgramID( 0 )
 	, m_unCompanionWindowProgramID( 0 )
+	, m_unGlyphProgramID( 0 )
 	, m_unControllerTransformProgramID( 0 )
 	, m_unRenderModelProgramID( 0 )
 	, m_pHMD( NULL )
@@ -394,12 +574,16 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	, m_bPerf( false )
 	, m_bVblank( false )
 	, m_bGlFinishHack( true )
-	, m_glControllerVertBuffer( 0 )
 	, m_unControllerVAO( 0 )
 	, m_unSceneVAO( 0 )
 	, m_nSceneMatrixLocation( -1 )
 	, m_nControllerMatrixLocation( -1 )
 	, m_nRenderModelMatrixLocation( -1 )
+	, m_nControllerEyeCountLocation( -1 )
+	, m_nRenderModelEyeCountLocation( -1 )
+	, m_nFunctionEyeCountLocation( -1 )
+	, m_bSinglePassStereo( false )
+	, m_nPassEyeCount( 1 )
 	, m_iTrackedControllerCount( 0 )
 	, m_iTrackedControllerCount_Last( -1 )
 	, m_iValidPoseCount( 0 )
@@ -408,13 +592,45 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	, m_function(NULL)
 	, m_functionMesh(NULL)
 	, m_functionVAO(0)
+	, m_stagedFunctionMesh(NULL)
+	, m_stagedFunction(NULL)
+	, m_stagedVertBuffer(0)
+	, m_stagedGradientBuffer(0)
+	, m_nStagedBytes(0)
+	, m_fMeshUploadMBPerFrame(8)
+	, m_functionDrawFirsts(NULL)
+	, m_functionDrawCounts(NULL)
+	, m_nFunctionDraws(0)
+	, m_bDrawIndirect(false)
+	, m_functionDrawCommands(NULL)
+	, m_functionIndirectBuffer(0)
+	, m_nFunctionIndirectOffset(0)
+	, m_nLastHeapAllocations(0)
+	, m_lensVAO(0)
+	, m_nUploadedLensRevision(-1)
 	, m_bTriggerIsHeld(false)
 	, m_bInMenu(false)
 	, m_nActiveControllerID(-1)
 	, m_bDebugCubes( false )
+	, m_posedDebugCubes( NULL )
+	, m_debugCubesVAO( 0 )
+	, m_nDebugCubesVertexCount( 0 )
 	, m_FunctionMeshUnderConstruction( NULL )
 	, m_bFunctionMeshIsUnderConstruction( false )
 	, m_functionUnderConstruction( NULL )
+	, m_meshBudget( 0, 0 ) // No limit unless -maxtriangles or -maxmeshms asks for one.
+	, m_chartSampling( SAMPLING_CUBE )
+	, m_bUseSymmetry( true )
+	, m_bFindHiddenCrossings( false )
+	, m_nMeshWorkers( 0 )
+	, m_meshCoordinator( NULL )
+	, m_nStreamMeshDepth( 0 )
+	, m_bLevelOfDetail( true )
+	, m_fLodCellPixels( 6 )
+	, m_functionLens( NULL )
+	, m_bLensActive( false )
+	, m_fLensRadius( 0.05f )
+	, m_fLensBudgetMs( 4 )
 	, m_ftLibrary( NULL )
 	, m_robotoFace( NULL )
 {
@@ -441,9 +657,71 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 		{
 			g_bPrintf = false;
 		}
+		else if( !stricmp( argv[i], "-perf" ) )
+		{
+			m_bPerf = true;
+#ifndef PV_COUNT_HEAP_ALLOCATIONS
+			dprintf( "Heap allocations are only counted in builds with PV_COUNT_HEAP_ALLOCATIONS defined\n" );
+#endif
+		}
+		else if( !stricmp( argv[i], "-maxtriangles" ) && i + 1 < argc )
+		{
+			m_meshBudget.max_triangles = atoi( argv[++i] );
+		}
+		else if( !stricmp( argv[i], "-maxmeshms" ) && i + 1 < argc )
+		{
+			m_meshBudget.max_milliseconds = atof( argv[++i] );
+		}
+		else if( !stricmp( argv[i], "-equiangular" ) )
+		{
+			m_chartSampling = SAMPLING_EQUIANGULAR;
+		}
+		else if( !stricmp( argv[i], "-nosymmetry" ) )
+		{
+			m_bUseSymmetry = false;
+		}
+		else if( !stricmp( argv[i], "-hiddencrossings" ) )
+		{
+			m_bFindHiddenCrossings = true;
+		}
+		else if( !stricmp( argv[i], "-meshworkers" ) && i + 1 < argc )
+		{
+			m_nMeshWorkers = atoi( argv[++i] );
+		}
+		else if( !stricmp( argv[i], "-streammesh" ) && i + 3 < argc )
+		{
+			m_strStreamMeshPath = argv[++i];
+			m_nStreamMeshDepth = atoi( argv[++i] );
+			m_strStreamMeshEquation = argv[++i];
+		}
+		else if( !stricmp( argv[i], "-loadmesh" ) && i + 1 < argc )
+		{
+			m_strLoadMeshPath = argv[++i];
+		}
+		else if( !stricmp( argv[i], "-nolod" ) )
+		{
+			m_bLevelOfDetail = false;
+		}
+		else if( !stricmp( argv[i], "-lodpixels" ) && i + 1 < argc )
+		{
+			m_fLodCellPixels = atof( argv[++i] );
+		}
+		else if( !stricmp( argv[i], "-lensms" ) && i + 1 < argc )
+		{
+			m_fLensBudgetMs = atof( argv[++i] );
+		}
+		else if( !stricmp( argv[i], "-uploadmb" ) && i + 1 < argc )
+		{
+			m_fMeshUploadMBPerFrame = atof( argv[++i] );
+		}
+		else if( !stricmp( argv[i], "-singlepassstereo" ) )
+		{
+			m_bSinglePassStereo = true;
+		}
 	}
 	// other initialization tasks are done in BInit
 	memset(m_rDevClassChar, 0, sizeof(m_rDevClassChar));
+	memset(&stereoDesc, 0, sizeof(stereoDesc));
 };
 
 
@@ -617,6 +895,12 @@ bool CMainApplication::BInitGL()
 	if( !CreateAllShaders() )
 		return false;
 
+	if( !m_streamBuffer.BInit( 1 << 20 ) )
+	{
+		dprintf( "Unable to map the stream buffer\n" );
+		return false;
+	}
+
 	SetupFunctionTexture();
 	SetupCameras();
 	SetupStereoRenderTargets();
@@ -685,6 +969,10 @@ void CMainApplication::Shutdown()
 		{
 			glDeleteProgram( m_unCompanionWindowProgramID );
 		}
+		if ( m_unGlyphProgramID )
+		{
+			glDeleteProgram( m_unGlyphProgramID );
+		}
 
 		glDeleteRenderbuffers( 1, &leftEyeDesc.m_nDepthBufferId );
 		glDeleteTextures( 1, &leftEyeDesc.m_nRenderTextureId );
@@ -698,6 +986,12 @@ void CMainApplication::Shutdown()
 		glDeleteTextures( 1, &rightEyeDesc.m_nResolveTextureId );
 		glDeleteFramebuffers( 1, &rightEyeDesc.m_nResolveFramebufferId );
 
+		glDeleteRenderbuffers( 1, &stereoDesc.m_nDepthBufferId );
+		glDeleteTextures( 1, &stereoDesc.m_nRenderTextureId );
+		glDeleteFramebuffers( 1, &stereoDesc.m_nRenderFramebufferId );
+		glDeleteTextures( 1, &stereoDesc.m_nResolveTextureId );
+		glDeleteFramebuffers( 1, &stereoDesc.m_nResolveFramebufferId );
+
 		if( m_unCompanionWindowVAO != 0 )
 		{
 			glDeleteVertexArrays( 1, &m_unCompanionWindowVAO );
@@ -710,10 +1004,19 @@ void CMainApplication::Shutdown()
 		{
 			glDeleteVertexArrays( 1, &m_unControllerVAO );
 		}
+		m_streamBuffer.Cleanup();
 		if (m_functionVAO != 0)
 		{
 			glDeleteVertexArrays(1, &m_functionVAO);
 		}
+		if (m_lensVAO != 0)
+		{
+			glDeleteVertexArrays(1, &m_lensVAO);
+		}
+		if (m_debugCubesVAO != 0)
+		{
+			glDeleteVertexArrays(1, &m_debugCubesVAO);
+		}
 	}
 
 	if( m_pCompanionWindow )
@@ -728,12 +1031,34 @@ void CMainApplication::Shutdown()
 	{
 		delete m_function;
 	}
+	if (m_functionLens != 0)
+	{
+		delete m_functionLens;
+	}
+	if (m_posedDebugCubes != 0)
+	{
+		delete m_posedDebugCubes;
+	}
 	if (m_functionMesh != 0)
 	{
 		delete m_functionMesh;
 
 		glDeleteBuffers(1, &m_functionVertBuffer);
-		glDeleteBuffers(1, &m_functionNormalBuffer);
+		glDeleteBuffers(1, &m_functionGradientBuffer);
+		glDeleteBuffers(1, &m_lensVertBuffer);
+		glDeleteBuffers(1, &m_lensGradientBuffer);
+	}
+	if (m_stagedFunctionMesh != 0)
+	{
+		delete m_stagedFunctionMesh;
+		delete m_stagedFunction;
+
+		glDeleteBuffers(1, &m_stagedVertBuffer);
+		glDeleteBuffers(1, &m_stagedGradientBuffer);
+	}
+	if (m_meshCoordinator != 0)
+	{
+		delete m_meshCoordinator;
 	}
 }
 
@@ -880,6 +1205,14 @@ DWORD WINAPI AsynchReplaceFunctionStarter(LPVOID vparams)
 	return 0;
 }
 
+// Deletes a function mesh that's been swapped out, which for a big one takes a while.
+DWORD WINAPI DeleteFunctionMeshStarter(LPVOID vmesh)
+{
+	delete (FunctionMesh*)vmesh;
+
+	return 0;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -1023,6 +1356,12 @@ bool CMainApplication::HandleInput()
 				}
 				dprintf("%s\n", m_functionTextInput.get_str().c_str());
 			}
+			else if (sdlEvent.key.keysym.sym == SDLK_l)
+			{
+				m_bLensActive = !m_bLensActive;
+				if (!m_bLensActive)
+					m_functionLens->Disable();
+			}
 		}
 	}
 
@@ -1169,15 +1508,12 @@ void CMainApplication::RunMainLoop()
 
 		bQuit = HandleInput();
 
-		// An asynchronous function mesh computation has completed.
-		if (!m_bFunctionMeshIsUnderConstruction && m_FunctionMeshUnderConstruction != NULL)
-		{
-			delete(m_functionMesh);
-			m_functionMesh = m_FunctionMeshUnderConstruction;
-			m_function = m_functionUnderConstruction;
-			m_FunctionMeshUnderConstruction = NULL;
-			m_functionUnderConstruction = NULL;
-		}
+		// An asynchronous function mesh computation has completed. It's shown once
+		// it's been copied to the GPU, over as many frames as that takes.
+		if (!m_bFunctionMeshIsUnderConstruction && m_FunctionMeshUnderConstruction != NULL && m_stagedFunctionMesh == NULL)
+			BeginFunctionMeshUpload();
+		if (m_stagedFunctionMesh != NULL && ContinueFunctionMeshUpload())
+			SwapInFunctionMesh();
 
 		RenderFrame();
 	}
@@ -1218,12 +1554,27 @@ void CMainApplication::ProcessVREvent( const vr::VREvent_t & event )
 //-----------------------------------------------------------------------------
 void CMainApplication::RenderFrame()
 {
+	// Say whenever something between here and the last frame allocated; it shouldn't. Counts are
+	// always 0 unless the build counts them (see ThreadHeapAllocations).
+	unsigned long long nHeapAllocations = ThreadHeapAllocations();
+	if ( m_bPerf && m_nLastHeapAllocations != 0 && nHeapAllocations != m_nLastHeapAllocations )
+		dprintf( "Heap allocations since the last frame: %llu\n", nHeapAllocations - m_nLastHeapAllocations );
+	m_nLastHeapAllocations = nHeapAllocations;
+
+	m_frameArena.Reset();
+
 	// for now as fast as possible
 	if ( m_pHMD )
 	{
 		RenderControllerAxes();
+		UpdateRegionLevels();
+		UpdateFunctionDraws();
+		UpdateLens();
+		UpdateDebugCubes();
+		UpdateFunctionTextInput();
 		RenderStereoTargets();
 		RenderCompanionWindow();
+		m_streamBuffer.EndFrame();
 
 		vr::Texture_t leftEyeTexture = {(void*)(uintptr_t)leftEyeDesc.m_nResolveTextureId, vr::TextureType_OpenGL, vr::ColorSpace_Gamma };
 		vr::VRCompositor()->Submit(vr::Eye_Left, &leftEyeTexture );
@@ -1275,7 +1626,7 @@ void CMainApplication::RenderFrame()
 // Purpose: Compiles a GL shader program and returns the handle. Returns 0 if
 //			the shader couldn't be compiled for some reason.
 //-----------------------------------------------------------------------------
-GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchFragmentShader )
+GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchFragmentShader, const char *pchGeometryShader )
 {
 	GLuint unProgramID = glCreateProgram();
 
@@ -1302,6 +1653,32 @@ GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char
 	glAttachShader( unProgramID, nSceneVertexShader);
 	glDeleteShader( nSceneVertexShader ); // the program hangs onto this once it's attached
 
+	if ( pchGeometryShader != NULL )
+	{
+		GLuint nSceneGeometryShader = glCreateShader(GL_GEOMETRY_SHADER);
+		glShaderSource( nSceneGeometryShader, 1, &pchGeometryShader, NULL);
+		glCompileShader( nSceneGeometryShader );
+
+		GLint gShaderCompiled = GL_FALSE;
+		glGetShaderiv( nSceneGeometryShader, GL_COMPILE_STATUS, &gShaderCompiled);
+		if ( gShaderCompiled != GL_TRUE)
+		{
+			dprintf("%s - Unable to compile geometry shader %d!\n", pchShaderName, nSceneGeometryShader);
+
+			char err_string[256];
+			err_string[255] = 0;
+			int length;
+			glGetShaderInfoLog(nSceneGeometryShader, 256, &length, err_string);
+			dprintf("%s\n", err_string);
+
+			glDeleteProgram( unProgramID );
+			glDeleteShader( nSceneGeometryShader );
+			return 0;
+		}
+		glAttachShader( unProgramID, nSceneGeometryShader);
+		glDeleteShader( nSceneGeometryShader ); // the program hangs onto this once it's attached
+	}
+
 	GLuint  nSceneFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource( nSceneFragmentShader, 1, &pchFragmentShader, NULL);
 	glCompileShader( nSceneFragmentShader );
@@ -1347,6 +1724,20 @@ GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char
 //-----------------------------------------------------------------------------
 // Purpose: Creates all the shaders used by HelloVR SDL
 //-----------------------------------------------------------------------------
+// For shaders of whatever is drawn in single-pass stereo: squeezes the clip coordinates of eye
+// 'eye' into its half of the side-by-side target, and clips them where that half ends. With
+// eyeCount 1 they're left as they are.
+#define EYE_PLACEMENT_GLSL \
+	"uniform int eyeCount;\n" \
+	"vec4 placeInEye(vec4 clip, int eye)\n" \
+	"{\n" \
+	"	if (eyeCount == 1)\n" \
+	"		return clip;\n" \
+	"	float side = (eye == 0) ? -1.0 : 1.0;\n" \
+	"	gl_ClipDistance[0] = clip.w + side*clip.x;\n" \
+	"	return vec4(0.5*(clip.x + side*clip.w), clip.yzw);\n" \
+	"}\n"
+
 bool CMainApplication::CreateAllShaders()
 {
 	m_unSceneProgramID = CompileGLShader( 
@@ -1387,14 +1778,15 @@ bool CMainApplication::CreateAllShaders()
 
 		// vertex shader
 		"#version 410\n"
-		"uniform mat4 matrix;\n"
+		"uniform mat4 matrix[2];\n"
+		EYE_PLACEMENT_GLSL
 		"layout(location = 0) in vec4 position;\n"
 		"layout(location = 1) in vec3 v3ColorIn;\n"
 		"out vec4 v4Color;\n"
 		"void main()\n"
 		"{\n"
 		"	v4Color.xyz = v3ColorIn; v4Color.a = 1.0;\n"
-		"	gl_Position = matrix * position;\n"
+		"	gl_Position = placeInEye(matrix[gl_InstanceID] * position, gl_InstanceID);\n"
 		"}\n",
 
 		// fragment shader
@@ -1407,6 +1799,7 @@ bool CMainApplication::CreateAllShaders()
 		"}\n"
 		);
 	m_nControllerMatrixLocation = glGetUniformLocation( m_unControllerTransformProgramID, "matrix" );
+	m_nControllerEyeCountLocation = glGetUniformLocation( m_unControllerTransformProgramID, "eyeCount" );
 	if( m_nControllerMatrixLocation == -1 )
 	{
 		dprintf( "Unable to find matrix uniform in controller shader\n" );
@@ -1418,7 +1811,8 @@ bool CMainApplication::CreateAllShaders()
 
 		// vertex shader
 		"#version 410\n"
-		"uniform mat4 matrix;\n"
+		"uniform mat4 matrix[2];\n"
+		EYE_PLACEMENT_GLSL
 		"layout(location = 0) in vec4 position;\n"
 		"layout(location = 1) in vec3 v3NormalIn;\n"
 		"layout(location = 2) in vec2 v2TexCoordsIn;\n"
@@ -1426,7 +1820,7 @@ bool CMainApplication::CreateAllShaders()
 		"void main()\n"
 		"{\n"
 		"	v2TexCoord = v2TexCoordsIn;\n"
-		"	gl_Position = matrix * vec4(position.xyz, 1);\n"
+		"	gl_Position = placeInEye(matrix[gl_InstanceID] * vec4(position.xyz, 1), gl_InstanceID);\n"
 		"}\n",
 
 		//fragment shader
@@ -1441,6 +1835,7 @@ bool CMainApplication::CreateAllShaders()
 
 		);
 	m_nRenderModelMatrixLocation = glGetUniformLocation( m_unRenderModelProgramID, "matrix" );
+	m_nRenderModelEyeCountLocation = glGetUniformLocation( m_unRenderModelProgramID, "eyeCount" );
 	if( m_nRenderModelMatrixLocation == -1 )
 	{
 		dprintf( "Unable to find matrix uniform in render model shader\n" );
@@ -1472,22 +1867,53 @@ bool CMainApplication::CreateAllShaders()
 		"}\n"
 		);
 
+	// Text, from the glyph atlas's signed distance fields: white where they're over one half,
+	// blended over a pixel's width of the field at the outline.
+	m_unGlyphProgramID = CompileGLShader(
+		"Glyph",
+
+		// vertex shader
+		"#version 410 core\n"
+		"layout(location = 0) in vec4 position;\n"
+		"layout(location = 1) in vec2 v2UVIn;\n"
+		"noperspective out vec2 v2UV;\n"
+		"void main()\n"
+		"{\n"
+		"	v2UV = v2UVIn;\n"
+		"	gl_Position = position;\n"
+		"}\n",
+
+		// fragment shader
+		"#version 410 core\n"
+		"uniform sampler2D mytexture;\n"
+		"noperspective in vec2 v2UV;\n"
+		"out vec4 outputColor;\n"
+		"void main()\n"
+		"{\n"
+		"	float distance = texture(mytexture, v2UV).r;\n"
+		"	float width = 0.5 * fwidth(distance);\n"
+		"	outputColor = vec4(1, 1, 1, smoothstep(0.5 - width, 0.5 + width, distance));\n"
+		"}\n"
+		);
+
+	// The function mesh is drawn straight from its static buffers. The vertex shader applies the
+	// projective pose, and the geometry shader divides by w, clipping triangles that cross w = 0
+	// into their pieces on either side, and leaves out triangles the lens draws instead. In
+	// single-pass stereo it runs once for each eye.
 	m_unFunctionProgramID = CompileGLShader(
 		"function mesh",
 
-		// vertex shaderc
+		// vertex shader
 		"#version 410 core\n"
-		"layout(location = 0) in vec4 vertexPosition_modelspace;\n"
-		"layout(location = 1) in vec3 vertexNormal;\n"
-		"uniform mat4 projection;\n"
-		"uniform vec3 surfaceColor;\n"
-		"out vec3 fragmentColor;\n"
-		"out vec3 texCoordsOut;\n"
+		"layout(location = 0) in vec4 vertexPosition_functionspace;\n"
+		"layout(location = 1) in vec4 vertexGradient;\n"
+		"uniform mat4 pose;\n"
+		"out vec4 posedPosition;\n"
+		"out vec3 posedNormal;\n"
 		"void main(void)\n"
 		"{\n"
-		"	gl_Position = projection*vertexPosition_modelspace;\n"
-		"	fragmentColor = surfaceColor * abs(dot(vertexNormal, vec3(0.4,0.7,0.5))) + 0.003*dot(vertexPosition_modelspace, vertexPosition_modelspace);\n"
-		"   texCoordsOut = vec3(vertexPosition_modelspace);\n"
+		"	posedPosition = pose*vertexPosition_functionspace;\n"
+		"	posedNormal = normalize(pose*vertexGradient).xyz;\n"
 		"}\n",
 
 		// fragment shader
@@ -1499,13 +1925,104 @@ bool CMainApplication::CreateAllShaders()
 		"void main(void)\n"
 		"{\n"
 		"    color = vec3(texture(myTexture, texCoordsOut))*fragmentColor;\n"
+		"}\n",
+
+		// geometry shader
+		(std::string(m_bSinglePassStereo ? "#version 410 core\n" "layout(triangles, invocations = 2) in;\n" : "#version 410 core\n" "layout(triangles) in;\n") +
+		"layout(triangle_strip, max_vertices = 8) out;\n"
+		"in vec4 posedPosition[];\n"
+		"in vec3 posedNormal[];\n"
+		"uniform mat4 projection[2];\n"
+		EYE_PLACEMENT_GLSL
+		"uniform vec3 surfaceColor;\n"
+		"uniform vec3 lensCenter;\n"
+		"uniform float lensRadius;\n"
+		"uniform int lensMode;\n"		// 0: no lens, 1: skip triangles inside it, 2: only triangles reaching into it
+		"out vec3 fragmentColor;\n"
+		"out vec3 texCoordsOut;\n"
+		"const float clipW = 0.0001;\n"
+		"void emitPolygon(vec4 p[4], vec3 n[4], int count)\n"
+		"{\n"
+		"	vec4 q[4];\n"
+		"	bool anyInside = false;\n"
+		"	bool allInside = true;\n"
+		"	for (int i = 0; i < count; i++)\n"
+		"	{\n"
+		"		q[i] = p[i] / p[i].w;\n"
+		"		bool inside = distance(q[i].xyz, lensCenter) < lensRadius;\n"
+		"		anyInside = anyInside || inside;\n"
+		"		allInside = allInside && inside;\n"
+		"	}\n"
+		"	if ((lensMode == 1 && allInside) || (lensMode == 2 && !anyInside))\n"
+		"		return;\n"
+		"	const int quadOrder[4] = int[4](0, 1, 3, 2);\n"
+		"	for (int v = 0; v < count; v++)\n"
+		"	{\n"
+		"		int i = (count == 4) ? quadOrder[v] : v;\n"
+		"		gl_Position = placeInEye(projection[gl_InvocationID]*q[i], gl_InvocationID);\n"
+		"		fragmentColor = surfaceColor * abs(dot(n[i], vec3(0.4,0.7,0.5))) + 0.003*dot(q[i], q[i]);\n"
+		"		texCoordsOut = q[i].xyz;\n"
+		"		EmitVertex();\n"
+		"	}\n"
+		"	EndPrimitive();\n"
+		"}\n"
+		"void emitClipped(float side)\n"	// The part of the triangle where side*w >= clipW.
+		"{\n"
+		"	vec4 p[4];\n"
+		"	vec3 n[4];\n"
+		"	int count = 0;\n"
+		"	for (int i = 0; i < 3; i++)\n"
+		"	{\n"
+		"		int j = (i + 1) % 3;\n"
+		"		float di = side*posedPosition[i].w - clipW;\n"
+		"		float dj = side*posedPosition[j].w - clipW;\n"
+		"		if (di >= 0)\n"
+		"		{\n"
+		"			p[count] = posedPosition[i];\n"
+		"			n[count] = posedNormal[i];\n"
+		"			count++;\n"
+		"		}\n"
+		"		if ((di >= 0) != (dj >= 0))\n"
+		"		{\n"
+		"			float t = di / (di - dj);\n"
+		"			p[count] = mix(posedPosition[i], posedPosition[j], t);\n"
+		"			n[count] = mix(posedNormal[i], posedNormal[j], t);\n"
+		"			count++;\n"
+		"		}\n"
+		"	}\n"
+		"	if (count >= 3)\n"
+		"		emitPolygon(p, n, count);\n"
 		"}\n"
+		"void main(void)\n"
+		"{\n"
+		"	if (gl_InvocationID >= eyeCount)\n"
+		"		return;\n"
+		"	float w0 = posedPosition[0].w;\n"
+		"	float w1 = posedPosition[1].w;\n"
+		"	float w2 = posedPosition[2].w;\n"
+		"	if ((w0 > 0 && w1 > 0 && w2 > 0) || (w0 < 0 && w1 < 0 && w2 < 0))\n"
+		"	{\n"
+		"		vec4 p[4] = vec4[4](posedPosition[0], posedPosition[1], posedPosition[2], vec4(0));\n"
+		"		vec3 n[4] = vec3[4](posedNormal[0], posedNormal[1], posedNormal[2], vec3(0));\n"
+		"		emitPolygon(p, n, 3);\n"
+		"	}\n"
+		"	else\n"
+		"	{\n"
+		"		emitClipped(1.0);\n"
+		"		emitClipped(-1.0);\n"
+		"	}\n"
+		"}\n").c_str()
 	);
 
 	m_nFunctionMatrixLocation = glGetUniformLocation(m_unFunctionProgramID, "projection");
+	m_nFunctionPoseLocation = glGetUniformLocation(m_unFunctionProgramID, "pose");
 	m_nFunctionSurfaceColorLocation = glGetUniformLocation(m_unFunctionProgramID, "surfaceColor");
+	m_nFunctionLensCenterLocation = glGetUniformLocation(m_unFunctionProgramID, "lensCenter");
+	m_nFunctionLensRadiusLocation = glGetUniformLocation(m_unFunctionProgramID, "lensRadius");
+	m_nFunctionLensModeLocation = glGetUniformLocation(m_unFunctionProgramID, "lensMode");
+	m_nFunctionEyeCountLocation = glGetUniformLocation(m_unFunctionProgramID, "eyeCount");
 
-	if (m_nFunctionMatrixLocation == -1)
+	if (m_nFunctionMatrixLocation == -1 || m_nFunctionPoseLocation == -1)
 	{
 		dprintf("Unable to find matrix uniform in function mesh shader\n");
 		return false;
@@ -1515,6 +2032,7 @@ bool CMainApplication::CreateAllShaders()
 		&& m_unControllerTransformProgramID != 0
 		&& m_unRenderModelProgramID != 0
 		&& m_unCompanionWindowProgramID != 0
+		&& m_unGlyphProgramID != 0
 		&& m_unFunctionProgramID;
 }
 
@@ -1572,7 +2090,9 @@ void CMainApplication::RenderControllerAxes()
 	if( m_pHMD->IsInputFocusCapturedByAnotherProcess() )
 		return;
 
-	std::vector<float> vertdataarray;
+	// Four lines of two vertices for each controller, at six floats a vertex.
+	float *vertdataarray = m_frameArena.Allocate<float>( vr::k_unMaxTrackedDeviceCount * 4 * 2 * 6 );
+	int nFloats = 0;
 
 	m_uiControllerVertcount = 0;
 	m_iTrackedControllerCount = 0;
@@ -1601,21 +2121,21 @@ void CMainApplication::RenderControllerAxes()
 			point[i] += 0.05f;  // offset in X, Y, Z
 			color[i] = 1.0;  // R, G, B
 			point = mat * point;
-			vertdataarray.push_back( center.x );
-			vertdataarray.push_back( center.y );
-			vertdataarray.push_back( center.z );
+			vertdataarray[ nFloats++ ] = center.x;
+			vertdataarray[ nFloats++ ] = center.y;
+			vertdataarray[ nFloats++ ] = center.z;
 
-			vertdataarray.push_back( color.x );
-			vertdataarray.push_back( color.y );
-			vertdataarray.push_back( color.z );
+			vertdataarray[ nFloats++ ] = color.x;
+			vertdataarray[ nFloats++ ] = color.y;
+			vertdataarray[ nFloats++ ] = color.z;
 		
-			vertdataarray.push_back( point.x );
-			vertdataarray.push_back( point.y );
-			vertdataarray.push_back( point.z );
+			vertdataarray[ nFloats++ ] = point.x;
+			vertdataarray[ nFloats++ ] = point.y;
+			vertdataarray[ nFloats++ ] = point.z;
 		
-			vertdataarray.push_back( color.x );
-			vertdataarray.push_back( color.y );
-			vertdataarray.push_back( color.z );
+			vertdataarray[ nFloats++ ] = color.x;
+			vertdataarray[ nFloats++ ] = color.y;
+			vertdataarray[ nFloats++ ] = color.z;
 		
 			m_uiControllerVertcount += 2;
 		}
@@ -1624,11 +2144,11 @@ void CMainApplication::RenderControllerAxes()
 		Vector4 end = mat * Vector4( 0, 0, -39.f, 1 );
 		Vector3 color( .92f, .92f, .71f );
 
-		vertdataarray.push_back( start.x );vertdataarray.push_back( start.y );vertdataarray.push_back( start.z );
-		vertdataarray.push_back( color.x );vertdataarray.push_back( color.y );vertdataarray.push_back( color.z );
+		vertdataarray[ nFloats++ ] = start.x;vertdataarray[ nFloats++ ] = start.y;vertdataarray[ nFloats++ ] = start.z;
+		vertdataarray[ nFloats++ ] = color.x;vertdataarray[ nFloats++ ] = color.y;vertdataarray[ nFloats++ ] = color.z;
 
-		vertdataarray.push_back( end.x );vertdataarray.push_back( end.y );vertdataarray.push_back( end.z );
-		vertdataarray.push_back( color.x );vertdataarray.push_back( color.y );vertdataarray.push_back( color.z );
+		vertdataarray[ nFloats++ ] = end.x;vertdataarray[ nFloats++ ] = end.y;vertdataarray[ nFloats++ ] = end.z;
+		vertdataarray[ nFloats++ ] = color.x;vertdataarray[ nFloats++ ] = color.y;vertdataarray[ nFloats++ ] = color.z;
 		m_uiControllerVertcount += 2;
 	}
 
@@ -1637,30 +2157,28 @@ void CMainApplication::RenderControllerAxes()
 	{
 		glGenVertexArrays( 1, &m_unControllerVAO );
 		glBindVertexArray( m_unControllerVAO );
-
-		glGenBuffers( 1, &m_glControllerVertBuffer );
-		glBindBuffer( GL_ARRAY_BUFFER, m_glControllerVertBuffer );
-
-		GLuint stride = 2 * 3 * sizeof( float );
-		uintptr_t offset = 0;
-
 		glEnableVertexAttribArray( 0 );
-		glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
-
-		offset += sizeof( Vector3 );
 		glEnableVertexAttribArray( 1 );
-		glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
-
 		glBindVertexArray( 0 );
 	}
 
-	glBindBuffer( GL_ARRAY_BUFFER, m_glControllerVertBuffer );
-
-	// set vertex data if we have some
-	if( vertdataarray.size() > 0 )
+	// set vertex data if we have some, pointing the VAO at where it went in the stream buffer
+	if( nFloats > 0 )
 	{
-		//$ TODO: Use glBufferSubData for this...
-		glBufferData( GL_ARRAY_BUFFER, sizeof(float) * vertdataarray.size(), &vertdataarray[0], GL_STREAM_DRAW );
+		GLintptr offset = m_streamBuffer.Write( vertdataarray, sizeof(float) * nFloats );
+		if ( offset < 0 )
+		{
+			m_uiControllerVertcount = 0;
+			return;
+		}
+		GLuint stride = 2 * 3 * sizeof( float );
+
+		glBindVertexArray( m_unControllerVAO );
+		glBindBuffer( GL_ARRAY_BUFFER, m_streamBuffer.GetBuffer() );
+		glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
+		glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, stride, (const void *)( offset + sizeof( Vector3 ) ));
+		glBindVertexArray( 0 );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
 	}
 }
 
@@ -1676,7 +2194,268 @@ void CMainApplication::SetupCameras()
 	m_mat4eyePosRight = GetHMDMatrixPoseEye( vr::Eye_Right );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Meshes the -streammesh equation to a file slab by slab. Returns the
+//          process exit code.
+//-----------------------------------------------------------------------------
+int CMainApplication::RunStreamMesher()
+{
+	try
+	{
+		Term* temp_term = Term::parseTerm(m_strStreamMeshEquation);
+		int degree;
+		Term* hommed_term = temp_term->homogenize(&degree);
+		delete temp_term;
+
+		bool written = StreamMeshToFile(hommed_term, m_strStreamMeshEquation, m_nStreamMeshDepth, m_chartSampling, m_strStreamMeshPath.c_str());
+		delete hommed_term;
+
+		return written ? 0 : 1;
+	}
+	catch (BadTermException bte)
+	{
+		dprintf("%s\n", bte.getErrorMessage());
+		return 1;
+	}
+}
+
 void CMainApplication::SetupFunction()
+{
+	if (m_nMeshWorkers > 0)
+	{
+		std::string worker_path = Path_Join(Path_StripFilename(Path_GetExecutablePath()), "pvmesh-worker.exe");
+		m_meshCoordinator = new MeshCoordinator(worker_path, m_nMeshWorkers);
+	}
+
+	// A mesh file brings its own equation.
+	StreamedMeshHeader header;
+	if (!m_strLoadMeshPath.empty())
+	{
+		if (ReadStreamedMeshHeader(m_strLoadMeshPath.c_str(), &header))
+		{
+			try
+			{
+				Term* temp_term = Term::parseTerm(header.equation);
+				m_functionTextInput.set_str(header.equation);
+
+				int degree;
+				m_function = temp_term->homogenize(&degree);
+				delete temp_term;
+
+				m_functionMesh = new FunctionMesh(m_function, m_strLoadMeshPath.c_str());
+				if (m_functionMesh->load_failed)
+				{
+					dprintf("Couldn't load mesh file %s; meshing its equation instead\n", m_strLoadMeshPath.c_str());
+					delete m_functionMesh;
+					m_functionMesh = new FunctionMesh(m_function, m_meshBudget, m_chartSampling, m_bUseSymmetry, m_meshCoordinator,
+					                                  m_bFindHiddenCrossings);
+				}
+			}
+			catch (BadTermException bte)
+			{
+				dprintf("%s\n", bte.getErrorMessage());
+			}
+		}
+		else
+		{
+			dprintf("Couldn't read mesh file %s; showing a random function instead\n", m_strLoadMeshPath.c_str());
+		}
+	}
+
+	if (m_functionMesh == NULL)
+		SetupRandomFunction();
+
+	m_functionLens = new FunctionLens(3, m_fLensBudgetMs);
+	m_functionLens->SetMesh(m_functionMesh);
+
+	// Positions and gradients are both 4-vectors, as the mesh stores them.
+	GLuint* meshVAOs[2] = { &m_functionVAO, &m_lensVAO };
+	GLuint* meshVertBuffers[2] = { &m_functionVertBuffer, &m_lensVertBuffer };
+	GLuint* meshGradientBuffers[2] = { &m_functionGradientBuffer, &m_lensGradientBuffer };
+	for (int n = 0; n < 2; n++)
+	{
+		glGenBuffers(1, meshVertBuffers[n]);
+		glGenBuffers(1, meshGradientBuffers[n]);
+		glGenVertexArrays(1, meshVAOs[n]);
+
+		glBindVertexArray(*meshVAOs[n]);
+		glBindBuffer(GL_ARRAY_BUFFER, *meshVertBuffers[n]);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		glBindBuffer(GL_ARRAY_BUFFER, *meshGradientBuffers[n]);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Multi-draw indirect is core only from GL 4.3; without it the draws are passed as arrays.
+	m_bDrawIndirect = GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+
+	UploadFunctionMesh();
+
+	m_functionPose.translate(Vector3(0, 1, 0));
+
+	// Debug Cubes stuff
+	m_posedDebugCubes = new PosedSegments(3);
+	m_posedDebugCubes->SetSegments(&m_functionMesh->debug_vertices, &m_functionMesh->debug_colors);
+
+	// Pointed at the stream buffer by UpdateDebugCubes.
+	glGenVertexArrays(1, &m_debugCubesVAO);
+	glBindVertexArray(m_debugCubesVAO);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glBindVertexArray(0);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies the function mesh, with all its levels of detail, to its static
+//          buffers all at once. Meshes built later are copied a frame at a time
+//          by ContinueFunctionMeshUpload instead.
+//-----------------------------------------------------------------------------
+void CMainApplication::UploadFunctionMesh()
+{
+	const FunctionMesh* mesh = m_functionMesh;
+	GLsizeiptr levelBytes = sizeof(Vector4) * mesh->vertices.size();
+	GLsizeiptr lodBytes = sizeof(Vector4) * mesh->lod_vertices.size();
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_functionVertBuffer);
+	glBufferData(GL_ARRAY_BUFFER, levelBytes + lodBytes, NULL, GL_STATIC_DRAW);
+	if (levelBytes > 0)
+		glBufferSubData(GL_ARRAY_BUFFER, 0, levelBytes, mesh->vertices.data());
+	if (lodBytes > 0)
+		glBufferSubData(GL_ARRAY_BUFFER, levelBytes, lodBytes, mesh->lod_vertices.data());
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_functionGradientBuffer);
+	glBufferData(GL_ARRAY_BUFFER, levelBytes + lodBytes, NULL, GL_STATIC_DRAW);
+	if (levelBytes > 0)
+		glBufferSubData(GL_ARRAY_BUFFER, 0, levelBytes, mesh->gradients.data());
+	if (lodBytes > 0)
+		glBufferSubData(GL_ARRAY_BUFFER, levelBytes, lodBytes, mesh->lod_gradients.data());
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The lens was cleared by SetMesh.
+	m_nUploadedLensRevision = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Takes the mesh that's just been built, and makes buffers for it, laid
+//          out as UploadFunctionMesh lays out the current mesh's.
+//-----------------------------------------------------------------------------
+void CMainApplication::BeginFunctionMeshUpload()
+{
+	m_stagedFunctionMesh = m_FunctionMeshUnderConstruction;
+	m_stagedFunction = m_functionUnderConstruction;
+	m_FunctionMeshUnderConstruction = NULL;
+	m_functionUnderConstruction = NULL;
+	m_nStagedBytes = 0;
+
+	GLsizeiptr bytes = sizeof(Vector4) * (m_stagedFunctionMesh->vertices.size() + m_stagedFunctionMesh->lod_vertices.size());
+
+	glGenBuffers(1, &m_stagedVertBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_stagedVertBuffer);
+	glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+	glGenBuffers(1, &m_stagedGradientBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_stagedGradientBuffer);
+	glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies this frame's share of the staged mesh to its buffers: the
+//          vertices, then the gradients, each level 0 first. Returns whether
+//          it's all been copied.
+//-----------------------------------------------------------------------------
+bool CMainApplication::ContinueFunctionMeshUpload()
+{
+	const FunctionMesh* mesh = m_stagedFunctionMesh;
+	GLsizeiptr levelBytes = sizeof(Vector4) * mesh->vertices.size();
+	GLsizeiptr lodBytes = sizeof(Vector4) * mesh->lod_vertices.size();
+
+	struct Piece
+	{
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr bytes;
+		const Vector4* data;
+	};
+	Piece pieces[4] = {
+		{ m_stagedVertBuffer, 0, levelBytes, mesh->vertices.data() },
+		{ m_stagedVertBuffer, levelBytes, lodBytes, mesh->lod_vertices.data() },
+		{ m_stagedGradientBuffer, 0, levelBytes, mesh->gradients.data() },
+		{ m_stagedGradientBuffer, levelBytes, lodBytes, mesh->lod_gradients.data() },
+	};
+
+	// At least a vertex a frame, however small the budget.
+	GLsizeiptr budget = (GLsizeiptr)(m_fMeshUploadMBPerFrame * 1024 * 1024);
+	if (budget < (GLsizeiptr)sizeof(Vector4))
+		budget = sizeof(Vector4);
+
+	// Where each piece starts in the whole upload, which goes through them in order.
+	GLsizeiptr pieceStart = 0;
+	for (int p = 0; p < _countof(pieces); p++)
+	{
+		const Piece& piece = pieces[p];
+		GLsizeiptr done = m_nStagedBytes - pieceStart;
+		if (done >= 0 && done < piece.bytes && budget > 0)
+		{
+			GLsizeiptr bytes = piece.bytes - done < budget ? piece.bytes - done : budget;
+			glBindBuffer(GL_ARRAY_BUFFER, piece.buffer);
+			glBufferSubData(GL_ARRAY_BUFFER, piece.offset + done, bytes, (const char*)piece.data + done);
+			m_nStagedBytes += bytes;
+			budget -= bytes;
+		}
+		pieceStart += piece.bytes;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return m_nStagedBytes == pieceStart;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Draws the staged mesh from now on, now that its buffers are full,
+//          and sends the old one to be deleted on a thread of its own.
+//-----------------------------------------------------------------------------
+void CMainApplication::SwapInFunctionMesh()
+{
+	m_functionLens->SetMesh(m_stagedFunctionMesh);
+	m_posedDebugCubes->SetSegments(&m_stagedFunctionMesh->debug_vertices, &m_stagedFunctionMesh->debug_colors);
+
+	FunctionMesh* old_mesh = m_functionMesh;
+	m_functionMesh = m_stagedFunctionMesh;
+	m_function = m_stagedFunction;
+	m_stagedFunctionMesh = NULL;
+	m_stagedFunction = NULL;
+
+	// The old buffers may still be in use by frames in flight; GL frees them once they're done.
+	glDeleteBuffers(1, &m_functionVertBuffer);
+	glDeleteBuffers(1, &m_functionGradientBuffer);
+	m_functionVertBuffer = m_stagedVertBuffer;
+	m_functionGradientBuffer = m_stagedGradientBuffer;
+	m_stagedVertBuffer = 0;
+	m_stagedGradientBuffer = 0;
+
+	glBindVertexArray(m_functionVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_functionVertBuffer);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glBindBuffer(GL_ARRAY_BUFFER, m_functionGradientBuffer);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The lens was cleared by SetMesh.
+	m_nUploadedLensRevision = -1;
+
+	DWORD threadID;
+	HANDLE delete_thread = CreateThread(NULL, 0, DeleteFunctionMeshStarter, old_mesh, 0, &threadID);
+	if (delete_thread != NULL)
+		CloseHandle(delete_thread);
+	else
+		delete old_mesh;
+}
+
+void CMainApplication::SetupRandomFunction()
 {
 	std::stringstream sstream;
 
@@ -1710,30 +2489,19 @@ void CMainApplication::SetupFunction()
 
 	std::cout << "Function initialized. Building mesh..." << std::endl;
 
-	m_functionMesh = new FunctionMesh(m_function);
+	m_functionMesh = new FunctionMesh(m_function, m_meshBudget, m_chartSampling, m_bUseSymmetry, m_meshCoordinator,
+	                                  m_bFindHiddenCrossings);
 
 	std::cout << "Mesh built." << std::endl;
+}
 
-	glGenBuffers(1, &m_functionVertBuffer);
-	glGenBuffers(1, &m_functionNormalBuffer);
+void CMainApplication::AsynchReplaceFunction()
+{
+	m_FunctionMeshUnderConstruction = new FunctionMesh(m_functionUnderConstruction, m_meshBudget, m_chartSampling, m_bUseSymmetry,
+	                                                   m_meshCoordinator, m_bFindHiddenCrossings);
 
-	glGenVertexArrays(1, &m_functionVAO);
-
-	m_functionPose.translate(Vector3(0, 1, 0));
-
-	// Debug Cubes stuff
-	glGenBuffers(1, &m_debugCubesVertBuffer);
-	glGenBuffers(1, &m_debugCubesColorBuffer);
-
-	glGenVertexArrays(1, &m_debugCubesVAO);
-}
-
-void CMainApplication::AsynchReplaceFunction()
-{
-	m_FunctionMeshUnderConstruction = new FunctionMesh(m_functionUnderConstruction);
-
-	m_bFunctionMeshIsUnderConstruction = false;
-}
+	m_bFunctionMeshIsUnderConstruction = false;
+}
 
 void CMainApplication::CreateAsynchReplaceFunctionThread()
 {
@@ -1761,65 +2529,242 @@ void CMainApplication::CreateAsynchReplaceFunctionThread()
 	}
 }
 
-void CMainApplication::RenderFunction( vr::Hmd_Eye nEye )
+//-----------------------------------------------------------------------------
+// Purpose: The pose of the function this frame, including any motion in progress.
+//-----------------------------------------------------------------------------
+Matrix4 CMainApplication::GetCurrentFunctionPose()
 {
-	int num_vertices = m_functionMesh->vertices.size();
+	return m_bTriggerIsHeld ? (m_fromTriggerPressedPose * m_functionPose) :
+		(m_bRotatingThroughInfinity ? m_temporaryRotation * m_functionPose :
+			m_functionPose);
+}
 
-	// Slight abbreviation.
-	std::vector<Vector4>& mesh_vertices = m_functionMesh->vertices;
-	std::vector<Vector4>& mesh_gradients = m_functionMesh->gradients;
+//-----------------------------------------------------------------------------
+// Purpose: Whether all the points lie beyond the same plane of the view frustum
+//          of viewProjection.
+//-----------------------------------------------------------------------------
+static bool AllOutsideFrustum(const Matrix4& viewProjection, const Vector3* points, int count)
+{
+	int outside[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < count; i++)
+	{
+		Vector4 c = viewProjection * Vector4(points[i].x, points[i].y, points[i].z, 1);
+		outside[0] += c.x < -c.w;
+		outside[1] += c.x > c.w;
+		outside[2] += c.y < -c.w;
+		outside[3] += c.y > c.w;
+		outside[4] += c.z < -c.w;
+		outside[5] += c.z > c.w;
+	}
 
-	std::vector<Vector4> culled_rotated_vertices;
-	std::vector<Vector3> normals_list;
-	culled_rotated_vertices.reserve(num_vertices);
-	normals_list.reserve(num_vertices);
+	for (int p = 0; p < 6; p++)
+	{
+		if (outside[p] == count)
+			return true;
+	}
+	return false;
+}
 
-	Matrix4 currentFunctionPose =
-		m_bTriggerIsHeld ? (m_fromTriggerPressedPose * m_functionPose) : 
-		(m_bRotatingThroughInfinity ? m_temporaryRotation * m_functionPose :
-			m_functionPose);
+//-----------------------------------------------------------------------------
+// Purpose: Picks the level of detail of each region of the function mesh from
+//          how large its cells appear from the head, and culls regions neither
+//          eye can see. Both eyes use the same levels.
+//-----------------------------------------------------------------------------
+void CMainApplication::UpdateRegionLevels()
+{
+	const std::vector<FunctionMesh::Region>& regions = m_functionMesh->regions;
+	m_regionLevels.assign(regions.size(), 0);
+
+	Matrix4 currentFunctionPose = GetCurrentFunctionPose();
+	Matrix4 leftViewProjection = GetCurrentViewProjectionMatrix(vr::Eye_Left);
+	Matrix4 rightViewProjection = GetCurrentViewProjectionMatrix(vr::Eye_Right);
+
+	const float* head = m_rmat4DevicePose[vr::k_unTrackedDeviceIndex_Hmd].get();
+	Vector3 head_position(head[12], head[13], head[14]);
 
-	for (int i = 0; i < num_vertices / 3; i++)
+	// Width of the eye's view in pixels per radian, near the center of the view.
+	float pixels_per_radian = m_mat4ProjectionLeft.get()[0] * m_nRenderWidth / 2;
+
+	for (int r = 0; r < regions.size(); r++)
 	{
-		Vector4 p1 = currentFunctionPose*mesh_vertices[3 * i];
-		Vector4 p2 = currentFunctionPose*mesh_vertices[3 * i + 1];
-		Vector4 p3 = currentFunctionPose*mesh_vertices[3 * i + 2];
+		const FunctionMesh::Region& region = regions[r];
 
-		if ((p1.w > 0 && p2.w > 0 && p3.w > 0) || (p1.w < 0 && p2.w < 0 && p3.w < 0))
+		// Corners of the region after the projective pose. A region crossing infinity
+		// has no finite bound, so it is always drawn, at full detail.
+		Vector3 corners[8];
+		bool positive = false;
+		bool negative = false;
+		for (int c = 0; c < 8; c++)
 		{
-			p1 /= p1.w;
-			p2 /= p2.w;
-			p3 /= p3.w;
-
-			Vector4 n1 = currentFunctionPose*mesh_gradients[3 * i];
-			Vector4 n2 = currentFunctionPose*mesh_gradients[3 * i + 1];
-			Vector4 n3 = currentFunctionPose*mesh_gradients[3 * i + 2];
+			Vector4 p = currentFunctionPose*region.corners[c];
+			positive = positive || p.w > 0;
+			negative = negative || p.w <= 0;
+			corners[c] = Vector3(p.x, p.y, p.z) / p.w;
+		}
+		if (positive && negative)
+			continue;
 
-			n1.normalize();
-			n2.normalize();
-			n3.normalize();
+		// Away from w = 0 the pose maps the region's box onto the convex hull of its
+		// corners' images, which is out of view if they're all beyond one side of it.
+		if (AllOutsideFrustum(leftViewProjection, corners, 8) && AllOutsideFrustum(rightViewProjection, corners, 8))
+		{
+			m_regionLevels[r] = -1;
+			continue;
+		}
 
-			normals_list.push_back(Vector3(n1.x,n1.y,n1.z));
-			normals_list.push_back(Vector3(n2.x,n2.y,n2.z));
-			normals_list.push_back(Vector3(n3.x,n3.y,n3.z));
+		if (!m_bLevelOfDetail)
+			continue;
 
-			culled_rotated_vertices.push_back(p1);
-			culled_rotated_vertices.push_back(p2);
-			culled_rotated_vertices.push_back(p3);
+		Vector3 center(0, 0, 0);
+		for (int c = 0; c < 8; c++)
+			center += corners[c] / 8;
+		float radius = 0;
+		for (int c = 0; c < 8; c++)
+		{
+			if (center.distance(corners[c]) > radius)
+				radius = center.distance(corners[c]);
 		}
+
+		float distance = center.distance(head_position) - radius;
+		if (distance <= 0)
+			continue;
+
+		// Use the coarsest level whose cells still look no bigger than m_fLodCellPixels.
+		float region_pixels = 2 * radius / distance * pixels_per_radian;
+		int level = 0;
+		while (level + 1 < region.level_count && region_pixels / region.levels[level + 1].cells <= m_fLodCellPixels)
+			level++;
+
+		m_regionLevels[r] = level;
 	}
+}
 
-	int num_culled_vertices = culled_rotated_vertices.size();
+//-----------------------------------------------------------------------------
+// Purpose: Lists the draws of the regions in view, at their levels of detail,
+//          once for both eyes. The coarser levels follow level 0 in the buffers.
+//-----------------------------------------------------------------------------
+void CMainApplication::UpdateFunctionDraws()
+{
+	m_functionDrawFirsts = m_frameArena.Allocate<GLint>(m_functionMesh->regions.size());
+	m_functionDrawCounts = m_frameArena.Allocate<GLsizei>(m_functionMesh->regions.size());
+	m_nFunctionDraws = 0;
+	for (int r = 0; r < m_functionMesh->regions.size(); r++)
+	{
+		int level = m_regionLevels[r];
+		if (level < 0)
+			continue;
 
-	// GL stuff for surface.
-	glUseProgram(m_unFunctionProgramID);
+		const FunctionMesh::RegionLevel& region_level = m_functionMesh->regions[r].levels[level];
+		if (region_level.vertex_count == 0)
+			continue;
 
-	glBindVertexArray(m_functionVAO);
+		m_functionDrawFirsts[m_nFunctionDraws] = (level == 0 ? 0 : (GLint)m_functionMesh->vertices.size()) + region_level.first_vertex;
+		m_functionDrawCounts[m_nFunctionDraws] = region_level.vertex_count;
+		m_nFunctionDraws++;
+	}
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
+	if (!m_bDrawIndirect)
+		return;
 
-	glUniformMatrix4fv(m_nFunctionMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix(nEye).get());
+	// Single-pass stereo draws both eyes from one instance, in the geometry shader.
+	if (m_nFunctionDraws == 0)
+		return;
+
+	m_functionDrawCommands = m_frameArena.Allocate<DrawArraysIndirectCommand>(m_nFunctionDraws);
+	for (int i = 0; i < m_nFunctionDraws; i++)
+	{
+		DrawArraysIndirectCommand& command = m_functionDrawCommands[i];
+		command.count = m_functionDrawCounts[i];
+		command.instanceCount = 1;
+		command.first = m_functionDrawFirsts[i];
+		command.baseInstance = 0;
+	}
+
+	// If the commands couldn't be written, this frame draws without them.
+	m_nFunctionIndirectOffset = m_streamBuffer.Write(m_functionDrawCommands, sizeof(DrawArraysIndirectCommand) * m_nFunctionDraws);
+	m_functionIndirectBuffer = m_nFunctionIndirectOffset < 0 ? 0 : m_streamBuffer.GetBuffer();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves the lens to the tip of the first tracked controller.
+//-----------------------------------------------------------------------------
+void CMainApplication::UpdateLens()
+{
+	if (!m_bLensActive)
+		return;
+
+	for (vr::TrackedDeviceIndex_t unDevice = vr::k_unTrackedDeviceIndex_Hmd + 1; unDevice < vr::k_unMaxTrackedDeviceCount; unDevice++)
+	{
+		if (m_pHMD->GetTrackedDeviceClass(unDevice) != vr::TrackedDeviceClass_Controller || !m_rTrackedDevicePose[unDevice].bPoseIsValid)
+			continue;
+
+		Vector4 tip = m_rmat4DevicePose[unDevice] * Vector4(0, 0, -0.02f - m_fLensRadius, 1);
+		m_lensCenter = Vector3(tip.x, tip.y, tip.z);
+		m_functionLens->Update(GetCurrentFunctionPose(), m_lensCenter, m_fLensRadius);
+		return;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Poses the debug cubes for this frame, for both eyes, if the pose has
+//          changed, and streams them. The stream buffer only keeps a frame's
+//          writes for that frame, so they're written every frame.
+//-----------------------------------------------------------------------------
+void CMainApplication::UpdateDebugCubes()
+{
+	m_nDebugCubesVertexCount = 0;
+	if (!m_bDebugCubes)
+		return;
+
+	m_posedDebugCubes->Update(GetCurrentFunctionPose());
+	GLsizei nVertices = m_posedDebugCubes->vertex_count;
+	if (nVertices == 0)
+		return;
+
+	// Each write may move the stream to a new buffer, so each attribute gets the buffer it went to.
+	GLintptr vertOffset = m_streamBuffer.Write(m_posedDebugCubes->vertices.data(), sizeof(Vector4) * nVertices);
+	GLuint vertBuffer = m_streamBuffer.GetBuffer();
+	GLintptr colorOffset = m_streamBuffer.Write(m_posedDebugCubes->colors.data(), sizeof(Vector3) * nVertices);
+	GLuint colorBuffer = m_streamBuffer.GetBuffer();
+	if (vertOffset < 0 || colorOffset < 0)
+		return;
+
+	glBindVertexArray(m_debugCubesVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, vertBuffer);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, (const void *)vertOffset);
+	glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (const void *)colorOffset);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	m_nDebugCubesVertexCount = nVertices;
+}
+
+void CMainApplication::RenderFunction( vr::Hmd_Eye nEye )
+{
+	Matrix4 currentFunctionPose = GetCurrentFunctionPose();
+
+	bool bLensShown = m_bLensActive && !m_functionLens->vertices.empty();
+
+	// The lens's triangles change only as its blocks finish.
+	if (bLensShown && m_nUploadedLensRevision != m_functionLens->revision)
+	{
+		GLsizeiptr lensBytes = sizeof(Vector4) * m_functionLens->vertices.size();
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_lensVertBuffer);
+		glBufferData(GL_ARRAY_BUFFER, lensBytes, m_functionLens->vertices.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, m_lensGradientBuffer);
+		glBufferData(GL_ARRAY_BUFFER, lensBytes, m_functionLens->gradients.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		m_nUploadedLensRevision = m_functionLens->revision;
+	}
+
+	// GL stuff for surface.
+	glUseProgram(m_unFunctionProgramID);
+
+	SetEyeMatrices(m_nFunctionMatrixLocation, m_nFunctionEyeCountLocation, nEye, Matrix4());
+	glUniformMatrix4fv(m_nFunctionPoseLocation, 1, GL_FALSE, currentFunctionPose.get());
 
 	if (m_bRotatingThroughInfinity)
 	{
@@ -1834,267 +2779,228 @@ void CMainApplication::RenderFunction( vr::Hmd_Eye nEye )
 		glUniform3f(m_nFunctionSurfaceColorLocation, (float)0x20 / 0xff, (float)0x6b / 0xff, (float)0xaf / 0xff); // 206bafff
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, m_functionVertBuffer);
-	glVertexAttribPointer(
-		0,
-		4,
-		GL_FLOAT,
-		GL_FALSE,
-		0,
-		(void*)0
-	);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*num_culled_vertices * 4, &(culled_rotated_vertices[0]), GL_DYNAMIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, m_functionNormalBuffer);
-	glVertexAttribPointer(
-		1,
-		3,
-		GL_FLOAT,
-		GL_FALSE,
-		0,
-		(void*)0
-	);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*num_culled_vertices * 3, &(normals_list[0]), GL_DYNAMIC_DRAW);
+	glUniform3f(m_nFunctionLensCenterLocation, m_lensCenter.x, m_lensCenter.y, m_lensCenter.z);
+	glUniform1f(m_nFunctionLensRadiusLocation, m_fLensRadius);
 
 	glBindTexture(GL_TEXTURE_3D, m_nFunctionTexture);
 
-	glDrawArrays(GL_TRIANGLES, 0, num_culled_vertices);
+	// The lens draws its own, finer version of whatever lies inside it.
+	glUniform1i(m_nFunctionLensModeLocation, bLensShown ? 1 : 0);
+	glBindVertexArray(m_functionVAO);
+	if (m_bDrawIndirect && m_functionIndirectBuffer != 0 && m_nFunctionDraws > 0)
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_functionIndirectBuffer);
+		glMultiDrawArraysIndirect(GL_TRIANGLES, (const void *)m_nFunctionIndirectOffset, m_nFunctionDraws, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	else if (m_nFunctionDraws > 0)
+	{
+		glMultiDrawArrays(GL_TRIANGLES, m_functionDrawFirsts, m_functionDrawCounts, m_nFunctionDraws);
+	}
 
-	glBindVertexArray(0);
+	// Composite the lens: its triangles that reach into the sphere.
+	if (bLensShown)
+	{
+		glUniform1i(m_nFunctionLensModeLocation, 2);
+		glBindVertexArray(m_lensVAO);
+		glDrawArrays(GL_TRIANGLES, 0, m_functionLens->vertices.size());
+	}
 
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
+	glBindVertexArray(0);
 
 	glBindTexture(GL_TEXTURE_3D, 0);
 
 
-	if (m_bDebugCubes)
+	if (m_nDebugCubesVertexCount > 0)
 	{
-		// Culling stuff for debug cubes
-
-		std::vector<Vector4> culled_debug_vertices;
-		std::vector<Vector3> culled_debug_colors;
-		culled_debug_vertices.reserve(m_functionMesh->debug_vertices.size());
-		culled_debug_colors.reserve(m_functionMesh->debug_colors.size());
-
-		for (int i = 0; i < m_functionMesh->debug_vertices.size() / 2; i++)
-		{
-			Vector4 p1 = currentFunctionPose*m_functionMesh->debug_vertices[2 * i];
-			Vector4 p2 = currentFunctionPose*m_functionMesh->debug_vertices[2 * i + 1];
-
-			if ((p1.w > 0 && p2.w > 0) || (p1.w < 0 && p2.w < 0))
-			{
-				p1 /= p1.w;
-				p2 /= p2.w;
-
-				culled_debug_vertices.push_back(p1);
-				culled_debug_vertices.push_back(p2);
-
-				culled_debug_colors.push_back(m_functionMesh->debug_colors[2 * i]);
-				culled_debug_colors.push_back(m_functionMesh->debug_colors[2 * i + 1]);
-			}
-		}
-
-		// GL stuff for debug cubes
+		// Posed, culled and streamed by UpdateDebugCubes.
 		glUseProgram(m_unControllerTransformProgramID); // We can reuse this one.
+		SetEyeMatrices(m_nControllerMatrixLocation, m_nControllerEyeCountLocation, nEye, Matrix4());
 
 		glBindVertexArray(m_debugCubesVAO);
+		glDrawArraysInstanced(GL_LINES, 0, m_nDebugCubesVertexCount, m_nPassEyeCount);
+		glBindVertexArray(0);
+	}
 
-		glEnableVertexAttribArray(0);
-		glEnableVertexAttribArray(1);
-
-		glUniformMatrix4fv(m_nControllerMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix(nEye).get());
+}
 
-		glBindBuffer(GL_ARRAY_BUFFER, m_debugCubesVertBuffer);
-		glVertexAttribPointer(
-			0,
-			4,
-			GL_FLOAT,
-			GL_FALSE,
-			0,
-			(void*)0
-		);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(float)*culled_debug_vertices.size() * 4, &(culled_debug_vertices[0]), GL_DYNAMIC_DRAW);
-
-		glBindBuffer(GL_ARRAY_BUFFER, m_debugCubesColorBuffer);
-		glVertexAttribPointer(
-			1,
-			3,
-			GL_FLOAT,
-			GL_FALSE,
-			0,
-			(void*)0
-		);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(float)*culled_debug_colors.size() * 3, &(culled_debug_colors[0]), GL_DYNAMIC_DRAW);
+//-----------------------------------------------------------------------------
+// Purpose: Adds a quad for glyph, with its origin at penx on the line at
+//          baseline, to a list of triangles with room for it.
+//-----------------------------------------------------------------------------
+void CMainApplication::AddGlyphQuad(VertexDataWindow *vVerts, int &nVerts, GLushort *vIndices, int &nIndices,
+	const GlyphAtlas::Glyph &glyph, float penx, float baseline, float scale)
+{
+	if (!glyph.present || glyph.width == 0)
+		return;
 
-		glDrawArrays(GL_LINES, 0, culled_debug_vertices.size());
+	float left = penx + scale * glyph.bearing_x;
+	float top = baseline + scale * glyph.bearing_y;
+	float bottom = top - scale * glyph.height;
+	float right = left + scale * glyph.width;
 
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-	}
+	GLushort first = (GLushort)nVerts;
+	vVerts[nVerts++] = VertexDataWindow(Vector2(left, bottom), Vector2(glyph.uv_min.x, glyph.uv_max.y));
+	vVerts[nVerts++] = VertexDataWindow(Vector2(right, bottom), Vector2(glyph.uv_max.x, glyph.uv_max.y));
+	vVerts[nVerts++] = VertexDataWindow(Vector2(left, top), Vector2(glyph.uv_min.x, glyph.uv_min.y));
+	vVerts[nVerts++] = VertexDataWindow(Vector2(right, top), Vector2(glyph.uv_max.x, glyph.uv_min.y));
 
+	GLushort quadIndices[] = { 0, 1, 3,   0, 3, 2 };
+	for (int i = 0; i < _countof(quadIndices); i++)
+		vIndices[nIndices++] = first + quadIndices[i];
 }
 
-void CMainApplication::RenderFunctionTextInput(vr::Hmd_Eye nEye)
+//-----------------------------------------------------------------------------
+// Purpose: Checks the typed function, and draws it into the text texture when
+//          what that shows has changed: the string, the cursor, or the
+//          background, which fades to red while the function stays invalid.
+//-----------------------------------------------------------------------------
+void CMainApplication::UpdateFunctionTextInput()
 {
-	// Render text to a relevant texture
+	if (!m_bInMenu)
+		return;
 
-	glUseProgram(m_unCompanionWindowProgramID);
+	FunctionTextInput &input = m_functionTextInput;
 
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_functionTextInput.glFramebufferId);
-	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE1, m_functionTextInput.glTextureId, 0);
-	
 	// They say not to use exceptions for control flow. Don't tell them.
-	// It also might be better to do this somewhere other than the drawing code. Don't tell anyone.
-	bool function_string_is_valid;
-	try
-	{
-		Term* term = Term::parseTerm(m_functionTextInput.str);
-		delete term;
-		m_functionTextInput.is_correct = true;
-		m_functionTextInput.ticks_when_last_valid = SDL_GetTicks();
-	}
-	catch (BadTermException bte)
+	if (!input.validated || input.str != input.validated_str)
 	{
-		function_string_is_valid = false;
-		m_functionTextInput.is_correct = false;
+		try
+		{
+			Term* term = Term::parseTerm(input.str);
+			delete term;
+			input.is_correct = true;
+		}
+		catch (BadTermException bte)
+		{
+			input.is_correct = false;
+		}
+		input.validated_str = input.str;
+		input.validated = true;
 	}
+	if (input.is_correct)
+		input.ticks_when_last_valid = SDL_GetTicks();
 
-	Uint32 ticks_since_last_valid = SDL_GetTicks() - m_functionTextInput.ticks_when_last_valid;
-	if (m_functionTextInput.is_correct || ticks_since_last_valid < 300)
-		glClearColor(0, 0, 0, 1);
+	Vector3 background(0, 0, 0);
+	Uint32 ticks_since_last_valid = SDL_GetTicks() - input.ticks_when_last_valid;
+	if (input.is_correct || ticks_since_last_valid < 300)
+		background.set(0, 0, 0);
 	else if (ticks_since_last_valid < 500)
 	{
 		float r = (float)(ticks_since_last_valid - 300) / 200;
-		glClearColor(r * (float)170 / 256, r * (float)23 / 256, r * (float)2 / 256, 1);
+		background.set(r * (float)170 / 256, r * (float)23 / 256, r * (float)2 / 256);
 	}
 	else
-		glClearColor((float)170/256, (float)23/256, (float)2/256, 1);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glClearColor(1, 1, 1, 1);
+		background.set((float)170/256, (float)23/256, (float)2/256);
 
-	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (input.rendered && input.str == input.rendered_str && input.cursor_pos == input.rendered_cursor_pos &&
+		background == input.rendered_background)
+		return;
 
-	glViewport(0, 0, m_functionTextInput.texture_width, m_functionTextInput.texture_height);
+	// Lay out the whole string, and the cursor, as one list of quads from the atlas.
+	static const char suffix[] = " = 0";
+	int nLength = (int)input.str.length() + (int)strlen(suffix);
+	char *str_to_show = m_frameArena.Allocate<char>(nLength);
+	memcpy(str_to_show, input.str.data(), input.str.length());
+	memcpy(str_to_show + input.str.length(), suffix, strlen(suffix));
 
-	glBindVertexArray(m_functionTextInput.glCharVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_functionTextInput.glCharVertBuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_functionTextInput.glCharIndexBuffer);
+	// A quad for each character and one for the cursor.
+	VertexDataWindow *vVerts = m_frameArena.Allocate<VertexDataWindow>(4 * (nLength + 1));
+	GLushort *vIndices = m_frameArena.Allocate<GLushort>(6 * (nLength + 1));
+	int nVerts = 0;
+	int nIndices = 0;
 
 	float penx = -0.95;
 	float peny = 0.85;
 	float line_height = 0.08;
+	const GlyphAtlas &atlas = input.atlas;
+	float scale = line_height / atlas.a_height;
 
-	FT_UInt glyph_index = FT_Get_Char_Index(m_robotoFace, 'A');
-	FT_Load_Glyph(m_robotoFace, glyph_index, FT_LOAD_DEFAULT);
-	float a_height = m_robotoFace->glyph->metrics.height;
-	static bool printed = false;
-	std::string str_to_show = m_functionTextInput.str;
-	str_to_show.append(" = 0");
-	for (int i = 0; i < str_to_show.length(); i++)
+	for (int i = 0; i < nLength; i++)
 	{
-		std::vector<VertexDataWindow> vVerts;
-
-		char c = str_to_show[i];
-		FT_UInt glyph_index = FT_Get_Char_Index(m_robotoFace, c);
-		FT_Load_Glyph(m_robotoFace, glyph_index, FT_LOAD_DEFAULT);
-		FT_Glyph_Metrics metrics = m_robotoFace->glyph->metrics;
-
-		float bearingX = (line_height / a_height) * metrics.horiBearingX;
-		float bearingY = (line_height / a_height) * metrics.horiBearingY;
-		float width = (line_height / a_height) * metrics.width;
-		float height = (line_height / a_height) * metrics.height;
+		unsigned char c = str_to_show[i];
+		if (c >= GlyphAtlas::glyph_count)
+			continue;
+		const GlyphAtlas::Glyph &glyph = atlas.glyphs[c];
 
-		vVerts.push_back(VertexDataWindow(Vector2(penx + bearingX, peny + bearingY - height), Vector2(0, 1)));
-		vVerts.push_back(VertexDataWindow(Vector2(penx + bearingX + width, peny + bearingY - height), Vector2(1, 1)));
-		vVerts.push_back(VertexDataWindow(Vector2(penx + bearingX, peny + bearingY), Vector2(0, 0)));
-		vVerts.push_back(VertexDataWindow(Vector2(penx + bearingX + width, peny + bearingY), Vector2(1, 0)));
+		AddGlyphQuad(vVerts, nVerts, vIndices, nIndices, glyph, penx, peny, scale);
 
-		if (i + 1 < str_to_show.length())
+		if (i + 1 < nLength && (unsigned char)str_to_show[i + 1] < GlyphAtlas::glyph_count)
 		{
-			// There's a next character, so compute kerning.
-			FT_UInt next_glyph_index = FT_Get_Char_Index(m_robotoFace, str_to_show[i + 1]);
-			FT_Vector delta;
-			FT_Get_Kerning(m_robotoFace, glyph_index, next_glyph_index, FT_KERNING_DEFAULT, &delta);
-			penx += (line_height / a_height) * delta.x;
+			// There's a next character, so add kerning.
+			penx += scale * atlas.kerning[c][(unsigned char)str_to_show[i + 1]];
 		}
 
-		penx += (line_height / a_height) * metrics.horiAdvance;
-
-		glBufferData(GL_ARRAY_BUFFER, vVerts.size() * sizeof(VertexDataWindow), &vVerts[0], GL_DYNAMIC_DRAW);
-
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexDataWindow), (void *)offsetof(VertexDataWindow, position));
-
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexDataWindow), (void *)offsetof(VertexDataWindow, texCoord));
-
-		glBindTexture(GL_TEXTURE_2D, m_functionTextInput.glCharTextures[c]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		penx += scale * glyph.advance;
 
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+		if (i + 1 == input.cursor_pos)
+			AddGlyphQuad(vVerts, nVerts, vIndices, nIndices, atlas.glyphs['|'], penx, peny, scale);
 
-		if (i + 1 == m_functionTextInput.cursor_pos)
+		// rough line-wrapping
+		if (penx > .9)
 		{
-			// Gotta draw a cursor
-			c = '|';
-			glyph_index = FT_Get_Char_Index(m_robotoFace, c);
-			FT_Load_Glyph(m_robotoFace, glyph_index, FT_LOAD_DEFAULT);
-			metrics = m_robotoFace->glyph->metrics;
-
-			bearingX = 0;
-			bearingY = (line_height / a_height) * metrics.horiBearingY;
-			width = (line_height / a_height) * metrics.width;
-			height = (line_height / a_height) * metrics.height;
-
-			vVerts.clear();
-			vVerts.push_back(VertexDataWindow(Vector2(penx + bearingX, peny + bearingY - height), Vector2(0, 1)));
-			vVerts.push_back(VertexDataWindow(Vector2(penx + bearingX + width, peny + bearingY - height), Vector2(1, 1)));
-			vVerts.push_back(VertexDataWindow(Vector2(penx + bearingX, peny + bearingY), Vector2(0, 0)));
-			vVerts.push_back(VertexDataWindow(Vector2(penx + bearingX + width, peny + bearingY), Vector2(1, 0)));
+			penx = -0.95;
+			peny -= scale * atlas.line_spacing;
+		}
+	}
 
-			glBufferData(GL_ARRAY_BUFFER, vVerts.size() * sizeof(VertexDataWindow), &vVerts[0], GL_DYNAMIC_DRAW);
+	// Streamed before the texture is touched, so that if they can't be, it keeps the old text and
+	// is redrawn next frame.
+	GLintptr vertOffset = 0;
+	GLuint vertBuffer = 0;
+	GLintptr indexOffset = 0;
+	GLuint indexBuffer = 0;
+	if (nIndices > 0)
+	{
+		vertOffset = m_streamBuffer.Write(vVerts, nVerts * sizeof(VertexDataWindow));
+		vertBuffer = m_streamBuffer.GetBuffer();
+		indexOffset = m_streamBuffer.Write(vIndices, nIndices * sizeof(GLushort));
+		indexBuffer = m_streamBuffer.GetBuffer();
+		if (vertOffset < 0 || indexOffset < 0)
+			return;
+	}
 
-			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexDataWindow), (void *)offsetof(VertexDataWindow, position));
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, input.glFramebufferId);
+	glViewport(0, 0, input.texture_width, input.texture_height);
 
-			glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexDataWindow), (void *)offsetof(VertexDataWindow, texCoord));
+	glClearColor(background.x, background.y, background.z, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
 
-			glBindTexture(GL_TEXTURE_2D, m_functionTextInput.glCharTextures[c]);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	if (nIndices > 0)
+	{
+		glUseProgram(m_unGlyphProgramID);
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-		}
+		glBindVertexArray(input.glCharVAO);
 
-		// rough line-wrapping
-		if (penx > .9)
-		{
-			penx = -0.95;
-			peny -= (line_height / a_height) * m_robotoFace->size->metrics.height;
-		}
+		glBindBuffer(GL_ARRAY_BUFFER, vertBuffer);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexDataWindow), (void *)(vertOffset + offsetof(VertexDataWindow, position)));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexDataWindow), (void *)(vertOffset + offsetof(VertexDataWindow, texCoord)));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
 
+		glBindTexture(GL_TEXTURE_2D, input.glAtlasTextureId);
+		glDrawElements(GL_TRIANGLES, nIndices, GL_UNSIGNED_SHORT, (void *)indexOffset);
 
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+		glUseProgram(0);
 	}
-	printed = true;
 
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
-	glViewport(0, 0, m_nRenderWidth, m_nRenderHeight);
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
-
-	if (nEye == vr::Eye_Left)
-		glBindFramebuffer(GL_FRAMEBUFFER, leftEyeDesc.m_nRenderFramebufferId);
-	else
-		glBindFramebuffer(GL_FRAMEBUFFER, rightEyeDesc.m_nRenderFramebufferId);
+	input.rendered_str = input.str;
+	input.rendered_cursor_pos = input.cursor_pos;
+	input.rendered_background = background;
+	input.rendered = true;
+}
 
-    // Now draw the stuff in 3D
+void CMainApplication::RenderFunctionTextInput(vr::Hmd_Eye nEye)
+{
+	// The text texture is kept up to date by UpdateFunctionTextInput.
 	glUseProgram(m_unSceneProgramID);
 
 	glUniformMatrix4fv(m_nSceneMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix(nEye).get());
@@ -2121,89 +3027,54 @@ void CMainApplication::SetupFunctionTextInput()
 {
 	FT_Init_FreeType(&m_ftLibrary);
 
+	// The font is shipped next to the executable, wherever it's run from.
+	std::string font_dir = Path_StripFilename(Path_GetExecutablePath());
+	std::string font_path = Path_Join(font_dir, "Roboto-Regular.ttf");
 	if (FT_New_Face(m_ftLibrary,
-		"Roboto-Regular.ttf",
+		font_path.c_str(),
 		0,
 		&m_robotoFace))
 	{
 		dprintf("Trouble loading font.\n");
 	}
 
-	if (FT_Set_Pixel_Sizes(m_robotoFace, 0, m_functionTextInput.char_texture_height))
+	// The glyphs' distance fields take a moment to compute, so they're kept next to the font.
+	FunctionTextInput &input = m_functionTextInput;
+	std::string cache_path = Path_Join(font_dir, "Roboto-Regular.glyphs");
+	if (!input.atlas.LoadOrBuild(m_robotoFace, font_path.c_str(), cache_path.c_str()))
 	{
-		dprintf("Trouble setting size of font.\n");
+		dprintf("Trouble building the glyph atlas.\n");
 	}
+	dprintf("Glyph atlas is %ix%i.\n", input.atlas.width, input.atlas.height);
 
-	// Set up textures for the characters we use.
-
-	for (int i = 0; i < 256; i++)
+	// Rows of the atlas aren't padded to 4 bytes.
+	glGenTextures(1, &input.glAtlasTextureId);
+	glBindTexture(GL_TEXTURE_2D, input.glAtlasTextureId);
+	if (!input.atlas.texels.empty())
 	{
-		FT_UInt glyph_index = FT_Get_Char_Index(m_robotoFace, i);
-		if (glyph_index == 0)
-		{
-			dprintf("Glyph %i: %c not found.\n", i, i);
-			continue;
-		}
-		if (FT_Load_Glyph(m_robotoFace, glyph_index, FT_LOAD_DEFAULT) != 0)
-		{
-			dprintf("Trouble loading glpyh %c.\n", i);
-			continue;
-		}
-		//dprintf("About to render %ith texture...\n", i);
-
-		if (FT_Render_Glyph(m_robotoFace->glyph, FT_RENDER_MODE_NORMAL))
-		{
-			dprintf("Trouble rendering glyph %i: %c\n", i, i);
-			continue;
-		}
-
-		if (m_robotoFace->glyph->bitmap.buffer == 0)
-		{
-			dprintf("Empty bitmap for glyph %i\n", i);
-			continue;
-		}
-
-		glGenTextures(1, &m_functionTextInput.glCharTextures[i]);
-		glBindTexture(GL_TEXTURE_2D, m_functionTextInput.glCharTextures[i]);
-
-		int width = m_robotoFace->glyph->bitmap.width;
-		int height = m_robotoFace->glyph->bitmap.rows;
-
-		dprintf("%c has a %ix%i size texture.\n", i, width, height);
-
-		// To avoid what looks like a bug in my OpenGL implementation, I'm manually converting
-		// from grayscale to RGBA, then passing this to OpenGL.
-		std::vector<Vector4> buffer_vec;
-		
-		for (int j = 0; j < m_robotoFace->glyph->bitmap.rows; j++)
-			for (int i = 0; i < m_robotoFace->glyph->bitmap.width; i++)
-				buffer_vec.push_back(Vector4(
-					1,
-					1,
-					1,
-					(float)(*(m_robotoFace->glyph->bitmap.buffer + width*j + i)) / 256.00));
-		
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
-			0, GL_RGBA, GL_FLOAT, &buffer_vec[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, input.atlas.width, input.atlas.height, 0, GL_RED, GL_UNSIGNED_BYTE, &input.atlas.texels[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	}
-	glBindTexture(GL_TEXTURE_2D, 0);
 
-	// Then vertex, index arrays and VAO for individual characters.
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
-	glGenBuffers(1, &m_functionTextInput.glCharVertBuffer);
-	glGenBuffers(1, &m_functionTextInput.glCharIndexBuffer);
+	// Then the VAO for the characters, whose vertices and indices go in the stream buffer.
 
 	glGenVertexArrays(1, &m_functionTextInput.glCharVAO);
 	glBindVertexArray(m_functionTextInput.glCharVAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, m_functionTextInput.glCharVertBuffer);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
 
 	GLushort vIndices[] = { 0, 1, 3,   0, 3, 2 };
 	int num_indices = _countof(vIndices);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_functionTextInput.glCharIndexBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(GLushort), &vIndices[0], GL_STATIC_DRAW);
-
 	// Set up the 3D part
 	std::vector<VertexDataScene> vVerts;
 
@@ -2268,10 +3139,11 @@ void CMainApplication::SetupFunctionTextInput()
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Creates a frame buffer. Returns true if the buffer was set up.
+// Purpose: Creates a frame buffer, and unless bResolve is false the buffer its
+//          samples are resolved into. Returns true if the buffer was set up.
 //          Returns false if the setup failed.
 //-----------------------------------------------------------------------------
-bool CMainApplication::CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc )
+bool CMainApplication::CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc, bool bResolve )
 {
 	glGenFramebuffers(1, &framebufferDesc.m_nRenderFramebufferId );
 	glBindFramebuffer(GL_FRAMEBUFFER, framebufferDesc.m_nRenderFramebufferId);
@@ -2286,6 +3158,13 @@ bool CMainApplication::CreateFrameBuffer( int nWidth, int nHeight, FramebufferDe
 	glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGBA8, nWidth, nHeight, true);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, framebufferDesc.m_nRenderTextureId, 0);
 
+	if ( !bResolve )
+	{
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		return status == GL_FRAMEBUFFER_COMPLETE;
+	}
+
 	glGenFramebuffers(1, &framebufferDesc.m_nResolveFramebufferId );
 	glBindFramebuffer(GL_FRAMEBUFFER, framebufferDesc.m_nResolveFramebufferId);
 
@@ -2321,6 +3200,17 @@ bool CMainApplication::SetupStereoRenderTargets()
 
 	CreateFrameBuffer( m_nRenderWidth, m_nRenderHeight, leftEyeDesc );
 	CreateFrameBuffer( m_nRenderWidth, m_nRenderHeight, rightEyeDesc );
+
+	if ( m_bSinglePassStereo )
+	{
+		GLint nMaxSize = 0;
+		glGetIntegerv( GL_MAX_RENDERBUFFER_SIZE, &nMaxSize );
+		if ( 2 * m_nRenderWidth > (uint32_t)nMaxSize || !CreateFrameBuffer( 2 * m_nRenderWidth, m_nRenderHeight, stereoDesc ) )
+		{
+			dprintf( "Unable to create the side-by-side target, rendering an eye at a time\n" );
+			m_bSinglePassStereo = false;
+		}
+	}
 	
 	return true;
 }
@@ -2386,6 +3276,43 @@ void CMainApplication::RenderStereoTargets()
 	glClearColor( 1.0f, 1.0f, 1.0f, 1.0f );
 	glEnable( GL_MULTISAMPLE );
 
+	if ( m_bSinglePassStereo && !m_bInMenu )
+	{
+		// Both eyes at once, left and right halves
+		glBindFramebuffer( GL_FRAMEBUFFER, stereoDesc.m_nRenderFramebufferId );
+		glViewport( 0, 0, 2 * m_nRenderWidth, m_nRenderHeight );
+		glEnable( GL_CLIP_DISTANCE0 );
+		m_nPassEyeCount = 2;
+		RenderScene( vr::Eye_Left );
+		m_nPassEyeCount = 1;
+		glDisable( GL_CLIP_DISTANCE0 );
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+		glDisable( GL_MULTISAMPLE );
+
+		// A blit out of a multisampled buffer must have the same bounds on both sides, so
+		// the whole target is resolved at once, and each half then copied to its eye.
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, stereoDesc.m_nRenderFramebufferId );
+		glBindFramebuffer( GL_DRAW_FRAMEBUFFER, stereoDesc.m_nResolveFramebufferId );
+		glBlitFramebuffer( 0, 0, 2 * m_nRenderWidth, m_nRenderHeight, 0, 0, 2 * m_nRenderWidth, m_nRenderHeight,
+			GL_COLOR_BUFFER_BIT,
+			GL_LINEAR );
+
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, stereoDesc.m_nResolveFramebufferId );
+		glBindFramebuffer( GL_DRAW_FRAMEBUFFER, leftEyeDesc.m_nResolveFramebufferId );
+		glBlitFramebuffer( 0, 0, m_nRenderWidth, m_nRenderHeight, 0, 0, m_nRenderWidth, m_nRenderHeight,
+			GL_COLOR_BUFFER_BIT,
+			GL_NEAREST );
+		glBindFramebuffer( GL_DRAW_FRAMEBUFFER, rightEyeDesc.m_nResolveFramebufferId );
+		glBlitFramebuffer( m_nRenderWidth, 0, 2 * m_nRenderWidth, m_nRenderHeight, 0, 0, m_nRenderWidth, m_nRenderHeight,
+			GL_COLOR_BUFFER_BIT,
+			GL_NEAREST );
+
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+		glBindFramebuffer( GL_DRAW_FRAMEBUFFER, 0 );
+		return;
+	}
+
 	// Left Eye
 	glBindFramebuffer( GL_FRAMEBUFFER, leftEyeDesc.m_nRenderFramebufferId );
  	glViewport(0, 0, m_nRenderWidth, m_nRenderHeight );
@@ -2427,7 +3354,8 @@ void CMainApplication::RenderStereoTargets()
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Renders a scene with respect to nEye.
+// Purpose: Renders a scene with respect to nEye, or to both eyes when
+//          m_nPassEyeCount is 2.
 //-----------------------------------------------------------------------------
 void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 {
@@ -2445,9 +3373,9 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 	{
 		// draw the controller axis lines
 		glUseProgram( m_unControllerTransformProgramID );
-		glUniformMatrix4fv( m_nControllerMatrixLocation, 1, GL_FALSE, GetCurrentViewProjectionMatrix( nEye ).get() );
+		SetEyeMatrices( m_nControllerMatrixLocation, m_nControllerEyeCountLocation, nEye, Matrix4() );
 		glBindVertexArray( m_unControllerVAO );
-		glDrawArrays( GL_LINES, 0, m_uiControllerVertcount );
+		glDrawArraysInstanced( GL_LINES, 0, m_uiControllerVertcount, m_nPassEyeCount );
 		glBindVertexArray( 0 );
 	}
 
@@ -2470,10 +3398,9 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 			continue;
 
 		const Matrix4 & matDeviceToTracking = m_rmat4DevicePose[ unTrackedDevice ];
-		Matrix4 matMVP = GetCurrentViewProjectionMatrix( nEye ) * matDeviceToTracking;
-		glUniformMatrix4fv( m_nRenderModelMatrixLocation, 1, GL_FALSE, matMVP.get() );
+		SetEyeMatrices( m_nRenderModelMatrixLocation, m_nRenderModelEyeCountLocation, nEye, matDeviceToTracking );
 
-		m_rTrackedDeviceToRenderModel[ unTrackedDevice ]->Draw();
+		m_rTrackedDeviceToRenderModel[ unTrackedDevice ]->Draw( m_nPassEyeCount );
 	}
 
 	glUseProgram( 0 );
@@ -2571,6 +3498,29 @@ Matrix4 CMainApplication::GetCurrentViewProjectionMatrix( vr::Hmd_Eye nEye )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Sets a shader's matrix array to the view-projection times matModel of
+//          each eye drawn this pass, nEye alone or both eyes in single-pass stereo,
+//          and its eyeCount to how many there are.
+//-----------------------------------------------------------------------------
+void CMainApplication::SetEyeMatrices( GLint nMatrixLocation, GLint nEyeCountLocation, vr::Hmd_Eye nEye, const Matrix4 &matModel )
+{
+	float matrices[2][16];
+	if ( m_nPassEyeCount == 2 )
+	{
+		memcpy( matrices[0], ( GetCurrentViewProjectionMatrix( vr::Eye_Left ) * matModel ).get(), sizeof( matrices[0] ) );
+		memcpy( matrices[1], ( GetCurrentViewProjectionMatrix( vr::Eye_Right ) * matModel ).get(), sizeof( matrices[1] ) );
+	}
+	else
+	{
+		memcpy( matrices[0], ( GetCurrentViewProjectionMatrix( nEye ) * matModel ).get(), sizeof( matrices[0] ) );
+	}
+
+	glUniformMatrix4fv( nMatrixLocation, m_nPassEyeCount, GL_FALSE, &matrices[0][0] );
+	glUniform1i( nEyeCountLocation, m_nPassEyeCount );
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -2840,19 +3790,248 @@ void CGLRenderModel::Cleanup()
 //-----------------------------------------------------------------------------
 // Purpose: Draws the render model
 //-----------------------------------------------------------------------------
-void CGLRenderModel::Draw()
+void CGLRenderModel::Draw( GLsizei nInstances )
 {
 	glBindVertexArray( m_glVertArray );
 
 	glActiveTexture( GL_TEXTURE0 );
 	glBindTexture( GL_TEXTURE_2D, m_glTexture );
 
-	glDrawElements( GL_TRIANGLES, m_unVertexCount, GL_UNSIGNED_SHORT, 0 );
+	glDrawElementsInstanced( GL_TRIANGLES, m_unVertexCount, GL_UNSIGNED_SHORT, 0, nInstances );
 
 	glBindVertexArray( 0 );
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Create/destroy the stream buffer
+//-----------------------------------------------------------------------------
+CGLStreamBuffer::CGLStreamBuffer()
+{
+	m_glBuffer = 0;
+	m_nCapacity = 0;
+	m_bPersistent = false;
+	m_pMapped = NULL;
+	m_nHead = 0;
+	m_nFrameBegin = 0;
+	m_nFirstPending = 0;
+	m_nPendingFrames = 0;
+}
+
+
+CGLStreamBuffer::~CGLStreamBuffer()
+{
+	Cleanup();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Allocates the ring, persistently mapped if the driver can
+//-----------------------------------------------------------------------------
+bool CGLStreamBuffer::BInit( GLsizeiptr nCapacity )
+{
+	m_bPersistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	return CreateBuffer( nCapacity );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees the ring
+//-----------------------------------------------------------------------------
+void CGLStreamBuffer::Cleanup()
+{
+	if ( m_glBuffer )
+		DeleteBuffer();
+	if ( !m_retiredBuffers.empty() )
+		glDeleteBuffers( (GLsizei)m_retiredBuffers.size(), &m_retiredBuffers[0] );
+	m_retiredBuffers.clear();
+}
+
+
+bool CGLStreamBuffer::CreateBuffer( GLsizeiptr nCapacity )
+{
+	glGenBuffers( 1, &m_glBuffer );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, m_glBuffer );
+	if ( m_bPersistent )
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage( GL_COPY_WRITE_BUFFER, nCapacity, NULL, flags );
+		m_pMapped = (unsigned char *)glMapBufferRange( GL_COPY_WRITE_BUFFER, 0, nCapacity, flags );
+	}
+	else
+	{
+		glBufferData( GL_COPY_WRITE_BUFFER, nCapacity, NULL, GL_STREAM_DRAW );
+	}
+	glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+
+	m_nCapacity = nCapacity;
+	m_nHead = 0;
+	m_nFrameBegin = 0;
+
+	return !m_bPersistent || m_pMapped != NULL;
+}
+
+
+void CGLStreamBuffer::DeleteBuffer()
+{
+	RetirePendingFrames( m_nPendingFrames );
+
+	// Deleting unmaps it. Draws already issued from it still finish.
+	glDeleteBuffers( 1, &m_glBuffer );
+	m_glBuffer = 0;
+	m_pMapped = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Whether the bytes from nBegin to nEnd, around the ring, meet the
+//          nBytes at nOffset
+//-----------------------------------------------------------------------------
+bool CGLStreamBuffer::BOverlaps( GLintptr nBegin, GLintptr nEnd, GLintptr nOffset, GLsizeiptr nBytes ) const
+{
+	if ( nBegin <= nEnd )
+		return nBegin < nOffset + nBytes && nOffset < nEnd;
+	return nOffset < nEnd || nOffset + nBytes > nBegin;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Forgets the oldest nCount pending frames, once their part of the
+//          ring is free to write again
+//-----------------------------------------------------------------------------
+void CGLStreamBuffer::RetirePendingFrames( int nCount )
+{
+	for ( int i = 0; i < nCount; i++ )
+		glDeleteSync( PendingAt( i ).sync );
+	m_nFirstPending = ( m_nFirstPending + nCount ) % k_nMaxPendingFrames;
+	m_nPendingFrames -= nCount;
+}
+
+
+GLintptr CGLStreamBuffer::Write( const void *pData, GLsizeiptr nBytes, GLsizeiptr nAlignment )
+{
+	GLintptr nOffset = ( m_nHead + nAlignment - 1 ) / nAlignment * nAlignment;
+	bool bWrapped = nOffset + nBytes > m_nCapacity;
+	if ( bWrapped )
+		nOffset = 0;
+
+	// Orphaning gives every lap of the ring fresh memory, but a mapped ring has to hold all of
+	// this frame's writes at once.
+	bool bFrameFull = false;
+	if ( m_bPersistent && m_nHead != m_nFrameBegin )
+	{
+		if ( m_nHead > m_nFrameBegin )
+			bFrameFull = bWrapped && nOffset + nBytes >= m_nFrameBegin;
+		else
+			bFrameFull = bWrapped || nOffset + nBytes >= m_nFrameBegin;
+	}
+
+	// Grow, keeping the old buffer for this frame's draws from it. Nothing will be written to it
+	// again, so its fences are done with.
+	if ( nBytes > m_nCapacity || bFrameFull )
+	{
+		GLsizeiptr nCapacity = 2 * m_nCapacity;
+		while ( nCapacity < 4 * nBytes )
+			nCapacity *= 2;
+		RetirePendingFrames( m_nPendingFrames );
+		m_retiredBuffers.push_back( m_glBuffer );
+		if ( !CreateBuffer( nCapacity ) )
+			dprintf( "Unable to map the stream buffer\n" );
+		nOffset = 0;
+		bWrapped = false;
+	}
+
+	if ( m_bPersistent && !m_pMapped )
+		return -1;
+
+	if ( m_bPersistent )
+	{
+		// Wait for the GPU to finish the frames whose part of the ring this overwrites. They finish
+		// in order, so waiting for the last of them is enough.
+		int nRetire = 0;
+		for ( int i = 0; i < m_nPendingFrames; i++ )
+		{
+			if ( BOverlaps( PendingAt( i ).nBegin, PendingAt( i ).nEnd, nOffset, nBytes ) )
+				nRetire = i + 1;
+		}
+		if ( nRetire > 0 )
+		{
+			// A frame's draws take milliseconds; if they haven't finished in a second, or the wait
+			// fails, the GPU is in no state to draw this either.
+			GLenum eWait = glClientWaitSync( PendingAt( nRetire - 1 ).sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 );
+			if ( eWait == GL_TIMEOUT_EXPIRED || eWait == GL_WAIT_FAILED )
+			{
+				dprintf( "Gave up waiting for the GPU to finish with the stream buffer\n" );
+				return -1;
+			}
+			RetirePendingFrames( nRetire );
+		}
+
+		memcpy( m_pMapped + nOffset, pData, nBytes );
+	}
+	else
+	{
+		glBindBuffer( GL_COPY_WRITE_BUFFER, m_glBuffer );
+		if ( bWrapped )
+			glBufferData( GL_COPY_WRITE_BUFFER, m_nCapacity, NULL, GL_STREAM_DRAW );
+		void *pMapped = glMapBufferRange( GL_COPY_WRITE_BUFFER, nOffset, nBytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
+		if ( pMapped )
+		{
+			memcpy( pMapped, pData, nBytes );
+			glUnmapBuffer( GL_COPY_WRITE_BUFFER );
+		}
+		glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+		if ( !pMapped )
+			return -1;
+	}
+
+	m_nHead = nOffset + nBytes;
+	return nOffset;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Fences off what this frame wrote, once its draws are all issued
+//-----------------------------------------------------------------------------
+void CGLStreamBuffer::EndFrame()
+{
+	if ( !m_retiredBuffers.empty() )
+	{
+		glDeleteBuffers( (GLsizei)m_retiredBuffers.size(), &m_retiredBuffers[0] );
+		m_retiredBuffers.clear();
+	}
+
+	if ( !m_bPersistent || m_nHead == m_nFrameBegin )
+		return;
+
+	if ( m_nPendingFrames == k_nMaxPendingFrames )
+	{
+		GLenum eWait = glClientWaitSync( PendingAt( 0 ).sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 );
+		if ( eWait == GL_TIMEOUT_EXPIRED || eWait == GL_WAIT_FAILED )
+		{
+			// None of the ring is known to be free, so carry on in a new buffer. The old one goes
+			// at the end of the next frame, and GL keeps it until the draws from it finish.
+			dprintf( "Gave up waiting for the GPU to finish with the stream buffer\n" );
+			RetirePendingFrames( m_nPendingFrames );
+			m_retiredBuffers.push_back( m_glBuffer );
+			if ( !CreateBuffer( m_nCapacity ) )
+				dprintf( "Unable to map the stream buffer\n" );
+			return;
+		}
+		RetirePendingFrames( 1 );
+	}
+
+	PendingFrame &frame = PendingAt( m_nPendingFrames );
+	frame.sync = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	frame.nBegin = m_nFrameBegin;
+	frame.nEnd = m_nHead;
+	m_nPendingFrames++;
+
+	m_nFrameBegin = m_nHead;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -2860,6 +4039,9 @@ int main(int argc, char *argv[])
 {
 	CMainApplication *pMainApplication = new CMainApplication( argc, argv );
 
+	if (pMainApplication->BStreamMeshOnly())
+		return pMainApplication->RunStreamMesher();
+
 	if (!pMainApplication->BInit())
 	{
 		pMainApplication->Shutdown();
@@ -0,0 +1,583 @@
+#include "latticeevaluator.h"
+
+#include <cmath>
+#include <algorithm>
+
+// How far a row's coordinates may stray from an even spacing and still be stepped as evenly spaced.
+static const double spacing_tolerance = 1e-12;
+
+void LatticeEvaluator::Evaluate(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                                double* values_out) const
+{
+    for (int i = 0; i < x1.size(); i++)
+    {   for (int j = 0; j < x2.size(); j++)
+        {
+            EvaluateRow(e1, e2, e3, e4, x1[i], x2[j], x3.data(), x3.size(), values_out + (i*x2.size() + j)*x3.size());
+        }
+    }
+}
+
+LatticeEvaluator* CreateLatticeEvaluator(Term* f)
+{
+    try
+    {
+        Polynomial expanded = f->expandUpTo(EdgeSolver::max_degree);
+        return CreateLatticeEvaluator(f, &expanded);
+    }
+    catch (BadTermException e)
+    {
+    }
+    return CreateLatticeEvaluator(f, 0);
+}
+
+LatticeEvaluator* CreateLatticeEvaluator(Term* f, const Polynomial* expanded)
+{
+    if (expanded)
+        return new ExactDyadicEvaluator(*expanded);
+    return new TermLatticeEvaluator(f);
+}
+
+void TermLatticeEvaluator::EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                       double x1, double x2, const double* x3, int count, double* values_out) const
+{
+    for (int k = 0; k < count; k++)
+        values_out[k] = f->eval(e4 + x1*e1 + x2*e2 + x3[k]*e3);
+}
+
+static double EvaluatePolynomial(const double* p, int degree, double t)
+{
+    double value = p[degree];
+    for (int n = degree - 1; n >= 0; n--)
+        value = value*t + p[n];
+    return value;
+}
+
+void ForwardDifferenceEvaluator::EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                             double x1, double x2, const double* x3, int count, double* values_out) const
+{
+    if (count <= 0)
+        return;
+
+    int degree = row_polynomials.GetDegree();
+    double h = (count > 1) ? x3[1] - x3[0] : 1;
+    bool even = true;
+    for (int k = 2; k < count && even; k++)
+        even = fabs(x3[k] - (x3[0] + k*h)) <= spacing_tolerance*(fabs(x3[0]) + fabs(k*h));
+
+    // On an even row the polynomial is in the sample index; otherwise it's in x3 itself.
+    double origin = even ? x3[0] : 0;
+    double step = even ? h : 1;
+    double start[4], end[4];
+    for (int var = 0; var < 4; var++)
+    {
+        start[var] = (double)e4[var] + x1*e1[var] + x2*e2[var] + origin*e3[var];
+        end[var] = start[var] + step*e3[var];
+    }
+
+    double p[EdgeSolver::max_degree + 1];
+    row_polynomials.Restrict(start, end, p);
+
+    if (!even)
+    {
+        for (int k = 0; k < count; k++)
+            values_out[k] = EvaluatePolynomial(p, degree, x3[k]);
+        return;
+    }
+
+    // differences[n] is the n-th forward difference of the row at the current sample.
+    double differences[EdgeSolver::max_degree + 1];
+    for (int k = 0; k < count; k++)
+    {
+        if (k % reseed_interval == 0)
+        {
+            for (int n = 0; n <= degree; n++)
+                differences[n] = EvaluatePolynomial(p, degree, k + n);
+            for (int order = 1; order <= degree; order++)
+            {
+                for (int n = degree; n >= order; n--)
+                    differences[n] -= differences[n - 1];
+            }
+        }
+
+        values_out[k] = differences[0];
+        for (int n = 0; n < degree; n++)
+            differences[n] += differences[n + 1];
+    }
+}
+
+// The coordinate e is the unit vector of, if it's one.
+static bool CoordinateAxis(const Vector4& e, int* axis_out)
+{
+    int axis = -1;
+    for (int var = 0; var < 4; var++)
+    {
+        if (e[var] == 0)
+            continue;
+        if (e[var] != 1 || axis >= 0)
+            return false;
+        axis = var;
+    }
+    *axis_out = axis;
+    return axis >= 0;
+}
+
+// Which coordinate each of e1..e4 is the unit vector of, if the basis is made of them, as the charts' are.
+static bool ChartAxes(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4, int axes_out[4])
+{
+    if (!CoordinateAxis(e1, &axes_out[0]) || !CoordinateAxis(e2, &axes_out[1])
+        || !CoordinateAxis(e3, &axes_out[2]) || !CoordinateAxis(e4, &axes_out[3]))
+        return false;
+    for (int a = 0; a < 4; a++)
+    {
+        for (int b = a + 1; b < 4; b++)
+        {
+            if (axes_out[a] == axes_out[b])
+                return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+struct ChartMonomial
+{
+    int exponents[3];           // Of x1, x2, x3.
+    T coefficient;
+};
+
+// Powers 0 to max_exponent of each coordinate, into powers_out[a*count + n].
+template <typename T>
+static void PowerTable(const T* x, int count, int max_exponent, std::vector<T>* powers_out)
+{
+    powers_out->resize((max_exponent + 1)*count);
+    for (int n = 0; n < count; n++)
+        (*powers_out)[n] = 1;
+    for (int a = 1; a <= max_exponent; a++)
+    {
+        for (int n = 0; n < count; n++)
+            (*powers_out)[a*count + n] = (*powers_out)[(a - 1)*count + n]*x[n];
+    }
+}
+
+// The sum factorization described in latticeevaluator.h, for monomials sorted by a1, then a2.
+template <typename T>
+static void ContractLattice(const std::vector<ChartMonomial<T> >& monomials, const T* x1, int n1, const T* x2, int n2,
+                            const T* x3, int n3, T* values_out)
+{
+    int max_exponent[3] = { 0, 0, 0 };
+    for (int m = 0; m < monomials.size(); m++)
+    {
+        for (int n = 0; n < 3; n++)
+        {
+            if (monomials[m].exponents[n] > max_exponent[n])
+                max_exponent[n] = monomials[m].exponents[n];
+        }
+    }
+
+    std::vector<T> powers1, powers2, powers3;
+    PowerTable(x1, n1, max_exponent[0], &powers1);
+    PowerTable(x2, n2, max_exponent[1], &powers2);
+    PowerTable(x3, n3, max_exponent[2], &powers3);
+
+    std::fill(values_out, values_out + n1*n2*n3, T(0));
+
+    std::vector<T> g(n3);
+    std::vector<T> h(n2*n3);
+    int m = 0;
+    while (m < monomials.size())
+    {
+        int a1 = monomials[m].exponents[0];
+        std::fill(h.begin(), h.end(), T(0));
+
+        while (m < monomials.size() && monomials[m].exponents[0] == a1)
+        {
+            int a2 = monomials[m].exponents[1];
+            std::fill(g.begin(), g.end(), T(0));
+
+            for (; m < monomials.size() && monomials[m].exponents[0] == a1 && monomials[m].exponents[1] == a2; m++)
+            {
+                const T c = monomials[m].coefficient;
+                const T* p3 = &powers3[monomials[m].exponents[2]*n3];
+                for (int k = 0; k < n3; k++)
+                    g[k] += c*p3[k];
+            }
+
+            const T* p2 = &powers2[a2*n2];
+            for (int j = 0; j < n2; j++)
+            {
+                T* h_row = &h[j*n3];
+                for (int k = 0; k < n3; k++)
+                    h_row[k] += p2[j]*g[k];
+            }
+        }
+
+        const T* p1 = &powers1[a1*n1];
+        for (int i = 0; i < n1; i++)
+        {
+            T* values = values_out + i*n2*n3;
+            for (int jk = 0; jk < n2*n3; jk++)
+                values[jk] += p1[i]*h[jk];
+        }
+    }
+}
+
+template <typename T>
+static bool ByFirstExponents(const ChartMonomial<T>& a, const ChartMonomial<T>& b)
+{
+    return a.exponents[0] < b.exponents[0] || (a.exponents[0] == b.exponents[0] && a.exponents[1] < b.exponents[1]);
+}
+
+// Double-double numbers, hi + lo with |lo| at most half an ulp of hi, which carry about 104 bits.
+struct DoubleDouble
+{
+    double hi;
+    double lo;
+};
+
+static DoubleDouble QuickTwoSum(double a, double b)
+{
+    DoubleDouble s;
+    s.hi = a + b;
+    s.lo = b - (s.hi - a);
+    return s;
+}
+
+static DoubleDouble Add(const DoubleDouble& a, const DoubleDouble& b)
+{
+    double hi = a.hi + b.hi;
+    double a_part = hi - b.hi;
+    double lo = (a.hi - a_part) + (b.hi - (hi - a_part)) + a.lo + b.lo;
+    return QuickTwoSum(hi, lo);
+}
+
+static DoubleDouble Multiply(const DoubleDouble& a, double b)
+{
+    double hi = a.hi*b;
+    double lo = fma(a.hi, b, -hi) + a.lo*b;
+    return QuickTwoSum(hi, lo);
+}
+
+// The unit roundoff of doubles, and a bound on the relative error of a double-double operation, which
+// is a few times its own.
+static const double double_epsilon = 1.0/9007199254740992.0;
+static const double double_double_epsilon = 1.0/1125899906842624.0/1125899906842624.0;
+
+// Higham's gamma(n), bounding the relative error of n operations in a row.
+static double Gamma(int n, double epsilon)
+{
+    return n*epsilon/(1 - n*epsilon);
+}
+
+static double DoubleDoubleValue(const std::vector<Polynomial::Monomial>& terms, const int axes[4], double x1, double x2, double x3)
+{
+    DoubleDouble value = { 0, 0 };
+    for (int m = 0; m < terms.size(); m++)
+    {
+        DoubleDouble monomial = { terms[m].coefficient, 0 };
+        for (int n = 0; n < terms[m].exponents[axes[0]]; n++)
+            monomial = Multiply(monomial, x1);
+        for (int n = 0; n < terms[m].exponents[axes[1]]; n++)
+            monomial = Multiply(monomial, x2);
+        for (int n = 0; n < terms[m].exponents[axes[2]]; n++)
+            monomial = Multiply(monomial, x3);
+        value = Add(value, monomial);
+    }
+    return value.hi + value.lo;
+}
+
+static double LargestMagnitude(const double* x, int count, double largest)
+{
+    for (int n = 0; n < count; n++)
+    {
+        if (fabs(x[n]) > largest)
+            largest = fabs(x[n]);
+    }
+    return largest;
+}
+
+TensorProductEvaluator::TensorProductEvaluator(const Polynomial& f) : ForwardDifferenceEvaluator(f), terms(f.getTerms())
+{
+    coefficient_sum = 0;
+    for (int m = 0; m < terms.size(); m++)
+        coefficient_sum += fabs(terms[m].coefficient);
+}
+
+// Values whose sign the evaluation might have got wrong, being at most bound, are evaluated again.
+static void RefineSmallValues(const std::vector<Polynomial::Monomial>& terms, const int axes[4], double bound,
+                              double double_double_bound, const double* x1, int n1, const double* x2, int n2,
+                              const double* x3, int n3, double* values_out)
+{
+    for (int i = 0; i < n1; i++)
+    {   for (int j = 0; j < n2; j++)
+        {   for (int k = 0; k < n3; k++)
+            {
+                double* value = &values_out[(i*n2 + j)*n3 + k];
+                if (fabs(*value) > bound)
+                    continue;
+                *value = DoubleDoubleValue(terms, axes, x1[i], x2[j], x3[k]);
+                if (fabs(*value) <= double_double_bound)
+                    *value = 0;
+            }
+        }
+    }
+}
+
+bool TensorProductEvaluator::ContractFiltered(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                              const double* x1, int n1, const double* x2, int n2, const double* x3, int n3,
+                                              double* values_out) const
+{
+    int axes[4];
+    if (!ChartAxes(e1, e2, e3, e4, axes))
+        return false;
+
+    // The chart's own coordinate is 1, so its exponents drop out.
+    std::vector<ChartMonomial<double> > monomials(terms.size());
+    int degree = 0;
+    for (int m = 0; m < terms.size(); m++)
+    {
+        for (int n = 0; n < 3; n++)
+            monomials[m].exponents[n] = terms[m].exponents[axes[n]];
+        monomials[m].coefficient = terms[m].coefficient;
+
+        int chart_degree = monomials[m].exponents[0] + monomials[m].exponents[1] + monomials[m].exponents[2];
+        if (chart_degree > degree)
+            degree = chart_degree;
+    }
+    std::sort(monomials.begin(), monomials.end(), ByFirstExponents<double>);
+
+    ContractLattice(monomials, x1, n1, x2, n2, x3, n3, values_out);
+
+    // Each monomial takes at most degree + 3 roundings on its way into the sum, which takes one more for each.
+    double largest = LargestMagnitude(x3, n3, LargestMagnitude(x2, n2, LargestMagnitude(x1, n1, 1)));
+    double magnitude = coefficient_sum*pow(largest, degree);
+    int operations = degree + 3 + (int)terms.size();
+    RefineSmallValues(terms, axes, Gamma(operations, double_epsilon)*magnitude, Gamma(operations, double_double_epsilon)*magnitude,
+                      x1, n1, x2, n2, x3, n3, values_out);
+    return true;
+}
+
+// A row is f's polynomial in x3 there, built from the monomials and evaluated by Horner's rule.
+bool TensorProductEvaluator::EvaluateRowFiltered(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                                 double x1, double x2, const double* x3, int count, double* values_out) const
+{
+    int axes[4];
+    if (!ChartAxes(e1, e2, e3, e4, axes))
+        return false;
+
+    double p[EdgeSolver::max_degree + 1];
+    for (int n = 0; n <= EdgeSolver::max_degree; n++)
+        p[n] = 0;
+    int degree = 0;
+    for (int m = 0; m < terms.size(); m++)
+    {
+        double monomial = terms[m].coefficient;
+        for (int n = 0; n < terms[m].exponents[axes[0]]; n++)
+            monomial *= x1;
+        for (int n = 0; n < terms[m].exponents[axes[1]]; n++)
+            monomial *= x2;
+        int a3 = terms[m].exponents[axes[2]];
+        p[a3] += monomial;
+
+        int chart_degree = terms[m].exponents[axes[0]] + terms[m].exponents[axes[1]] + a3;
+        if (chart_degree > degree)
+            degree = chart_degree;
+    }
+
+    for (int k = 0; k < count; k++)
+    {
+        double value = p[degree];
+        for (int n = degree - 1; n >= 0; n--)
+            value = value*x3[k] + p[n];
+        values_out[k] = value;
+    }
+
+    // Horner's rule adds two roundings a step to each monomial's.
+    double largest = LargestMagnitude(x3, count, LargestMagnitude(&x2, 1, LargestMagnitude(&x1, 1, 1)));
+    double magnitude = coefficient_sum*pow(largest, degree);
+    int operations = 3*degree + 1 + (int)terms.size();
+    RefineSmallValues(terms, axes, Gamma(operations, double_epsilon)*magnitude, Gamma(operations, double_double_epsilon)*magnitude,
+                      &x1, 1, &x2, 1, x3, count, values_out);
+    return true;
+}
+
+void TensorProductEvaluator::Evaluate(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                      const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                                      double* values_out) const
+{
+    if (!ContractFiltered(e1, e2, e3, e4, x1.data(), x1.size(), x2.data(), x2.size(), x3.data(), x3.size(), values_out))
+        LatticeEvaluator::Evaluate(e1, e2, e3, e4, x1, x2, x3, values_out);
+}
+
+void TensorProductEvaluator::EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                         double x1, double x2, const double* x3, int count, double* values_out) const
+{
+    if (!EvaluateRowFiltered(e1, e2, e3, e4, x1, x2, x3, count, values_out))
+        ForwardDifferenceEvaluator::EvaluateRow(e1, e2, e3, e4, x1, x2, x3, count, values_out);
+}
+
+ExactDyadicEvaluator::ExactDyadicEvaluator(const Polynomial& f) : TensorProductEvaluator(f)
+{
+    // Beyond 2^53 doubles no longer hold every integer, so a coefficient there might not be the one meant.
+    integer_coefficients = true;
+    for (int m = 0; m < terms.size(); m++)
+    {
+        double c = terms[m].coefficient;
+        if (c != floor(c) || fabs(c) >= 9007199254740992.0)
+            integer_coefficients = false;
+    }
+}
+
+// Raises *bits until every coordinate is a multiple of 2^-bits, and *largest to the largest of their
+// absolute values. Returns false if that would take more than max_bits.
+static bool DyadicBits(const double* x, int count, int max_bits, int* bits, double* largest)
+{
+    double scale = ldexp(1.0, *bits);
+    for (int n = 0; n < count; n++)
+    {
+        while (*bits <= max_bits && x[n]*scale != floor(x[n]*scale))
+        {
+            (*bits)++;
+            scale *= 2;
+        }
+        if (*bits > max_bits)
+            return false;
+        if (fabs(x[n]) > *largest)
+            *largest = fabs(x[n]);
+    }
+    return true;
+}
+
+template <typename T>
+static void DyadicNumerators(const double* x, int count, int bits, std::vector<T>* numerators_out)
+{
+    double scale = ldexp(1.0, bits);
+    numerators_out->resize(count);
+    for (int n = 0; n < count; n++)
+        (*numerators_out)[n] = (T)(x[n]*scale);
+}
+
+bool ExactDyadicEvaluator::DyadicScale(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                       const double* x1, int n1, const double* x2, int n2, const double* x3, int n3,
+                                       int axes_out[4], int* bits_out, int* degree_out, bool* fits_int_out) const
+{
+    if (!integer_coefficients || !ChartAxes(e1, e2, e3, e4, axes_out))
+        return false;
+
+    int bits = 0;
+    double largest = 1;
+    if (!DyadicBits(x1, n1, max_dyadic_bits, &bits, &largest) || !DyadicBits(x2, n2, max_dyadic_bits, &bits, &largest)
+        || !DyadicBits(x3, n3, max_dyadic_bits, &bits, &largest))
+        return false;
+
+    int degree = 0;
+    for (int m = 0; m < terms.size(); m++)
+    {
+        int chart_degree = terms[m].exponents[axes_out[0]] + terms[m].exponents[axes_out[1]] + terms[m].exponents[axes_out[2]];
+        if (chart_degree > degree)
+            degree = chart_degree;
+    }
+
+    // Every monomial of 2^(bits*degree) f is at most its coefficient times radix^degree, and so is every
+    // partial sum of them that's formed on the way, all told.
+    double bound = coefficient_sum*pow(ldexp(largest, bits), degree);
+    if (bound >= ldexp(1.0, 62))
+        return false;
+
+    *bits_out = bits;
+    *degree_out = degree;
+    *fits_int_out = (bound < ldexp(1.0, 30));
+    return true;
+}
+
+template <typename T>
+static void ContractDyadicLattice(const std::vector<Polynomial::Monomial>& terms, const int axes[4], int bits, int degree,
+                                  const double* x1, int n1, const double* x2, int n2, const double* x3, int n3,
+                                  double* values_out)
+{
+    std::vector<ChartMonomial<T> > monomials(terms.size());
+    for (int m = 0; m < terms.size(); m++)
+    {
+        for (int n = 0; n < 3; n++)
+            monomials[m].exponents[n] = terms[m].exponents[axes[n]];
+        int chart_degree = monomials[m].exponents[0] + monomials[m].exponents[1] + monomials[m].exponents[2];
+        monomials[m].coefficient = (T)((long long)terms[m].coefficient * (1LL << (bits*(degree - chart_degree))));
+    }
+    std::sort(monomials.begin(), monomials.end(), ByFirstExponents<T>);
+
+    std::vector<T> m1, m2, m3;
+    DyadicNumerators(x1, n1, bits, &m1);
+    DyadicNumerators(x2, n2, bits, &m2);
+    DyadicNumerators(x3, n3, bits, &m3);
+
+    std::vector<T> scaled_values(n1*n2*n3);
+    ContractLattice(monomials, m1.data(), n1, m2.data(), n2, m3.data(), n3, scaled_values.data());
+
+    double scale = ldexp(1.0, -bits*degree);
+    for (int n = 0; n < n1*n2*n3; n++)
+        values_out[n] = (double)scaled_values[n]*scale;
+}
+
+// Along a row the scaled f is a polynomial in the numerator of x3, evaluated by Horner's rule; its
+// partial sums are bounded just as the contraction's are.
+template <typename T>
+static void EvaluateDyadicRow(const std::vector<Polynomial::Monomial>& terms, const int axes[4], int bits, int degree,
+                              double x1, double x2, const double* x3, int count, double* values_out)
+{
+    double numerator_scale = ldexp(1.0, bits);
+    double value_scale = ldexp(1.0, -bits*degree);
+    T m1 = (T)(x1*numerator_scale);
+    T m2 = (T)(x2*numerator_scale);
+
+    T p[EdgeSolver::max_degree + 1];
+    for (int n = 0; n <= degree; n++)
+        p[n] = 0;
+    for (int m = 0; m < terms.size(); m++)
+    {
+        int a1 = terms[m].exponents[axes[0]];
+        int a2 = terms[m].exponents[axes[1]];
+        int a3 = terms[m].exponents[axes[2]];
+        T monomial = (T)((long long)terms[m].coefficient * (1LL << (bits*(degree - a1 - a2 - a3))));
+        for (int n = 0; n < a1; n++)
+            monomial *= m1;
+        for (int n = 0; n < a2; n++)
+            monomial *= m2;
+        p[a3] += monomial;
+    }
+
+    for (int k = 0; k < count; k++)
+    {
+        T m3 = (T)(x3[k]*numerator_scale);
+        T value = p[degree];
+        for (int n = degree - 1; n >= 0; n--)
+            value = value*m3 + p[n];
+        values_out[k] = (double)value*value_scale;
+    }
+}
+
+void ExactDyadicEvaluator::Evaluate(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                    const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                                    double* values_out) const
+{
+    int axes[4], bits, degree;
+    bool fits_int;
+    if (!DyadicScale(e1, e2, e3, e4, x1.data(), x1.size(), x2.data(), x2.size(), x3.data(), x3.size(), axes, &bits, &degree, &fits_int))
+        TensorProductEvaluator::Evaluate(e1, e2, e3, e4, x1, x2, x3, values_out);
+    else if (fits_int)
+        ContractDyadicLattice<int>(terms, axes, bits, degree, x1.data(), x1.size(), x2.data(), x2.size(), x3.data(), x3.size(), values_out);
+    else
+        ContractDyadicLattice<long long>(terms, axes, bits, degree, x1.data(), x1.size(), x2.data(), x2.size(), x3.data(), x3.size(), values_out);
+}
+
+void ExactDyadicEvaluator::EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                                       double x1, double x2, const double* x3, int count, double* values_out) const
+{
+    int axes[4], bits, degree;
+    bool fits_int;
+    if (!DyadicScale(e1, e2, e3, e4, &x1, 1, &x2, 1, x3, count, axes, &bits, &degree, &fits_int))
+        TensorProductEvaluator::EvaluateRow(e1, e2, e3, e4, x1, x2, x3, count, values_out);
+    else if (fits_int)
+        EvaluateDyadicRow<int>(terms, axes, bits, degree, x1, x2, x3, count, values_out);
+    else
+        EvaluateDyadicRow<long long>(terms, axes, bits, degree, x1, x2, x3, count, values_out);
+}
@@ -0,0 +1,138 @@
+#ifndef LATTICEEVALUATOR_H
+#define LATTICEEVALUATOR_H
+
+#include <vector>
+
+#include "term.h"
+#include "edgesolver.h"
+#include "shared/Vectors.h"
+
+// Evaluates f on the lattice of (part of) a chart: the points e4 + x1[i]*e1 + x2[j]*e2 + x3[k]*e3,
+// where e1..e4 is the chart basis (see FunctionMesh::GetChartBasis) and x1, x2, x3 are the chart
+// coordinates of the lattice planes along each axis. Lattices are nearly all samples of f the mesher
+// takes, so how they're evaluated matters far more than evaluating single points.
+class LatticeEvaluator
+{
+public:
+    virtual ~LatticeEvaluator() {}
+
+    // Values at every point of the lattice, into values_out[(i*x2.size() + j)*x3.size() + k].
+    // By default a row at a time.
+    virtual void Evaluate(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                          const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                          double* values_out) const;
+
+    // Values along one row, at e4 + x1*e1 + x2*e2 + x3[k]*e3 for k < count.
+    virtual void EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                             double x1, double x2, const double* x3, int count, double* values_out) const = 0;
+};
+
+// Warning: allocates a new LatticeEvaluator.
+// The fastest evaluator that can handle f, which must outlive it.
+LatticeEvaluator* CreateLatticeEvaluator(Term* f);
+// As above, for an f that has already been expanded; expanded is null if f isn't a polynomial of
+// at most EdgeSolver::max_degree.
+LatticeEvaluator* CreateLatticeEvaluator(Term* f, const Polynomial* expanded);
+
+// Evaluates any f one point at a time with Term::eval.
+class TermLatticeEvaluator : public LatticeEvaluator
+{
+public:
+    explicit TermLatticeEvaluator(Term* f) : f(f) {}
+
+    virtual void EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                             double x1, double x2, const double* x3, int count, double* values_out) const;
+
+private:
+    Term* f;
+};
+
+// For polynomials. Along a row, f is a polynomial of its degree d in the row's chart coordinate; see
+// EdgeSolver::Restrict. On an evenly spaced row it is stepped by forward differences: once a table of
+// d+1 differences is seeded, each sample takes d additions. The table is seeded again from the row's
+// polynomial every reseed_interval samples, before rounding error can build up. Rows that aren't
+// evenly spaced, as with SAMPLING_EQUIANGULAR, get their polynomial evaluated by Horner's rule.
+class ForwardDifferenceEvaluator : public LatticeEvaluator
+{
+public:
+    // f must be of at most EdgeSolver::max_degree.
+    explicit ForwardDifferenceEvaluator(const Polynomial& f) : row_polynomials(f) {}
+
+    virtual void EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                             double x1, double x2, const double* x3, int count, double* values_out) const;
+
+private:
+    static const int reseed_interval = 32;
+
+    EdgeSolver row_polynomials;
+};
+
+// For polynomials, on the charts of FunctionMesh, whose bases are coordinate vectors. There f is a sum
+// of monomials c x1^a1 x2^a2 x3^a3 in the chart coordinates, and a whole lattice is contracted one
+// axis at a time from tables of powers along each axis:
+//   g(a1,a2)[k] = sum over a3 of c x3[k]^a3,  h(a1)[j][k] = sum over a2 of x2[j]^a2 g(a1,a2)[k],
+//   f[i][j][k] = sum over a1 of x1[i]^a1 h(a1)[j][k].
+// That takes about N^3 (d+1) operations for a lattice of N^3 points, however many monomials f has.
+// Rows are evaluated by Horner's rule in x3. Lattices in any other basis are evaluated row by row as
+// by ForwardDifferenceEvaluator, without the check below.
+//
+// The sign of each value is checked against a forward error bound for the whole lattice,
+// gamma(D + M + 3) sum|c| R^D, for M monomials of degree at most D in chart coordinates at most R
+// (or 1) in size; rows have a bound of the same form. Values within the bound, whose sign might be
+// wrong, are evaluated again in double-double arithmetic, and taken to be 0 if still too small to tell.
+class TensorProductEvaluator : public ForwardDifferenceEvaluator
+{
+public:
+    // f must be of at most EdgeSolver::max_degree.
+    explicit TensorProductEvaluator(const Polynomial& f);
+
+    virtual void Evaluate(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                          const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                          double* values_out) const;
+    virtual void EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                             double x1, double x2, const double* x3, int count, double* values_out) const;
+
+protected:
+    std::vector<Polynomial::Monomial> terms;
+    double coefficient_sum;     // Of their absolute values; bounds the values and their errors.
+
+private:
+    bool ContractFiltered(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                          const double* x1, int n1, const double* x2, int n2, const double* x3, int n3,
+                          double* values_out) const;
+    bool EvaluateRowFiltered(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                             double x1, double x2, const double* x3, int count, double* values_out) const;
+};
+
+// For polynomials with integer coefficients, on lattices whose coordinates are all dyadic, m/2^s with
+// s at most max_dyadic_bits, as they are with SAMPLING_CUBE. Then 2^(sD) f, with D the degree of f in
+// the chart coordinates, is an integer at every point, and is evaluated exactly in 64-bit integers by
+// the same sum factorization. The values come back as doubles, rounded, but with their signs and zeros
+// exactly right. Lattices that aren't dyadic in a coordinate basis, or where f could overflow, are
+// evaluated as by TensorProductEvaluator.
+class ExactDyadicEvaluator : public TensorProductEvaluator
+{
+public:
+    // f must be of at most EdgeSolver::max_degree.
+    explicit ExactDyadicEvaluator(const Polynomial& f);
+
+    virtual void Evaluate(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                          const std::vector<double>& x1, const std::vector<double>& x2, const std::vector<double>& x3,
+                          double* values_out) const;
+    virtual void EvaluateRow(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                             double x1, double x2, const double* x3, int count, double* values_out) const;
+
+private:
+    static const int max_dyadic_bits = 30;
+
+    // Whether the lattice can be evaluated exactly, and if so, the basis's axes, the bits of the
+    // coordinates' denominators, the degree of f in the chart coordinates, and whether 2^(bits*degree) f
+    // fits in an int everywhere on it, which lets the compiler fit more of it into each vector register.
+    bool DyadicScale(const Vector4& e1, const Vector4& e2, const Vector4& e3, const Vector4& e4,
+                     const double* x1, int n1, const double* x2, int n2, const double* x3, int n3,
+                     int axes_out[4], int* bits_out, int* degree_out, bool* fits_int_out) const;
+
+    bool integer_coefficients;
+};
+
+#endif // LATTICEEVALUATOR_H
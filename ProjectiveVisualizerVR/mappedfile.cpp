@@ -0,0 +1,200 @@
+#include "mappedfile.h"
+
+#include <cstring>
+
+MappedFile::MappedFile()
+{
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+    writable = false;
+    view = NULL;
+    view_offset = 0;
+    view_bytes = 0;
+    position = 0;
+    size = 0;
+    capacity = 0;
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::OpenForWriting(const char* path)
+{
+    Close();
+
+    file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    // The mapping is only created once there is something to write; an empty file can't be mapped.
+    writable = true;
+    position = 0;
+    size = 0;
+    capacity = 0;
+    return true;
+}
+
+bool MappedFile::OpenForReading(const char* path)
+{
+    Close();
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    writable = false;
+    position = 0;
+    size = file_size.QuadPart;
+    capacity = size;
+    return true;
+}
+
+void MappedFile::Unmap()
+{
+    if (view != NULL)
+        UnmapViewOfFile(view);
+    view = NULL;
+    view_bytes = 0;
+}
+
+bool MappedFile::MapWindow(unsigned long long offset)
+{
+    Unmap();
+
+    // Views have to start on a multiple of the allocation granularity.
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    view_offset = offset - offset % system_info.dwAllocationGranularity;
+
+    view_bytes = capacity - view_offset;
+    if (view_bytes > window_bytes)
+        view_bytes = window_bytes;
+
+    view = (unsigned char*)MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                         (DWORD)(view_offset >> 32), (DWORD)(view_offset & 0xFFFFFFFF), (size_t)view_bytes);
+    if (view == NULL)
+    {
+        view_bytes = 0;
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::Grow(unsigned long long needed)
+{
+    Unmap();
+    if (mapping != NULL)
+        CloseHandle(mapping);
+
+    // Mapping a file past its end extends it.
+    capacity = (needed + growth_bytes - 1) / growth_bytes * growth_bytes;
+    mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(capacity >> 32), (DWORD)(capacity & 0xFFFFFFFF), NULL);
+    return mapping != NULL;
+}
+
+bool MappedFile::Write(const void* data, unsigned long long bytes)
+{
+    if (!writable)
+        return false;
+
+    if (position + bytes > capacity && !Grow(position + bytes))
+        return false;
+
+    const unsigned char* source = (const unsigned char*)data;
+    while (bytes > 0)
+    {
+        if (view == NULL || position < view_offset || position >= view_offset + view_bytes)
+        {
+            if (!MapWindow(position))
+                return false;
+        }
+
+        unsigned long long chunk = view_offset + view_bytes - position;
+        if (chunk > bytes)
+            chunk = bytes;
+        memcpy(view + (position - view_offset), source, (size_t)chunk);
+
+        source += chunk;
+        position += chunk;
+        bytes -= chunk;
+    }
+
+    if (position > size)
+        size = position;
+    return true;
+}
+
+bool MappedFile::WriteAt(unsigned long long offset, const void* data, unsigned long long bytes)
+{
+    unsigned long long saved_position = position;
+    position = offset;
+    bool written = Write(data, bytes);
+    position = saved_position;
+    return written;
+}
+
+bool MappedFile::Read(void* data, unsigned long long bytes)
+{
+    if (position + bytes > size)
+        return false;
+
+    unsigned char* destination = (unsigned char*)data;
+    while (bytes > 0)
+    {
+        if (view == NULL || position < view_offset || position >= view_offset + view_bytes)
+        {
+            if (!MapWindow(position))
+                return false;
+        }
+
+        unsigned long long chunk = view_offset + view_bytes - position;
+        if (chunk > bytes)
+            chunk = bytes;
+        memcpy(destination, view + (position - view_offset), (size_t)chunk);
+
+        destination += chunk;
+        position += chunk;
+        bytes -= chunk;
+    }
+    return true;
+}
+
+void MappedFile::Close()
+{
+    Unmap();
+
+    if (mapping != NULL)
+        CloseHandle(mapping);
+    mapping = NULL;
+
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        // The file grew in big steps; cut off what wasn't used.
+        if (writable)
+        {
+            LARGE_INTEGER end;
+            end.QuadPart = size;
+            SetFilePointerEx(file, end, NULL, FILE_BEGIN);
+            SetEndOfFile(file);
+        }
+        CloseHandle(file);
+    }
+    file = INVALID_HANDLE_VALUE;
+    writable = false;
+}
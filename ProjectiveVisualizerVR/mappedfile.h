@@ -0,0 +1,54 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <Windows.h>
+
+// Sequential access to a file through a window of it mapped into memory. Only the window is mapped
+// at any time, so files far bigger than the address space can be written, growing as needed, and
+// read back.
+class MappedFile
+{
+public:
+    MappedFile();
+    virtual ~MappedFile();
+
+    bool OpenForWriting(const char* path);
+    bool OpenForReading(const char* path);
+
+    // Copy bytes to or from the current position and move past them. Return false on failure,
+    // including reading past the end of the file.
+    bool Write(const void* data, unsigned long long bytes);
+    bool Read(void* data, unsigned long long bytes);
+
+    // Overwrites bytes already written, e.g. a header whose contents are only known at the end.
+    bool WriteAt(unsigned long long offset, const void* data, unsigned long long bytes);
+
+    unsigned long long GetPosition() const { return position; }
+    unsigned long long GetSize() const { return size; }
+
+    // Unmaps the file and, if it was written, trims it to the bytes actually written.
+    void Close();
+
+private:
+    // The file grows in steps of this much, and is mapped this much at a time.
+    static const unsigned long long growth_bytes = 256ull << 20;
+    static const unsigned long long window_bytes = 16ull << 20;
+
+    bool MapWindow(unsigned long long offset);
+    bool Grow(unsigned long long needed);
+    void Unmap();
+
+    HANDLE file;
+    HANDLE mapping;
+    bool writable;
+
+    unsigned char* view;
+    unsigned long long view_offset;
+    unsigned long long view_bytes;
+
+    unsigned long long position;
+    unsigned long long size;        // Bytes written, or the size of a file being read.
+    unsigned long long capacity;    // Size of the file on disk while writing.
+};
+
+#endif // MAPPEDFILE_H
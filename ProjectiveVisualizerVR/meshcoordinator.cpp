@@ -0,0 +1,258 @@
+#include "meshcoordinator.h"
+
+#include <iostream>
+
+struct worker_thread_params
+{
+    MeshCoordinator* coordinator;
+    int worker;
+};
+
+MeshCoordinator::MeshCoordinator(const std::string& worker_path, int worker_count)
+{
+    InitializeCriticalSection(&run_lock);
+    InitializeCriticalSection(&job_lock);
+
+    jobs = 0;
+    fragments = 0;
+    next_job = 0;
+    jobs_done = 0;
+
+    for (int w = 0; w < worker_count; w++)
+    {
+        Worker worker;
+        if (StartWorker(worker_path, &worker))
+            workers.push_back(worker);
+    }
+
+    std::cout << "Started " << workers.size() << " of " << worker_count << " mesh workers from "
+              << worker_path << "." << std::endl;
+}
+
+MeshCoordinator::~MeshCoordinator()
+{
+    for (int w = 0; w < workers.size(); w++)
+        StopWorker(&workers[w]);
+
+    DeleteCriticalSection(&job_lock);
+    DeleteCriticalSection(&run_lock);
+}
+
+bool MeshCoordinator::StartWorker(const std::string& worker_path, Worker* worker_out)
+{
+    // Both pipes are created inheritable, then the coordinator's ends are made private so that the
+    // worker sees the end of its input when the coordinator closes it.
+    SECURITY_ATTRIBUTES inheritable = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+
+    HANDLE worker_input, to_worker;
+    if (!CreatePipe(&worker_input, &to_worker, &inheritable, 0))
+        return false;
+
+    HANDLE from_worker, worker_output;
+    if (!CreatePipe(&from_worker, &worker_output, &inheritable, 0))
+    {
+        CloseHandle(worker_input);
+        CloseHandle(to_worker);
+        return false;
+    }
+
+    SetHandleInformation(to_worker, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(from_worker, HANDLE_FLAG_INHERIT, 0);
+
+    STARTUPINFOA startup_info;
+    ZeroMemory(&startup_info, sizeof(startup_info));
+    startup_info.cb = sizeof(startup_info);
+    startup_info.dwFlags = STARTF_USESTDHANDLES;
+    startup_info.hStdInput = worker_input;
+    startup_info.hStdOutput = worker_output;
+    startup_info.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    // CreateProcessA may write to the command line.
+    std::vector<char> command_line(worker_path.begin(), worker_path.end());
+    command_line.push_back('\0');
+
+    PROCESS_INFORMATION process_info;
+    BOOL started = CreateProcessA(NULL, command_line.data(), NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL,
+                                  &startup_info, &process_info);
+
+    // The worker has its own copies of its ends now.
+    CloseHandle(worker_input);
+    CloseHandle(worker_output);
+
+    if (!started)
+    {
+        CloseHandle(to_worker);
+        CloseHandle(from_worker);
+        return false;
+    }
+
+    CloseHandle(process_info.hThread);
+
+    worker_out->process = process_info.hProcess;
+    worker_out->to_worker = to_worker;
+    worker_out->from_worker = from_worker;
+    worker_out->alive = true;
+    worker_out->busy = false;
+    worker_out->job_started = 0;
+    return true;
+}
+
+void MeshCoordinator::StopWorker(Worker* worker)
+{
+    if (worker->alive)
+        WriteMeshQuit(worker->to_worker);
+    CloseHandle(worker->to_worker);
+
+    // A worker that doesn't notice the pipe closing within a few seconds is stuck.
+    if (WaitForSingleObject(worker->process, 5000) != WAIT_OBJECT_0)
+        TerminateProcess(worker->process, 1);
+
+    CloseHandle(worker->from_worker);
+    CloseHandle(worker->process);
+    worker->alive = false;
+}
+
+int MeshCoordinator::GetWorkerCount()
+{
+    EnterCriticalSection(&job_lock);
+    int count = 0;
+    for (int w = 0; w < workers.size(); w++)
+    {
+        if (workers[w].alive)
+            count++;
+    }
+    LeaveCriticalSection(&job_lock);
+    return count;
+}
+
+bool MeshCoordinator::Run(const std::vector<MeshJob>& jobs, std::vector<MeshFragment>* fragments_out)
+{
+    EnterCriticalSection(&run_lock);
+
+    this->jobs = &jobs;
+    fragments = fragments_out;
+    fragments->clear();
+    fragments->resize(jobs.size());
+    next_job = 0;
+    failed_jobs.clear();
+    jobs_done = 0;
+
+    std::vector<worker_thread_params> params;
+    for (int w = 0; w < workers.size(); w++)
+    {
+        if (workers[w].alive)
+        {
+            worker_thread_params p = { this, w };
+            params.push_back(p);
+        }
+    }
+
+    std::vector<HANDLE> threads;
+    for (int t = 0; t < params.size(); t++)
+    {
+        DWORD threadID;
+        threads.push_back(CreateThread(NULL, 0, WorkerThread, &params[t], 0, &threadID));
+    }
+
+    // The threads block reading their workers' replies, so they're watched from here.
+    if (!threads.empty())
+    {
+        while (WaitForMultipleObjects(threads.size(), threads.data(), TRUE, 1000) == WAIT_TIMEOUT)
+            StopStalledWorkers();
+    }
+    for (int t = 0; t < threads.size(); t++)
+        CloseHandle(threads[t]);
+
+    // A job can be left over if the last worker holding one died after the others had finished.
+    bool done = (jobs_done == jobs.size());
+    if (!done)
+        std::cout << "Mesh workers finished " << jobs_done << " of " << jobs.size() << " jobs." << std::endl;
+
+    this->jobs = 0;
+    fragments = 0;
+
+    LeaveCriticalSection(&run_lock);
+    return done;
+}
+
+DWORD WINAPI MeshCoordinator::WorkerThread(LPVOID vparams)
+{
+    worker_thread_params* params = (worker_thread_params*)vparams;
+    params->coordinator->FeedWorker(params->worker);
+    return 0;
+}
+
+bool MeshCoordinator::TakeJob(int* job_out)
+{
+    EnterCriticalSection(&job_lock);
+
+    bool taken = true;
+    if (!failed_jobs.empty())
+    {
+        *job_out = failed_jobs.back();
+        failed_jobs.pop_back();
+    }
+    else if (next_job < jobs->size())
+        *job_out = next_job++;
+    else
+        taken = false;
+
+    LeaveCriticalSection(&job_lock);
+    return taken;
+}
+
+void MeshCoordinator::FeedWorker(int w)
+{
+    Worker& worker = workers[w];
+
+    int job;
+    while (TakeJob(&job))
+    {
+        EnterCriticalSection(&job_lock);
+        worker.busy = true;
+        worker.job_started = GetTickCount();
+        LeaveCriticalSection(&job_lock);
+
+        // Each job's fragment is written by only the worker that finishes it.
+        bool answered = WriteMeshJob(worker.to_worker, (*jobs)[job])
+                        && ReadMeshFragment(worker.from_worker, &(*fragments)[job]);
+
+        EnterCriticalSection(&job_lock);
+        worker.busy = false;
+        if (answered)
+            jobs_done++;
+        LeaveCriticalSection(&job_lock);
+
+        if (answered)
+            continue;
+
+        std::cout << "Mesh worker " << w << " stopped responding." << std::endl;
+
+        EnterCriticalSection(&job_lock);
+        failed_jobs.push_back(job);
+        worker.alive = false;
+        LeaveCriticalSection(&job_lock);
+        return;
+    }
+}
+
+void MeshCoordinator::StopStalledWorkers()
+{
+    EnterCriticalSection(&job_lock);
+
+    DWORD now = GetTickCount();
+    for (int w = 0; w < workers.size(); w++)
+    {
+        // Ending the process closes its end of the pipes, which ends the read FeedWorker is blocked in.
+        Worker& worker = workers[w];
+        if (worker.alive && worker.busy && now - worker.job_started > job_timeout_ms)
+        {
+            std::cout << "Mesh worker " << w << " spent over " << job_timeout_ms / 1000 << " s on one job; stopping it."
+                      << std::endl;
+            TerminateProcess(worker.process, 1);
+            worker.busy = false;
+        }
+    }
+
+    LeaveCriticalSection(&job_lock);
+}
@@ -0,0 +1,75 @@
+#ifndef MESHCOORDINATOR_H
+#define MESHCOORDINATOR_H
+
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "meshjob.h"
+
+// Shares the regions of a mesh out among pvmesh-worker processes, which may run on however many
+// cores the machine has, where FunctionMesh's own threads are one per chart. Workers are started
+// once with their standard input and output redirected to pipes, and live until the coordinator
+// is destroyed; see meshjob.h for what goes over the pipes.
+class MeshCoordinator
+{
+public:
+    // Starts worker_count copies of the executable at worker_path. Workers that fail to start are
+    // left out; see GetWorkerCount.
+    MeshCoordinator(const std::string& worker_path, int worker_count);
+    virtual ~MeshCoordinator();
+
+    // Workers still running.
+    int GetWorkerCount();
+
+    // No region takes more than a few seconds to mesh, so a worker that has been on one job this
+    // long is stuck, and is stopped.
+    static const DWORD job_timeout_ms = 60000;
+
+    // Meshes every job, the reply to jobs[n] going to (*fragments_out)[n]. A job whose worker dies,
+    // or takes longer than job_timeout_ms, is handed to another worker. Returns false if every worker
+    // died before the jobs were done.
+    bool Run(const std::vector<MeshJob>& jobs, std::vector<MeshFragment>* fragments_out);
+
+private:
+    struct Worker
+    {
+        HANDLE process;
+        HANDLE to_worker;       // The worker's standard input.
+        HANDLE from_worker;     // The worker's standard output.
+        bool alive;
+        bool busy;              // Waiting for a reply to a job sent at job_started, by GetTickCount.
+        DWORD job_started;
+    };
+
+    bool StartWorker(const std::string& worker_path, Worker* worker_out);
+    void StopWorker(Worker* worker);
+
+    static DWORD WINAPI WorkerThread(LPVOID vparams);
+
+    // Hands jobs to worker w one at a time until none are left or the worker dies.
+    void FeedWorker(int w);
+
+    // Takes the next job to run, or returns false if there isn't one.
+    bool TakeJob(int* job_out);
+
+    // Stops the workers that have been busy for more than job_timeout_ms. Their threads' reads then
+    // fail, and the jobs go back to failed_jobs.
+    void StopStalledWorkers();
+
+    std::vector<Worker> workers;
+
+    // Held through a whole Run, as meshes for the viewer and for replacements may be built at once.
+    CRITICAL_SECTION run_lock;
+
+    // State of the current Run, guarded by job_lock.
+    CRITICAL_SECTION job_lock;
+    const std::vector<MeshJob>* jobs;
+    std::vector<MeshFragment>* fragments;
+    int next_job;
+    std::vector<int> failed_jobs;   // Taken before next_job, by the workers still alive.
+    int jobs_done;
+};
+
+#endif // MESHCOORDINATOR_H
@@ -0,0 +1,220 @@
+#include "meshjob.h"
+
+#include <cstring>
+
+enum MeshMessageType
+{
+    MESSAGE_JOB = 1,
+    MESSAGE_FRAGMENT = 2,
+    MESSAGE_QUIT = 3
+};
+
+struct MeshMessageHeader
+{
+    char magic[4];
+    unsigned int type;              // MeshMessageType
+    unsigned int payload_bytes;
+};
+
+static const char mesh_message_magic[4] = { 'P', 'V', 'M', 'J' };
+
+// Far more than the biggest region at max_budget_depth; anything bigger is a corrupt header.
+static const unsigned int max_payload_bytes = 1u << 30;
+
+// Pipes may move fewer bytes than asked for at a time.
+static bool WriteAll(HANDLE pipe, const void* data, unsigned int bytes)
+{
+    const char* next = (const char*)data;
+    while (bytes > 0)
+    {
+        DWORD written = 0;
+        if (!WriteFile(pipe, next, bytes, &written, NULL) || written == 0)
+            return false;
+        next += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+static bool ReadAll(HANDLE pipe, void* data, unsigned int bytes)
+{
+    char* next = (char*)data;
+    while (bytes > 0)
+    {
+        DWORD read = 0;
+        if (!ReadFile(pipe, next, bytes, &read, NULL) || read == 0)
+            return false;
+        next += read;
+        bytes -= read;
+    }
+    return true;
+}
+
+static bool WriteMessage(HANDLE pipe, MeshMessageType type, const std::vector<char>& payload)
+{
+    MeshMessageHeader header;
+    memcpy(header.magic, mesh_message_magic, sizeof(header.magic));
+    header.type = type;
+    header.payload_bytes = payload.size();
+
+    return WriteAll(pipe, &header, sizeof(header))
+        && (payload.empty() || WriteAll(pipe, payload.data(), payload.size()));
+}
+
+static bool ReadMessage(HANDLE pipe, MeshMessageType* type_out, std::vector<char>* payload_out)
+{
+    MeshMessageHeader header;
+    if (!ReadAll(pipe, &header, sizeof(header))
+        || memcmp(header.magic, mesh_message_magic, sizeof(header.magic)) != 0
+        || header.payload_bytes > max_payload_bytes)
+        return false;
+
+    *type_out = (MeshMessageType)header.type;
+    payload_out->resize(header.payload_bytes);
+    return payload_out->empty() || ReadAll(pipe, payload_out->data(), header.payload_bytes);
+}
+
+// Payloads are plain copies of the fields in order; both ends are built from the same sources.
+static void Put(std::vector<char>* payload, const void* data, size_t bytes)
+{
+    payload->insert(payload->end(), (const char*)data, (const char*)data + bytes);
+}
+
+static void PutVectors(std::vector<char>* payload, const std::vector<Vector4>& vectors)
+{
+    unsigned int count = vectors.size();
+    Put(payload, &count, sizeof(count));
+    if (count > 0)
+        Put(payload, vectors.data(), count*sizeof(Vector4));
+}
+
+static bool Get(const std::vector<char>& payload, size_t* offset, void* data, size_t bytes)
+{
+    if (payload.size() - *offset < bytes)
+        return false;
+    memcpy(data, payload.data() + *offset, bytes);
+    *offset += bytes;
+    return true;
+}
+
+static bool GetVectors(const std::vector<char>& payload, size_t* offset, std::vector<Vector4>* vectors_out)
+{
+    unsigned int count;
+    if (!Get(payload, offset, &count, sizeof(count)) || (payload.size() - *offset) / sizeof(Vector4) < count)
+        return false;
+    vectors_out->resize(count);
+    return count == 0 || Get(payload, offset, vectors_out->data(), count*sizeof(Vector4));
+}
+
+bool WriteMeshJob(HANDLE pipe, const MeshJob& job)
+{
+    std::vector<char> payload;
+
+    unsigned int fields[4] = { (unsigned int)job.chart, (unsigned int)job.depth, (unsigned int)job.sampling,
+                               (unsigned int)job.find_hidden_crossings };
+    Put(&payload, fields, sizeof(fields));
+    Put(&payload, &job.min, sizeof(job.min));
+    Put(&payload, &job.max, sizeof(job.max));
+
+    const std::vector<Polynomial::Monomial>& terms = job.f.getTerms();
+    unsigned int term_count = terms.size();
+    Put(&payload, &term_count, sizeof(term_count));
+    for (int n = 0; n < terms.size(); n++)
+    {
+        Put(&payload, terms[n].exponents, sizeof(terms[n].exponents));
+        Put(&payload, &terms[n].coefficient, sizeof(terms[n].coefficient));
+    }
+
+    return WriteMessage(pipe, MESSAGE_JOB, payload);
+}
+
+bool ReadMeshJob(HANDLE pipe, MeshJob* job_out, bool* quit_out)
+{
+    MeshMessageType type;
+    std::vector<char> payload;
+    if (!ReadMessage(pipe, &type, &payload))
+        return false;
+
+    *quit_out = (type == MESSAGE_QUIT);
+    if (*quit_out)
+        return true;
+    if (type != MESSAGE_JOB)
+        return false;
+
+    size_t offset = 0;
+    unsigned int fields[4];
+    unsigned int term_count;
+    if (!Get(payload, &offset, fields, sizeof(fields))
+        || !Get(payload, &offset, &job_out->min, sizeof(job_out->min))
+        || !Get(payload, &offset, &job_out->max, sizeof(job_out->max))
+        || !Get(payload, &offset, &term_count, sizeof(term_count)))
+        return false;
+    if (fields[0] > Variable::VAR_W || fields[2] > SAMPLING_EQUIANGULAR)
+        return false;
+
+    job_out->chart = (Variable::var_type)fields[0];
+    job_out->depth = fields[1];
+    job_out->sampling = (ChartSampling)fields[2];
+    job_out->find_hidden_crossings = (fields[3] != 0);
+
+    std::vector<Polynomial::Monomial> terms(term_count);
+    for (int n = 0; n < term_count; n++)
+    {
+        if (!Get(payload, &offset, terms[n].exponents, sizeof(terms[n].exponents))
+            || !Get(payload, &offset, &terms[n].coefficient, sizeof(terms[n].coefficient)))
+            return false;
+    }
+    job_out->f = Polynomial::fromTerms(terms);
+
+    return true;
+}
+
+bool WriteMeshFragment(HANDLE pipe, const MeshFragment& fragment)
+{
+    std::vector<char> payload;
+
+    Put(&payload, &fragment.region, sizeof(fragment.region));
+    PutVectors(&payload, fragment.vertices);
+    PutVectors(&payload, fragment.gradients);
+    PutVectors(&payload, fragment.lod_vertices);
+    PutVectors(&payload, fragment.lod_gradients);
+
+    return WriteMessage(pipe, MESSAGE_FRAGMENT, payload);
+}
+
+bool ReadMeshFragment(HANDLE pipe, MeshFragment* fragment_out)
+{
+    MeshMessageType type;
+    std::vector<char> payload;
+    if (!ReadMessage(pipe, &type, &payload) || type != MESSAGE_FRAGMENT)
+        return false;
+
+    size_t offset = 0;
+    if (!Get(payload, &offset, &fragment_out->region, sizeof(fragment_out->region))
+        || !GetVectors(payload, &offset, &fragment_out->vertices)
+        || !GetVectors(payload, &offset, &fragment_out->gradients)
+        || !GetVectors(payload, &offset, &fragment_out->lod_vertices)
+        || !GetVectors(payload, &offset, &fragment_out->lod_gradients))
+        return false;
+
+    // Check the levels against what came with them, so a bad reply can't index past the fragment.
+    const FunctionMesh::Region& region = fragment_out->region;
+    if (region.level_count < 1 || region.level_count > FunctionMesh::max_lod_levels
+        || fragment_out->gradients.size() != fragment_out->vertices.size()
+        || fragment_out->lod_gradients.size() != fragment_out->lod_vertices.size())
+        return false;
+    for (int level = 0; level < region.level_count; level++)
+    {
+        int available = (level == 0) ? fragment_out->vertices.size() : fragment_out->lod_vertices.size();
+        if (region.levels[level].first_vertex < 0 || region.levels[level].vertex_count < 0
+            || region.levels[level].first_vertex > available - region.levels[level].vertex_count)
+            return false;
+    }
+
+    return true;
+}
+
+bool WriteMeshQuit(HANDLE pipe)
+{
+    return WriteMessage(pipe, MESSAGE_QUIT, std::vector<char>());
+}
@@ -0,0 +1,49 @@
+#ifndef MESHJOB_H
+#define MESHJOB_H
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "polynomial.h"
+#include "functionmesh.h"
+
+// The protocol between the viewer and pvmesh-worker processes; see MeshCoordinator. The coordinator
+// writes jobs to a worker's standard input and reads one fragment back from its standard output for
+// each, in order. Every message is a small header naming its type and payload size, then the payload.
+
+// A request to mesh one region of a chart, as FunctionMesh::MeshRegion does.
+struct MeshJob
+{
+    Polynomial f;                   // Homogeneous, with integer coefficients.
+    Variable::var_type chart;
+    Vector3 min;                    // The region, in generating coordinates.
+    Vector3 max;
+    int depth;                      // Depth of the whole chart.
+    ChartSampling sampling;
+    bool find_hidden_crossings;
+};
+
+// A worker's reply: the region with all its levels of detail. Level 0 indexes vertices/gradients, and
+// the coarser levels index lod_vertices/lod_gradients, both from 0.
+struct MeshFragment
+{
+    FunctionMesh::Region region;
+    std::vector<Vector4> vertices;
+    std::vector<Vector4> gradients;
+    std::vector<Vector4> lod_vertices;
+    std::vector<Vector4> lod_gradients;
+};
+
+// All of these return false if the pipe is closed or the message is malformed.
+bool WriteMeshJob(HANDLE pipe, const MeshJob& job);
+bool WriteMeshFragment(HANDLE pipe, const MeshFragment& fragment);
+
+// Asks a worker to exit once it has answered every job before this.
+bool WriteMeshQuit(HANDLE pipe);
+
+// *quit_out is set if the message was a quit rather than a job.
+bool ReadMeshJob(HANDLE pipe, MeshJob* job_out, bool* quit_out);
+bool ReadMeshFragment(HANDLE pipe, MeshFragment* fragment_out);
+
+#endif // MESHJOB_H
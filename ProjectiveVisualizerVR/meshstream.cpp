@@ -0,0 +1,436 @@
+#include "meshstream.h"
+
+#include <iostream>
+#include <cstring>
+#include <new>
+
+#include <Windows.h>
+
+#include "cellkernel.h"
+#include "mappedfile.h"
+#include "latticeevaluator.h"
+
+static const char streamed_mesh_magic[8] = { 'P', 'V', 'M', 'E', 'S', 'H', 0, 0 };
+static const unsigned int streamed_mesh_version = 1;
+
+// What a loaded mesh may take, in bytes. A 32-bit viewer has 2 GB of address space for everything,
+// the meshes it draws included.
+static const unsigned long long max_loaded_mesh_bytes = (sizeof(void*) < 8) ? (1ull << 29) : (1ull << 36);
+
+struct stream_chart_params
+{
+    LatticeEvaluator* evaluator;
+    Term* gradient[4];
+    int depth;
+    ChartSampling sampling;
+    Variable::var_type var;
+
+    // Shared by all charts, guarded by file_lock.
+    MappedFile* file;
+    CRITICAL_SECTION* file_lock;
+    StreamedMeshHeader* header;
+    bool* failed;
+};
+
+// Sweeps one chart slab by slab; see meshstream.h.
+DWORD WINAPI StreamChart(LPVOID vparams)
+{
+    struct stream_chart_params* params = (struct stream_chart_params*)vparams;
+
+    Vector4 e1, e2, e3, e4;
+    FunctionMesh::GetChartBasis(params->var, &e1, &e2, &e3, &e4);
+
+    const int res = 1 << params->depth;
+    const int row = res + 1;
+
+    std::vector<double> x(row);
+    for (int n = 0; n < row; n++)
+        x[n] = FunctionMesh::ChartCoordinate(params->sampling, -1 + 2.0*n/res);
+
+    // Rows along k are too long for one word of sign bits, so they're cut into segments of
+    // max_row_cells cells, each with its own word; see cellkernel.h.
+    const int segments = (res + max_row_cells - 1) / max_row_cells;
+
+    // The planes bounding the current slab: values, sign bits and the crossing on each edge lying in
+    // the plane (by axis and lowest point, as in FunctionMeshTreeLeaf). Edges along i belong to the slab.
+    // Only entries that were set are reset between slabs, as the planes can be millions of points.
+    const unsigned int no_crossing = 0xFFFFFFFF;
+    std::vector<double> plane_values[2] = { std::vector<double>(row*row), std::vector<double>(row*row) };
+    std::vector<unsigned int> plane_signs[2] = { std::vector<unsigned int>(row*segments), std::vector<unsigned int>(row*segments) };
+    std::vector<unsigned int> plane_edges[2] = { std::vector<unsigned int>(2*row*row, no_crossing), std::vector<unsigned int>(2*row*row, no_crossing) };
+    std::vector<unsigned int> slab_edges(row*row, no_crossing);
+    std::vector<int> set_plane_edges[2];
+    std::vector<int> set_slab_edges;
+
+    auto sample_plane = [&](int i, int p)
+    {
+        for (int j = 0; j < row; j++)
+        {
+            double* values = &plane_values[p][j*row];
+            params->evaluator->EvaluateRow(e1, e2, e3, e4, x[i], x[j], x.data(), row, values);
+
+            for (int s = 0; s < segments; s++)
+            {
+                int k0 = s*max_row_cells;
+                int points = (res - k0 < max_row_cells ? res - k0 : max_row_cells) + 1;
+                plane_signs[p][j*segments + s] = RowSignBits(values + k0, points);
+            }
+        }
+    };
+
+    // The current slab's chunk, and the number of vertices of this chart in chunks before it.
+    std::vector<Vector4> chunk_vertices;
+    std::vector<Vector4> chunk_gradients;
+    std::vector<unsigned int> chunk_indices;
+    unsigned int chart_vertex_count = 0;
+
+    const int max_row_edges = max_row_cells*cell_edge_count;
+    double edge_start_values[max_row_edges];
+    double edge_end_values[max_row_edges];
+    double edge_t[max_row_edges];
+    int edge_k[max_row_edges];
+    int edge_number[max_row_edges];
+
+    unsigned char active_flags[max_row_cells];
+    unsigned int edge_crossing[max_row_cells][cell_edge_count];
+
+    sample_plane(0, 0);
+
+    for (int i = 0; i < res; i++)
+    {
+        sample_plane(i + 1, 1);
+
+        chunk_vertices.clear();
+        chunk_gradients.clear();
+        chunk_indices.clear();
+
+        for (int j = 0; j < res; j++)
+        {   for (int s = 0; s < segments; s++)
+            {
+                int k0 = s*max_row_cells;
+                int cells = (res - k0 < max_row_cells) ? res - k0 : max_row_cells;
+
+                unsigned int r00 = plane_signs[0][j*segments + s];
+                unsigned int r01 = plane_signs[0][(j + 1)*segments + s];
+                unsigned int r10 = plane_signs[1][j*segments + s];
+                unsigned int r11 = plane_signs[1][(j + 1)*segments + s];
+
+                unsigned int active = ActiveCellBits(r00, r01, r10, r11, cells);
+                if (!active)
+                    continue;
+
+                unsigned int first_new_crossing = chart_vertex_count + (unsigned int)chunk_vertices.size();
+                int active_count = 0;
+                int edge_count = 0;
+                for (unsigned int remaining = active; remaining; remaining &= remaining - 1)
+                {
+                    int k = k0 + LowestSetBit(remaining);
+                    unsigned char flags = CellSignFlags(r00, r01, r10, r11, k - k0);
+                    active_flags[active_count] = flags;
+
+                    for (int e = 0; e < cell_edge_count; e++)
+                    {
+                        int start = cell_edge_start[e];
+                        int axis = cell_edge_axis[e];
+                        int end = start | (4 >> axis);
+                        if (!(((flags >> start) ^ (flags >> end)) & 1))
+                            continue;
+
+                        int plane_point = (j + ((start >> 1) & 1))*row + k + (start & 1);
+                        int slot = (axis == 0) ? plane_point : (axis - 1)*row*row + plane_point;
+                        unsigned int& cached = (axis == 0) ? slab_edges[slot] : plane_edges[start >> 2][slot];
+                        if (cached == no_crossing)
+                        {
+                            cached = first_new_crossing + edge_count;
+                            if (axis == 0)
+                                set_slab_edges.push_back(slot);
+                            else
+                                set_plane_edges[start >> 2].push_back(slot);
+
+                            edge_start_values[edge_count] = plane_values[start >> 2][(j + ((start >> 1) & 1))*row + k + (start & 1)];
+                            edge_end_values[edge_count] = plane_values[end >> 2][(j + ((end >> 1) & 1))*row + k + (end & 1)];
+                            edge_k[edge_count] = k;
+                            edge_number[edge_count] = e;
+                            edge_count++;
+                        }
+                        edge_crossing[active_count][e] = cached;
+                    }
+                    active_count++;
+                }
+
+                InterpolateCrossings(edge_start_values, edge_end_values, edge_t, edge_count);
+
+                for (int n = 0; n < edge_count; n++)
+                {
+                    int e = edge_number[n];
+                    int start = cell_edge_start[e];
+                    int axis = cell_edge_axis[e];
+
+                    int ci = i + (start >> 2);
+                    int cj = j + ((start >> 1) & 1);
+                    int ck = edge_k[n] + (start & 1);
+                    double c1 = x[ci] + (axis == 0 ? edge_t[n]*(x[ci + 1] - x[ci]) : 0);
+                    double c2 = x[cj] + (axis == 1 ? edge_t[n]*(x[cj + 1] - x[cj]) : 0);
+                    double c3 = x[ck] + (axis == 2 ? edge_t[n]*(x[ck + 1] - x[ck]) : 0);
+
+                    Vector4 v = e4 + c1*e1 + c2*e2 + c3*e3;
+                    chunk_vertices.push_back(v);
+                    chunk_gradients.push_back(Vector4(params->gradient[0]->eval(v), params->gradient[1]->eval(v),
+                                                      params->gradient[2]->eval(v), params->gradient[3]->eval(v)));
+                }
+
+                for (int c = 0; c < active_count; c++)
+                {
+                    const CellCase& cell_case = GetCellCase(active_flags[c]);
+                    for (int n = 0; n < cell_case.edge_count; n++)
+                        chunk_indices.push_back(edge_crossing[c][cell_case.edges[n]]);
+                }
+            }
+        }
+
+        if (!chunk_indices.empty() || !chunk_vertices.empty())
+        {
+            StreamedMeshChunk chunk = { (unsigned int)params->var, (unsigned int)i, (unsigned int)chunk_vertices.size(), (unsigned int)chunk_indices.size() };
+
+            EnterCriticalSection(params->file_lock);
+            bool written = params->file->Write(&chunk, sizeof(chunk))
+                        && params->file->Write(chunk_vertices.data(), chunk_vertices.size()*sizeof(Vector4))
+                        && params->file->Write(chunk_gradients.data(), chunk_gradients.size()*sizeof(Vector4))
+                        && params->file->Write(chunk_indices.data(), chunk_indices.size()*sizeof(unsigned int));
+            params->header->chunk_count++;
+            params->header->vertex_count += chunk_vertices.size();
+            params->header->index_count += chunk_indices.size();
+            if (!written)
+                *(params->failed) = true;
+            bool failed = *(params->failed);
+            LeaveCriticalSection(params->file_lock);
+
+            if (failed)
+                return 1;
+
+            chart_vertex_count += (unsigned int)chunk_vertices.size();
+        }
+
+        // The upper plane becomes the lower one of the next slab.
+        plane_values[0].swap(plane_values[1]);
+        plane_signs[0].swap(plane_signs[1]);
+        for (int n = 0; n < set_plane_edges[0].size(); n++)
+            plane_edges[0][set_plane_edges[0][n]] = no_crossing;
+        set_plane_edges[0].clear();
+        plane_edges[0].swap(plane_edges[1]);
+        set_plane_edges[0].swap(set_plane_edges[1]);
+        for (int n = 0; n < set_slab_edges.size(); n++)
+            slab_edges[set_slab_edges[n]] = no_crossing;
+        set_slab_edges.clear();
+    }
+
+    return 0;
+}
+
+bool StreamMeshToFile(Term* f_of_xyz, const std::string& equation, int depth, ChartSampling sampling, const char* path)
+{
+    MappedFile file;
+    if (!file.OpenForWriting(path))
+    {
+        std::cout << "Couldn't create " << path << std::endl;
+        return false;
+    }
+
+    StreamedMeshHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, streamed_mesh_magic, sizeof(header.magic));
+    header.version = streamed_mesh_version;
+    header.depth = depth;
+    header.sampling = sampling;
+    strncpy(header.equation, equation.c_str(), sizeof(header.equation) - 1);
+
+    // Counts are filled in at the end.
+    bool failed = !file.Write(&header, sizeof(header));
+
+    CRITICAL_SECTION file_lock;
+    InitializeCriticalSection(&file_lock);
+
+    Term* f = f_of_xyz->simplify();
+    LatticeEvaluator* evaluator = CreateLatticeEvaluator(f);
+    const char variable_names[4] = { 'x', 'y', 'z', 'w' };
+    Term* gradient[4];
+    for (int n = 0; n < 4; n++)
+    {
+        Term* derivative = f_of_xyz->derivative(variable_names[n]);
+        gradient[n] = derivative->simplify();
+        delete derivative;
+    }
+
+    struct stream_chart_params params[4];
+    HANDLE threads[4];
+    for (int c = 0; c < 4; c++)
+    {
+        params[c].evaluator = evaluator;
+        for (int n = 0; n < 4; n++)
+            params[c].gradient[n] = gradient[n];
+        params[c].depth = depth;
+        params[c].sampling = sampling;
+        params[c].var = (Variable::var_type)c;
+        params[c].file = &file;
+        params[c].file_lock = &file_lock;
+        params[c].header = &header;
+        params[c].failed = &failed;
+
+        DWORD threadID;
+        threads[c] = CreateThread(NULL, 0, StreamChart, &params[c], 0, &threadID);
+    }
+
+    WaitForMultipleObjects(4, threads, TRUE, INFINITE);
+    for (int c = 0; c < 4; c++)
+        CloseHandle(threads[c]);
+
+    DeleteCriticalSection(&file_lock);
+    delete evaluator;
+    delete f;
+    for (int n = 0; n < 4; n++)
+        delete gradient[n];
+
+    if (!failed)
+        failed = !file.WriteAt(0, &header, sizeof(header));
+    file.Close();
+
+    if (failed)
+    {
+        std::cout << "Couldn't write " << path << std::endl;
+        return false;
+    }
+
+    std::cout << "Streamed " << header.index_count / 3 << " triangles in " << header.chunk_count << " chunks to " << path << std::endl;
+    return true;
+}
+
+static bool ReadHeader(MappedFile* file, StreamedMeshHeader* header_out)
+{
+    if (!file->Read(header_out, sizeof(*header_out)))
+        return false;
+
+    header_out->equation[sizeof(header_out->equation) - 1] = 0;
+    return memcmp(header_out->magic, streamed_mesh_magic, sizeof(header_out->magic)) == 0
+        && header_out->version == streamed_mesh_version
+        && header_out->sampling <= SAMPLING_EQUIANGULAR;
+}
+
+bool ReadStreamedMeshHeader(const char* path, StreamedMeshHeader* header_out)
+{
+    MappedFile file;
+    return file.OpenForReading(path) && ReadHeader(&file, header_out);
+}
+
+bool StreamedMeshFitsInMemory(const StreamedMeshHeader& header)
+{
+    return header.index_count <= max_loaded_mesh_bytes / (2*sizeof(Vector4));
+}
+
+static bool ReadStreamedMeshChunks(MappedFile& file, const StreamedMeshHeader& header, std::vector<Vector4>* vertices_out,
+                                   std::vector<Vector4>* gradients_out, std::vector<FunctionMesh::Region>* regions_out);
+
+bool ReadStreamedMesh(const char* path, std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradients_out,
+                      std::vector<FunctionMesh::Region>* regions_out)
+{
+    MappedFile file;
+    StreamedMeshHeader header;
+    if (!file.OpenForReading(path) || !ReadHeader(&file, &header))
+        return false;
+
+    // Sizes are checked, in 64 bits, against what's left of the file and against what fits in memory
+    // before anything is allocated for them, so a damaged header or chunk, or a mesh too big to load,
+    // is reported instead of asking for absurd amounts of memory.
+    if (header.depth > 30 || header.index_count > file.GetSize() / sizeof(unsigned int) || !StreamedMeshFitsInMemory(header))
+        return false;
+
+    // Even a mesh that fits may not find that much free address space.
+    try
+    {
+        return ReadStreamedMeshChunks(file, header, vertices_out, gradients_out, regions_out);
+    }
+    catch (std::bad_alloc)
+    {
+        return false;
+    }
+}
+
+static bool ReadStreamedMeshChunks(MappedFile& file, const StreamedMeshHeader& header, std::vector<Vector4>* vertices_out,
+                                   std::vector<Vector4>* gradients_out, std::vector<FunctionMesh::Region>* regions_out)
+{
+
+    ChartSampling sampling = (ChartSampling)header.sampling;
+    int res = 1 << header.depth;
+
+    vertices_out->reserve(vertices_out->size() + (size_t)header.index_count);
+    gradients_out->reserve(gradients_out->size() + (size_t)header.index_count);
+    unsigned long long indices_left = header.index_count;
+
+    // For each chart, the vertices of its latest chunk and the one before, with the chart-wide index
+    // of their first vertex.
+    std::vector<Vector4> chunk_vertices[4][2];
+    std::vector<Vector4> chunk_gradients[4][2];
+    unsigned int chunk_first_vertex[4][2] = { { 0 } };
+    unsigned int chart_vertex_count[4] = { 0 };
+    std::vector<unsigned int> indices;
+
+    for (unsigned int n = 0; n < header.chunk_count; n++)
+    {
+        StreamedMeshChunk chunk;
+        if (!file.Read(&chunk, sizeof(chunk)) || chunk.chart > 3 || chunk.index_count % 3 != 0)
+            return false;
+        unsigned long long vertex_bytes = (unsigned long long)chunk.vertex_count*sizeof(Vector4);
+        unsigned long long index_bytes = (unsigned long long)chunk.index_count*sizeof(unsigned int);
+        if (2*vertex_bytes + index_bytes > file.GetSize() - file.GetPosition() || 2*vertex_bytes > max_loaded_mesh_bytes
+            || chunk.index_count > indices_left)
+            return false;
+        indices_left -= chunk.index_count;
+
+        int c = chunk.chart;
+        chunk_vertices[c][0].swap(chunk_vertices[c][1]);
+        chunk_gradients[c][0].swap(chunk_gradients[c][1]);
+        chunk_first_vertex[c][0] = chunk_first_vertex[c][1];
+        chunk_first_vertex[c][1] = chart_vertex_count[c];
+
+        chunk_vertices[c][1].resize(chunk.vertex_count);
+        chunk_gradients[c][1].resize(chunk.vertex_count);
+        indices.resize(chunk.index_count);
+        if (!file.Read(chunk_vertices[c][1].data(), vertex_bytes)
+         || !file.Read(chunk_gradients[c][1].data(), vertex_bytes)
+         || !file.Read(indices.data(), index_bytes))
+            return false;
+        chart_vertex_count[c] += chunk.vertex_count;
+
+        FunctionMesh::Region region;
+        region.chart = (Variable::var_type)c;
+        region.level_count = 1;
+        region.levels[0].first_vertex = vertices_out->size();
+        region.levels[0].vertex_count = chunk.index_count;
+        region.levels[0].cells = res;
+
+        Vector4 e1, e2, e3, e4;
+        FunctionMesh::GetChartBasis(region.chart, &e1, &e2, &e3, &e4);
+        for (int corner = 0; corner < 8; corner++)
+        {
+            int slab_end = chunk.slab + ((corner >> 2) & 1);
+            region.corners[corner] = e4 + FunctionMesh::ChartCoordinate(sampling, -1 + 2.0*slab_end/res)*e1
+                                        + ((corner & 2) ? 1.0f : -1.0f)*e2
+                                        + ((corner & 1) ? 1.0f : -1.0f)*e3;
+        }
+
+        for (unsigned int v = 0; v < chunk.index_count; v++)
+        {
+            unsigned int index = indices[v];
+            int which = (index >= chunk_first_vertex[c][1]) ? 1 : 0;
+            unsigned int local = index - chunk_first_vertex[c][which];
+            if (local >= chunk_vertices[c][which].size())
+                return false;
+
+            vertices_out->push_back(chunk_vertices[c][which][local]);
+            gradients_out->push_back(chunk_gradients[c][which][local]);
+        }
+
+        regions_out->push_back(region);
+    }
+
+    return true;
+}
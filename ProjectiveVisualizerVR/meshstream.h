@@ -0,0 +1,59 @@
+#ifndef MESHSTREAM_H
+#define MESHSTREAM_H
+
+#include <string>
+#include <vector>
+
+#include "term.h"
+#include "functionmesh.h"
+
+// Streamed meshes are for resolutions whose lattices and meshes don't fit in memory, such as
+// 2048^3 cells per chart for offline renders. Each chart is swept a slab of cells (i to i+1) at a
+// time, with only the two planes of samples bounding the slab alive, and every slab's part of the
+// mesh goes straight to a file mapped into memory a window at a time.
+//
+// The file is a StreamedMeshHeader followed by chunks, one for each slab with any surface in it, in
+// whatever order the charts finish them. A chunk is a StreamedMeshChunk, then vertex_count vertices,
+// vertex_count gradients (both as Vector4) and index_count 32-bit indices, three per triangle.
+// Indices count the vertices of the chunk's chart in the order its chunks were written; a slab
+// shares the crossings on its lower plane with the slab below, so a chunk's indices refer to its
+// own vertices or to those of the previous chunk of the same chart.
+
+struct StreamedMeshHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int depth;
+    unsigned int sampling;              // ChartSampling
+    unsigned int chunk_count;
+    unsigned long long vertex_count;
+    unsigned long long index_count;
+    char equation[1024];                // As typed, before homogenizing.
+};
+
+struct StreamedMeshChunk
+{
+    unsigned int chart;                 // Variable::var_type
+    unsigned int slab;
+    unsigned int vertex_count;
+    unsigned int index_count;
+};
+
+// Meshes f_of_xyz (homogenized from equation) over all four charts at depth, writing the mesh to path.
+// Returns false if the file couldn't be written.
+bool StreamMeshToFile(Term* f_of_xyz, const std::string& equation, int depth, ChartSampling sampling, const char* path);
+
+// Reads just the header of a streamed mesh, e.g. to get the equation to parse before loading it.
+bool ReadStreamedMeshHeader(const char* path, StreamedMeshHeader* header_out);
+
+// Whether the mesh of a file with this header, read as triangle lists, fits in the memory the viewer
+// can spare for it: two Vector4s per index, which is about eight times the file. Larger files can be
+// written for offline renders but not loaded.
+bool StreamedMeshFitsInMemory(const StreamedMeshHeader& header);
+
+// Reads a streamed mesh as triangle lists, one region per chunk with only a level 0. Returns false if
+// the file is missing or malformed, or doesn't fit in memory.
+bool ReadStreamedMesh(const char* path, std::vector<Vector4>* vertices_out, std::vector<Vector4>* gradients_out,
+                      std::vector<FunctionMesh::Region>* regions_out);
+
+#endif // MESHSTREAM_H
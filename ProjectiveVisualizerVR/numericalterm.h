@@ -26,6 +26,8 @@ public:
     virtual bool isNumerical() {return true; }
     virtual Term* homogenize(int* degree) { *degree = 0;
                                             return Clone(); }
+    virtual Polynomial expand() { return Polynomial::constant(val); }
+    virtual int degreeBound() { return 0; }
 private:
     int val;
 
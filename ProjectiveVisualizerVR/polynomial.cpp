@@ -0,0 +1,193 @@
+#include "polynomial.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include "binaryop.h"
+#include "numericalterm.h"
+#include "variable.h"
+
+static bool ExponentsLess(const Polynomial::Monomial& a, const Polynomial::Monomial& b)
+{
+    for (int n = 0; n < 4; n++)
+    {
+        if (a.exponents[n] != b.exponents[n])
+            return a.exponents[n] < b.exponents[n];
+    }
+    return false;
+}
+
+static bool ExponentsEqual(const Polynomial::Monomial& a, const Polynomial::Monomial& b)
+{
+    return a.exponents[0] == b.exponents[0] && a.exponents[1] == b.exponents[1]
+        && a.exponents[2] == b.exponents[2] && a.exponents[3] == b.exponents[3];
+}
+
+Polynomial Polynomial::fromTerms(const std::vector<Monomial>& monomials)
+{
+    std::vector<Monomial> sorted = monomials;
+    std::sort(sorted.begin(), sorted.end(), ExponentsLess);
+
+    Polynomial result;
+    for (int n = 0; n < sorted.size(); n++)
+    {
+        if (!result.terms.empty() && ExponentsEqual(result.terms.back(), sorted[n]))
+            result.terms.back().coefficient += sorted[n].coefficient;
+        else
+            result.terms.push_back(sorted[n]);
+
+        if (result.terms.back().coefficient == 0)
+            result.terms.pop_back();
+    }
+    return result;
+}
+
+Polynomial Polynomial::constant(double c)
+{
+    Polynomial result;
+    if (c != 0)
+    {
+        Monomial m = { { 0, 0, 0, 0 }, c };
+        result.terms.push_back(m);
+    }
+    return result;
+}
+
+Polynomial Polynomial::coordinate(int var)
+{
+    Polynomial result;
+    Monomial m = { { 0, 0, 0, 0 }, 1 };
+    m.exponents[var] = 1;
+    result.terms.push_back(m);
+    return result;
+}
+
+Polynomial Polynomial::operator+(const Polynomial& other) const
+{
+    std::vector<Monomial> monomials = terms;
+    monomials.insert(monomials.end(), other.terms.cbegin(), other.terms.cend());
+    return fromTerms(monomials);
+}
+
+Polynomial Polynomial::operator-(const Polynomial& other) const
+{
+    return *this + (-other);
+}
+
+Polynomial Polynomial::operator-() const
+{
+    Polynomial result = *this;
+    for (int n = 0; n < result.terms.size(); n++)
+        result.terms[n].coefficient = -result.terms[n].coefficient;
+    return result;
+}
+
+Polynomial Polynomial::operator*(const Polynomial& other) const
+{
+    std::vector<Monomial> monomials;
+    monomials.reserve(terms.size()*other.terms.size());
+    for (int a = 0; a < terms.size(); a++)
+    {
+        for (int b = 0; b < other.terms.size(); b++)
+        {
+            Monomial m;
+            for (int n = 0; n < 4; n++)
+                m.exponents[n] = terms[a].exponents[n] + other.terms[b].exponents[n];
+            m.coefficient = terms[a].coefficient*other.terms[b].coefficient;
+            monomials.push_back(m);
+        }
+    }
+    return fromTerms(monomials);
+}
+
+Polynomial Polynomial::power(int n) const
+{
+    // Square and multiply.
+    Polynomial result = constant(1);
+    Polynomial base = *this;
+    while (n > 0)
+    {
+        if (n & 1)
+            result = result*base;
+        n >>= 1;
+        if (n > 0)
+            base = base*base;
+    }
+    return result;
+}
+
+bool Polynomial::operator==(const Polynomial& other) const
+{
+    if (terms.size() != other.terms.size())
+        return false;
+
+    for (int n = 0; n < terms.size(); n++)
+    {
+        if (!ExponentsEqual(terms[n], other.terms[n]) || terms[n].coefficient != other.terms[n].coefficient)
+            return false;
+    }
+    return true;
+}
+
+double Polynomial::eval(double x, double y, double z, double w) const
+{
+    double v[4] = { x, y, z, w };
+    double result = 0;
+    for (int n = 0; n < terms.size(); n++)
+    {
+        double m = terms[n].coefficient;
+        for (int var = 0; var < 4; var++)
+        {
+            for (int e = 0; e < terms[n].exponents[var]; e++)
+                m *= v[var];
+        }
+        result += m;
+    }
+    return result;
+}
+
+int Polynomial::degree() const
+{
+    int result = 0;
+    for (int n = 0; n < terms.size(); n++)
+    {
+        int d = terms[n].exponents[0] + terms[n].exponents[1] + terms[n].exponents[2] + terms[n].exponents[3];
+        if (d > result)
+            result = d;
+    }
+    return result;
+}
+
+Term* Polynomial::toTerm() const
+{
+    if (terms.empty())
+        return new NumericalTerm(0);
+
+    Term* sum = 0;
+    for (int n = 0; n < terms.size(); n++)
+    {
+        double c = terms[n].coefficient;
+        if (c != floor(c) || c > INT_MAX || c < INT_MIN)
+        {
+            delete sum;
+            throw BadTermException("Coefficient is not an int.");
+        }
+
+        Term* monomial = new NumericalTerm((int)c);
+        for (int var = 0; var < 4; var++)
+        {
+            int e = terms[n].exponents[var];
+            if (e == 0)
+                continue;
+
+            Term* power = new Variable((Variable::var_type)var);
+            if (e > 1)
+                power = new BinaryOp(BinaryOp::OP_EXP, power, new NumericalTerm(e));
+            monomial = new BinaryOp(BinaryOp::OP_TIMES, monomial, power);
+        }
+
+        sum = (sum == 0) ? monomial : new BinaryOp(BinaryOp::OP_PLUS, sum, monomial);
+    }
+    return sum;
+}
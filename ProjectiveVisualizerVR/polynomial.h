@@ -0,0 +1,54 @@
+#ifndef POLYNOMIAL_H
+#define POLYNOMIAL_H
+
+#include <vector>
+
+class Term;
+
+// A polynomial in x, y, z, w in expanded form: a list of monomials with their coefficients.
+// Terms are expanded into one with Term::expand(), which gives passes that need to look at
+// the structure of f (rather than just evaluate it) a canonical form to work with.
+class Polynomial
+{
+public:
+    struct Monomial
+    {
+        int exponents[4];       // Indexed by Variable::var_type.
+        double coefficient;
+    };
+
+    Polynomial() {}
+
+    static Polynomial constant(double c);
+    static Polynomial coordinate(int var);
+
+    Polynomial operator+(const Polynomial& other) const;
+    Polynomial operator-(const Polynomial& other) const;
+    Polynomial operator*(const Polynomial& other) const;
+    Polynomial operator-() const;
+    Polynomial power(int n) const;
+
+    // Equal as polynomials; both are kept in the same canonical order, so this compares term by term.
+    bool operator==(const Polynomial& other) const;
+    bool operator!=(const Polynomial& other) const { return !(*this == other); }
+
+    double eval(double x, double y, double z, double w) const;
+
+    int degree() const;
+    bool isZero() const { return terms.empty(); }
+
+    // Monomials sorted by exponents, with like terms combined and zero coefficients dropped.
+    const std::vector<Monomial>& getTerms() const { return terms; }
+
+    // Builds a polynomial from arbitrary monomials, combining like terms.
+    static Polynomial fromTerms(const std::vector<Monomial>& monomials);
+
+    // Warning: allocates a new Term.
+    // Throws BadTermException if a coefficient isn't an integer that fits in an int, as NumericalTerm needs.
+    Term* toTerm() const;
+
+private:
+    std::vector<Monomial> terms;
+};
+
+#endif // POLYNOMIAL_H
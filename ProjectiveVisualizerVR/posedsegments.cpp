@@ -0,0 +1,169 @@
+#include "posedsegments.h"
+
+#include <cstring>
+
+PosedSegments::PosedSegments(int worker_count)
+{
+    vertex_count = 0;
+    source_vertices = NULL;
+    source_colors = NULL;
+    posed = false;
+    shares = 0;
+    next_share = 0;
+    pending_shares = 0;
+    quitting = false;
+
+    InitializeCriticalSection(&lock);
+    InitializeConditionVariable(&work_available);
+    InitializeConditionVariable(&work_done);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        DWORD threadID;
+        workers.push_back(CreateThread(NULL, 0, WorkerStarter, this, 0, &threadID));
+    }
+}
+
+PosedSegments::~PosedSegments()
+{
+    EnterCriticalSection(&lock);
+    quitting = true;
+    WakeAllConditionVariable(&work_available);
+    LeaveCriticalSection(&lock);
+
+    if (!workers.empty())
+        WaitForMultipleObjects(workers.size(), &workers[0], TRUE, INFINITE);
+    for (int i = 0; i < workers.size(); i++)
+        CloseHandle(workers[i]);
+
+    DeleteCriticalSection(&lock);
+}
+
+void PosedSegments::SetSegments(const std::vector<Vector4>* vertices, const std::vector<Vector3>* colors)
+{
+    // Workers only run during Update, on this same thread.
+    source_vertices = vertices;
+    source_colors = colors;
+    posed = false;
+}
+
+bool PosedSegments::Update(const Matrix4& pose)
+{
+    if (source_vertices == NULL)
+        return false;
+    if (posed && memcmp(pose.get(), this->pose.get(), 16 * sizeof(float)) == 0)
+        return false;
+
+    this->pose = pose;
+    posed = true;
+
+    int segments = source_vertices->size() / 2;
+    if (vertices.size() < 2 * segments)
+    {
+        vertices.resize(2 * segments);
+        colors.resize(2 * segments);
+    }
+
+    int share_count = (segments < min_parallel_segments) ? 1 : workers.size() + 1;
+    share_counts.assign(share_count, 0);
+
+    EnterCriticalSection(&lock);
+    shares = share_count;
+    next_share = 1;
+    pending_shares = share_count - 1;
+    if (pending_shares > 0)
+        WakeAllConditionVariable(&work_available);
+    LeaveCriticalSection(&lock);
+
+    TransformShare(0);
+
+    EnterCriticalSection(&lock);
+    while (pending_shares > 0)
+        SleepConditionVariableCS(&work_done, &lock, INFINITE);
+    LeaveCriticalSection(&lock);
+
+    // Close the gaps the left out segments leave at the end of each share.
+    vertex_count = share_counts[0];
+    for (int s = 1; s < share_count; s++)
+    {
+        int first = 2 * (int)((long long)segments * s / share_count);
+        if (first != vertex_count && share_counts[s] > 0)
+        {
+            memmove(&vertices[vertex_count], &vertices[first], sizeof(Vector4) * share_counts[s]);
+            memmove(&colors[vertex_count], &colors[first], sizeof(Vector3) * share_counts[s]);
+        }
+        vertex_count += share_counts[s];
+    }
+
+    return true;
+}
+
+void PosedSegments::TransformShare(int share)
+{
+    int segments = source_vertices->size() / 2;
+    int begin = (int)((long long)segments * share / shares);
+    int end = (int)((long long)segments * (share + 1) / shares);
+
+    const Vector4* in = source_vertices->data();
+    const Vector3* in_colors = source_colors->data();
+    Vector4* out = vertices.data() + 2 * begin;
+    Vector3* out_colors = colors.data() + 2 * begin;
+    int count = 0;
+
+    // A block at a time, transformed into its own place in out, so it's still in cache when
+    // it's culled and divided there.
+    for (int block_begin = begin; block_begin < end; block_begin += block_segments)
+    {
+        int block_end = (block_begin + block_segments < end) ? block_begin + block_segments : end;
+        Vector4* block = out + 2 * (block_begin - begin);
+        transformPoints(pose, in + 2 * block_begin, block, 2 * (block_end - block_begin));
+
+        for (int s = block_begin; s < block_end; s++)
+        {
+            Vector4 p1 = block[2 * (s - block_begin)];
+            Vector4 p2 = block[2 * (s - block_begin) + 1];
+            if (!((p1.w > 0 && p2.w > 0) || (p1.w < 0 && p2.w < 0)))
+                continue;
+
+            out[count] = p1 / p1.w;
+            out[count + 1] = p2 / p2.w;
+            out_colors[count] = in_colors[2 * s];
+            out_colors[count + 1] = in_colors[2 * s + 1];
+            count += 2;
+        }
+    }
+
+    share_counts[share] = count;
+}
+
+DWORD WINAPI PosedSegments::WorkerStarter(LPVOID vsegments)
+{
+    ((PosedSegments*)vsegments)->WorkerLoop();
+    return 0;
+}
+
+void PosedSegments::WorkerLoop()
+{
+    EnterCriticalSection(&lock);
+
+    while (true)
+    {
+        while (!quitting && next_share >= shares)
+            SleepConditionVariableCS(&work_available, &lock, INFINITE);
+
+        if (quitting)
+            break;
+
+        int share = next_share++;
+        LeaveCriticalSection(&lock);
+
+        TransformShare(share);
+
+        EnterCriticalSection(&lock);
+        pending_shares--;
+        if (pending_shares == 0)
+            WakeAllConditionVariable(&work_done);
+    }
+
+    LeaveCriticalSection(&lock);
+}
@@ -0,0 +1,70 @@
+#ifndef POSEDSEGMENTS_H
+#define POSEDSEGMENTS_H
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "shared/Vectors.h"
+#include "shared/Matrices.h"
+
+// Line segments in function coordinates, like the mesh's debug cubes, put through the projective
+// pose of the function on the CPU, for shaders that don't apply it themselves. Both ends of each
+// segment are divided through by w, and segments crossing w = 0 are left out.
+//
+// The pose is the same for both eyes and often stays put for many frames, so the segments are
+// only transformed again when it changes. Then the calling thread and the workers each take an
+// equal share of them, transforming them with transformPoints into buffers that are kept from
+// one update to the next.
+class PosedSegments
+{
+public:
+    PosedSegments(int worker_count = 3);
+    virtual ~PosedSegments();
+
+    // Switches to other segments: pairs of consecutive vertices, with a color for each vertex.
+    // They're read by every Update until the next call, so must stay unchanged until then.
+    void SetSegments(const std::vector<Vector4>* vertices, const std::vector<Vector3>* colors);
+
+    // Transforms the segments by pose, unless they already were. Returns whether
+    // vertices/colors changed.
+    bool Update(const Matrix4& pose);
+
+    // The posed segments, in the first vertex_count elements. The rest is room kept for later updates.
+    std::vector<Vector4> vertices;
+    std::vector<Vector3> colors;
+    int vertex_count;
+
+private:
+    // Below this many segments, the calling thread transforms them all by itself.
+    const int min_parallel_segments = 4096;
+
+    // Segments transformed together, before culling them.
+    const int block_segments = 256;
+
+    // Transforms share of the segments into the start of their own range of vertices/colors,
+    // and sets share_counts[share] to how many vertices were kept.
+    void TransformShare(int share);
+
+    static DWORD WINAPI WorkerStarter(LPVOID vsegments);
+    void WorkerLoop();
+
+    const std::vector<Vector4>* source_vertices;
+    const std::vector<Vector3>* source_colors;
+
+    Matrix4 pose;
+    bool posed;                 // Whether vertices/colors hold the segments under pose.
+
+    int shares;                 // Of the current update: the calling thread's, then one per worker.
+    int next_share;             // The next one to be taken.
+    int pending_shares;         // Taken or not, but not yet finished.
+    std::vector<int> share_counts;
+    bool quitting;
+
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE work_available;
+    CONDITION_VARIABLE work_done;
+    std::vector<HANDLE> workers;
+};
+
+#endif // POSEDSEGMENTS_H
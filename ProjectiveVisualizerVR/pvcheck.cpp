@@ -0,0 +1,724 @@
+// pvcheck: compares the fast paths of the mesher and of the renderer's matrix math against plain
+// reference versions of them, on fixed pseudo-random inputs, and regions meshed by pvmesh-worker
+// processes against the same regions meshed here, and prints how many results of each kind disagree.
+// Exits with 1 if any do. With -bench, also times each matrix path against its reference.
+
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "functionmesh.h"
+#include "latticeevaluator.h"
+#include "cellkernel.h"
+#include "meshcoordinator.h"
+#include "shared/cpufeatures.h"
+#include "shared/Matrices.h"
+
+static int failures = 0;
+
+static void Report(const char* check, int mismatches, int total)
+{
+    std::cout << (mismatches == 0 ? "ok    " : "FAIL  ") << check << ": " << mismatches << " of " << total
+              << " differ" << std::endl;
+    if (mismatches != 0)
+        failures++;
+}
+
+// A small linear congruential generator, so that every run checks the same cases.
+static unsigned int random_state = 12345;
+
+static int RandomInt(int lo, int hi)
+{
+    random_state = random_state*1103515245u + 12345u;
+    return lo + (int)((random_state >> 8) % (unsigned int)(hi - lo + 1));
+}
+
+// Lattice evaluators --------------------------------------------------------------------------------
+
+// Lattice coordinates m/2^lattice_bits for m from -2^lattice_bits to 2^lattice_bits, as SAMPLING_CUBE
+// lays out a whole chart. They're small enough that f at every lattice point of the bases below,
+// scaled by 2^(lattice_bits D), is an integer that fits in 64 bits.
+static const int lattice_bits = 4;
+
+static Polynomial RandomPolynomial(int degree, bool homogeneous)
+{
+    std::vector<Polynomial::Monomial> monomials;
+    int count = RandomInt(1, 8);
+    for (int n = 0; n < count; n++)
+    {
+        Polynomial::Monomial monomial;
+        int left = homogeneous ? degree : RandomInt(0, degree);
+        for (int var = 0; var < 3; var++)
+        {
+            monomial.exponents[var] = RandomInt(0, left);
+            left -= monomial.exponents[var];
+        }
+        monomial.exponents[3] = left;
+        monomial.coefficient = RandomInt(-3, 3);
+        monomials.push_back(monomial);
+    }
+    return Polynomial::fromTerms(monomials);
+}
+
+static Polynomial Coordinate(int var)
+{
+    return Polynomial::coordinate(var);
+}
+
+// Surfaces whose lattices have many exact zeros, which is where signs go wrong if they're going to.
+static std::vector<Polynomial> TestPolynomials()
+{
+    Polynomial x = Coordinate(Variable::VAR_X), y = Coordinate(Variable::VAR_Y);
+    Polynomial z = Coordinate(Variable::VAR_Z), w = Coordinate(Variable::VAR_W);
+
+    std::vector<Polynomial> polynomials;
+    polynomials.push_back(x*x + y*y + z*z - w*w);
+    polynomials.push_back(x.power(3) + y.power(3) + z.power(3) - w.power(3));
+    polynomials.push_back((x - y)*(y - z)*(z - w)*(w - x));
+    polynomials.push_back((x*x + y*y - z*w)*(x - w) + Polynomial::constant(3)*x*y*z);
+    polynomials.push_back((x + y + z + w).power(6) - Polynomial::constant(64)*x*y*z*w*(x*x + w*w));
+    for (int n = 0; n < 12; n++)
+        polynomials.push_back(RandomPolynomial(RandomInt(1, 6), n % 3 != 0));
+    return polynomials;
+}
+
+// 2^(lattice_bits D) f(p/2^lattice_bits) for an integer point p, exactly.
+static long long ScaledValue(const Polynomial& f, const long long p[4])
+{
+    int degree = f.degree();
+    long long value = 0;
+    const std::vector<Polynomial::Monomial>& terms = f.getTerms();
+    for (int m = 0; m < terms.size(); m++)
+    {
+        long long product = (long long)terms[m].coefficient;
+        int monomial_degree = 0;
+        for (int var = 0; var < 4; var++)
+        {
+            for (int a = 0; a < terms[m].exponents[var]; a++)
+                product *= p[var];
+            monomial_degree += terms[m].exponents[var];
+        }
+        value += product << (lattice_bits*(degree - monomial_degree));
+    }
+    return value;
+}
+
+// f in long double, for coordinates that aren't dyadic.
+static long double ReferenceValue(const Polynomial& f, const long double p[4])
+{
+    long double value = 0;
+    const std::vector<Polynomial::Monomial>& terms = f.getTerms();
+    for (int m = 0; m < terms.size(); m++)
+    {
+        long double product = terms[m].coefficient;
+        for (int var = 0; var < 4; var++)
+        {
+            for (int a = 0; a < terms[m].exponents[var]; a++)
+                product *= p[var];
+        }
+        value += product;
+    }
+    return value;
+}
+
+static int Sign(double value)
+{
+    return (value > 0) - (value < 0);
+}
+
+struct Basis
+{
+    Vector4 e[4];
+    bool chart;     // One of FunctionMesh's, whose signs the evaluators promise to get right.
+};
+
+static std::vector<Basis> TestBases()
+{
+    std::vector<Basis> bases;
+    for (int var = 0; var < 4; var++)
+    {
+        Basis basis;
+        FunctionMesh::GetChartBasis((Variable::var_type)var, &basis.e[0], &basis.e[1], &basis.e[2], &basis.e[3]);
+        basis.chart = true;
+        bases.push_back(basis);
+    }
+
+    // Not a chart, so its rows are stepped by forward differences. Its entries are small integers, so
+    // the lattice points are still dyadic.
+    Basis skew;
+    skew.e[0] = Vector4(1, 1, 0, 0);
+    skew.e[1] = Vector4(0, 1, -1, 0);
+    skew.e[2] = Vector4(1, 0, 0, 1);
+    skew.e[3] = Vector4(0, 0, 1, 2);
+    skew.chart = false;
+    bases.push_back(skew);
+    return bases;
+}
+
+// Checks a whole lattice and each of its rows from evaluator against the reference values. The values
+// must be within a small multiple of the size of f's terms, and if exact_signs, then in a chart with
+// dyadic coordinates their signs must be exactly right.
+static void CheckLattice(const LatticeEvaluator& evaluator, const Polynomial& f, const Basis& basis,
+                         ChartSampling sampling, bool exact_signs, int* mismatches, int* total)
+{
+    const int scale = 1 << lattice_bits;
+    const int count = 2*scale + 1;
+    std::vector<double> x(count);
+    for (int n = 0; n < count; n++)
+        x[n] = FunctionMesh::ChartCoordinate(sampling, (n - scale)/(double)scale);
+
+    std::vector<double> lattice(count*count*count);
+    evaluator.Evaluate(basis.e[0], basis.e[1], basis.e[2], basis.e[3], x, x, x, lattice.data());
+    std::vector<double> rows(count*count*count);
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < count; j++)
+            evaluator.EvaluateRow(basis.e[0], basis.e[1], basis.e[2], basis.e[3], x[i], x[j], x.data(), count,
+                                  &rows[(i*count + j)*count]);
+    }
+
+    double coefficient_sum = 0;
+    for (int m = 0; m < f.getTerms().size(); m++)
+        coefficient_sum += fabs(f.getTerms()[m].coefficient);
+    const bool exact = exact_signs && basis.chart && sampling == SAMPLING_CUBE;
+
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < count; j++)
+        {
+            for (int k = 0; k < count; k++)
+            {
+                const int index = (i*count + j)*count + k;
+                const int m[3] = { i - scale, j - scale, k - scale };
+                long double p[4];
+                double size = 0;
+                for (int var = 0; var < 4; var++)
+                {
+                    p[var] = (long double)x[i]*basis.e[0][var] + (long double)x[j]*basis.e[1][var]
+                             + (long double)x[k]*basis.e[2][var] + basis.e[3][var];
+                    size = std::max(size, fabs((double)p[var]));
+                }
+                double expected = (double)ReferenceValue(f, p);
+                const double tolerance = 1e-9*coefficient_sum*std::max(1.0, pow(size, f.degree()));
+
+                int expected_sign = 0;
+                if (exact)
+                {
+                    long long scaled_p[4];
+                    for (int var = 0; var < 4; var++)
+                        scaled_p[var] = m[0]*(long long)basis.e[0][var] + m[1]*(long long)basis.e[1][var]
+                                        + m[2]*(long long)basis.e[2][var] + scale*(long long)basis.e[3][var];
+                    long long scaled = ScaledValue(f, scaled_p);
+                    expected_sign = (scaled > 0) - (scaled < 0);
+                }
+
+                for (int which = 0; which < 2; which++)
+                {
+                    double value = which == 0 ? lattice[index] : rows[index];
+                    if (fabs(value - expected) > tolerance || (exact && Sign(value) != expected_sign))
+                        (*mismatches)++;
+                    (*total)++;
+                }
+            }
+        }
+    }
+}
+
+static void CheckLatticeEvaluators()
+{
+    std::vector<Polynomial> polynomials = TestPolynomials();
+    std::vector<Basis> bases = TestBases();
+
+    const char* names[3] = { "ForwardDifferenceEvaluator", "TensorProductEvaluator", "ExactDyadicEvaluator" };
+    const char* sampling_names[2] = { "cube", "equiangular" };
+    for (int which = 0; which < 3; which++)
+    {
+        for (int sampling = 0; sampling < 2; sampling++)
+        {
+            for (int chart = 1; chart >= 0; chart--)
+            {
+                int mismatches = 0, total = 0;
+                for (int p = 0; p < polynomials.size(); p++)
+                {
+                    LatticeEvaluator* evaluator;
+                    if (which == 0)
+                        evaluator = new ForwardDifferenceEvaluator(polynomials[p]);
+                    else if (which == 1)
+                        evaluator = new TensorProductEvaluator(polynomials[p]);
+                    else
+                        evaluator = new ExactDyadicEvaluator(polynomials[p]);
+                    for (int b = 0; b < bases.size(); b++)
+                    {
+                        if (bases[b].chart == (chart != 0))
+                            CheckLattice(*evaluator, polynomials[p], bases[b], (ChartSampling)sampling, which != 0,
+                                         &mismatches, &total);
+                    }
+                    delete evaluator;
+                }
+
+                std::string check = std::string(names[which]) + ", " + sampling_names[sampling]
+                                    + (chart ? " lattices in charts" : " lattices in another basis");
+                Report(check.c_str(), mismatches, total);
+            }
+        }
+    }
+}
+
+// Cell kernel ---------------------------------------------------------------------------------------
+
+static void CheckCellKernel()
+{
+    int mismatches = 0, total = 0;
+    double values[32], start[32], end[32], t[32];
+    for (int row = 0; row < 1000; row++)
+    {
+        int count = row % 33;
+        for (int n = 0; n < count; n++)
+            values[n] = (RandomInt(0, 4) == 0) ? 0 : RandomInt(-1000, 1000)/7.0;
+
+        unsigned int expected = 0;
+        for (int n = 0; n < count; n++)
+            expected |= (unsigned int)(values[n] >= 0) << n;
+        mismatches += RowSignBits(values, count) != expected;
+        total++;
+
+        for (int n = 0; n < count; n++)
+        {
+            start[n] = RandomInt(1, 1000)/7.0;
+            end[n] = -RandomInt(1, 1000)/3.0;
+        }
+        InterpolateCrossings(start, end, t, count);
+        for (int n = 0; n < count; n++)
+        {
+            mismatches += t[n] != start[n]/(start[n] - end[n]);
+            total++;
+        }
+    }
+    Report("RowSignBits, InterpolateCrossings", mismatches, total);
+}
+
+// Expansion -----------------------------------------------------------------------------------------
+
+// Each equation with the degree it expands to under the limit, or -1 if expandUpTo should refuse it.
+struct ExpansionCase
+{
+    const char* equation;
+    int degree;
+};
+
+static void CheckExpansionLimits()
+{
+    const ExpansionCase cases[] = {
+        { "(x^2+y^2+z^2-w^2)^12", 24 },
+        { "(x^2+y^2+z^2-w^2)^12*x", -1 },
+        { "(x+y+z+w)^200", -1 },
+        { "(x+y+z+w)^(2^40)", -1 },
+        { "(2^100)*x*y", 2 },
+        { "(x+y)^0*z", 1 },
+    };
+
+    int mismatches = 0, total = 0;
+    for (const ExpansionCase& c : cases)
+    {
+        Term* f = Term::parseTerm(c.equation);
+        int degree = -1;
+        try
+        {
+            degree = f->expandUpTo(EdgeSolver::max_degree).degree();
+        }
+        catch (BadTermException e)
+        {
+        }
+        delete f;
+
+        total++;
+        if (degree != c.degree)
+        {
+            std::cout << "      " << c.equation << " expanded to degree " << degree << ", expected " << c.degree << std::endl;
+            mismatches++;
+        }
+    }
+    Report("Term::expandUpTo", mismatches, total);
+}
+
+// Mesh workers --------------------------------------------------------------------------------------
+
+// FunctionMesh cuts each chart into this many regions along each axis.
+static const int regions_per_axis = 4;
+
+// Jobs for every fifth region of every chart of f, made as FunctionMesh::MeshRegionsOnWorkers makes them.
+static std::vector<MeshJob> TestMeshJobs(const Polynomial& f, int depth)
+{
+    double region_size = 2.0 / regions_per_axis;
+    std::vector<MeshJob> jobs;
+    for (int id = 0; id < 4*regions_per_axis*regions_per_axis*regions_per_axis; id += 5)
+    {
+        int ri = id / (regions_per_axis*regions_per_axis) % regions_per_axis;
+        int rj = id / regions_per_axis % regions_per_axis;
+        int rk = id % regions_per_axis;
+
+        MeshJob job;
+        job.f = f;
+        job.chart = (Variable::var_type)(id / (regions_per_axis*regions_per_axis*regions_per_axis));
+        job.min = Vector3(-1 + region_size*ri, -1 + region_size*rj, -1 + region_size*rk);
+        job.max = job.min + Vector3(region_size, region_size, region_size);
+        job.depth = depth;
+        job.sampling = SAMPLING_CUBE;
+        job.find_hidden_crossings = false;
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+static bool SameJobs(const MeshJob& a, const MeshJob& b)
+{
+    return a.f == b.f && a.chart == b.chart && memcmp(&a.min, &b.min, sizeof(a.min)) == 0
+        && memcmp(&a.max, &b.max, sizeof(a.max)) == 0 && a.depth == b.depth && a.sampling == b.sampling
+        && a.find_hidden_crossings == b.find_hidden_crossings;
+}
+
+static bool SameVectors(const std::vector<Vector4>& a, const std::vector<Vector4>& b)
+{
+    return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size()*sizeof(Vector4)) == 0);
+}
+
+// Levels past level_count are never set, so they aren't compared.
+static bool SameFragments(const MeshFragment& a, const MeshFragment& b)
+{
+    if (a.region.chart != b.region.chart || a.region.level_count != b.region.level_count
+        || memcmp(a.region.corners, b.region.corners, sizeof(a.region.corners)) != 0)
+        return false;
+    for (int level = 0; level < a.region.level_count && level < FunctionMesh::max_lod_levels; level++)
+    {
+        const FunctionMesh::RegionLevel& la = a.region.levels[level];
+        const FunctionMesh::RegionLevel& lb = b.region.levels[level];
+        if (la.first_vertex != lb.first_vertex || la.vertex_count != lb.vertex_count || la.cells != lb.cells)
+            return false;
+    }
+    return SameVectors(a.vertices, b.vertices) && SameVectors(a.gradients, b.gradients)
+        && SameVectors(a.lod_vertices, b.lod_vertices) && SameVectors(a.lod_gradients, b.lod_gradients);
+}
+
+struct test_writer_params
+{
+    HANDLE pipe;
+    const MeshJob* job;
+    const MeshFragment* fragment;
+    bool written;
+};
+
+// Writes a job, a fragment, the fragment with no levels, which readers must refuse, and a quit. Runs on
+// its own thread, as the pipe holds less than a fragment.
+static DWORD WINAPI WriteTestMessages(LPVOID vparams)
+{
+    test_writer_params* params = (test_writer_params*)vparams;
+    MeshFragment no_levels = *params->fragment;
+    no_levels.region.level_count = 0;
+    params->written = WriteMeshJob(params->pipe, *params->job) && WriteMeshFragment(params->pipe, *params->fragment)
+                      && WriteMeshFragment(params->pipe, no_levels) && WriteMeshQuit(params->pipe);
+    return 0;
+}
+
+static void CheckMeshProtocol(const MeshJob& job, const MeshFragment& fragment)
+{
+    HANDLE read_end, write_end;
+    if (!CreatePipe(&read_end, &write_end, NULL, 0))
+    {
+        std::cout << "      Couldn't create a pipe." << std::endl;
+        Report("WriteMeshJob, WriteMeshFragment through a pipe", 1, 1);
+        return;
+    }
+
+    test_writer_params params = { write_end, &job, &fragment, false };
+    DWORD threadID;
+    HANDLE writer = CreateThread(NULL, 0, WriteTestMessages, &params, 0, &threadID);
+
+    int mismatches = 0;
+    MeshJob job_read;
+    MeshFragment fragment_read;
+    bool quit = false;
+    mismatches += !(ReadMeshJob(read_end, &job_read, &quit) && !quit && SameJobs(job, job_read));
+    mismatches += !(ReadMeshFragment(read_end, &fragment_read) && SameFragments(fragment, fragment_read));
+    mismatches += ReadMeshFragment(read_end, &fragment_read);
+    mismatches += !(ReadMeshJob(read_end, &job_read, &quit) && quit);
+
+    WaitForSingleObject(writer, INFINITE);
+    CloseHandle(writer);
+    mismatches += !params.written;
+
+    CloseHandle(write_end);
+    CloseHandle(read_end);
+    Report("WriteMeshJob, WriteMeshFragment through a pipe", mismatches, 5);
+}
+
+// pvmesh-worker.exe is built next to pvcheck.exe.
+static std::string WorkerPath()
+{
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileNameA(NULL, path, MAX_PATH);
+    std::string directory(path, length);
+    return directory.substr(0, directory.find_last_of("\\/") + 1) + "pvmesh-worker.exe";
+}
+
+static void CheckMeshWorkers()
+{
+    Term* f_term = Term::parseTerm("x^4+y^4+z^4-w^4+3*x*y*z*w-2*x^2*w^2");
+    Polynomial f = f_term->expandUpTo(EdgeSolver::max_degree);
+    delete f_term;
+
+    // Built from f's expansion, as the workers build theirs.
+    Term* expanded_term = f.toTerm();
+    FunctionMesh mesh(expanded_term, SAMPLING_CUBE);
+    delete expanded_term;
+
+    std::vector<MeshJob> jobs = TestMeshJobs(f, 5);
+    std::vector<MeshFragment> expected(jobs.size());
+    int surface_job = -1;
+    for (int n = 0; n < jobs.size(); n++)
+    {
+        mesh.MeshRegion(jobs[n].chart, jobs[n].min, jobs[n].max, jobs[n].depth, &expected[n].region,
+                        &expected[n].vertices, &expected[n].gradients, &expected[n].lod_vertices,
+                        &expected[n].lod_gradients);
+        if (surface_job < 0 && !expected[n].vertices.empty())
+            surface_job = n;
+    }
+    if (surface_job < 0)
+    {
+        std::cout << "      None of the test regions meet the surface." << std::endl;
+        Report("MeshCoordinator", 1, 1);
+        return;
+    }
+
+    CheckMeshProtocol(jobs[surface_job], expected[surface_job]);
+
+    // More jobs than workers, so each worker meshes several with the same surface.
+    MeshCoordinator coordinator(WorkerPath(), 3);
+    std::vector<MeshFragment> fragments;
+    if (coordinator.GetWorkerCount() == 0 || !coordinator.Run(jobs, &fragments))
+    {
+        std::cout << "      No workers finished the jobs; is pvmesh-worker.exe built?" << std::endl;
+        Report("MeshCoordinator with pvmesh-worker", jobs.size(), jobs.size());
+        return;
+    }
+
+    int mismatches = 0;
+    for (int n = 0; n < jobs.size(); n++)
+        mismatches += !SameFragments(expected[n], fragments[n]);
+    Report("MeshCoordinator with pvmesh-worker", mismatches, jobs.size());
+}
+
+// Matrices ------------------------------------------------------------------------------------------
+
+// The products as Matrices.h took them before it used SSE and AVX. The vector paths sum in the same
+// order and don't fuse multiplies and adds, so their results must be the same to the bit.
+static Vector4 ScalarProduct(const Matrix4& matrix, const Vector4& v)
+{
+    const float* m = matrix.get();
+    return Vector4(m[0]*v.x + m[4]*v.y + m[8]*v.z  + m[12]*v.w,
+                   m[1]*v.x + m[5]*v.y + m[9]*v.z  + m[13]*v.w,
+                   m[2]*v.x + m[6]*v.y + m[10]*v.z + m[14]*v.w,
+                   m[3]*v.x + m[7]*v.y + m[11]*v.z + m[15]*v.w);
+}
+
+static Matrix4 ScalarProduct(const Matrix4& matrix, const Matrix4& n)
+{
+    const float* m = matrix.get();
+    return Matrix4(m[0]*n[0]  + m[4]*n[1]  + m[8]*n[2]  + m[12]*n[3],   m[1]*n[0]  + m[5]*n[1]  + m[9]*n[2]  + m[13]*n[3],   m[2]*n[0]  + m[6]*n[1]  + m[10]*n[2]  + m[14]*n[3],   m[3]*n[0]  + m[7]*n[1]  + m[11]*n[2]  + m[15]*n[3],
+                   m[0]*n[4]  + m[4]*n[5]  + m[8]*n[6]  + m[12]*n[7],   m[1]*n[4]  + m[5]*n[5]  + m[9]*n[6]  + m[13]*n[7],   m[2]*n[4]  + m[6]*n[5]  + m[10]*n[6]  + m[14]*n[7],   m[3]*n[4]  + m[7]*n[5]  + m[11]*n[6]  + m[15]*n[7],
+                   m[0]*n[8]  + m[4]*n[9]  + m[8]*n[10] + m[12]*n[11],  m[1]*n[8]  + m[5]*n[9]  + m[9]*n[10] + m[13]*n[11],  m[2]*n[8]  + m[6]*n[9]  + m[10]*n[10] + m[14]*n[11],  m[3]*n[8]  + m[7]*n[9]  + m[11]*n[10] + m[15]*n[11],
+                   m[0]*n[12] + m[4]*n[13] + m[8]*n[14] + m[12]*n[15],  m[1]*n[12] + m[5]*n[13] + m[9]*n[14] + m[13]*n[15],  m[2]*n[12] + m[6]*n[13] + m[10]*n[14] + m[14]*n[15],  m[3]*n[12] + m[7]*n[13] + m[11]*n[14] + m[15]*n[15]);
+}
+
+static float RandomFloat(float lo, float hi)
+{
+    return lo + (hi - lo)*RandomInt(0, 1 << 20)/(float)(1 << 20);
+}
+
+static Matrix4 RandomMatrix()
+{
+    float m[16];
+    for (int n = 0; n < 16; n++)
+        m[n] = RandomFloat(-2, 2);
+    return Matrix4(m);
+}
+
+static int DifferentVectors(const Vector4* a, const Vector4* b, int count)
+{
+    int different = 0;
+    for (int n = 0; n < count; n++)
+        different += memcmp(&a[n], &b[n], sizeof(Vector4)) != 0;
+    return different;
+}
+
+// Nanoseconds per call of body, averaged over enough calls to take about a tenth of a second.
+template <typename Body>
+static double Time(Body body)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    int reps = 1;
+    while (true)
+    {
+        Clock::time_point start = Clock::now();
+        for (int r = 0; r < reps; r++)
+            body();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (ns > 1e8)
+            return ns/reps;
+        reps *= 2;
+    }
+}
+
+static void ReportTime(const char* path, double ns, int count, double reference_ns)
+{
+    std::cout << "      " << path << ": " << ns/count << " ns each";
+    if (reference_ns > 0)
+        std::cout << " (reference " << reference_ns/count << ")";
+    std::cout << std::endl;
+}
+
+static void CheckMatrices(bool bench)
+{
+    // Not a multiple of the vector widths, so the scalar tails are checked too.
+    const int count = 4099;
+    const Matrix4 m = RandomMatrix();
+
+    std::vector<Vector4> points(count), expected(count), result(count);
+    for (int n = 0; n < count; n++)
+        points[n] = Vector4(RandomFloat(-4, 4), RandomFloat(-4, 4), RandomFloat(-4, 4), RandomFloat(0.5f, 1.5f));
+
+    // M * v, one point at a time.
+    for (int n = 0; n < count; n++)
+        expected[n] = ScalarProduct(m, points[n]);
+    for (int n = 0; n < count; n++)
+        result[n] = m*points[n];
+    Report("Matrix4 * Vector4", DifferentVectors(result.data(), expected.data(), count), count);
+    if (bench)
+    {
+        double reference = Time([&]() { for (int n = 0; n < count; n++) expected[n] = ScalarProduct(m, points[n]); });
+        ReportTime("Matrix4 * Vector4", Time([&]() { for (int n = 0; n < count; n++) result[n] = m*points[n]; }),
+                   count, reference);
+    }
+
+    // transformPoints, and in place.
+    transformPoints(m, points.data(), result.data(), count);
+    int different = DifferentVectors(result.data(), expected.data(), count);
+    result = points;
+    transformPoints(m, result.data(), result.data(), count);
+    different += DifferentVectors(result.data(), expected.data(), count);
+    Report("transformPoints", different, 2*count);
+    if (bench)
+    {
+        double reference = Time([&]() { for (int n = 0; n < count; n++) expected[n] = ScalarProduct(m, points[n]); });
+        ReportTime("transformPoints", Time([&]() { transformPoints(m, points.data(), result.data(), count); }),
+                   count, reference);
+    }
+
+    // transformPointsDivide.
+    for (int n = 0; n < count; n++)
+        expected[n] = ScalarProduct(m, points[n]) / ScalarProduct(m, points[n]).w;
+    transformPointsDivide(m, points.data(), result.data(), count);
+    Report("transformPointsDivide", DifferentVectors(result.data(), expected.data(), count), count);
+    if (bench)
+    {
+        double reference = Time([&]()
+        {
+            for (int n = 0; n < count; n++)
+            {
+                Vector4 p = ScalarProduct(m, points[n]);
+                expected[n] = p / p.w;
+            }
+        });
+        ReportTime("transformPointsDivide", Time([&]() { transformPointsDivide(m, points.data(), result.data(), count); }),
+                   count, reference);
+    }
+
+    // transformPointsSoA.
+    std::vector<float> x(count), y(count), z(count), w(count), x_out(count), y_out(count), z_out(count), w_out(count);
+    for (int n = 0; n < count; n++)
+    {
+        x[n] = points[n].x;
+        y[n] = points[n].y;
+        z[n] = points[n].z;
+        w[n] = points[n].w;
+    }
+    transformPointsSoA(m, x.data(), y.data(), z.data(), w.data(), x_out.data(), y_out.data(), z_out.data(),
+                       w_out.data(), count);
+    for (int n = 0; n < count; n++)
+    {
+        expected[n] = ScalarProduct(m, points[n]);
+        result[n] = Vector4(x_out[n], y_out[n], z_out[n], w_out[n]);
+    }
+    Report("transformPointsSoA", DifferentVectors(result.data(), expected.data(), count), count);
+    if (bench)
+    {
+        double reference = Time([&]()
+        {
+            for (int n = 0; n < count; n++)
+            {
+                Vector4 p = ScalarProduct(m, Vector4(x[n], y[n], z[n], w[n]));
+                x_out[n] = p.x;
+                y_out[n] = p.y;
+                z_out[n] = p.z;
+                w_out[n] = p.w;
+            }
+        });
+        ReportTime("transformPointsSoA", Time([&]()
+        {
+            transformPointsSoA(m, x.data(), y.data(), z.data(), w.data(), x_out.data(), y_out.data(), z_out.data(),
+                               w_out.data(), count);
+        }), count, reference);
+    }
+
+    // M * N.
+    const int matrix_count = 256;
+    std::vector<Matrix4> matrices(matrix_count), expected_products(matrix_count), products(matrix_count);
+    for (int n = 0; n < matrix_count; n++)
+        matrices[n] = RandomMatrix();
+    different = 0;
+    for (int n = 0; n < matrix_count; n++)
+    {
+        expected_products[n] = ScalarProduct(m, matrices[n]);
+        products[n] = m*matrices[n];
+        different += memcmp(expected_products[n].get(), products[n].get(), 16*sizeof(float)) != 0;
+    }
+    Report("Matrix4 * Matrix4", different, matrix_count);
+    if (bench)
+    {
+        double reference = Time([&]()
+        {
+            for (int n = 0; n < matrix_count; n++)
+                expected_products[n] = ScalarProduct(m, matrices[n]);
+        });
+        ReportTime("Matrix4 * Matrix4", Time([&]()
+        {
+            for (int n = 0; n < matrix_count; n++)
+                products[n] = m*matrices[n];
+        }), matrix_count, reference);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool bench = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-bench"))
+            bench = true;
+    }
+
+    std::cout << (CpuHasAVX() ? "Checking the AVX paths." : "No AVX; checking the SSE2 paths.") << std::endl;
+
+    CheckLatticeEvaluators();
+    CheckCellKernel();
+    CheckExpansionLimits();
+    CheckMeshWorkers();
+    CheckMatrices(bench);
+
+    if (failures != 0)
+        std::cout << failures << " checks failed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
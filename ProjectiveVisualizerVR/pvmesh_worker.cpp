@@ -0,0 +1,63 @@
+// pvmesh-worker: meshes regions of a surface for a MeshCoordinator in another process. Reads
+// MeshJobs from standard input and answers each with a MeshFragment on standard output, until it
+// is asked to quit or its input is closed. See meshjob.h.
+
+#include <iostream>
+
+#include <Windows.h>
+
+#include "meshjob.h"
+
+int main(int argc, char *argv[])
+{
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+
+    // Standard output carries the replies, so FunctionMesh's progress messages go to the error stream.
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+    // Consecutive jobs are nearly always for the same surface, so its mesher is kept between them.
+    FunctionMesh* mesh = 0;
+    Polynomial mesh_f;
+    ChartSampling mesh_sampling = SAMPLING_CUBE;
+    bool mesh_finds_hidden_crossings = false;
+
+    MeshJob job;
+    bool quit = false;
+    while (ReadMeshJob(input, &job, &quit) && !quit)
+    {
+        if (mesh == 0 || job.f != mesh_f || job.sampling != mesh_sampling
+            || job.find_hidden_crossings != mesh_finds_hidden_crossings)
+        {
+            delete mesh;
+            mesh = 0;
+
+            try
+            {
+                Term* f = job.f.toTerm();
+                mesh = new FunctionMesh(f, job.sampling, job.find_hidden_crossings);
+                delete f;
+            }
+            catch (BadTermException bte)
+            {
+                if (bte.getErrorMessage() != 0)
+                    std::cerr << "pvmesh-worker: " << bte.getErrorMessage() << std::endl;
+                break;
+            }
+
+            mesh_f = job.f;
+            mesh_sampling = job.sampling;
+            mesh_finds_hidden_crossings = job.find_hidden_crossings;
+        }
+
+        MeshFragment fragment;
+        mesh->MeshRegion(job.chart, job.min, job.max, job.depth, &fragment.region, &fragment.vertices,
+                         &fragment.gradients, &fragment.lod_vertices, &fragment.lod_gradients);
+
+        if (!WriteMeshFragment(output, fragment))
+            break;
+    }
+
+    delete mesh;
+    return 0;
+}
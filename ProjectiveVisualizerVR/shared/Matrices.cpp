@@ -19,10 +19,20 @@
 #include <cmath>
 #include <algorithm>
 #include "Matrices.h"
+#include "cpufeatures.h"
 
 const float DEG2RAD = 3.141593f / 180;
 const float EPSILON = 0.00001f;
 
+// in MatricesAVX.cpp, the only file built for AVX; each returns how many points it did
+size_t transformPointsAVX(const float* a, const float* in, float* out, size_t n);
+size_t transformPointsDivideAVX(const float* a, const float* in, float* out, size_t n);
+size_t transformPointsSoAAVX(const float* a,
+                             const float* x, const float* y, const float* z, const float* w,
+                             float* xOut, float* yOut, float* zOut, float* wOut, size_t n);
+
+static const bool useAVX = CpuHasAVX();
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -579,3 +589,79 @@ Matrix4& Matrix4::rotateZ(float angle)
 
     return *this;
 }
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// transform n points by M: out[i] = M * in[i]
+// With AVX, two points at a time; see MatricesAVX.cpp.
+///////////////////////////////////////////////////////////////////////////////
+void transformPoints(const Matrix4& m, const Vector4* in, Vector4* out, size_t n)
+{
+    size_t i = useAVX ? transformPointsAVX(m.get(), (const float*)in, (float*)out, n) : 0;
+    for(; i < n; ++i)
+        out[i] = m * in[i];
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// transform n points by M and divide each by its w, as for a perspective
+// projection: out[i] = (M * in[i]) / w
+///////////////////////////////////////////////////////////////////////////////
+void transformPointsDivide(const Matrix4& m, const Vector4* in, Vector4* out, size_t n)
+{
+    size_t i = useAVX ? transformPointsDivideAVX(m.get(), (const float*)in, (float*)out, n) : 0;
+    for(; i < n; ++i)
+    {
+        Vector4 p = m * in[i];
+        out[i] = p / p.w;
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// transform n points given as separate arrays of x, y, z and w by M
+// Eight points at a time with AVX, then four with SSE; the outputs may be the
+// inputs.
+///////////////////////////////////////////////////////////////////////////////
+void transformPointsSoA(const Matrix4& m,
+                        const float* x, const float* y, const float* z, const float* w,
+                        float* xOut, float* yOut, float* zOut, float* wOut, size_t n)
+{
+    const float* a = m.get();
+    size_t i = useAVX ? transformPointsSoAAVX(a, x, y, z, w, xOut, yOut, zOut, wOut, n) : 0;
+#ifdef MATRICES_USE_SSE
+    __m128 f[16];
+    for(int j = 0; j < 16; ++j)
+        f[j] = _mm_set1_ps(a[j]);
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+        __m128 vw = _mm_loadu_ps(w + i);
+        __m128 r[4];
+        for(int j = 0; j < 4; ++j)
+        {
+            r[j] = _mm_mul_ps(f[j], vx);
+            r[j] = _mm_add_ps(r[j], _mm_mul_ps(f[j + 4], vy));
+            r[j] = _mm_add_ps(r[j], _mm_mul_ps(f[j + 8], vz));
+            r[j] = _mm_add_ps(r[j], _mm_mul_ps(f[j + 12], vw));
+        }
+        _mm_storeu_ps(xOut + i, r[0]);
+        _mm_storeu_ps(yOut + i, r[1]);
+        _mm_storeu_ps(zOut + i, r[2]);
+        _mm_storeu_ps(wOut + i, r[3]);
+    }
+#endif
+    for(; i < n; ++i)
+    {
+        float px = x[i], py = y[i], pz = z[i], pw = w[i];
+        xOut[i] = a[0]*px + a[4]*py + a[8]*pz  + a[12]*pw;
+        yOut[i] = a[1]*px + a[5]*py + a[9]*pz  + a[13]*pw;
+        zOut[i] = a[2]*px + a[6]*py + a[10]*pz + a[14]*pw;
+        wOut[i] = a[3]*px + a[7]*py + a[11]*pz + a[15]*pw;
+    }
+}
@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// MatricesAVX.cpp
+// ===============
+// The AVX loops of Matrices.cpp's batch transforms. Only this file is built
+// for AVX, and Matrices.cpp calls it only once CpuHasAVX says the CPU has it;
+// see cpufeatures.h. So it mustn't include Matrices.h or Vectors.h, whose
+// inline functions would get AVX copies here; the matrix is the 16 floats of
+// Matrix4::get(), and points are 4 floats each.
+//
+// Each returns how many points it did, leaving the rest to the caller.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <immintrin.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// two points at a time, one in each half of a register
+///////////////////////////////////////////////////////////////////////////////
+size_t transformPointsAVX(const float* a, const float* in, float* out, size_t n)
+{
+    size_t i = 0;
+    const __m256 c0 = _mm256_broadcast_ps((const __m128*)(a));
+    const __m256 c1 = _mm256_broadcast_ps((const __m128*)(a + 4));
+    const __m256 c2 = _mm256_broadcast_ps((const __m128*)(a + 8));
+    const __m256 c3 = _mm256_broadcast_ps((const __m128*)(a + 12));
+    for(; i + 2 <= n; i += 2)
+    {
+        __m256 v = _mm256_loadu_ps(in + 4 * i);
+        __m256 p = _mm256_mul_ps(c0, _mm256_permute_ps(v, 0x00));
+        p = _mm256_add_ps(p, _mm256_mul_ps(c1, _mm256_permute_ps(v, 0x55)));
+        p = _mm256_add_ps(p, _mm256_mul_ps(c2, _mm256_permute_ps(v, 0xAA)));
+        p = _mm256_add_ps(p, _mm256_mul_ps(c3, _mm256_permute_ps(v, 0xFF)));
+        _mm256_storeu_ps(out + 4 * i, p);
+    }
+    return i;
+}
+
+
+
+size_t transformPointsDivideAVX(const float* a, const float* in, float* out, size_t n)
+{
+    size_t i = 0;
+    const __m256 c0 = _mm256_broadcast_ps((const __m128*)(a));
+    const __m256 c1 = _mm256_broadcast_ps((const __m128*)(a + 4));
+    const __m256 c2 = _mm256_broadcast_ps((const __m128*)(a + 8));
+    const __m256 c3 = _mm256_broadcast_ps((const __m128*)(a + 12));
+    for(; i + 2 <= n; i += 2)
+    {
+        __m256 v = _mm256_loadu_ps(in + 4 * i);
+        __m256 p = _mm256_mul_ps(c0, _mm256_permute_ps(v, 0x00));
+        p = _mm256_add_ps(p, _mm256_mul_ps(c1, _mm256_permute_ps(v, 0x55)));
+        p = _mm256_add_ps(p, _mm256_mul_ps(c2, _mm256_permute_ps(v, 0xAA)));
+        p = _mm256_add_ps(p, _mm256_mul_ps(c3, _mm256_permute_ps(v, 0xFF)));
+        _mm256_storeu_ps(out + 4 * i, _mm256_div_ps(p, _mm256_permute_ps(p, 0xFF)));
+    }
+    return i;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// eight points at a time, from separate arrays of each coordinate
+///////////////////////////////////////////////////////////////////////////////
+size_t transformPointsSoAAVX(const float* a,
+                             const float* x, const float* y, const float* z, const float* w,
+                             float* xOut, float* yOut, float* zOut, float* wOut, size_t n)
+{
+    size_t i = 0;
+    __m256 e[16];
+    for(int j = 0; j < 16; ++j)
+        e[j] = _mm256_set1_ps(a[j]);
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 vz = _mm256_loadu_ps(z + i);
+        __m256 vw = _mm256_loadu_ps(w + i);
+        __m256 r[4];
+        for(int j = 0; j < 4; ++j)
+        {
+            r[j] = _mm256_mul_ps(e[j], vx);
+            r[j] = _mm256_add_ps(r[j], _mm256_mul_ps(e[j + 4], vy));
+            r[j] = _mm256_add_ps(r[j], _mm256_mul_ps(e[j + 8], vz));
+            r[j] = _mm256_add_ps(r[j], _mm256_mul_ps(e[j + 12], vw));
+        }
+        _mm256_storeu_ps(xOut + i, r[0]);
+        _mm256_storeu_ps(yOut + i, r[1]);
+        _mm256_storeu_ps(zOut + i, r[2]);
+        _mm256_storeu_ps(wOut + i, r[3]);
+    }
+    return i;
+}
@@ -0,0 +1,20 @@
+#include "cpufeatures.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+bool CpuHasAVX()
+{
+#if defined(_MSC_VER)
+    // CPUID leaf 1 has AVX in bit 28 of ECX and OSXSAVE in bit 27. The OS must also save the
+    // upper halves of the YMM registers on a context switch, which bits 1 and 2 of XCR0 say.
+    int info[4];
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)))
+        return false;
+    return (_xgetbv(0) & 6) == 6;
+#else
+    return __builtin_cpu_supports("avx");
+#endif
+}
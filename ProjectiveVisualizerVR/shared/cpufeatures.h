@@ -0,0 +1,10 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+// The program is built for SSE2. The few files built for AVX (cellkernelavx.cpp and
+// shared/MatricesAVX.cpp) may only be called into if this says the CPU, and the OS, support it.
+// Those files mustn't include headers with inline functions, or the linker could pick their AVX
+// copies of them for everyone.
+bool CpuHasAVX();
+
+#endif // CPUFEATURES_H
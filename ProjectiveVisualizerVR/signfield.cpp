@@ -0,0 +1,108 @@
+#include "signfield.h"
+
+// Moves each point's bit to the point one step lower along an axis, i.e. bit b of the result is the
+// bit of the next point along that axis. Points on the brick's high face take theirs from next_brick.
+static inline unsigned long long NextAlongK(unsigned long long brick, unsigned long long next_brick)
+{
+    return ((brick >> 1) & 0x7777777777777777ull) | ((next_brick << 3) & 0x8888888888888888ull);
+}
+
+static inline unsigned long long NextAlongJ(unsigned long long brick, unsigned long long next_brick)
+{
+    return ((brick >> 4) & 0x0FFF0FFF0FFF0FFFull) | ((next_brick << 12) & 0xF000F000F000F000ull);
+}
+
+static inline unsigned long long NextAlongI(unsigned long long brick, unsigned long long next_brick)
+{
+    return (brick >> 16) | (next_brick << 48);
+}
+
+SignField::SignField(int points)
+{
+    this->points = points;
+    bricks_per_axis = (points + 3) / 4;
+
+    // Morton order needs a power of two bricks along each axis.
+    int padded = 1;
+    while (padded < bricks_per_axis)
+        padded *= 2;
+    bricks.assign(padded*padded*padded, 0);
+}
+
+unsigned int SignField::MortonIndex(int bi, int bj, int bk)
+{
+    unsigned int index = 0;
+    for (int bit = 0; bit < 4; bit++)
+    {
+        index |= ((bi >> bit) & 1) << (3*bit + 2);
+        index |= ((bj >> bit) & 1) << (3*bit + 1);
+        index |= ((bk >> bit) & 1) << (3*bit);
+    }
+    return index;
+}
+
+void SignField::SetPositive(int i, int j, int k)
+{
+    bricks[MortonIndex(i >> 2, j >> 2, k >> 2)] |= 1ull << (16*(i & 3) + 4*(j & 3) + (k & 3));
+}
+
+bool SignField::IsPositive(int i, int j, int k) const
+{
+    return (bricks[MortonIndex(i >> 2, j >> 2, k >> 2)] >> (16*(i & 3) + 4*(j & 3) + (k & 3))) & 1;
+}
+
+unsigned long long SignField::Brick(int bi, int bj, int bk) const
+{
+    // Past the end of the lattice there are no points; those cells are masked out anyway.
+    if (bi >= bricks_per_axis || bj >= bricks_per_axis || bk >= bricks_per_axis)
+        return 0;
+    return bricks[MortonIndex(bi, bj, bk)];
+}
+
+unsigned long long SignField::ClassifyBrick(int bi, int bj, int bk, unsigned long long corners_out[8]) const
+{
+    unsigned long long b000 = Brick(bi, bj, bk);
+    unsigned long long b001 = Brick(bi, bj, bk + 1);
+    unsigned long long b010 = Brick(bi, bj + 1, bk);
+    unsigned long long b011 = Brick(bi, bj + 1, bk + 1);
+    unsigned long long b100 = Brick(bi + 1, bj, bk);
+    unsigned long long b101 = Brick(bi + 1, bj, bk + 1);
+    unsigned long long b110 = Brick(bi + 1, bj + 1, bk);
+    unsigned long long b111 = Brick(bi + 1, bj + 1, bk + 1);
+
+    // Corner (di, dj, dk) of every cell, numbered 4*di + 2*dj + dk as in cellkernel.h.
+    unsigned long long next_k_of_j = NextAlongK(b010, b011);
+    unsigned long long next_k_of_i = NextAlongK(b100, b101);
+    corners_out[0] = b000;
+    corners_out[1] = NextAlongK(b000, b001);
+    corners_out[2] = NextAlongJ(b000, b010);
+    corners_out[3] = NextAlongJ(corners_out[1], next_k_of_j);
+    corners_out[4] = NextAlongI(b000, b100);
+    corners_out[5] = NextAlongI(corners_out[1], next_k_of_i);
+    corners_out[6] = NextAlongI(corners_out[2], NextAlongJ(b100, b110));
+    corners_out[7] = NextAlongI(corners_out[3], NextAlongJ(next_k_of_i, NextAlongK(b110, b111)));
+
+    unsigned long long all_positive = ~0ull;
+    unsigned long long any_positive = 0;
+    for (int c = 0; c < 8; c++)
+    {
+        all_positive &= corners_out[c];
+        any_positive |= corners_out[c];
+    }
+
+    // Only cells whose lowest corner is below the last point along every axis exist.
+    unsigned long long valid_i = 0;
+    unsigned long long valid_j = 0;
+    unsigned long long valid_k = 0;
+    for (int n = 0; n < 4; n++)
+    {
+        if (4*bi + n < points - 1)
+            valid_i |= 0xFFFFull << (16*n);
+        if (4*bj + n < points - 1)
+            valid_j |= 0x000F000F000F000Full << (4*n);
+        if (4*bk + n < points - 1)
+            valid_k |= 0x1111111111111111ull << n;
+    }
+
+    return any_positive & ~all_positive & valid_i & valid_j & valid_k;
+}
@@ -0,0 +1,38 @@
+#ifndef SIGNFIELD_H
+#define SIGNFIELD_H
+
+#include <vector>
+
+// The signs of f on a cubic lattice, one bit per lattice point, for lattices too big to keep the values of.
+//
+// Points are grouped into 4x4x4 bricks, each held in one 64-bit word with bit (16*i + 4*j + k) for the
+// point at (i,j,k) within the brick. Bricks are stored in Morton order, so bricks near each other in
+// the lattice are near each other in memory too. A whole brick of cells is classified with a few
+// shifts and ands of its word and those of its neighbours, like the rows in cellkernel.h.
+class SignField
+{
+public:
+    // points is the number of lattice points along each axis, at most 64.
+    SignField(int points);
+
+    void SetPositive(int i, int j, int k);
+    bool IsPositive(int i, int j, int k) const;
+
+    int GetBricksPerAxis() const { return bricks_per_axis; }
+
+    // Classifies the 64 cells whose lowest corners are the points of brick (bi, bj, bk). Returns a mask
+    // with bit b set iff the surface passes through the cell at point b; cells reaching past the last
+    // lattice point are left out. corners_out[c] receives the sign bits of corner c of every cell, so
+    // the sign flags of the cell at point b have bit c set iff bit b of corners_out[c] is.
+    unsigned long long ClassifyBrick(int bi, int bj, int bk, unsigned long long corners_out[8]) const;
+
+private:
+    unsigned long long Brick(int bi, int bj, int bk) const;
+    static unsigned int MortonIndex(int bi, int bj, int bk);
+
+    int points;
+    int bricks_per_axis;
+    std::vector<unsigned long long> bricks;
+};
+
+#endif // SIGNFIELD_H
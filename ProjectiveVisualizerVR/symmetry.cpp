@@ -0,0 +1,55 @@
+#include "symmetry.h"
+
+#include <algorithm>
+
+Polynomial Substitute(const Polynomial& f, const SignedPermutation& g)
+{
+    // Variable n becomes sign[n] times variable perm[n], so a monomial's exponent of variable n
+    // moves to variable perm[n] and its coefficient picks up sign[n] to that power.
+    const std::vector<Polynomial::Monomial>& terms = f.getTerms();
+    std::vector<Polynomial::Monomial> substituted(terms.size());
+    for (int t = 0; t < terms.size(); t++)
+    {
+        Polynomial::Monomial& m = substituted[t];
+        m.coefficient = terms[t].coefficient;
+        for (int n = 0; n < 4; n++)
+            m.exponents[n] = 0;
+
+        for (int n = 0; n < 4; n++)
+        {
+            m.exponents[g.perm[n]] += terms[t].exponents[n];
+            if (g.sign[n] < 0 && (terms[t].exponents[n] & 1))
+                m.coefficient = -m.coefficient;
+        }
+    }
+    return Polynomial::fromTerms(substituted);
+}
+
+void FindSymmetries(const Polynomial& f, std::vector<Symmetry>* symmetries_out)
+{
+    Polynomial minus_f = -f;
+
+    int perm[4] = { 0, 1, 2, 3 };
+    do
+    {
+        for (int signs = 0; signs < 16; signs++)
+        {
+            Symmetry symmetry;
+            for (int n = 0; n < 4; n++)
+            {
+                symmetry.g.perm[n] = perm[n];
+                symmetry.g.sign[n] = (signs & (1 << n)) ? -1 : 1;
+            }
+
+            Polynomial f_of_g = Substitute(f, symmetry.g);
+            if (f_of_g == f)
+                symmetry.parity = 1;
+            else if (f_of_g == minus_f)
+                symmetry.parity = -1;
+            else
+                continue;
+
+            symmetries_out->push_back(symmetry);
+        }
+    } while (std::next_permutation(perm, perm + 4));
+}
@@ -0,0 +1,44 @@
+#ifndef SYMMETRY_H
+#define SYMMETRY_H
+
+#include <vector>
+
+#include "polynomial.h"
+#include "shared/Vectors.h"
+
+// A signed permutation of the coordinates (x,y,z,w): coordinate n of the image of v is
+// sign[n]*v[perm[n]]. There are 4!*2^4 = 384 of them. As a matrix it is orthogonal.
+struct SignedPermutation
+{
+    int perm[4];
+    int sign[4];
+
+    Vector4 apply(const Vector4& v) const
+    {
+        return Vector4(sign[0]*v[perm[0]], sign[1]*v[perm[1]], sign[2]*v[perm[2]], sign[3]*v[perm[3]]);
+    }
+
+    bool isIdentity() const
+    {
+        return perm[0] == 0 && perm[1] == 1 && perm[2] == 2 && perm[3] == 3
+            && sign[0] == 1 && sign[1] == 1 && sign[2] == 1 && sign[3] == 1;
+    }
+};
+
+// A signed permutation g with f(g v) = parity*f(v), parity being 1 or -1.
+// Either way g maps the surface f = 0 onto itself, and the gradient of f at g v is parity*g(grad f(v)).
+struct Symmetry
+{
+    SignedPermutation g;
+    int parity;
+};
+
+// Finds every signed permutation that maps the zero set of f to itself, by substituting it into f and
+// comparing monomials. The identity is always found first. g and -g are the same map of projective
+// space, so for a homogeneous f both show up.
+void FindSymmetries(const Polynomial& f, std::vector<Symmetry>* symmetries_out);
+
+// f(g v), as a polynomial in v.
+Polynomial Substitute(const Polynomial& f, const SignedPermutation& g);
+
+#endif // SYMMETRY_H
@@ -10,6 +10,7 @@
 #define TERM_H
 
 #include "shared/Vectors.h"
+#include "polynomial.h"
 
 class Term
 {
@@ -31,6 +32,15 @@ public:
     virtual Term* simplify() { return Clone(); }
     // Warning: allocates a new Term.
     virtual Term* homogenize(int* degree) = 0;
+    // Multiplies out into a sum of monomials. Throws BadTermException if the term
+    // isn't a polynomial, e.g. it has an exponent that isn't a non-negative integer.
+    virtual Polynomial expand() = 0;
+    // An upper bound on the degree of expand(), read off the tree without multiplying anything
+    // out; saturates at INT_MAX. Throws BadTermException where expand() would.
+    virtual int degreeBound() = 0;
+    // expand(), but throws BadTermException instead if the result could be above max_degree,
+    // since a high power of a sum has far too many monomials to multiply out.
+    Polynomial expandUpTo(int max_degree);
 
     virtual bool isZero() { return false; }
     virtual bool isOne() { return false; }
@@ -46,4 +56,11 @@ private:
     char* message = 0;
 };
 
+inline Polynomial Term::expandUpTo(int max_degree)
+{
+    if (degreeBound() > max_degree)
+        throw BadTermException("Degree is too high to expand.");
+    return expand();
+}
+
 #endif // TERM_H
@@ -24,6 +24,8 @@ public:
     virtual Term* Clone();
     virtual Term* homogenize(int* degree) { *degree = 1;
                                             return Clone(); }
+    virtual Polynomial expand() { return Polynomial::coordinate(var); }
+    virtual int degreeBound() { return 1; }
 private:
     var_type var;
 };